@@ -0,0 +1,353 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "augmenter.h"
+
+/**
+ * @brief      Constructs the augmentation stage
+ *
+ * @param[in]  _source       undistorted samples
+ * @param[in]  _width        image width
+ * @param[in]  _height       image height
+ * @param[in]  _params       distortion parameters
+ * @param[in]  _window_size  samples per window
+ * @param[in]  _nr_workers   number of worker threads
+ * @param[in]  _seed         seed of the stream
+ */
+Augmenter::Augmenter(const std::shared_ptr<Dataset>& _source, unsigned int _width, unsigned int _height,
+                     const AugmentationParameters& _params, size_t _window_size, unsigned int _nr_workers,
+                     uint64_t _seed) :
+source(_source),
+width(_width),
+height(_height),
+params(_params),
+window_size(std::max((size_t)1, _window_size)),
+nr_workers(std::max(1u, _nr_workers)),
+seed(_seed),
+epoch(0),
+nr_windows(0),
+next_task(0),
+next_window_index(0),
+stop(false) {
+    if((size_t)this->width * this->height != this->source->get_nr_input_nodes()) {
+        throw std::runtime_error("Image dimensions do not match the dataset");
+    }
+}
+
+Augmenter::~Augmenter() {
+    this->stop_workers();
+}
+
+/**
+ * @brief      Start producing the windows of an epoch
+ *
+ * @param[in]  _epoch  epoch index
+ */
+void Augmenter::start_epoch(unsigned int _epoch) {
+    this->stop_workers();
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->epoch = _epoch;
+
+    // shuffle samples of this epoch
+    std::mt19937_64 rng(this->seed ^ (0x9e3779b97f4a7c15ULL * (_epoch + 1)));
+    this->order.resize(this->source->size());
+    for(size_t i=0; i<this->order.size(); i++) {
+        this->order[i] = i;
+    }
+    std::shuffle(this->order.begin(), this->order.end(), rng);
+
+    this->nr_windows = (this->order.size() + this->window_size - 1) / this->window_size;
+    this->next_task = 0;
+    this->next_window_index = 0;
+    this->ready.clear();
+    this->stop = false;
+    this->error = nullptr;
+
+    for(unsigned int i=0; i<this->nr_workers; i++) {
+        this->workers.emplace_back(&Augmenter::work, this);
+    }
+}
+
+/**
+ * @brief      Get the next window of the current epoch
+ *
+ * @return     window or nullptr when the epoch is exhausted
+ */
+std::shared_ptr<Dataset> Augmenter::next_window() {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    if(this->next_window_index >= this->nr_windows) {
+        return nullptr;
+    }
+
+    this->cv.wait(lock, [this]() {
+        return this->ready.count(this->next_window_index) > 0 || this->error;
+    });
+
+    if(this->error) {
+        std::rethrow_exception(this->error);
+    }
+
+    auto it = this->ready.find(this->next_window_index);
+    auto window = it->second;
+    this->ready.erase(it);
+    this->next_window_index++;
+    this->cv.notify_all();
+
+    return window;
+}
+
+/**
+ * @brief      Apply a random distortion to an image
+ *
+ * @param[in]  src   source image
+ * @param      dest  distorted image
+ * @param      rng   random number generator
+ */
+void Augmenter::augment_image(const double* src, double* dest, std::mt19937_64& rng) const {
+    static thread_local std::vector<double> sx;
+    static thread_local std::vector<double> sy;
+    static thread_local std::vector<double> field;
+    static thread_local std::vector<double> tmp;
+
+    const unsigned int w = this->width;
+    const unsigned int h = this->height;
+    const size_t npix = (size_t)w * h;
+    sx.resize(npix);
+    sy.resize(npix);
+
+    std::uniform_real_distribution<double> unif(-1.0, 1.0);
+    const double tx = unif(rng) * this->params.max_shift;
+    const double ty = unif(rng) * this->params.max_shift;
+    const double theta = unif(rng) * this->params.max_rotation * M_PI / 180.0;
+    const double scale = 1.0 + unif(rng) * this->params.max_scale;
+
+    // inverse affine map from destination to source coordinates
+    const double cx = 0.5 * (w - 1);
+    const double cy = 0.5 * (h - 1);
+    const double a = std::cos(theta) / scale;
+    const double b = std::sin(theta) / scale;
+
+    for(unsigned int y=0; y<h; y++) {
+        const double py = y - cy - ty;
+        double* rx = &sx[y * w];
+        double* ry = &sy[y * w];
+        #pragma omp simd
+        for(unsigned int x=0; x<w; x++) {
+            const double px = x - cx - tx;
+            rx[x] = a * px + b * py + cx;
+            ry[x] = -b * px + a * py + cy;
+        }
+    }
+
+    // add smooth random displacements
+    if(this->params.elastic_alpha > 0.0) {
+        field.resize(2 * npix);
+        tmp.resize(2 * npix);
+        this->build_elastic_field(field, tmp, rng);
+
+        const double* fx = &field[0];
+        const double* fy = &field[npix];
+        double* psx = &sx[0];
+        double* psy = &sy[0];
+        #pragma omp simd
+        for(size_t i=0; i<npix; i++) {
+            psx[i] += fx[i];
+            psy[i] += fy[i];
+        }
+    }
+
+    // bilinear interpolation; pixels outside of the source are background
+    const double* psx = &sx[0];
+    const double* psy = &sy[0];
+    #pragma omp simd
+    for(size_t i=0; i<npix; i++) {
+        const double fx = std::floor(psx[i]);
+        const double fy = std::floor(psy[i]);
+        const double wx = psx[i] - fx;
+        const double wy = psy[i] - fy;
+        const int x0 = (int)fx;
+        const int y0 = (int)fy;
+
+        double val = 0.0;
+        for(int dy=0; dy<2; dy++) {
+            for(int dx=0; dx<2; dx++) {
+                const int xs = x0 + dx;
+                const int ys = y0 + dy;
+                const bool inside = xs >= 0 && xs < (int)w && ys >= 0 && ys < (int)h;
+                const int idx = inside ? ys * (int)w + xs : 0;
+                const double weight = (dx ? wx : 1.0 - wx) * (dy ? wy : 1.0 - wy);
+                val += inside ? weight * src[idx] : 0.0;
+            }
+        }
+        dest[i] = val;
+    }
+}
+
+/**
+ * @brief      Stop all worker threads and discard their windows
+ */
+void Augmenter::stop_workers() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+        this->cv.notify_all();
+    }
+
+    for(auto& worker : this->workers) {
+        worker.join();
+    }
+    this->workers.clear();
+}
+
+/**
+ * @brief      Generate windows until the epoch is exhausted (worker thread)
+ */
+void Augmenter::work() {
+    if(Trace::is_active()) {
+        Trace::get().set_thread_name("augmenter");
+    }
+
+    while(true) {
+        size_t index;
+        {
+            // do not run further ahead than one window per worker
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cv.wait(lock, [this]() {
+                return this->stop || this->next_task >= this->nr_windows ||
+                       this->next_task < this->next_window_index + this->nr_workers;
+            });
+            if(this->stop || this->next_task >= this->nr_windows) {
+                return;
+            }
+            index = this->next_task++;
+        }
+
+        try {
+            auto window = this->generate_window(index);
+
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->ready[index] = window;
+            this->cv.notify_all();
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->error = std::current_exception();
+            this->cv.notify_all();
+            return;
+        }
+    }
+}
+
+/**
+ * @brief      Generate a single window
+ *
+ * @param[in]  index  window index
+ *
+ * @return     the window
+ */
+std::shared_ptr<Dataset> Augmenter::generate_window(size_t index) const {
+    NN_TRACE_SPAN("data", "augment window");
+
+    // the generator only depends on seed, epoch and window
+    std::seed_seq seq({(uint32_t)this->seed, (uint32_t)(this->seed >> 32), (uint32_t)this->epoch,
+                       (uint32_t)index, (uint32_t)(index >> 32)});
+    std::mt19937_64 rng(seq);
+
+    const size_t first = index * this->window_size;
+    const size_t n = std::min(this->window_size, this->order.size() - first);
+    const unsigned int nr_out = this->source->get_nr_output_nodes();
+
+    auto window = std::make_shared<Dataset>(n, this->source->get_nr_input_nodes(), nr_out);
+    for(size_t i=0; i<n; i++) {
+        const size_t sample = this->order[first + i];
+        this->augment_image(this->source->get_input_vector(sample), window->get_input_vector(i), rng);
+
+        const double* out = this->source->get_output_vector(sample);
+        std::copy(out, out + nr_out, window->get_output_vector(i));
+    }
+
+    return window;
+}
+
+/**
+ * @brief      Build a smooth random displacement field
+ *
+ * @param      field  displacement per pixel
+ * @param      tmp    scratch buffer of the same size
+ * @param      rng    random number generator
+ */
+void Augmenter::build_elastic_field(std::vector<double>& field, std::vector<double>& tmp, std::mt19937_64& rng) const {
+    const int w = this->width;
+    const int h = this->height;
+    const size_t npix = (size_t)w * h;
+
+    std::uniform_real_distribution<double> unif(-1.0, 1.0);
+    for(size_t i=0; i<field.size(); i++) {
+        field[i] = unif(rng);
+    }
+
+    // normalized gaussian kernel
+    const double sigma = std::max(this->params.elastic_sigma, 1e-3);
+    const int radius = (int)std::ceil(3.0 * sigma);
+    std::vector<double> kernel(2 * radius + 1);
+    double sum = 0.0;
+    for(int k=-radius; k<=radius; k++) {
+        kernel[k + radius] = std::exp(-0.5 * k * k / (sigma * sigma));
+        sum += kernel[k + radius];
+    }
+    for(auto& k : kernel) {
+        k *= this->params.elastic_alpha / sum;
+    }
+
+    // separable convolution with zero padding; the kernel carries the factor
+    // alpha, which is divided out again in the second pass
+    for(unsigned int c=0; c<2; c++) {
+        const double* f = &field[c * npix];
+        double* t = &tmp[c * npix];
+        for(int y=0; y<h; y++) {
+            for(int x=0; x<w; x++) {
+                double val = 0.0;
+                for(int k=std::max(-radius, -x); k<=std::min(radius, w - 1 - x); k++) {
+                    val += kernel[k + radius] * f[y * w + x + k];
+                }
+                t[y * w + x] = val;
+            }
+        }
+
+        double* g = &field[c * npix];
+        for(int y=0; y<h; y++) {
+            for(int x=0; x<w; x++) {
+                double val = 0.0;
+                for(int k=std::max(-radius, -y); k<=std::min(radius, h - 1 - y); k++) {
+                    val += kernel[k + radius] * t[(y + k) * w + x];
+                }
+                g[y * w + x] = val / this->params.elastic_alpha;
+            }
+        }
+    }
+}
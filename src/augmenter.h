@@ -0,0 +1,175 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _AUGMENTER_H
+#define _AUGMENTER_H
+
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#include "dataset_stream.h"
+#include "trace.h"
+
+/**
+ * @brief      Parameters of the random image distortions
+ */
+struct AugmentationParameters {
+    double max_shift = 2.0;         //!< maximum translation in pixels
+    double max_rotation = 10.0;     //!< maximum rotation in degrees
+    double max_scale = 0.1;         //!< maximum relative scaling
+    double elastic_alpha = 0.0;     //!< magnitude of elastic distortion (0 to disable)
+    double elastic_sigma = 4.0;     //!< smoothness of elastic distortion
+};
+
+/**
+ * @brief      Stream of randomly distorted copies of a dataset
+ *
+ * Every epoch, the samples of the source dataset are shuffled and divided
+ * into windows. Worker threads distort the images of upcoming windows while
+ * the network trains on the current one, such that only a few windows are
+ * resident at any time. Each window is generated from a random number
+ * generator seeded by the seed, epoch and window index, hence the stream is
+ * reproducible regardless of the number of workers.
+ */
+class Augmenter : public DatasetStream {
+private:
+    std::shared_ptr<Dataset> source;        //!< undistorted samples
+    unsigned int width;                     //!< image width
+    unsigned int height;                    //!< image height
+    AugmentationParameters params;          //!< distortion parameters
+    size_t window_size;                     //!< samples per window
+    unsigned int nr_workers;                //!< number of worker threads
+    uint64_t seed;                          //!< seed of the stream
+
+    std::vector<std::thread> workers;       //!< worker threads
+    std::mutex mtx;                         //!< guards the fields below
+    std::condition_variable cv;             //!< signals pipeline changes
+    std::map<size_t, std::shared_ptr<Dataset>> ready; //!< finished windows
+    std::vector<size_t> order;              //!< sample order of the epoch
+    unsigned int epoch;                     //!< current epoch
+    size_t nr_windows;                      //!< windows in the epoch
+    size_t next_task;                       //!< next window to generate
+    size_t next_window_index;               //!< next window to hand out
+    bool stop;                              //!< request workers to stop
+    std::exception_ptr error;               //!< error raised by a worker
+
+public:
+    /**
+     * @brief      Constructs the augmentation stage
+     *
+     * @param[in]  _source       undistorted samples
+     * @param[in]  _width        image width
+     * @param[in]  _height       image height
+     * @param[in]  _params       distortion parameters
+     * @param[in]  _window_size  samples per window
+     * @param[in]  _nr_workers   number of worker threads
+     * @param[in]  _seed         seed of the stream
+     */
+    Augmenter(const std::shared_ptr<Dataset>& _source, unsigned int _width, unsigned int _height,
+              const AugmentationParameters& _params, size_t _window_size, unsigned int _nr_workers,
+              uint64_t _seed);
+
+    ~Augmenter();
+
+    Augmenter(const Augmenter&) = delete;
+
+    Augmenter& operator=(const Augmenter&) = delete;
+
+    /**
+     * @brief      Start producing the windows of an epoch
+     *
+     * @param[in]  _epoch  epoch index
+     */
+    void start_epoch(unsigned int _epoch) override;
+
+    /**
+     * @brief      Get the next window of the current epoch
+     *
+     * @return     window or nullptr when the epoch is exhausted
+     */
+    std::shared_ptr<Dataset> next_window() override;
+
+    inline size_t size() const override {
+        return this->source->size();
+    }
+
+    inline unsigned int get_nr_input_nodes() const override {
+        return this->source->get_nr_input_nodes();
+    }
+
+    inline unsigned int get_nr_output_nodes() const override {
+        return this->source->get_nr_output_nodes();
+    }
+
+    /**
+     * @brief      Apply a random distortion to an image
+     *
+     * @param[in]  src   source image
+     * @param      dest  distorted image
+     * @param      rng   random number generator
+     */
+    void augment_image(const double* src, double* dest, std::mt19937_64& rng) const;
+
+private:
+    /**
+     * @brief      Stop all worker threads and discard their windows
+     */
+    void stop_workers();
+
+    /**
+     * @brief      Generate windows until the epoch is exhausted (worker thread)
+     */
+    void work();
+
+    /**
+     * @brief      Generate a single window
+     *
+     * @param[in]  index  window index
+     *
+     * @return     the window
+     */
+    std::shared_ptr<Dataset> generate_window(size_t index) const;
+
+    /**
+     * @brief      Build a smooth random displacement field
+     *
+     * @param      field  displacement per pixel
+     * @param      tmp    scratch buffer of the same size
+     * @param      rng    random number generator
+     */
+    void build_elastic_field(std::vector<double>& field, std::vector<double>& tmp, std::mt19937_64& rng) const;
+};
+
+#endif // _AUGMENTER_H
@@ -0,0 +1,256 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "batch_classifier.h"
+
+/**
+ * @brief      Constructs the classifier
+ *
+ * @param[in]  _nn          network used for classification
+ * @param[in]  _batch_size  images per batch
+ * @param[in]  _nr_threads  threads used for decoding
+ */
+BatchClassifier::BatchClassifier(const NeuralNetwork& _nn, size_t _batch_size, unsigned int _nr_threads) :
+nn(_nn),
+batch_size(std::max((size_t)1, _batch_size)),
+nr_threads(std::max(1u, _nr_threads)),
+preprocess(false),
+cascade(nullptr) {}
+
+/**
+ * @brief      Expand a directory, glob pattern or file list to png files
+ *
+ * @param[in]  spec  directory, glob pattern, png file or newline-separated list
+ *
+ * @return     list of files
+ */
+std::vector<std::string> BatchClassifier::collect_files(const std::string& spec) {
+    namespace fs = boost::filesystem;
+    std::vector<std::string> files;
+
+    if(fs::is_directory(spec)) {
+        for(fs::directory_iterator it(spec); it != fs::directory_iterator(); ++it) {
+            std::string ext = it->path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            if(fs::is_regular_file(it->path()) && ext == ".png") {
+                files.push_back(it->path().string());
+            }
+        }
+        std::sort(files.begin(), files.end());
+    } else if(spec.find_first_of("*?[") != std::string::npos) {
+        glob_t g;
+        if(glob(spec.c_str(), 0, NULL, &g) == 0) {
+            for(size_t i=0; i<g.gl_pathc; i++) {
+                files.push_back(g.gl_pathv[i]);
+            }
+        }
+        globfree(&g);
+    } else if(fs::extension(spec) == ".png") {
+        files.push_back(spec);
+    } else {
+        std::ifstream in(spec);
+        if(!in.is_open()) {
+            throw std::runtime_error("Cannot open file list " + spec);
+        }
+        std::string line;
+        while(std::getline(in, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if(!line.empty()) {
+                files.push_back(line);
+            }
+        }
+    }
+
+    return files;
+}
+
+/**
+ * @brief      Classify images and write the results
+ *
+ * @param[in]  files   png files
+ * @param      out     output stream
+ * @param[in]  format  output format
+ *
+ * @return     number of images that could not be classified
+ */
+size_t BatchClassifier::classify(const std::vector<std::string>& files, std::ostream& out, OutputFormat format) {
+    const unsigned int nr_in = this->nn.get_nr_inputs();
+    const unsigned int nr_out = this->nn.get_sizes().back();
+
+    std::vector<double> inputs(this->batch_size * nr_in);
+    std::vector<double> outputs(this->batch_size * nr_out);
+    std::vector<std::string> errors(this->batch_size);
+    size_t nr_failed = 0;
+
+    if(format == OutputFormat::CSV) {
+        out << "filename,class";
+        for(unsigned int j=0; j<nr_out; j++) {
+            out << ",score" << j;
+        }
+        out << "\n";
+    } else {
+        out << "[";
+    }
+
+    for(size_t start=0; start<files.size(); start+=this->batch_size) {
+        const size_t n = std::min(this->batch_size, files.size() - start);
+
+        // decode images in parallel
+        #pragma omp parallel for num_threads(this->nr_threads) schedule(dynamic)
+        for(size_t i=0; i<n; i++) {
+            NN_TRACE_SPAN("classify", "decode image");
+            errors[i].clear();
+            try {
+                load_input_vector(files[start + i], &inputs[i * nr_in], this->preprocess);
+            } catch(const std::exception& e) {
+                errors[i] = e.what();
+                std::fill(&inputs[i * nr_in], &inputs[(i+1) * nr_in], 0.0);
+            }
+        }
+
+        {
+            NN_TRACE_SPAN("classify", "classify batch");
+            if(this->cascade) {
+                this->cascade->classify_batch(&inputs[0], n, &outputs[0]);
+            } else {
+                this->nn.feed_forward_batch(&inputs[0], n, &outputs[0], this->workspace);
+            }
+        }
+
+        for(size_t i=0; i<n; i++) {
+            const std::string filename = escape(files[start + i], format);
+            const double* scores = &outputs[i * nr_out];
+            const long cls = std::distance(scores, std::max_element(scores, scores + nr_out));
+
+            if(format == OutputFormat::CSV) {
+                out << filename << ",";
+                if(errors[i].empty()) {
+                    out << cls;
+                    for(unsigned int j=0; j<nr_out; j++) {
+                        out << "," << scores[j];
+                    }
+                } else {
+                    out << "-1";
+                    for(unsigned int j=0; j<nr_out; j++) {
+                        out << ",";
+                    }
+                }
+                out << "\n";
+            } else {
+                out << ((start + i) == 0 ? "\n" : ",\n") << "  {\"filename\": \"" << filename << "\", ";
+                if(errors[i].empty()) {
+                    out << "\"class\": " << cls << ", \"scores\": [";
+                    for(unsigned int j=0; j<nr_out; j++) {
+                        out << (j == 0 ? "" : ", ") << scores[j];
+                    }
+                    out << "]}";
+                } else {
+                    out << "\"error\": \"" << escape(errors[i], format) << "\"}";
+                }
+            }
+
+            if(!errors[i].empty()) {
+                std::cerr << "Cannot classify " << files[start + i] << ": " << errors[i] << std::endl;
+                nr_failed++;
+            }
+        }
+    }
+
+    if(format == OutputFormat::JSON) {
+        out << "\n]\n";
+    }
+    out.flush();
+
+    return nr_failed;
+}
+
+/**
+ * @brief      Decode a png file into an input vector
+ *
+ * Images that are not 28x28 8-bit grayscale (or all images when requested)
+ * are normalized like the MNIST digits first.
+ *
+ * @param[in]  filename    png file
+ * @param      in          input vector (28 x 28 values)
+ * @param[in]  preprocess  whether to normalize all images
+ */
+void BatchClassifier::load_input_vector(const std::string& filename, double* in, bool preprocess) {
+    static thread_local PNG::Decoder decoder;
+    static thread_local Preprocessor preprocessor;
+    static thread_local std::vector<uint8_t> buffer;
+
+    const PNG::ImageInfo info = decoder.decode_file(filename, buffer);
+
+    if(preprocess || info.width != 28 || info.height != 28 || info.col != PNG_COLOR_TYPE_GRAY || info.bit_depth != 8) {
+        preprocessor.process(buffer.data(), info, in);
+        return;
+    }
+
+    #pragma omp simd
+    for(unsigned int i=0; i<28*28; i++) {
+        in[i] = (double)buffer[i] / 255.0;
+    }
+}
+
+/**
+ * @brief      Escape a string for use in json or csv output
+ *
+ * @param[in]  str     the string
+ * @param[in]  format  output format
+ *
+ * @return     escaped string
+ */
+std::string BatchClassifier::escape(const std::string& str, OutputFormat format) {
+    std::string res;
+    if(format == OutputFormat::CSV) {
+        if(str.find_first_of(",\"\n") == std::string::npos) {
+            return str;
+        }
+        res = "\"";
+        for(char c : str) {
+            res += (c == '"') ? std::string("\"\"") : std::string(1, c);
+        }
+        return res + "\"";
+    }
+
+    for(char c : str) {
+        switch(c) {
+            case '"':  res += "\\\""; break;
+            case '\\': res += "\\\\"; break;
+            case '\n': res += "\\n"; break;
+            case '\t': res += "\\t"; break;
+            default:
+                if((unsigned char)c < 0x20) {
+                    res += (boost::format("\\u%04x") % (int)c).str();
+                } else {
+                    res += c;
+                }
+        }
+    }
+    return res;
+}
@@ -0,0 +1,141 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _BATCH_CLASSIFIER_H
+#define _BATCH_CLASSIFIER_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <glob.h>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "neural_network.h"
+#include "pngfuncs.h"
+#include "preprocess.h"
+#include "cascade.h"
+
+/**
+ * @brief      Classifies many images per network load
+ *
+ * Images are decoded in parallel and pushed through the network in batches,
+ * such that the forward pass becomes a series of matrix-matrix products.
+ */
+class BatchClassifier {
+public:
+    enum class OutputFormat {
+        CSV,
+        JSON
+    };
+
+private:
+    const NeuralNetwork& nn;                //!< network used for classification
+    InferenceWorkspace workspace;           //!< scratch memory of the network
+    size_t batch_size;                      //!< images per batch
+    unsigned int nr_threads;                //!< threads used for decoding
+    bool preprocess;                        //!< normalize all images
+    Cascade* cascade;                       //!< cascade ending in the network (optional)
+
+public:
+    /**
+     * @brief      Constructs the classifier
+     *
+     * @param[in]  _nn          network used for classification
+     * @param[in]  _batch_size  images per batch
+     * @param[in]  _nr_threads  threads used for decoding
+     */
+    BatchClassifier(const NeuralNetwork& _nn, size_t _batch_size, unsigned int _nr_threads);
+
+    /**
+     * @brief      Expand a directory, glob pattern or file list to png files
+     *
+     * @param[in]  spec  directory, glob pattern, png file or newline-separated list
+     *
+     * @return     list of files
+     */
+    static std::vector<std::string> collect_files(const std::string& spec);
+
+    /**
+     * @brief      Classify images and write the results
+     *
+     * @param[in]  files   png files
+     * @param      out     output stream
+     * @param[in]  format  output format
+     *
+     * @return     number of images that could not be classified
+     */
+    size_t classify(const std::vector<std::string>& files, std::ostream& out, OutputFormat format);
+
+    /**
+     * @brief      Set whether all images are normalized like the MNIST digits
+     *
+     * @param[in]  _preprocess  whether to normalize all images
+     */
+    inline void set_preprocess(bool _preprocess) {
+        this->preprocess = _preprocess;
+    }
+
+    /**
+     * @brief      Classify through a cascade whose full network is the network
+     *             of the classifier
+     *
+     * @param      _cascade  the cascade (nullptr to use the network only)
+     */
+    inline void set_cascade(Cascade* _cascade) {
+        this->cascade = _cascade;
+    }
+
+    /**
+     * @brief      Decode a png file into an input vector
+     *
+     * Images that are not 28x28 8-bit grayscale (or all images when requested)
+     * are normalized like the MNIST digits first.
+     *
+     * @param[in]  filename    png file
+     * @param      in          input vector (28 x 28 values)
+     * @param[in]  preprocess  whether to normalize all images
+     */
+    static void load_input_vector(const std::string& filename, double* in, bool preprocess = false);
+
+private:
+    /**
+     * @brief      Escape a string for use in json or csv output
+     *
+     * @param[in]  str     the string
+     * @param[in]  format  output format
+     *
+     * @return     escaped string
+     */
+    static std::string escape(const std::string& str, OutputFormat format);
+};
+
+#endif // _BATCH_CLASSIFIER_H
@@ -0,0 +1,564 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <omp.h>
+#include <tclap/CmdLine.h>
+#include <boost/format.hpp>
+
+#include "config.h"
+#include "neural_network.h"
+#include "mnist_loader.h"
+#include "shared_memory_communicator.h"
+#include "parameter_server.h"
+#include "ensemble.h"
+
+/*
+ * Micro-benchmarks of the training and inference steps of the network. Every
+ * benchmark is run for all combinations of layer sizes, batch sizes and thread
+ * counts given on the command line and the results are written as JSON. Two
+ * result files are compared with compare.py.
+ */
+
+/**
+ * @brief      Runs the benchmarks and collects the results
+ */
+class Benchmark {
+private:
+    unsigned int repeat;            //!< samples per benchmark
+    double min_time;                //!< minimum duration of a sample in seconds
+    std::vector<std::string> results;   //!< results as JSON objects
+
+public:
+    Benchmark(unsigned int _repeat, double _min_time) :
+    repeat(std::max(1u, _repeat)),
+    min_time(_min_time) {}
+
+    /**
+     * @brief      Time an operation and store the result
+     *
+     * The operation is repeated until a sample takes at least the minimum
+     * time; the median over all samples is reported.
+     *
+     * @param[in]  name        benchmark name
+     * @param[in]  layers      layer sizes
+     * @param[in]  batch_size  batch size
+     * @param[in]  threads     number of threads
+     * @param[in]  items       items processed per operation
+     * @param[in]  op          the operation
+     */
+    void run(const std::string& name, const std::vector<uint32_t>& layers, size_t batch_size, unsigned int threads,
+             size_t items, const std::function<void()>& op) {
+        omp_set_num_threads(threads);
+        openblas_set_num_threads(threads);
+        TaskPool::get().set_nr_threads(threads);
+
+        // warm up and calibrate the number of iterations per sample
+        size_t iterations = 1;
+        for(;;) {
+            double t = this->time(op, iterations);
+            if(t >= this->min_time || iterations >= (1ul << 30)) {
+                break;
+            }
+            iterations = std::max(iterations * 2, (size_t)(iterations * this->min_time / std::max(t, 1e-9) * 1.2));
+        }
+
+        std::vector<double> samples;
+        for(unsigned int i=0; i<this->repeat; i++) {
+            samples.push_back(this->time(op, iterations) / iterations);
+        }
+        this->add_result(name, layers, batch_size, threads, 1, iterations, items, samples);
+    }
+
+    /**
+     * @brief      Time a pass over a dataset that is shared between
+     *             processes, each training on its own part
+     *
+     * Has to be run before any multi-threaded benchmark, since the forked
+     * processes do not inherit the thread pools.
+     *
+     * @param[in]  layers      layer sizes
+     * @param[in]  batch_size  batch size
+     * @param[in]  procs       number of processes
+     * @param[in]  dataset     dataset that is split over the processes
+     */
+    void run_data_parallel(const std::vector<uint32_t>& layers, size_t batch_size, unsigned int procs,
+                           const std::shared_ptr<Dataset>& dataset) {
+        omp_set_num_threads(1);
+        openblas_set_num_threads(1);
+
+        auto comm = SharedMemoryCommunicator::launch(procs);
+        auto shard = Dataset::shard(dataset, comm->get_rank(), procs);
+        NeuralNetwork nn(layers, 42);
+        nn.set_communicator(comm.get());
+
+        // the first pass warms up
+        std::vector<double> samples;
+        for(unsigned int i=0; i<=this->repeat; i++) {
+            comm->barrier();
+            double t = this->time([&]() { nn.sgd_pass(shard, batch_size, 0.1); }, 1);
+            comm->barrier();
+            if(i > 0) {
+                samples.push_back(t);
+            }
+        }
+
+        if(comm->get_rank() != 0) {
+            comm->finalize();
+            _exit(0);
+        }
+        if(comm->finalize() > 0) {
+            throw std::runtime_error("Benchmark process failed");
+        }
+
+        this->add_result("data_parallel", layers, batch_size, 1, procs, 1, shard->size() * procs, samples);
+    }
+
+    /**
+     * @brief      Time epochs of asynchronous training with a parameter
+     *             server and local worker processes
+     *
+     * Has to be run before any multi-threaded benchmark, since the forked
+     * processes do not inherit the thread pools.
+     *
+     * @param[in]  layers      layer sizes
+     * @param[in]  batch_size  batch size
+     * @param[in]  workers     number of worker processes
+     * @param[in]  staleness   maximum clock difference between workers
+     * @param[in]  dataset     dataset that is split over the workers
+     */
+    void run_parameter_server(const std::vector<uint32_t>& layers, size_t batch_size, unsigned int workers, unsigned int staleness,
+                              const std::shared_ptr<Dataset>& dataset) {
+        omp_set_num_threads(1);
+        openblas_set_num_threads(1);
+
+        ParameterServer server("127.0.0.1", 0, workers, staleness);
+        if(server.launch_local_workers()) {
+            int status = 0;
+            try {
+                ParameterClient client("127.0.0.1:" + std::to_string(server.get_port()));
+                NeuralNetwork nn(layers, 42);
+                client.train(nn, Dataset::shard(dataset, client.get_worker(), workers), this->repeat + 1, batch_size);
+            } catch(const std::exception& e) {
+                std::cerr << "Worker failed: " << e.what() << std::endl;
+                status = 1;
+            }
+            _exit(status);
+        }
+
+        NeuralNetwork nn(layers, 42);
+        std::vector<double> params;
+        nn.get_parameters(params);
+
+        // the first epoch warms up
+        const size_t epoch = (dataset->size() / workers) * workers;
+        std::vector<double> samples;
+        auto last = std::chrono::steady_clock::now();
+        server.serve(params, 0.1, epoch, [&](size_t, const std::vector<double>&) {
+            auto now = std::chrono::steady_clock::now();
+            samples.push_back(std::chrono::duration<double>(now - last).count());
+            last = now;
+        });
+        samples.erase(samples.begin());
+
+        this->add_result("parameter_server", layers, batch_size, 1, workers, 1, epoch, samples);
+    }
+
+    /**
+     * @brief      Write all results as JSON
+     *
+     * @param      out   output stream
+     */
+    void write(std::ostream& out) const {
+        out << "{\n  \"version\": \"" << PROGRAM_VERSION << "\",\n  \"benchmarks\": [";
+        for(unsigned int i=0; i<this->results.size(); i++) {
+            out << (i == 0 ? "\n    " : ",\n    ") << this->results[i];
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    /**
+     * @brief      Perform a single mini batch update of a network
+     *
+     * @param      nn          the network
+     * @param[in]  dataset     dataset holding the mini batch
+     * @param[in]  batches     sample order
+     * @param[in]  batch_size  size of the mini batch
+     */
+    static void update_mini_batch(NeuralNetwork& nn, const std::shared_ptr<Dataset>& dataset, const std::vector<size_t>& batches, size_t batch_size) {
+        nn.update_mini_batch(dataset, batches, 0, batch_size, 0.0);
+    }
+
+    /**
+     * @brief      Perform a single mini batch update of all members of an
+     *             ensemble
+     *
+     * @param      ensemble    the ensemble
+     * @param[in]  dataset     dataset holding the mini batch
+     * @param[in]  batches     sample order
+     * @param[in]  batch_size  size of the mini batch
+     */
+    static void update_mini_batch(Ensemble& ensemble, const std::shared_ptr<Dataset>& dataset, const std::vector<size_t>& batches, size_t batch_size) {
+        ensemble.update_mini_batch(dataset, batches, 0, batch_size, 0.0);
+    }
+
+private:
+    /**
+     * @brief      Store the result of a benchmark
+     *
+     * @param[in]  name        benchmark name
+     * @param[in]  layers      layer sizes
+     * @param[in]  batch_size  batch size
+     * @param[in]  threads     number of threads
+     * @param[in]  processes   number of processes
+     * @param[in]  iterations  operations per sample
+     * @param[in]  items       items processed per operation
+     * @param[in]  samples     time per operation of every sample in s
+     */
+    void add_result(const std::string& name, const std::vector<uint32_t>& layers, size_t batch_size, unsigned int threads,
+                    unsigned int processes, size_t iterations, size_t items, std::vector<double> samples) {
+        std::sort(samples.begin(), samples.end());
+        const double median = samples[samples.size() / 2];
+
+        std::string layer_str;
+        for(unsigned int i=0; i<layers.size(); i++) {
+            layer_str += (i == 0 ? "" : "-") + std::to_string(layers[i]);
+        }
+
+        this->results.push_back((boost::format("{\"name\": \"%s\", \"layers\": \"%s\", \"batch_size\": %i, \"threads\": %i, \"processes\": %i, "
+                                               "\"iterations\": %i, \"ns_per_op\": %.1f, \"min_ns_per_op\": %.1f, \"items_per_second\": %.1f}")
+                                 % name % layer_str % batch_size % threads % processes % iterations
+                                 % (median * 1e9) % (samples.front() * 1e9) % (items / median)).str());
+
+        std::cerr << boost::format("%-20s %-16s batch %5i threads %2i procs %2i %14.1f ns/op %14.1f items/s\n")
+                     % name % layer_str % batch_size % threads % processes % (median * 1e9) % (items / median);
+    }
+
+    double time(const std::function<void()>& op, size_t iterations) const {
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i=0; i<iterations; i++) {
+            op();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+};
+
+/**
+ * @brief      Split a string at a separator
+ *
+ * @param[in]  str   the string
+ * @param[in]  sep   the separator
+ *
+ * @return     the non-empty parts
+ */
+static std::vector<std::string> split(const std::string& str, char sep) {
+    std::vector<std::string> parts;
+    std::stringstream ss(str);
+    std::string item;
+    while(std::getline(ss, item, sep)) {
+        if(!item.empty()) {
+            parts.push_back(item);
+        }
+    }
+    return parts;
+}
+
+/**
+ * @brief      Parse a comma-separated list of numbers
+ *
+ * @param[in]  str   the list
+ *
+ * @return     the numbers
+ */
+template<typename T>
+static std::vector<T> parse_list(const std::string& str) {
+    std::vector<T> values;
+    for(const auto& item : split(str, ',')) {
+        values.push_back((T)std::stoul(item));
+    }
+    if(values.empty()) {
+        throw std::runtime_error("Empty list: " + str);
+    }
+    return values;
+}
+
+/**
+ * @brief      Create a dataset with random inputs and one-hot outputs
+ *
+ * @param[in]  size  number of samples
+ * @param[in]  nin   number of input nodes
+ * @param[in]  nout  number of output nodes
+ *
+ * @return     the dataset
+ */
+static std::shared_ptr<Dataset> random_dataset(size_t size, unsigned int nin, unsigned int nout) {
+    auto dataset = std::make_shared<Dataset>(size, nin, nout);
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    for(size_t i=0; i<size; i++) {
+        double* x = dataset->get_input_vector(i);
+        for(unsigned int j=0; j<nin; j++) {
+            x[j] = dist(rng);
+        }
+        double* y = dataset->get_output_vector(i);
+        std::fill(y, y + nout, 0.0);
+        y[i % nout] = 1.0;
+    }
+    return dataset;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        TCLAP::CmdLine cmd("Benchmarks the neural network", ' ', PROGRAM_VERSION);
+
+        TCLAP::ValueArg<std::string> arg_layers("l","layers","Layer sizes, networks separated by semicolons",false,"784,30,10;784,100,10","sizes");
+        cmd.add(arg_layers);
+        TCLAP::ValueArg<std::string> arg_batch("b","batch","Batch sizes",false,"1,10,100","sizes");
+        cmd.add(arg_batch);
+        TCLAP::ValueArg<std::string> arg_threads("t","threads","Thread counts",false,"1," + std::to_string(omp_get_num_procs()),"counts");
+        cmd.add(arg_threads);
+        TCLAP::ValueArg<std::string> arg_procs("p","procs","Process counts of the multi-process benchmarks (empty to skip)",false,"","counts");
+        cmd.add(arg_procs);
+        TCLAP::ValueArg<std::string> arg_ensemble("e","ensemble","Member counts of the ensemble benchmarks",false,"4","counts");
+        cmd.add(arg_ensemble);
+        TCLAP::ValueArg<unsigned int> arg_samples("n","samples","Size of the evaluated dataset",false,10000,"number");
+        cmd.add(arg_samples);
+        TCLAP::ValueArg<unsigned int> arg_repeat("r","repeat","Samples per benchmark",false,5,"number");
+        cmd.add(arg_repeat);
+        TCLAP::ValueArg<double> arg_min_time("m","min-time","Minimum duration of a sample in s",false,0.1,"seconds");
+        cmd.add(arg_min_time);
+        TCLAP::ValueArg<std::string> arg_data("d","data","Directory holding the MNIST files (empty to skip)",false,"../data","directory");
+        cmd.add(arg_data);
+        TCLAP::ValueArg<std::string> arg_filter("f","filter","Only run benchmarks whose name contains this string",false,"","name");
+        cmd.add(arg_filter);
+        TCLAP::ValueArg<std::string> arg_output("o","output","Output file (standard output when empty)",false,"","filename");
+        cmd.add(arg_output);
+
+        cmd.parse(argc, argv);
+
+        std::vector<std::vector<uint32_t>> networks;
+        for(const auto& spec : split(arg_layers.getValue(), ';')) {
+            networks.push_back(parse_list<uint32_t>(spec));
+            if(networks.back().size() < 2) {
+                throw std::runtime_error("A network needs at least two layers: " + spec);
+            }
+        }
+        const auto batch_sizes = parse_list<size_t>(arg_batch.getValue());
+        const auto thread_counts = parse_list<unsigned int>(arg_threads.getValue());
+        const auto member_counts = parse_list<unsigned int>(arg_ensemble.getValue());
+        const std::string filter = arg_filter.getValue();
+        auto selected = [&filter](const std::string& name) {
+            return name.find(filter) != std::string::npos;
+        };
+
+        Benchmark bench(arg_repeat.getValue(), arg_min_time.getValue());
+
+        // processes are forked first, before any thread pool has been started
+        if(!arg_procs.getValue().empty()) {
+            const auto proc_counts = parse_list<unsigned int>(arg_procs.getValue());
+            for(const auto& layers : networks) {
+                auto dataset = random_dataset(arg_samples.getValue(), layers.front(), layers.back());
+                for(size_t batch_size : batch_sizes) {
+                    for(unsigned int procs : proc_counts) {
+                        if(selected("data_parallel")) {
+                            bench.run_data_parallel(layers, batch_size, procs, dataset);
+                        }
+                        if(selected("parameter_server")) {
+                            bench.run_parameter_server(layers, batch_size, procs, 2, dataset);
+                        }
+                    }
+                }
+            }
+        }
+
+        for(const auto& layers : networks) {
+            const unsigned int nin = layers.front();
+            const unsigned int nout = layers.back();
+            const size_t max_batch = *std::max_element(batch_sizes.begin(), batch_sizes.end());
+
+            NeuralNetwork nn(layers);
+            auto dataset = random_dataset(std::max(max_batch, (size_t)arg_samples.getValue()), nin, nout);
+            std::vector<size_t> order(dataset->size());
+            std::iota(order.begin(), order.end(), 0);
+            InferenceWorkspace ws;
+            std::vector<double> out(max_batch * nout);
+
+            for(unsigned int threads : thread_counts) {
+                for(size_t batch_size : batch_sizes) {
+                    if(selected("feed_forward")) {
+                        bench.run("feed_forward", layers, batch_size, threads, batch_size, [&]() {
+                            for(size_t i=0; i<batch_size; i++) {
+                                nn.feed_forward(dataset->get_input_vector(i));
+                            }
+                        });
+                    }
+
+                    if(selected("feed_forward_batch")) {
+                        bench.run("feed_forward_batch", layers, batch_size, threads, batch_size, [&]() {
+                            nn.feed_forward_batch(dataset->get_input_vector(0), batch_size, &out[0], ws);
+                        });
+                    }
+
+                    if(selected("back_propagation")) {
+                        bench.run("back_propagation", layers, batch_size, threads, batch_size, [&]() {
+                            for(size_t i=0; i<batch_size; i++) {
+                                nn.back_propagation(dataset->get_input_vector(i), dataset->get_output_vector(i));
+                            }
+                        });
+                    }
+
+                    if(selected("update_mini_batch")) {
+                        bench.run("update_mini_batch", layers, batch_size, threads, batch_size, [&]() {
+                            Benchmark::update_mini_batch(nn, dataset, order, batch_size);
+                        });
+                    }
+                }
+
+                // N networks trained as stacked GEMMs versus one after the other
+                for(unsigned int members : member_counts) {
+                    const std::string suffix = "_x" + std::to_string(members);
+                    if(!selected("ensemble" + suffix) && !selected("separate" + suffix)) {
+                        continue;
+                    }
+
+                    Ensemble ensemble(layers, members, 0);
+                    std::vector<std::unique_ptr<NeuralNetwork>> separate;
+                    for(unsigned int k=0; k<members; k++) {
+                        separate.push_back(std::make_unique<NeuralNetwork>(layers, k));
+                    }
+
+                    for(size_t batch_size : batch_sizes) {
+                        if(selected("ensemble" + suffix)) {
+                            bench.run("ensemble" + suffix, layers, batch_size, threads, batch_size * members, [&]() {
+                                Benchmark::update_mini_batch(ensemble, dataset, order, batch_size);
+                            });
+                        }
+                        if(selected("separate" + suffix)) {
+                            bench.run("separate" + suffix, layers, batch_size, threads, batch_size * members, [&]() {
+                                for(auto& member : separate) {
+                                    Benchmark::update_mini_batch(*member, dataset, order, batch_size);
+                                }
+                            });
+                        }
+                    }
+                }
+
+                // a pass over datasets placed by the threads of the team, with and without huge pages
+                static const struct {
+                    const char* name;
+                    bool first_touch;
+                    MemoryPlacement::HugePages huge_pages;
+                } placements[] = {{"sgd_pass", false, MemoryPlacement::HugePages::NONE},
+                                  {"sgd_pass_first_touch", true, MemoryPlacement::HugePages::NONE},
+                                  {"sgd_pass_huge_pages", true, MemoryPlacement::HugePages::TRANSPARENT}};
+                for(const auto& p : placements) {
+                    if(!selected(p.name)) {
+                        continue;
+                    }
+
+                    TaskPool::get().set_nr_threads(threads);
+                    MemoryPlacement::get().set_first_touch(p.first_touch);
+                    MemoryPlacement::get().set_huge_pages(p.huge_pages);
+                    auto placed = random_dataset(dataset->size(), nin, nout);
+                    MemoryPlacement::get().set_first_touch(false);
+                    MemoryPlacement::get().set_huge_pages(MemoryPlacement::HugePages::NONE);
+
+                    for(size_t batch_size : batch_sizes) {
+                        bench.run(p.name, layers, batch_size, threads, placed->size(), [&]() {
+                            nn.sgd_pass(placed, batch_size, 3.0);
+                        });
+                    }
+                }
+
+                if(selected("evaluate")) {
+                    bench.run("evaluate", layers, dataset->size(), threads, dataset->size(), [&]() {
+                        nn.evaluate(dataset);
+                    });
+                }
+
+                if(selected("load_network")) {
+                    const std::string filename = "bench_network.ann";
+                    nn.save_network(filename);
+                    bench.run("load_network", layers, 1, threads, 1, [&]() {
+                        NeuralNetwork loaded(filename);
+                    });
+                    std::remove(filename.c_str());
+                }
+            }
+        }
+
+        // loading and converting the MNIST files
+        const std::string data = arg_data.getValue();
+        if(!data.empty() && selected("mnist_loader")) {
+            const std::vector<std::string> files = {data + "/train-images-idx3-ubyte.gz", data + "/train-labels-idx1-ubyte.gz",
+                                                    data + "/t10k-images-idx3-ubyte.gz", data + "/t10k-labels-idx1-ubyte.gz"};
+            if(std::all_of(files.begin(), files.end(), [](const std::string& f) { return std::ifstream(f).good(); })) {
+                MNISTLoader probe;
+                probe.load(files[0], files[1], files[2], files[3]);
+                const size_t images = probe.get_trainingset_size() + probe.get_testset_size();
+
+                for(unsigned int threads : thread_counts) {
+                    bench.run("mnist_loader", {}, images, threads, images, [&]() {
+                        MNISTLoader ml;
+                        ml.set_nr_threads(threads);
+                        ml.load(files[0], files[1], files[2], files[3]);
+                    });
+                }
+            } else {
+                std::cerr << "Skipping mnist_loader: MNIST files not found in " << data << std::endl;
+            }
+        }
+
+        if(arg_output.getValue().empty()) {
+            bench.write(std::cout);
+        } else {
+            std::ofstream outfile(arg_output.getValue());
+            bench.write(outfile);
+        }
+
+    } catch (TCLAP::ArgException &e) {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return -1;
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <omp.h>
+#include <unistd.h>
+#include <boost/format.hpp>
+
+#include "pngfuncs.h"
+
+/*
+ * Measures the decoding throughput of png images in images per second per
+ * core, for the original loader setting up libpng and allocating every row
+ * per call, for load_image_buffer_from_png and for the reusable decoder
+ * working on png bytes held in memory.
+ *
+ * Usage: bench_png [iterations] [image.png ...]
+ */
+
+/**
+ * @brief      Read a file into memory
+ *
+ * @param[in]  filename  The filename
+ *
+ * @return     file contents
+ */
+static std::vector<uint8_t> read_file(const std::string& filename) {
+    std::ifstream ifile(filename, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+}
+
+/**
+ * @brief      Original png loader, kept as baseline of the decoder
+ *
+ * @param[in]  filename   The filename
+ * @param      buffer     The buffer
+ * @param      width      The width
+ * @param      height     The height
+ * @param      col        The color type
+ * @param      bit_depth  The bit depth
+ */
+static void legacy_load(const std::string& filename, std::vector<uint8_t>& buffer, png_uint_32* width, png_uint_32* height, int* col, int* bit_depth) {
+    char header[8];
+
+    std::ifstream ifile(filename.c_str(), std::ios::binary);
+    if (!ifile.is_open() ) {
+        throw std::runtime_error("File " + filename + " could not be opened for reading");
+    }
+
+    ifile.read(&header[0], 8 * sizeof(char));
+    if (!png_check_sig((png_bytep)header, 8)) {
+        throw std::runtime_error("File " + filename + " is not recognized as a PNG file");
+    }
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+
+    png_set_read_fn(png_ptr, (void*)&ifile, PNG::read_file_callback);
+    png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
+    png_get_IHDR(png_ptr, info_ptr, width, height, bit_depth, col, 0, 0, 0);
+
+    png_bytepp row_pointers = new png_bytep[(*height)];
+    for (unsigned int y=0; y<(*height); y++) {
+        row_pointers[y] = new png_byte[png_get_rowbytes(png_ptr,info_ptr)];
+    }
+
+    png_read_image(png_ptr, row_pointers);
+    png_read_end(png_ptr, info_ptr);
+
+    buffer.resize((*width) * (*height), 0);
+    for(unsigned int i=0; i<(*height); i++) {
+        for(unsigned int j=0; j<(*width); j++) {
+            buffer[i * (*width) + j] = row_pointers[i][j];
+        }
+    }
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+    for(unsigned int i=0; i<*height; i++) {
+        delete[] row_pointers[i];
+    }
+    delete[] row_pointers;
+}
+
+/**
+ * @brief      Print the throughput of a benchmark
+ *
+ * @param[in]  name      benchmark name
+ * @param[in]  images    number of images decoded
+ * @param[in]  seconds   elapsed time
+ * @param[in]  threads   number of threads used
+ */
+static void report(const std::string& name, size_t images, double seconds, int threads) {
+    std::cout << boost::format("%-24s %2i thread(s) %12.0f img/s %12.0f img/s/core") % name % threads
+                 % (images / seconds) % (images / seconds / threads) << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 20000;
+
+    std::vector<std::string> files;
+    for(int i=2; i<argc; i++) {
+        files.push_back(argv[i]);
+    }
+
+    // without any input files, generate a 28x28 grayscale test image in a temporary file
+    std::string tmpfile;
+    if(files.empty()) {
+        const char* tmpdir = std::getenv("TMPDIR");
+        tmpfile = std::string(tmpdir != nullptr ? tmpdir : "/tmp") + "/bench_png-XXXXXX";
+        const int fd = mkstemp(&tmpfile[0]);
+        if(fd < 0) {
+            std::cerr << "Cannot create temporary file " << tmpfile << std::endl;
+            return -1;
+        }
+        close(fd);
+
+        std::vector<uint8_t> pixels(28 * 28);
+        for(unsigned int i=0; i<pixels.size(); i++) {
+            pixels[i] = (i * 37) % 256;
+        }
+        files.push_back(tmpfile);
+        PNG::write_image_buffer_to_png(files.back(), pixels, 28, 28, PNG_COLOR_TYPE_GRAY);
+    }
+
+    std::vector<std::vector<uint8_t>> images;
+    for(const auto& file : files) {
+        images.push_back(read_file(file));
+    }
+
+    // original loader: sets up libpng and allocates every row per call
+    {
+        std::vector<uint8_t> buffer;
+        png_uint_32 width, height;
+        int col, bit_depth;
+        auto start = std::chrono::system_clock::now();
+        for(size_t i=0; i<iterations; i++) {
+            legacy_load(files[i % files.size()], buffer, &width, &height, &col, &bit_depth);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+        report("legacy loader", iterations, elapsed.count(), 1);
+    }
+
+    // file-based loader on top of a thread-local decoder
+    {
+        std::vector<uint8_t> buffer;
+        png_uint_32 width, height;
+        int col, bit_depth;
+        auto start = std::chrono::system_clock::now();
+        for(size_t i=0; i<iterations; i++) {
+            PNG::load_image_buffer_from_png(files[i % files.size()], buffer, &width, &height, &col, &bit_depth);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+        report("load_image_buffer", iterations, elapsed.count(), 1);
+    }
+
+    // reusable decoder on in-memory png bytes, for an increasing number of threads
+    for(int threads=1; threads<=omp_get_num_procs(); threads*=2) {
+        auto start = std::chrono::system_clock::now();
+        #pragma omp parallel num_threads(threads)
+        {
+            PNG::Decoder decoder;
+            std::vector<uint8_t> buffer;
+            #pragma omp for schedule(static)
+            for(size_t i=0; i<iterations; i++) {
+                const auto& image = images[i % images.size()];
+                decoder.decode(image.data(), image.size(), buffer);
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+        report("Decoder (memory)", iterations, elapsed.count(), threads);
+    }
+
+    if(!tmpfile.empty()) {
+        unlink(tmpfile.c_str());
+    }
+
+    return 0;
+}
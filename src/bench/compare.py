@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#
+# Compares two result files of the bench program and flags the benchmarks
+# that became slower than the threshold. Returns a non-zero exit code when
+# any regression is found.
+#
+# Usage: compare.py baseline.json current.json [--threshold 0.10]
+#
+
+import argparse
+import json
+import sys
+
+def load(filename):
+    with open(filename) as f:
+        data = json.load(f)
+    return {(b['name'], b['layers'], b['batch_size'], b['threads'], b.get('processes', 1)): b for b in data['benchmarks']}
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare two benchmark result files')
+    parser.add_argument('baseline', help='results of the reference build')
+    parser.add_argument('current', help='results of the build under test')
+    parser.add_argument('--threshold', type=float, default=0.10,
+                        help='relative slowdown that counts as a regression (default: 0.10)')
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    print('%-20s %-16s %6s %7s %5s %14s %14s %8s' % ('name', 'layers', 'batch', 'threads', 'procs', 'baseline ns', 'current ns', 'change'))
+    regressions = 0
+    for key in sorted(set(baseline) & set(current)):
+        old = baseline[key]['ns_per_op']
+        new = current[key]['ns_per_op']
+        change = new / old - 1.0
+        if change > args.threshold:
+            status = 'REGRESSION'
+            regressions += 1
+        elif change < -args.threshold:
+            status = 'improved'
+        else:
+            status = ''
+        print('%-20s %-16s %6i %7i %5i %14.1f %14.1f %+7.1f%% %s' % (key + (old, new, change * 100.0, status)))
+
+    for key in sorted(set(baseline) ^ set(current)):
+        print('%-20s %-16s %6i %7i %5i only in %s' % (key + (args.baseline if key in baseline else args.current,)))
+
+    if regressions > 0:
+        print('%i regression(s) above %.0f%%' % (regressions, args.threshold * 100.0))
+        return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
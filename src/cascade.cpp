@@ -0,0 +1,185 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "cascade.h"
+
+/**
+ * @brief      Constructs the cascade
+ *
+ * @param[in]  _first      small network evaluated for all images
+ * @param[in]  _full       network evaluated for uncertain images
+ * @param[in]  _threshold  margin below which images fall through
+ */
+Cascade::Cascade(const NeuralNetwork& _first, const NeuralNetwork& _full, double _threshold) :
+first(_first),
+full(_full),
+threshold(_threshold),
+nr_classified(0),
+nr_escalated(0) {
+    if(this->first.get_nr_inputs() != this->full.get_nr_inputs() ||
+       this->first.get_sizes().back() != this->full.get_sizes().back()) {
+        throw std::runtime_error((boost::format("The networks of a cascade need the same inputs and outputs (%i -> %i versus %i -> %i)")
+            % this->first.get_nr_inputs() % this->first.get_sizes().back() % this->full.get_nr_inputs() % this->full.get_sizes().back()).str());
+    }
+}
+
+/**
+ * @brief      Classify a batch of images
+ *
+ * @param[in]  in    pointer to n input vectors (row-major)
+ * @param[in]  n     number of input vectors
+ * @param      out   pointer to n output vectors receiving the scores of
+ *                   the network that decided
+ */
+void Cascade::classify_batch(const double* in, size_t n, double* out) {
+    const size_t nr_in = this->full.get_nr_inputs();
+    const unsigned int nr_out = this->full.get_sizes().back();
+
+    this->first.feed_forward_batch(in, n, out, this->ws_first);
+
+    this->uncertain.clear();
+    for(size_t i=0; i<n; i++) {
+        if(margin(&out[i * nr_out], nr_out) < this->threshold) {
+            this->uncertain.push_back(i);
+        }
+    }
+
+    // evaluate the uncertain images together and replace their scores
+    const size_t k = this->uncertain.size();
+    if(k > 0) {
+        this->gathered_in.resize(k * nr_in);
+        this->gathered_out.resize(k * nr_out);
+        for(size_t j=0; j<k; j++) {
+            std::copy(&in[this->uncertain[j] * nr_in], &in[(this->uncertain[j] + 1) * nr_in], &this->gathered_in[j * nr_in]);
+        }
+
+        this->full.feed_forward_batch(&this->gathered_in[0], k, &this->gathered_out[0], this->ws_full);
+
+        for(size_t j=0; j<k; j++) {
+            std::copy(&this->gathered_out[j * nr_out], &this->gathered_out[(j + 1) * nr_out], &out[this->uncertain[j] * nr_out]);
+        }
+    }
+
+    this->nr_classified += n;
+    this->nr_escalated += k;
+}
+
+/**
+ * @brief      Choose the threshold on a labelled dataset
+ *
+ * @param[in]  dataset   labelled images, e.g. the test set
+ * @param[in]  max_loss  allowed loss in accuracy (e.g. 0.001)
+ *
+ * @return     the threshold with the accuracies and timings
+ */
+CascadeCalibration Cascade::calibrate(const std::shared_ptr<Dataset>& dataset, double max_loss) {
+    const size_t n = dataset->size();
+    const unsigned int nr_out = this->full.get_sizes().back();
+    if(n == 0 || dataset->get_nr_output_nodes() != nr_out) {
+        throw std::runtime_error("The calibration set does not match the networks");
+    }
+
+    // scores of both networks for all images
+    std::vector<double> scores_first(n * nr_out);
+    std::vector<double> scores_full(n * nr_out);
+    auto start = std::chrono::steady_clock::now();
+    this->first.feed_forward_batch(dataset->get_input_vector(0), n, &scores_first[0], this->ws_first);
+    auto mid = std::chrono::steady_clock::now();
+    this->full.feed_forward_batch(dataset->get_input_vector(0), n, &scores_full[0], this->ws_full);
+    auto end = std::chrono::steady_clock::now();
+
+    CascadeCalibration result;
+    result.first_us = std::chrono::duration<double, std::micro>(mid - start).count() / n;
+    result.full_us = std::chrono::duration<double, std::micro>(end - mid).count() / n;
+
+    auto argmax = [nr_out](const double* v) {
+        return std::distance(v, std::max_element(v, v + nr_out));
+    };
+
+    std::vector<double> margins(n);
+    std::vector<int> hit_first(n), hit_full(n);
+    for(size_t i=0; i<n; i++) {
+        const auto label = argmax(dataset->get_output_vector(i));
+        hit_first[i] = argmax(&scores_first[i * nr_out]) == label;
+        hit_full[i] = argmax(&scores_full[i * nr_out]) == label;
+        margins[i] = margin(&scores_first[i * nr_out], nr_out);
+    }
+
+    // letting the k least confident images fall through
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&margins](size_t a, size_t b) {
+        return margins[a] < margins[b];
+    });
+
+    const size_t hits_first = std::accumulate(hit_first.begin(), hit_first.end(), (size_t)0);
+    const size_t hits_full = std::accumulate(hit_full.begin(), hit_full.end(), (size_t)0);
+    const double target = (double)hits_full - max_loss * n;
+
+    size_t hits = hits_first;
+    size_t k = 0;
+    for(; k<n; k++) {
+        // a threshold cannot separate images of equal margin
+        const bool separable = k == 0 || margins[order[k-1]] < margins[order[k]];
+        if(separable && hits >= target) {
+            break;
+        }
+        hits += hit_full[order[k]] - hit_first[order[k]];
+    }
+
+    result.threshold = k < n ? margins[order[k]] : std::numeric_limits<double>::infinity();
+    result.escalated = (double)k / n;
+    result.accuracy = (double)hits / n;
+    result.accuracy_first = (double)hits_first / n;
+    result.accuracy_full = (double)hits_full / n;
+    this->threshold = result.threshold;
+
+    return result;
+}
+
+/**
+ * @brief      Get the margin between the highest and second highest score
+ *
+ * @param[in]  scores  the scores
+ * @param[in]  n       number of scores
+ *
+ * @return     the margin
+ */
+double Cascade::margin(const double* scores, unsigned int n) {
+    double best = -std::numeric_limits<double>::infinity();
+    double second = -std::numeric_limits<double>::infinity();
+    for(unsigned int i=0; i<n; i++) {
+        if(scores[i] > best) {
+            second = best;
+            best = scores[i];
+        } else if(scores[i] > second) {
+            second = scores[i];
+        }
+    }
+    return n > 1 ? best - second : std::numeric_limits<double>::infinity();
+}
@@ -0,0 +1,173 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _CASCADE_H
+#define _CASCADE_H
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+#include "neural_network.h"
+#include "dataset.h"
+
+/**
+ * @brief      Outcome of calibrating the threshold of a cascade
+ */
+struct CascadeCalibration {
+    double threshold = 0.0;             //!< margin below which images fall through
+    double escalated = 0.0;             //!< fraction of images evaluated by the full network
+    double accuracy = 0.0;              //!< accuracy of the cascade
+    double accuracy_first = 0.0;        //!< accuracy of the first network alone
+    double accuracy_full = 0.0;         //!< accuracy of the full network alone
+    double first_us = 0.0;              //!< time per image of the first network
+    double full_us = 0.0;               //!< time per image of the full network
+
+    /**
+     * @brief      Get the expected time per image of the cascade
+     *
+     * @return     time in us
+     */
+    inline double get_cascade_us() const {
+        return this->first_us + this->escalated * this->full_us;
+    }
+};
+
+/**
+ * @brief      Classifies with a small network first and only falls through
+ *             to the full network when the small one is not confident
+ *
+ * The confidence of a classification is the margin between the highest
+ * and the second highest score. Images of a batch whose margin is below
+ * the threshold are gathered and evaluated by the full network as a single
+ * batch. The networks are not modified; the workspaces are owned by the
+ * cascade, hence a cascade serves a single thread.
+ */
+class Cascade {
+private:
+    const NeuralNetwork& first;             //!< small network evaluated for all images
+    const NeuralNetwork& full;              //!< network evaluated for uncertain images
+    double threshold;                       //!< margin below which images fall through
+
+    InferenceWorkspace ws_first;            //!< scratch memory of the first network
+    InferenceWorkspace ws_full;             //!< scratch memory of the full network
+    std::vector<size_t> uncertain;          //!< images of the batch falling through
+    std::vector<double> gathered_in;        //!< inputs of the uncertain images
+    std::vector<double> gathered_out;       //!< outputs of the uncertain images
+
+    size_t nr_classified;                   //!< images classified so far
+    size_t nr_escalated;                    //!< images evaluated by the full network so far
+
+public:
+    /**
+     * @brief      Constructs the cascade
+     *
+     * @param[in]  _first      small network evaluated for all images
+     * @param[in]  _full       network evaluated for uncertain images
+     * @param[in]  _threshold  margin below which images fall through
+     */
+    Cascade(const NeuralNetwork& _first, const NeuralNetwork& _full, double _threshold);
+
+    /**
+     * @brief      Classify a batch of images
+     *
+     * @param[in]  in    pointer to n input vectors (row-major)
+     * @param[in]  n     number of input vectors
+     * @param      out   pointer to n output vectors receiving the scores of
+     *                   the network that decided
+     */
+    void classify_batch(const double* in, size_t n, double* out);
+
+    /**
+     * @brief      Choose the threshold on a labelled dataset
+     *
+     * The threshold is the lowest one for which the cascade classifies at
+     * most a fraction max_loss fewer images correctly than the full network,
+     * such that as few images as possible fall through. The threshold of the
+     * cascade is set to it.
+     *
+     * @param[in]  dataset   labelled images, e.g. the test set
+     * @param[in]  max_loss  allowed loss in accuracy (e.g. 0.001)
+     *
+     * @return     the threshold with the accuracies and timings
+     */
+    CascadeCalibration calibrate(const std::shared_ptr<Dataset>& dataset, double max_loss);
+
+    /**
+     * @brief      Get the margin between the highest and second highest score
+     *
+     * @param[in]  scores  the scores
+     * @param[in]  n       number of scores
+     *
+     * @return     the margin
+     */
+    static double margin(const double* scores, unsigned int n);
+
+    /**
+     * @brief      Gets the threshold.
+     *
+     * @return     margin below which images fall through
+     */
+    inline double get_threshold() const {
+        return this->threshold;
+    }
+
+    /**
+     * @brief      Sets the threshold.
+     *
+     * @param[in]  _threshold  margin below which images fall through
+     */
+    inline void set_threshold(double _threshold) {
+        this->threshold = _threshold;
+    }
+
+    /**
+     * @brief      Get the number of classified images
+     *
+     * @return     images classified so far
+     */
+    inline size_t get_nr_classified() const {
+        return this->nr_classified;
+    }
+
+    /**
+     * @brief      Get the number of images evaluated by the full network
+     *
+     * @return     images that fell through so far
+     */
+    inline size_t get_nr_escalated() const {
+        return this->nr_escalated;
+    }
+};
+
+#endif // _CASCADE_H
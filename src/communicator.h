@@ -0,0 +1,85 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _COMMUNICATOR_H
+#define _COMMUNICATOR_H
+
+#include <cstddef>
+
+/**
+ * @brief      Collective operations between the processes of a data-parallel
+ *             training run
+ *
+ * The network only depends on this interface, such that the transport
+ * (shared memory between processes on one host, sockets between hosts) can
+ * be exchanged without touching the training code. Every process has to call
+ * the collective operations in the same order and with the same sizes.
+ */
+class Communicator {
+public:
+    virtual ~Communicator() {}
+
+    /**
+     * @brief      Get the index of the calling process
+     *
+     * @return     rank in [0, size)
+     */
+    virtual unsigned int get_rank() const = 0;
+
+    /**
+     * @brief      Get the number of processes
+     *
+     * @return     number of processes
+     */
+    virtual unsigned int get_size() const = 0;
+
+    /**
+     * @brief      Wait until all processes have reached this point
+     */
+    virtual void barrier() = 0;
+
+    /**
+     * @brief      Sum a vector over all processes; every process receives
+     *             the sum
+     *
+     * @param      data  vector, replaced by the sum
+     * @param[in]  n     number of elements
+     */
+    virtual void allreduce(double* data, size_t n) = 0;
+
+    /**
+     * @brief      Copy a vector from one process to all others
+     *
+     * @param      data  vector, replaced by the one of the root process
+     * @param[in]  n     number of elements
+     * @param[in]  root  rank of the sending process
+     */
+    virtual void broadcast(double* data, size_t n, unsigned int root) = 0;
+};
+
+#endif // _COMMUNICATOR_H
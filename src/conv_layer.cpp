@@ -0,0 +1,446 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "conv_layer.h"
+
+/**
+ * @brief      sigmoid function
+ *
+ * @param[in]  z     input value
+ *
+ * @return     sigmoid value
+ */
+static inline double sigmoid(double z) {
+    return 1.0 / (1.0 + std::exp(-z));
+}
+
+/**
+ * @brief      Constructs a convolutional layer with zero parameters
+ *
+ * @param[in]  _channels  channels of the input
+ * @param[in]  _height    height of the input
+ * @param[in]  _width     width of the input
+ * @param[in]  _filters   number of filters
+ * @param[in]  _kernel    size of the filters
+ * @param[in]  _pool      size of the pooling window (1: no pooling)
+ */
+ConvLayer::ConvLayer(uint32_t _channels, uint32_t _height, uint32_t _width, uint32_t _filters, uint32_t _kernel, uint32_t _pool) :
+channels(_channels),
+height(_height),
+width(_width),
+filters(_filters),
+kernel(_kernel),
+pool(_pool) {
+    static const uint32_t max_size = 1 << 14;
+
+    if(this->channels == 0 || this->filters == 0 || this->kernel == 0 || this->pool == 0 ||
+       this->channels > max_size || this->filters > max_size || this->height > max_size || this->width > max_size) {
+        throw std::runtime_error("Invalid convolutional layer");
+    }
+    if(this->kernel > this->height || this->kernel > this->width) {
+        throw std::runtime_error("Filter of " + std::to_string(this->kernel) + " exceeds the input of " +
+                                 std::to_string(this->height) + "x" + std::to_string(this->width));
+    }
+
+    this->conv_height = this->height - this->kernel + 1;
+    this->conv_width = this->width - this->kernel + 1;
+    if(this->pool > this->conv_height || this->pool > this->conv_width) {
+        throw std::runtime_error("Pooling window of " + std::to_string(this->pool) + " exceeds the convolution of " +
+                                 std::to_string(this->conv_height) + "x" + std::to_string(this->conv_width));
+    }
+
+    // a remainder that does not fill a pooling window is dropped
+    this->out_height = this->conv_height / this->pool;
+    this->out_width = this->conv_width / this->pool;
+
+    const size_t ckk = (size_t)this->channels * this->kernel * this->kernel;
+    this->kernels.resize(this->filters * ckk, 0.0);
+    this->biases.resize(this->filters, 0.0);
+    this->nabla_k.resize(this->kernels.size(), 0.0);
+    this->nabla_b.resize(this->biases.size(), 0.0);
+}
+
+/**
+ * @brief      Construct a stack of layers from a specification
+ *
+ * The specification lists the layers separated by commas as
+ * filters x kernel, optionally followed by / pooling, e.g. "8x5/2,16x3".
+ *
+ * @param[in]  spec      specification
+ * @param[in]  channels  channels of the input image
+ * @param[in]  height    height of the input image
+ * @param[in]  width     width of the input image
+ *
+ * @return     the layers
+ */
+std::vector<ConvLayer> ConvLayer::parse(const std::string& spec, uint32_t channels, uint32_t height, uint32_t width) {
+    std::vector<ConvLayer> layers;
+
+    size_t pos = 0;
+    while(pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if(end == std::string::npos) {
+            end = spec.size();
+        }
+        const std::string term = spec.substr(pos, end - pos);
+        pos = end + 1;
+
+        unsigned int f = 0, k = 0, p = 1;
+        int len = 0;
+        bool valid = std::sscanf(term.c_str(), "%ux%u%n", &f, &k, &len) == 2;
+        if(valid && (size_t)len < term.size()) {
+            const std::string rest = term.substr(len);
+            valid = std::sscanf(rest.c_str(), "/%u%n", &p, &len) == 1 && (size_t)len == rest.size();
+        }
+        if(!valid) {
+            throw std::runtime_error("Invalid convolutional layer (expected filters x kernel[/pool]): " + term);
+        }
+
+        layers.emplace_back(channels, height, width, f, k, p);
+        channels = layers.back().filters;
+        height = layers.back().out_height;
+        width = layers.back().out_width;
+    }
+
+    return layers;
+}
+
+/**
+ * @brief      Initialize the filters and biases randomly
+ *
+ * @param[in]  seed  random seed
+ */
+void ConvLayer::initialize(uint64_t seed) {
+    std::uniform_real_distribution<double> unif(-1.0, 1.0);
+    std::default_random_engine re;
+    re.seed(seed);
+
+    for(auto& b : this->biases) {
+        b = unif(re);
+    }
+    for(auto& k : this->kernels) {
+        k = unif(re);
+    }
+}
+
+/**
+ * @brief      Perform feed forward on a single input, keeping the state
+ *             for the backward pass
+ *
+ * @param[in]  in    input image
+ *
+ * @return     output (valid until the next forward pass)
+ */
+const double* ConvLayer::forward(const double* in) {
+    const size_t ckk = (size_t)this->channels * this->kernel * this->kernel;
+    const size_t ohw = (size_t)this->conv_height * this->conv_width;
+
+    this->columns.resize(ckk * ohw);
+    this->activations.resize(this->filters * ohw);
+    this->output.resize(this->get_nr_outputs());
+    this->argmax.resize(this->get_nr_outputs());
+
+    this->im2col(in, &this->columns[0], ohw);
+
+    for(uint32_t f=0; f<this->filters; f++) {
+        std::fill(&this->activations[f * ohw], &this->activations[f * ohw] + ohw, this->biases[f]);
+    }
+
+    // Z(F x ohw) = K(F x ckk) * C(ckk x ohw) + Z
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                this->filters, ohw, ckk,
+                1.0, &this->kernels[0], ckk,
+                &this->columns[0], ohw,
+                1.0, &this->activations[0], ohw);
+
+    for(auto& a : this->activations) {
+        a = sigmoid(a);
+    }
+
+    this->max_pool(&this->activations[0], ohw, &this->output[0], &this->argmax[0]);
+
+    return &this->output[0];
+}
+
+/**
+ * @brief      Perform back propagation of the last forward pass, adding
+ *             to the summed derivatives
+ *
+ * @param[in]  dout  error of the output
+ * @param      din   receives the error of the input (skipped if nullptr)
+ */
+void ConvLayer::backward(const double* dout, double* din) {
+    const size_t ckk = (size_t)this->channels * this->kernel * this->kernel;
+    const size_t ohw = (size_t)this->conv_height * this->conv_width;
+    const size_t npool = (size_t)this->out_height * this->out_width;
+
+    // route the error to the maxima of the pooling windows
+    this->dactivations.assign(this->filters * ohw, 0.0);
+    for(uint32_t f=0; f<this->filters; f++) {
+        for(size_t q=0; q<npool; q++) {
+            this->dactivations[f * ohw + this->argmax[f * npool + q]] += dout[f * npool + q];
+        }
+    }
+
+    // sigmoid'(z) = a (1 - a)
+    for(size_t j=0; j<this->dactivations.size(); j++) {
+        this->dactivations[j] *= this->activations[j] * (1.0 - this->activations[j]);
+    }
+
+    // nabla_K(F x ckk) += D(F x ohw) * C^T(ohw x ckk)
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                this->filters, ckk, ohw,
+                1.0, &this->dactivations[0], ohw,
+                &this->columns[0], ohw,
+                1.0, &this->nabla_k[0], ckk);
+
+    for(uint32_t f=0; f<this->filters; f++) {
+        const double* d = &this->dactivations[f * ohw];
+        this->nabla_b[f] += std::accumulate(d, d + ohw, 0.0);
+    }
+
+    if(din == nullptr) {
+        return;
+    }
+
+    // D_C(ckk x ohw) = K^T(ckk x F) * D(F x ohw)
+    this->dcolumns.resize(ckk * ohw);
+    cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+                ckk, ohw, this->filters,
+                1.0, &this->kernels[0], ckk,
+                &this->dactivations[0], ohw,
+                0.0, &this->dcolumns[0], ohw);
+
+    std::fill(din, din + this->get_nr_inputs(), 0.0);
+    this->col2im(&this->dcolumns[0], din);
+}
+
+/**
+ * @brief      Perform feed forward on a batch of inputs without
+ *             modifying the layer
+ *
+ * @param[in]  in       n input images
+ * @param[in]  n        number of inputs
+ * @param      out      n outputs
+ * @param      scratch  scratch memory owned by the caller
+ */
+void ConvLayer::forward_batch(const double* in, size_t n, double* out, std::vector<double>& scratch) const {
+    // unrolled patches of at most this many values are kept at once
+    static const size_t max_columns = 1 << 20;
+
+    const size_t ckk = (size_t)this->channels * this->kernel * this->kernel;
+    const size_t ohw = (size_t)this->conv_height * this->conv_width;
+    const size_t chunk = std::max((size_t)1, std::min(n, max_columns / (ckk * ohw)));
+
+    if(scratch.size() < (ckk + this->filters) * chunk * ohw) {
+        scratch.resize((ckk + this->filters) * chunk * ohw);
+    }
+    double* cols = &scratch[0];
+    double* act = cols + ckk * chunk * ohw;
+
+    for(size_t s=0; s<n; s+=chunk) {
+        const size_t m = std::min(chunk, n - s);
+        const size_t ld = m * ohw;
+
+        // the patches of all inputs side by side, such that one product covers the chunk
+        for(size_t i=0; i<m; i++) {
+            this->im2col(in + (s + i) * this->get_nr_inputs(), cols + i * ohw, ld);
+        }
+
+        for(uint32_t f=0; f<this->filters; f++) {
+            std::fill(act + f * ld, act + (f + 1) * ld, this->biases[f]);
+        }
+
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    this->filters, ld, ckk,
+                    1.0, &this->kernels[0], ckk,
+                    cols, ld,
+                    1.0, act, ld);
+
+        for(size_t j=0; j<this->filters * ld; j++) {
+            act[j] = sigmoid(act[j]);
+        }
+
+        for(size_t i=0; i<m; i++) {
+            this->max_pool(act + i * ohw, ld, out + (s + i) * this->get_nr_outputs(), nullptr);
+        }
+    }
+}
+
+/**
+ * @brief      Reset the summed derivatives
+ */
+void ConvLayer::clear_gradients() {
+    std::fill(this->nabla_k.begin(), this->nabla_k.end(), 0.0);
+    std::fill(this->nabla_b.begin(), this->nabla_b.end(), 0.0);
+}
+
+/**
+ * @brief      Subtract the scaled summed derivatives from the parameters
+ *
+ * @param[in]  factor  scaling factor (learning rate over batch size)
+ */
+void ConvLayer::update(double factor) {
+    cblas_daxpy(this->kernels.size(), -factor, &this->nabla_k[0], 1, &this->kernels[0], 1);
+    cblas_daxpy(this->biases.size(), -factor, &this->nabla_b[0], 1, &this->biases[0], 1);
+}
+
+/**
+ * @brief      Write shape and parameters
+ *
+ * @param      out   output stream
+ */
+void ConvLayer::write(std::ostream& out) const {
+    const uint32_t shape[] = {this->channels, this->height, this->width, this->filters, this->kernel, this->pool};
+    out.write((const char*)shape, sizeof(shape));
+    out.write((const char*)&this->biases[0], sizeof(double) * this->biases.size());
+    out.write((const char*)&this->kernels[0], sizeof(double) * this->kernels.size());
+}
+
+/**
+ * @brief      Read a layer written by write()
+ *
+ * @param      in    input stream
+ *
+ * @return     the layer
+ */
+ConvLayer ConvLayer::read(std::istream& in) {
+    uint32_t shape[6];
+    in.read((char*)shape, sizeof(shape));
+    if(!in) {
+        throw std::runtime_error("Invalid convolutional layer");
+    }
+
+    ConvLayer layer(shape[0], shape[1], shape[2], shape[3], shape[4], shape[5]);
+    in.read((char*)&layer.biases[0], sizeof(double) * layer.biases.size());
+    in.read((char*)&layer.kernels[0], sizeof(double) * layer.kernels.size());
+    if(!in) {
+        throw std::runtime_error("Invalid convolutional layer");
+    }
+
+    return layer;
+}
+
+/**
+ * @brief      Sets the filters.
+ *
+ * @param[in]  _kernels  filters x (channels * kernel * kernel) matrix
+ */
+void ConvLayer::set_kernels(const std::vector<double>& _kernels) {
+    if(_kernels.size() != this->kernels.size()) {
+        throw std::runtime_error("Number of filter weights does not match the layer");
+    }
+    this->kernels = _kernels;
+}
+
+/**
+ * @brief      Unroll the patches of an input into columns
+ *
+ * @param[in]  in    input image
+ * @param      cols  receives (channels * kernel * kernel) rows of
+ *                   conv_height * conv_width values
+ * @param[in]  ld    leading dimension of cols
+ */
+void ConvLayer::im2col(const double* in, double* cols, size_t ld) const {
+    // every row holds one filter tap for all output positions; its values
+    // are contiguous runs of the input rows
+    for(uint32_t c=0; c<this->channels; c++) {
+        for(uint32_t ky=0; ky<this->kernel; ky++) {
+            for(uint32_t kx=0; kx<this->kernel; kx++) {
+                double* row = cols + ((c * this->kernel + ky) * this->kernel + kx) * ld;
+                for(uint32_t oy=0; oy<this->conv_height; oy++) {
+                    const double* src = in + ((size_t)c * this->height + oy + ky) * this->width + kx;
+                    std::memcpy(row + oy * this->conv_width, src, sizeof(double) * this->conv_width);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief      Fold unrolled patches back into an image, summing
+ *             overlapping values
+ *
+ * @param[in]  cols  unrolled patches (leading dimension
+ *                   conv_height * conv_width)
+ * @param      in    image the patches are added to
+ */
+void ConvLayer::col2im(const double* cols, double* in) const {
+    const size_t ohw = (size_t)this->conv_height * this->conv_width;
+
+    for(uint32_t c=0; c<this->channels; c++) {
+        for(uint32_t ky=0; ky<this->kernel; ky++) {
+            for(uint32_t kx=0; kx<this->kernel; kx++) {
+                const double* row = cols + ((c * this->kernel + ky) * this->kernel + kx) * ohw;
+                for(uint32_t oy=0; oy<this->conv_height; oy++) {
+                    double* dst = in + ((size_t)c * this->height + oy + ky) * this->width + kx;
+                    const double* src = row + oy * this->conv_width;
+                    #pragma omp simd
+                    for(uint32_t ox=0; ox<this->conv_width; ox++) {
+                        dst[ox] += src[ox];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief      Max pooling of the activations of a single input
+ *
+ * @param[in]  act   activations, one row per filter
+ * @param[in]  ld    leading dimension of act
+ * @param      out   pooled output
+ * @param      idx   receives the position of every maximum (optional)
+ */
+void ConvLayer::max_pool(const double* act, size_t ld, double* out, uint32_t* idx) const {
+    const size_t npool = (size_t)this->out_height * this->out_width;
+
+    for(uint32_t f=0; f<this->filters; f++) {
+        const double* a = act + f * ld;
+        for(uint32_t py=0; py<this->out_height; py++) {
+            for(uint32_t px=0; px<this->out_width; px++) {
+                uint32_t best = (py * this->pool) * this->conv_width + px * this->pool;
+                for(uint32_t dy=0; dy<this->pool; dy++) {
+                    for(uint32_t dx=0; dx<this->pool; dx++) {
+                        const uint32_t p = (py * this->pool + dy) * this->conv_width + px * this->pool + dx;
+                        if(a[p] > a[best]) {
+                            best = p;
+                        }
+                    }
+                }
+
+                const size_t q = f * npool + py * this->out_width + px;
+                out[q] = a[best];
+                if(idx != nullptr) {
+                    idx[q] = best;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,304 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _CONV_LAYER_H
+#define _CONV_LAYER_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <stdexcept>
+#include <openblas/cblas.h>
+
+/**
+ * @brief      Convolutional layer with sigmoid activation, followed by
+ *             optional max pooling
+ *
+ * Images are stored channel by channel in row-major order. The convolution
+ * uses a stride of one and no padding. It is computed as a single matrix
+ * product: the input patches are unrolled into the columns of a matrix
+ * (im2col), which is multiplied by the filters stored as the rows of a
+ * filters x (channels * kernel * kernel) matrix. The backward pass uses the
+ * same unrolled matrix for the filter derivatives and folds the error of
+ * the patches back into an image (col2im).
+ */
+class ConvLayer {
+private:
+    uint32_t channels;                      //!< channels of the input
+    uint32_t height;                        //!< height of the input
+    uint32_t width;                         //!< width of the input
+    uint32_t filters;                       //!< number of filters (output channels)
+    uint32_t kernel;                        //!< size of the square filters
+    uint32_t pool;                          //!< size of the square pooling window (1: no pooling)
+    uint32_t conv_height;                   //!< height of the convolution
+    uint32_t conv_width;                    //!< width of the convolution
+    uint32_t out_height;                    //!< height of the output
+    uint32_t out_width;                     //!< width of the output
+
+    std::vector<double> kernels;            //!< filters x (channels * kernel * kernel)
+    std::vector<double> biases;             //!< bias per filter
+    std::vector<double> nabla_k;            //!< summed filter derivatives
+    std::vector<double> nabla_b;            //!< summed bias derivatives
+
+    // state of the last single-sample forward pass
+    std::vector<double> columns;            //!< unrolled input patches
+    std::vector<double> activations;        //!< activations of the convolution
+    std::vector<uint32_t> argmax;           //!< position of every pooled maximum
+    std::vector<double> output;             //!< pooled output
+    std::vector<double> dactivations;       //!< error of the activations
+    std::vector<double> dcolumns;           //!< error of the unrolled input patches
+
+public:
+    /**
+     * @brief      Constructs a convolutional layer with zero parameters
+     *
+     * @param[in]  _channels  channels of the input
+     * @param[in]  _height    height of the input
+     * @param[in]  _width     width of the input
+     * @param[in]  _filters   number of filters
+     * @param[in]  _kernel    size of the filters
+     * @param[in]  _pool      size of the pooling window (1: no pooling)
+     */
+    ConvLayer(uint32_t _channels, uint32_t _height, uint32_t _width, uint32_t _filters, uint32_t _kernel, uint32_t _pool);
+
+    /**
+     * @brief      Construct a stack of layers from a specification
+     *
+     * The specification lists the layers separated by commas as
+     * filters x kernel, optionally followed by / pooling, e.g. "8x5/2,16x3".
+     *
+     * @param[in]  spec      specification
+     * @param[in]  channels  channels of the input image
+     * @param[in]  height    height of the input image
+     * @param[in]  width     width of the input image
+     *
+     * @return     the layers
+     */
+    static std::vector<ConvLayer> parse(const std::string& spec, uint32_t channels, uint32_t height, uint32_t width);
+
+    /**
+     * @brief      Initialize the filters and biases randomly
+     *
+     * @param[in]  seed  random seed
+     */
+    void initialize(uint64_t seed);
+
+    /**
+     * @brief      Perform feed forward on a single input, keeping the state
+     *             for the backward pass
+     *
+     * @param[in]  in    input image
+     *
+     * @return     output (valid until the next forward pass)
+     */
+    const double* forward(const double* in);
+
+    /**
+     * @brief      Perform back propagation of the last forward pass, adding
+     *             to the summed derivatives
+     *
+     * @param[in]  dout  error of the output
+     * @param      din   receives the error of the input (skipped if nullptr)
+     */
+    void backward(const double* dout, double* din);
+
+    /**
+     * @brief      Perform feed forward on a batch of inputs without
+     *             modifying the layer
+     *
+     * @param[in]  in       n input images
+     * @param[in]  n        number of inputs
+     * @param      out      n outputs
+     * @param      scratch  scratch memory owned by the caller
+     */
+    void forward_batch(const double* in, size_t n, double* out, std::vector<double>& scratch) const;
+
+    /**
+     * @brief      Reset the summed derivatives
+     */
+    void clear_gradients();
+
+    /**
+     * @brief      Subtract the scaled summed derivatives from the parameters
+     *
+     * @param[in]  factor  scaling factor (learning rate over batch size)
+     */
+    void update(double factor);
+
+    /**
+     * @brief      Write shape and parameters
+     *
+     * @param      out   output stream
+     */
+    void write(std::ostream& out) const;
+
+    /**
+     * @brief      Read a layer written by write()
+     *
+     * @param      in    input stream
+     *
+     * @return     the layer
+     */
+    static ConvLayer read(std::istream& in);
+
+    /**
+     * @brief      Gets the number of input values.
+     *
+     * @return     channels x height x width of the input
+     */
+    inline size_t get_nr_inputs() const {
+        return (size_t)this->channels * this->height * this->width;
+    }
+
+    /**
+     * @brief      Gets the number of output values.
+     *
+     * @return     filters x height x width of the output
+     */
+    inline size_t get_nr_outputs() const {
+        return (size_t)this->filters * this->out_height * this->out_width;
+    }
+
+    /**
+     * @brief      Gets the number of filter weights and biases.
+     *
+     * @return     number of parameters
+     */
+    inline size_t get_nr_parameters() const {
+        return this->kernels.size() + this->biases.size();
+    }
+
+    /**
+     * @brief      Gets the filters.
+     *
+     * @return     filters x (channels * kernel * kernel) matrix
+     */
+    inline const std::vector<double>& get_kernels() const {
+        return this->kernels;
+    }
+
+    /**
+     * @brief      Sets the filters.
+     *
+     * @param[in]  _kernels  filters x (channels * kernel * kernel) matrix
+     */
+    void set_kernels(const std::vector<double>& _kernels);
+
+    /**
+     * @brief      Gets the biases.
+     *
+     * @return     The biases.
+     */
+    inline const std::vector<double>& get_biases() const {
+        return this->biases;
+    }
+
+    /**
+     * @brief      Gets the summed filter derivatives.
+     *
+     * @return     The filter derivatives.
+     */
+    inline const std::vector<double>& get_nabla_k() const {
+        return this->nabla_k;
+    }
+
+    /**
+     * @brief      Gets the summed bias derivatives.
+     *
+     * @return     The bias derivatives.
+     */
+    inline const std::vector<double>& get_nabla_b() const {
+        return this->nabla_b;
+    }
+
+    /**
+     * @brief      Gets the number of filters.
+     *
+     * @return     The number of filters.
+     */
+    inline uint32_t get_filters() const {
+        return this->filters;
+    }
+
+    /**
+     * @brief      Gets the height of the output.
+     *
+     * @return     The height.
+     */
+    inline uint32_t get_out_height() const {
+        return this->out_height;
+    }
+
+    /**
+     * @brief      Gets the width of the output.
+     *
+     * @return     The width.
+     */
+    inline uint32_t get_out_width() const {
+        return this->out_width;
+    }
+
+private:
+    /**
+     * @brief      Unroll the patches of an input into columns
+     *
+     * @param[in]  in    input image
+     * @param      cols  receives (channels * kernel * kernel) rows of
+     *                   conv_height * conv_width values
+     * @param[in]  ld    leading dimension of cols
+     */
+    void im2col(const double* in, double* cols, size_t ld) const;
+
+    /**
+     * @brief      Fold unrolled patches back into an image, summing
+     *             overlapping values
+     *
+     * @param[in]  cols  unrolled patches (leading dimension
+     *                   conv_height * conv_width)
+     * @param      in    image the patches are added to
+     */
+    void col2im(const double* cols, double* in) const;
+
+    /**
+     * @brief      Max pooling of the activations of a single input
+     *
+     * @param[in]  act   activations, one row per filter
+     * @param[in]  ld    leading dimension of act
+     * @param      out   pooled output
+     * @param      idx   receives the position of every maximum (optional)
+     */
+    void max_pool(const double* act, size_t ld, double* out, uint32_t* idx) const;
+};
+
+#endif // _CONV_LAYER_H
@@ -28,19 +28,39 @@
 
 #include "dataset.h"
 
-Dataset::Dataset(unsigned int _dataset_size, unsigned int _nr_input_nodes, unsigned int _nr_output_nodes) :
+Dataset::Dataset(size_t _dataset_size, unsigned int _nr_input_nodes, unsigned int _nr_output_nodes) :
 dataset_size(_dataset_size),
 nr_input_nodes(_nr_input_nodes),
 nr_output_nodes(_nr_output_nodes)
 {
-    this->x.resize(dataset_size, std::vector<double>(this->nr_input_nodes));
-    this->y.resize(dataset_size, std::vector<double>(this->nr_output_nodes));
+    // inputs and expected outputs share a single zero-initialized mapping
+    const size_t nx = this->dataset_size * this->nr_input_nodes;
+    const size_t ny = this->dataset_size * this->nr_output_nodes;
+    this->mapping = MemoryPlacement::get().allocate((nx + ny) * sizeof(double));
+    this->x = static_cast<double*>(this->mapping.get());
+    this->y = this->x + nx;
 }
 
-void Dataset::set_input_vector(unsigned int i, const std::vector<double>& vals) {
-    cblas_dcopy(vals.size(), &vals[0], 1, &this->x[i][0], 1);
+Dataset::Dataset(size_t _dataset_size, unsigned int _nr_input_nodes, unsigned int _nr_output_nodes,
+                 const std::shared_ptr<void>& _mapping, double* _x, double* _y) :
+mapping(_mapping),
+x(_x),
+y(_y),
+dataset_size(_dataset_size),
+nr_input_nodes(_nr_input_nodes),
+nr_output_nodes(_nr_output_nodes)
+{}
+
+std::shared_ptr<Dataset> Dataset::shard(const std::shared_ptr<Dataset>& dataset, unsigned int index, unsigned int count) {
+    const size_t size = dataset->size() / count;
+    return std::make_shared<Dataset>(size, dataset->nr_input_nodes, dataset->nr_output_nodes, dataset,
+                                     dataset->get_input_vector(index * size), dataset->get_output_vector(index * size));
+}
+
+void Dataset::set_input_vector(size_t i, const std::vector<double>& vals) {
+    cblas_dcopy(vals.size(), &vals[0], 1, this->get_input_vector(i), 1);
 }
 
-void Dataset::set_output_vector(unsigned int i, const std::vector<double>& vals) {
-    cblas_dcopy(vals.size(), &vals[0], 1, &this->y[i][0], 1);
+void Dataset::set_output_vector(size_t i, const std::vector<double>& vals) {
+    cblas_dcopy(vals.size(), &vals[0], 1, this->get_output_vector(i), 1);
 }
@@ -30,34 +30,99 @@
 #define _DATASET_H
 
 #include <vector>
+#include <memory>
 #include <openblas/cblas.h>
 
+#include "memory_placement.h"
+
+/**
+ * @brief      Set of input and expected output vectors
+ *
+ * The vectors are stored contiguously (row-major, one row per sample) such
+ * that the storage can either be owned by the dataset or be provided by an
+ * external memory region, e.g. a memory-mapped cache file. Owned storage is
+ * allocated according to the process-wide MemoryPlacement.
+ */
 class Dataset {
 private:
-    std::vector<std::vector<double>> x;     // input values
-    std::vector<std::vector<double>> y;     // expected output
+    std::shared_ptr<void> mapping;          // keeps the storage alive
+
+    double* x;                              // input values
+    double* y;                              // expected output
 
-    unsigned int dataset_size;
+    size_t dataset_size;
     unsigned int nr_input_nodes;
     unsigned int nr_output_nodes;
 
 public:
-    Dataset(unsigned int _dataset_size, unsigned int _nr_input_nodes, unsigned int _nr_output_nodes);
+    /**
+     * @brief      Constructs a dataset owning its storage
+     *
+     * @param[in]  _dataset_size     number of samples
+     * @param[in]  _nr_input_nodes   size of an input vector
+     * @param[in]  _nr_output_nodes  size of an output vector
+     */
+    Dataset(size_t _dataset_size, unsigned int _nr_input_nodes, unsigned int _nr_output_nodes);
+
+    /**
+     * @brief      Constructs a dataset on top of external storage
+     *
+     * @param[in]  _dataset_size     number of samples
+     * @param[in]  _nr_input_nodes   size of an input vector
+     * @param[in]  _nr_output_nodes  size of an output vector
+     * @param[in]  _mapping          handle keeping the storage alive
+     * @param      _x                pointer to input values
+     * @param      _y                pointer to expected output
+     */
+    Dataset(size_t _dataset_size, unsigned int _nr_input_nodes, unsigned int _nr_output_nodes,
+            const std::shared_ptr<void>& _mapping, double* _x, double* _y);
+
+    /**
+     * @brief      Get one of several equally sized, contiguous parts of a
+     *             dataset without copying; remaining samples are dropped
+     *
+     * @param[in]  dataset  the dataset
+     * @param[in]  index    index of the part
+     * @param[in]  count    number of parts
+     *
+     * @return     dataset sharing the storage of the original one
+     */
+    static std::shared_ptr<Dataset> shard(const std::shared_ptr<Dataset>& dataset, unsigned int index, unsigned int count);
 
-    inline unsigned int size() const {
+    Dataset(const Dataset&) = delete;
+
+    Dataset& operator=(const Dataset&) = delete;
+
+    inline size_t size() const {
         return this->dataset_size;
     }
 
-    void set_input_vector(unsigned int i, const std::vector<double>& vals);
+    inline unsigned int get_nr_input_nodes() const {
+        return this->nr_input_nodes;
+    }
+
+    inline unsigned int get_nr_output_nodes() const {
+        return this->nr_output_nodes;
+    }
+
+    void set_input_vector(size_t i, const std::vector<double>& vals);
+
+    void set_output_vector(size_t i, const std::vector<double>& vals);
 
-    void set_output_vector(unsigned int i, const std::vector<double>& vals);
+    inline const double* get_input_vector(size_t i) const {
+        return this->x + i * this->nr_input_nodes;
+    }
+
+    inline double* get_input_vector(size_t i) {
+        return this->x + i * this->nr_input_nodes;
+    }
 
-    inline const std::vector<double>& get_input_vector(unsigned int i) const {
-        return this->x[i];
+    inline const double* get_output_vector(size_t i) const {
+        return this->y + i * this->nr_output_nodes;
     }
 
-    inline const std::vector<double>& get_output_vector(unsigned int i) const {
-        return this->y[i];
+    inline double* get_output_vector(size_t i) {
+        return this->y + i * this->nr_output_nodes;
     }
 
 private:
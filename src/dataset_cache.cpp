@@ -0,0 +1,224 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "dataset_cache.h"
+
+static const char CACHE_MAGIC[8] = {'N', 'N', 'D', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t CACHE_VERSION = 1;
+
+/**
+ * @brief      Constructs the cache
+ *
+ * @param[in]  _directory  directory holding the cache files
+ */
+DatasetCache::DatasetCache(const std::string& _directory) :
+directory(_directory) {}
+
+/**
+ * @brief      Load a dataset from the cache
+ *
+ * @param[in]  name     name of the dataset
+ * @param[in]  sources  files the dataset was generated from
+ *
+ * @return     memory-mapped dataset or nullptr when no valid cache exists
+ */
+std::shared_ptr<Dataset> DatasetCache::load(const std::string& name, const std::vector<std::string>& sources) const {
+    NN_TRACE_SPAN("io", "load cache");
+
+    std::vector<SourceStamp> stamps;
+    if(!this->stamp_files(sources, &stamps)) {
+        return nullptr;
+    }
+
+    const std::string filename = this->get_cache_filename(name);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    const size_t filesize = st.st_size;
+
+    // pages are only copied when written to, such that untouched pages are
+    // shared with the page cache
+    void* addr = mmap(NULL, filesize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        return nullptr;
+    }
+    std::shared_ptr<void> mapping(addr, [filesize](void* p) {
+        munmap(p, filesize);
+    });
+
+    // validate header
+    const char* base = (const char*)addr;
+    CacheHeader header;
+    std::memcpy(&header, base, sizeof(CacheHeader));
+    if(std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+       header.version != CACHE_VERSION ||
+       header.nr_sources != stamps.size()) {
+        return nullptr;
+    }
+
+    const size_t offset = sizeof(CacheHeader) + stamps.size() * sizeof(SourceStamp);
+    const size_t nr_values = header.dataset_size * (header.nr_input_nodes + header.nr_output_nodes);
+    if(filesize != offset + nr_values * sizeof(double)) {
+        return nullptr;
+    }
+
+    // validate source files
+    for(unsigned int i=0; i<stamps.size(); i++) {
+        SourceStamp stamp;
+        std::memcpy(&stamp, base + sizeof(CacheHeader) + i * sizeof(SourceStamp), sizeof(SourceStamp));
+        if(stamp.filesize != stamps[i].filesize ||
+           stamp.mtime != stamps[i].mtime ||
+           stamp.hash != stamps[i].hash) {
+            return nullptr;
+        }
+    }
+
+    // start reading in the data ahead of the first mini-batch
+    madvise(addr, filesize, MADV_WILLNEED);
+
+    double* x = (double*)(base + offset);
+    double* y = x + header.dataset_size * header.nr_input_nodes;
+
+    return std::make_shared<Dataset>(header.dataset_size, header.nr_input_nodes, header.nr_output_nodes, mapping, x, y);
+}
+
+/**
+ * @brief      Store a dataset in the cache
+ *
+ * @param[in]  name     name of the dataset
+ * @param[in]  sources  files the dataset was generated from
+ * @param[in]  dataset  the dataset
+ */
+void DatasetCache::store(const std::string& name, const std::vector<std::string>& sources, const Dataset& dataset) const {
+    NN_TRACE_SPAN("io", "store cache");
+
+    std::vector<SourceStamp> stamps;
+    if(!this->stamp_files(sources, &stamps)) {
+        throw std::runtime_error("Cannot read source files for dataset cache " + name);
+    }
+
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.nr_sources = stamps.size();
+    header.dataset_size = dataset.size();
+    header.nr_input_nodes = dataset.get_nr_input_nodes();
+    header.nr_output_nodes = dataset.get_nr_output_nodes();
+
+    // write to a temporary file first such that concurrent runs never
+    // observe a partially written cache
+    const std::string filename = this->get_cache_filename(name);
+    const std::string tmpfilename = filename + ".tmp." + std::to_string(getpid());
+
+    std::ofstream out(tmpfilename, std::ios::out | std::ios::binary);
+    if(!out.is_open()) {
+        throw std::runtime_error("Cannot open " + tmpfilename + " for writing");
+    }
+
+    out.write((const char*)&header, sizeof(CacheHeader));
+    out.write((const char*)&stamps[0], stamps.size() * sizeof(SourceStamp));
+    if(dataset.size() > 0) {
+        out.write((const char*)dataset.get_input_vector(0), dataset.size() * dataset.get_nr_input_nodes() * sizeof(double));
+        out.write((const char*)dataset.get_output_vector(0), dataset.size() * dataset.get_nr_output_nodes() * sizeof(double));
+    }
+    out.close();
+
+    if(out.fail() || std::rename(tmpfilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpfilename.c_str());
+        throw std::runtime_error("Could not write dataset cache " + filename);
+    }
+}
+
+/**
+ * @brief      Get the path of the cache file of a dataset
+ *
+ * @param[in]  name  name of the dataset
+ *
+ * @return     path to cache file
+ */
+std::string DatasetCache::get_cache_filename(const std::string& name) const {
+    return this->directory + "/" + name + ".cache";
+}
+
+/**
+ * @brief      Construct fingerprints of source files
+ *
+ * @param[in]  sources  source files
+ * @param      stamps   fingerprints
+ *
+ * @return     whether all source files could be read
+ */
+bool DatasetCache::stamp_files(const std::vector<std::string>& sources, std::vector<SourceStamp>* stamps) const {
+    static const uint64_t fnv_offset = 14695981039346656037ULL;
+    static const uint64_t fnv_prime = 1099511628211ULL;
+
+    stamps->clear();
+    std::vector<char> buffer(1 << 16);
+
+    for(const auto& source : sources) {
+        struct stat st;
+        if(stat(source.c_str(), &st) != 0) {
+            return false;
+        }
+
+        SourceStamp stamp;
+        stamp.filesize = st.st_size;
+#ifdef _APPLE
+        stamp.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+        stamp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+
+        std::ifstream in(source, std::ios::in | std::ios::binary);
+        if(!in.is_open()) {
+            return false;
+        }
+
+        stamp.hash = fnv_offset;
+        while(in) {
+            in.read(&buffer[0], buffer.size());
+            const std::streamsize n = in.gcount();
+            for(std::streamsize i=0; i<n; i++) {
+                stamp.hash ^= (uint8_t)buffer[i];
+                stamp.hash *= fnv_prime;
+            }
+        }
+
+        stamps->push_back(stamp);
+    }
+
+    return true;
+}
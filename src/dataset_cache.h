@@ -0,0 +1,128 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _DATASET_CACHE_H
+#define _DATASET_CACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dataset.h"
+#include "trace.h"
+
+/**
+ * @brief      Persistent cache of decoded datasets
+ *
+ * A cache file holds a dataset in exactly the layout used by Dataset, such
+ * that it can be memory-mapped and used without any further conversion.
+ * Every cache file records the size, modification time and hash of the
+ * source files it was generated from; any mismatch invalidates the cache.
+ */
+class DatasetCache {
+private:
+    std::string directory;                  //!< directory holding the cache files
+
+    /**
+     * @brief      Fingerprint of a source file
+     */
+    struct SourceStamp {
+        uint64_t filesize;                  //!< size of the file in bytes
+        int64_t mtime;                      //!< modification time in ns
+        uint64_t hash;                      //!< FNV-1a hash of the contents
+    };
+
+    /**
+     * @brief      Header of a cache file
+     */
+    struct CacheHeader {
+        char magic[8];                      //!< file signature
+        uint32_t version;                   //!< file format version
+        uint32_t nr_sources;                //!< number of source stamps
+        uint64_t dataset_size;              //!< number of samples
+        uint32_t nr_input_nodes;            //!< size of an input vector
+        uint32_t nr_output_nodes;           //!< size of an output vector
+    };
+
+public:
+    /**
+     * @brief      Constructs the cache
+     *
+     * @param[in]  _directory  directory holding the cache files
+     */
+    DatasetCache(const std::string& _directory);
+
+    /**
+     * @brief      Load a dataset from the cache
+     *
+     * @param[in]  name     name of the dataset
+     * @param[in]  sources  files the dataset was generated from
+     *
+     * @return     memory-mapped dataset or nullptr when no valid cache exists
+     */
+    std::shared_ptr<Dataset> load(const std::string& name, const std::vector<std::string>& sources) const;
+
+    /**
+     * @brief      Store a dataset in the cache
+     *
+     * @param[in]  name     name of the dataset
+     * @param[in]  sources  files the dataset was generated from
+     * @param[in]  dataset  the dataset
+     */
+    void store(const std::string& name, const std::vector<std::string>& sources, const Dataset& dataset) const;
+
+private:
+    /**
+     * @brief      Get the path of the cache file of a dataset
+     *
+     * @param[in]  name  name of the dataset
+     *
+     * @return     path to cache file
+     */
+    std::string get_cache_filename(const std::string& name) const;
+
+    /**
+     * @brief      Construct fingerprints of source files
+     *
+     * @param[in]  sources  source files
+     * @param      stamps   fingerprints
+     *
+     * @return     whether all source files could be read
+     */
+    bool stamp_files(const std::vector<std::string>& sources, std::vector<SourceStamp>* stamps) const;
+};
+
+#endif // _DATASET_CACHE_H
@@ -0,0 +1,83 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _DATASET_STREAM_H
+#define _DATASET_STREAM_H
+
+#include <memory>
+
+#include "dataset.h"
+
+/**
+ * @brief      Source of training data that is delivered in windows
+ *
+ * A dataset stream hands out a sequence of resident windows (each being a
+ * regular Dataset) per epoch, such that the full set of samples never has
+ * to reside in memory at once.
+ */
+class DatasetStream {
+public:
+    virtual ~DatasetStream() {}
+
+    /**
+     * @brief      Start producing the windows of an epoch
+     *
+     * @param[in]  epoch  epoch index
+     */
+    virtual void start_epoch(unsigned int epoch) = 0;
+
+    /**
+     * @brief      Get the next window of the current epoch
+     *
+     * @return     window or nullptr when the epoch is exhausted
+     */
+    virtual std::shared_ptr<Dataset> next_window() = 0;
+
+    /**
+     * @brief      Gets the total number of samples per epoch.
+     *
+     * @return     The number of samples.
+     */
+    virtual size_t size() const = 0;
+
+    /**
+     * @brief      Gets the size of an input vector.
+     *
+     * @return     The number of input nodes.
+     */
+    virtual unsigned int get_nr_input_nodes() const = 0;
+
+    /**
+     * @brief      Gets the size of an output vector.
+     *
+     * @return     The number of output nodes.
+     */
+    virtual unsigned int get_nr_output_nodes() const = 0;
+};
+
+#endif // _DATASET_STREAM_H
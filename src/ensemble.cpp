@@ -0,0 +1,469 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "ensemble.h"
+
+/**
+ * @brief      sigmoid function
+ *
+ * @param[in]  z     input value
+ *
+ * @return     sigmoid value
+ */
+static inline double sigmoid(double z) {
+    return 1.0 / (1.0 + std::exp(-z));
+}
+
+/**
+ * @brief      Constructs an ensemble of new networks
+ *
+ * Member k is initialized like NeuralNetwork(sizes, seed + k).
+ *
+ * @param[in]  _sizes       vector holding layer sizes
+ * @param[in]  _nr_members  number of networks
+ * @param[in]  seed         seed of the first member and the shuffling
+ */
+Ensemble::Ensemble(const std::vector<uint32_t>& _sizes, unsigned int _nr_members, uint64_t seed) :
+sizes(_sizes),
+nr_members(0) {
+    if(_nr_members == 0) {
+        throw std::runtime_error("An ensemble needs at least one member");
+    }
+
+    this->rng.seed(seed);
+    for(unsigned int k=0; k<_nr_members; k++) {
+        this->add_member(NeuralNetwork(this->sizes, seed + k));
+    }
+    this->construct_derivative_vectors();
+}
+
+/**
+ * @brief      Constructs an ensemble from network files
+ *
+ * @param[in]  filenames  networks of identical topology
+ */
+Ensemble::Ensemble(const std::vector<std::string>& filenames) :
+nr_members(0) {
+    if(filenames.empty()) {
+        throw std::runtime_error("An ensemble needs at least one member");
+    }
+
+    for(const auto& filename : filenames) {
+        NeuralNetwork nn(filename);
+        if(!nn.get_conv_layers().empty()) {
+            throw std::runtime_error("Ensembles do not support convolutional layers: " + filename);
+        }
+        if(this->nr_members == 0) {
+            this->sizes = nn.get_sizes();
+        } else if(nn.get_sizes() != this->sizes) {
+            throw std::runtime_error("All members of an ensemble need the same layer sizes: " + filename);
+        }
+        this->add_member(nn);
+    }
+    this->construct_derivative_vectors();
+}
+
+/**
+ * @brief      Perform stochastic gradient descent on all members
+ *
+ * @param[in]  trainingset      training dataset
+ * @param[in]  testset          test dataset
+ * @param[in]  epochs           number of epochs
+ * @param[in]  mini_batch_size  batch size
+ * @param[in]  eta              learning rate
+ */
+void Ensemble::sgd(const std::shared_ptr<Dataset>& trainingset,
+                   const std::shared_ptr<Dataset>& testset,
+                   unsigned int epochs,
+                   unsigned int mini_batch_size,
+                   double eta) {
+
+    for(unsigned int j=0; j<epochs; j++) {
+        auto start = std::chrono::system_clock::now();
+
+        this->sgd_pass(trainingset, mini_batch_size, eta);
+
+        auto end = std::chrono::system_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+        std::vector<size_t> member_hits;
+        const size_t hits = this->evaluate(testset, &member_hits);
+        const auto range = std::minmax_element(member_hits.begin(), member_hits.end());
+
+        std::cout << (boost::format("%4i | %i / %i (members %i - %i) | %f sec.") % (j+1) % hits % testset->size()
+                      % *range.first % *range.second % elapsed.count()).str() << std::endl;
+    }
+}
+
+/**
+ * @brief      Perform a single shuffled pass over a dataset
+ *
+ * @param[in]  dataset          training dataset
+ * @param[in]  mini_batch_size  batch size
+ * @param[in]  eta              learning rate
+ */
+void Ensemble::sgd_pass(const std::shared_ptr<Dataset>& trainingset, unsigned int mini_batch_size, double eta) {
+    std::vector<size_t> batches(trainingset->size());
+    for(size_t i=0; i<trainingset->size(); i++) {
+        batches[i] = i;
+    }
+
+    std::shuffle(std::begin(batches), std::end(batches), this->rng);
+
+    for(size_t i=0; i<trainingset->size(); i+= mini_batch_size) {
+        const size_t batch_size = std::min((size_t)mini_batch_size, trainingset->size() - i);
+        this->update_mini_batch(trainingset, batches, i, batch_size, eta);
+    }
+}
+
+/**
+ * @brief      Perform feed forward on a batch of input vectors and
+ *             average the outputs of the members
+ *
+ * @param[in]  a     pointer to n input vectors (row-major)
+ * @param[in]  n     number of input vectors
+ * @param      out   pointer to n averaged output vectors (row-major)
+ * @param      ws    workspace owned by the caller
+ */
+void Ensemble::feed_forward_batch(const double* a, size_t n, double* out, InferenceWorkspace& ws) const {
+    if(n == 0) {
+        return;
+    }
+
+    this->forward(a, n, ws.activations);
+
+    const unsigned int nr_out = this->sizes.back();
+    const size_t stride = (size_t)this->nr_members * nr_out;
+    const double* res = &ws.activations[this->sizes.size() - 2][0];
+    const double factor = 1.0 / (double)this->nr_members;
+
+    for(size_t r=0; r<n; r++) {
+        double* o = out + r * nr_out;
+        std::fill(o, o + nr_out, 0.0);
+        for(unsigned int k=0; k<this->nr_members; k++) {
+            cblas_daxpy(nr_out, factor, res + r * stride + k * nr_out, 1, o, 1);
+        }
+    }
+}
+
+/**
+ * @brief      Perform feed forward using a workspace local to the
+ *             calling thread
+ *
+ * @param[in]  a     pointer to input vector
+ *
+ * @return     averaged output vector
+ */
+std::vector<double> Ensemble::predict(const double* a) const {
+    static thread_local InferenceWorkspace ws;
+    std::vector<double> out(this->sizes.back());
+    this->feed_forward_batch(a, 1, &out[0], ws);
+    return out;
+}
+
+/**
+ * @brief      evaluate performance of the ensemble
+ *
+ * @param[in]  testset      testset
+ * @param      member_hits  receives the successful recognitions per
+ *                          member (optional)
+ *
+ * @return     number of successful recognitions of the ensemble
+ */
+size_t Ensemble::evaluate(const std::shared_ptr<Dataset>& testset, std::vector<size_t>* member_hits) const {
+    static const size_t batch_size = 256;
+
+    NN_TRACE_SPAN("train", "evaluate ensemble");
+
+    const unsigned int nr_out = this->sizes.back();
+    const size_t stride = (size_t)this->nr_members * nr_out;
+    std::vector<double> out(batch_size * nr_out);
+    InferenceWorkspace ws;
+    size_t hits = 0;
+
+    if(member_hits != nullptr) {
+        member_hits->assign(this->nr_members, 0);
+    }
+
+    auto correct = [&testset, nr_out](size_t sample, const double* v) {
+        const unsigned int idx = std::distance(v, std::max_element(v, v + nr_out));
+        return testset->get_output_vector(sample)[idx] == 1;
+    };
+
+    for(size_t i=0; i<testset->size(); i+=batch_size) {
+        const size_t n = std::min(batch_size, testset->size() - i);
+        this->feed_forward_batch(testset->get_input_vector(i), n, &out[0], ws);
+
+        // the outputs of the individual members are still in the workspace
+        const double* res = &ws.activations[this->sizes.size() - 2][0];
+        for(size_t r=0; r<n; r++) {
+            if(correct(i + r, &out[r * nr_out])) {
+                hits++;
+            }
+            if(member_hits != nullptr) {
+                for(unsigned int k=0; k<this->nr_members; k++) {
+                    if(correct(i + r, res + r * stride + k * nr_out)) {
+                        (*member_hits)[k]++;
+                    }
+                }
+            }
+        }
+    }
+
+    return hits;
+}
+
+/**
+ * @brief      Copy a member into a separate network
+ *
+ * @param[in]  k     member index
+ *
+ * @return     the network
+ */
+std::unique_ptr<NeuralNetwork> Ensemble::get_member(unsigned int k) const {
+    if(k >= this->nr_members) {
+        throw std::runtime_error("Invalid ensemble member: " + std::to_string(k));
+    }
+
+    // biases and weights layer by layer, as expected by set_parameters
+    std::vector<double> params;
+    for(unsigned int i=1; i<this->sizes.size(); i++) {
+        const size_t nb = this->sizes[i];
+        const size_t nw = (size_t)this->sizes[i-1] * this->sizes[i];
+        params.insert(params.end(), this->biases[i-1].begin() + k * nb, this->biases[i-1].begin() + (k+1) * nb);
+        params.insert(params.end(), this->weights[i-1].begin() + k * nw, this->weights[i-1].begin() + (k+1) * nw);
+    }
+
+    auto nn = std::make_unique<NeuralNetwork>(this->sizes);
+    nn->set_parameters(params);
+    return nn;
+}
+
+/**
+ * @brief      File name of a member, derived from the file name of
+ *             the ensemble, e.g. "net.ann" becomes "net-0.ann"
+ *
+ * @param[in]  filename  file name of the ensemble
+ * @param[in]  k         member index
+ *
+ * @return     file name of the member
+ */
+std::string Ensemble::member_filename(const std::string& filename, unsigned int k) {
+    const size_t slash = filename.find_last_of('/');
+    const size_t dot = filename.find_last_of('.');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return filename + "-" + std::to_string(k);
+    }
+    return filename.substr(0, dot) + "-" + std::to_string(k) + filename.substr(dot);
+}
+
+/**
+ * @brief      Append the biases and weights of a network to the stacks
+ *
+ * @param[in]  nn    network
+ */
+void Ensemble::add_member(const NeuralNetwork& nn) {
+    this->biases.resize(this->sizes.size() - 1);
+    this->weights.resize(this->sizes.size() - 1);
+
+    // row-major matrices of the members are stacked by appending them
+    for(unsigned int i=0; i<this->biases.size(); i++) {
+        this->biases[i].insert(this->biases[i].end(), nn.get_biases()[i].begin(), nn.get_biases()[i].end());
+        this->weights[i].insert(this->weights[i].end(), nn.get_weights()[i].begin(), nn.get_weights()[i].end());
+    }
+
+    this->nr_members++;
+}
+
+/**
+ * @brief      Allocate the derivatives of the stacked parameters
+ */
+void Ensemble::construct_derivative_vectors() {
+    for(unsigned int i=0; i<this->biases.size(); i++) {
+        this->nabla_b.emplace_back(this->biases[i].size());
+        this->nabla_w.emplace_back(this->weights[i].size());
+    }
+}
+
+/**
+ * @brief      Perform feed forward of all members on a batch
+ *
+ * @param[in]  a     pointer to n input vectors (row-major)
+ * @param[in]  n     number of input vectors
+ * @param      acts  receives the stacked activations per layer
+ */
+void Ensemble::forward(const double* a, size_t n, std::vector<std::vector<double> >& acts) const {
+    NN_TRACE_SPAN("train", "ensemble forward");
+
+    const size_t nm = this->nr_members;
+    if(acts.size() < this->sizes.size() - 1) {
+        acts.resize(this->sizes.size() - 1);
+    }
+
+    for(unsigned int i=1; i<this->sizes.size(); i++) {
+        const size_t l = this->sizes[i-1];
+        const size_t m = this->sizes[i];
+        if(acts[i-1].size() < n * nm * m) {
+            acts[i-1].resize(n * nm * m);
+        }
+        double* cur = &acts[i-1][0];
+
+        // broadcast the stacked bias vector over the rows
+        for(size_t r=0; r<n; r++) {
+            cblas_dcopy(nm * m, &this->biases[i-1][0], 1, cur + r * nm * m, 1);
+        }
+
+        if(i == 1) {
+            // the input is shared: Z(n x Nm) = A(n x l) * W^T(l x Nm) + Z
+            cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                        n, nm * m, l,
+                        1.0, a, l,
+                        &this->weights[0][0], l,
+                        1.0, cur, nm * m);
+        } else {
+            // every member reads its own columns of the previous layer
+            const double* prev = &acts[i-2][0];
+            for(size_t k=0; k<nm; k++) {
+                cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                            n, m, l,
+                            1.0, prev + k * l, nm * l,
+                            &this->weights[i-1][k * m * l], l,
+                            1.0, cur + k * m, nm * m);
+            }
+        }
+
+        for(size_t j=0; j<n * nm * m; j++) {
+            cur[j] = sigmoid(cur[j]);
+        }
+    }
+}
+
+/**
+ * @brief      update all members based on mini batch
+ *
+ * @param[in]  trainingset  pointer to training set
+ * @param[in]  batches      pointer to mini batches
+ * @param[in]  start        starting index
+ * @param[in]  batch_size   batch size
+ * @param[in]  eta          learning rate
+ */
+void Ensemble::update_mini_batch(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size, double eta) {
+    NN_TRACE_SPAN("train", "ensemble mini batch");
+
+    const size_t n = batch_size;
+    const size_t nm = this->nr_members;
+    const unsigned int nin = this->sizes.front();
+    const unsigned int nout = this->sizes.back();
+    const size_t sz = *std::max_element(this->sizes.begin(), this->sizes.end());
+
+    // gather the samples of the mini batch into contiguous matrices
+    this->x.resize(n * nin);
+    this->y.resize(n * nout);
+    for(size_t r=0; r<n; r++) {
+        cblas_dcopy(nin, trainingset->get_input_vector(batches[start + r]), 1, &this->x[r * nin], 1);
+        cblas_dcopy(nout, trainingset->get_output_vector(batches[start + r]), 1, &this->y[r * nout], 1);
+    }
+
+    this->forward(&this->x[0], n, this->activations);
+
+    {
+        NN_TRACE_SPAN("train", "ensemble backward");
+
+        if(this->delta.size() < n * nm * sz) {
+            this->delta.resize(n * nm * sz);
+            this->tdelta.resize(n * nm * sz);
+        }
+
+        // cost derivative, using sigmoid'(z) = a (1 - a)
+        {
+            const double* a = &this->activations[this->sizes.size() - 2][0];
+            for(size_t r=0; r<n; r++) {
+                for(size_t k=0; k<nm; k++) {
+                    for(unsigned int j=0; j<nout; j++) {
+                        const size_t idx = (r * nm + k) * nout + j;
+                        this->delta[idx] = (a[idx] - this->y[r * nout + j]) * a[idx] * (1.0 - a[idx]);
+                    }
+                }
+            }
+        }
+
+        for(size_t i=this->sizes.size()-1; i>=1; i--) {
+            const size_t l = this->sizes[i-1];
+            const size_t m = this->sizes[i];
+            const double* d = &this->delta[0];
+
+            // bias derivatives are summed over the rows of the batch
+            std::fill(this->nabla_b[i-1].begin(), this->nabla_b[i-1].end(), 0.0);
+            for(size_t r=0; r<n; r++) {
+                cblas_daxpy(nm * m, 1.0, d + r * nm * m, 1, &this->nabla_b[i-1][0], 1);
+            }
+
+            if(i == 1) {
+                // shared input: nabla_W(Nm x l) = D^T(Nm x n) * X(n x l)
+                cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+                            nm * m, l, n,
+                            1.0, d, nm * m,
+                            &this->x[0], l,
+                            0.0, &this->nabla_w[0][0], l);
+                break;
+            }
+
+            const double* prev = &this->activations[i-2][0];
+            for(size_t k=0; k<nm; k++) {
+                // nabla_W(m x l) = D^T(m x n) * A(n x l)
+                cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+                            m, l, n,
+                            1.0, d + k * m, nm * m,
+                            prev + k * l, nm * l,
+                            0.0, &this->nabla_w[i-1][k * m * l], l);
+
+                // error of the previous layer: D'(n x l) = D(n x m) * W(m x l)
+                cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                            n, l, m,
+                            1.0, d + k * m, nm * m,
+                            &this->weights[i-1][k * m * l], l,
+                            0.0, &this->tdelta[k * l], nm * l);
+            }
+
+            for(size_t j=0; j<n * nm * l; j++) {
+                this->tdelta[j] *= prev[j] * (1.0 - prev[j]);
+            }
+            std::swap(this->delta, this->tdelta);
+        }
+    }
+
+    {
+        NN_TRACE_SPAN("train", "ensemble weight update");
+
+        const double factor = eta / (double)batch_size;
+        for(unsigned int i=0; i<this->biases.size(); i++) {
+            cblas_daxpy(this->biases[i].size(), -factor, &this->nabla_b[i][0], 1, &this->biases[i][0], 1);
+            cblas_daxpy(this->weights[i].size(), -factor, &this->nabla_w[i][0], 1, &this->weights[i][0], 1);
+        }
+    }
+}
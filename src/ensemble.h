@@ -0,0 +1,230 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _ENSEMBLE_H
+#define _ENSEMBLE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <openblas/cblas.h>
+#include <boost/format.hpp>
+
+#include "neural_network.h"
+#include "dataset.h"
+#include "trace.h"
+
+/**
+ * @brief      Networks of identical topology trained together on the same
+ *             mini batches
+ *
+ * The biases and weights of all members are stacked per layer: member k
+ * occupies rows [k * m, (k+1) * m) of the (N * m) x l weight matrix of a
+ * layer with l inputs and m outputs. The activations of a batch are stored
+ * as n x (N * m) matrices, member k occupying columns [k * m, (k+1) * m).
+ *
+ * Since all members see the same input batch, the first layer (which holds
+ * most of the weights) is a single GEMM over the stacked weights and the
+ * shared input is read only once. The other layers are strided GEMMs per
+ * member on the stacked activations. The output of the ensemble is the
+ * average of the outputs of its members.
+ */
+class Ensemble {
+private:
+    std::vector<uint32_t> sizes;                        //!< size of the layers (of every member)
+    unsigned int nr_members;                            //!< number of networks
+
+    std::vector<std::vector<double> > biases;           //!< stacked biases per layer
+    std::vector<std::vector<double> > weights;          //!< stacked weights per layer
+
+    std::vector<std::vector<double> > nabla_b;          //!< stacked bias derivatives
+    std::vector<std::vector<double> > nabla_w;          //!< stacked weight derivatives
+
+    std::vector<double> x;                              //!< inputs of the mini batch
+    std::vector<double> y;                              //!< expected outputs of the mini batch
+    std::vector<std::vector<double> > activations;      //!< stacked activations per layer
+    std::vector<double> delta;                          //!< stacked error of the current layer
+    std::vector<double> tdelta;                         //!< stacked error of the previous layer
+
+    std::default_random_engine rng;                     //!< generator for shuffling
+
+    friend class Benchmark;                             //!< measures the private training steps
+
+public:
+    /**
+     * @brief      Constructs an ensemble of new networks
+     *
+     * Member k is initialized like NeuralNetwork(sizes, seed + k).
+     *
+     * @param[in]  _sizes       vector holding layer sizes
+     * @param[in]  _nr_members  number of networks
+     * @param[in]  seed         seed of the first member and the shuffling
+     */
+    Ensemble(const std::vector<uint32_t>& _sizes, unsigned int _nr_members, uint64_t seed);
+
+    /**
+     * @brief      Constructs an ensemble from network files
+     *
+     * @param[in]  filenames  networks of identical topology
+     */
+    Ensemble(const std::vector<std::string>& filenames);
+
+    /**
+     * @brief      Perform stochastic gradient descent on all members
+     *
+     * @param[in]  trainingset      training dataset
+     * @param[in]  testset          test dataset
+     * @param[in]  epochs           number of epochs
+     * @param[in]  mini_batch_size  batch size
+     * @param[in]  eta              learning rate
+     */
+    void sgd(const std::shared_ptr<Dataset>& trainingset,
+             const std::shared_ptr<Dataset>& testset,
+             unsigned int epochs,
+             unsigned int mini_batch_size,
+             double eta);
+
+    /**
+     * @brief      Perform a single shuffled pass over a dataset
+     *
+     * @param[in]  dataset          training dataset
+     * @param[in]  mini_batch_size  batch size
+     * @param[in]  eta              learning rate
+     */
+    void sgd_pass(const std::shared_ptr<Dataset>& trainingset, unsigned int mini_batch_size, double eta);
+
+    /**
+     * @brief      Perform feed forward on a batch of input vectors and
+     *             average the outputs of the members
+     *
+     * @param[in]  a     pointer to n input vectors (row-major)
+     * @param[in]  n     number of input vectors
+     * @param      out   pointer to n averaged output vectors (row-major)
+     * @param      ws    workspace owned by the caller
+     */
+    void feed_forward_batch(const double* a, size_t n, double* out, InferenceWorkspace& ws) const;
+
+    /**
+     * @brief      Perform feed forward using a workspace local to the
+     *             calling thread
+     *
+     * @param[in]  a     pointer to input vector
+     *
+     * @return     averaged output vector
+     */
+    std::vector<double> predict(const double* a) const;
+
+    /**
+     * @brief      evaluate performance of the ensemble
+     *
+     * @param[in]  testset      testset
+     * @param      member_hits  receives the successful recognitions per
+     *                          member (optional)
+     *
+     * @return     number of successful recognitions of the ensemble
+     */
+    size_t evaluate(const std::shared_ptr<Dataset>& testset, std::vector<size_t>* member_hits = nullptr) const;
+
+    /**
+     * @brief      Copy a member into a separate network
+     *
+     * @param[in]  k     member index
+     *
+     * @return     the network
+     */
+    std::unique_ptr<NeuralNetwork> get_member(unsigned int k) const;
+
+    /**
+     * @brief      File name of a member, derived from the file name of
+     *             the ensemble, e.g. "net.ann" becomes "net-0.ann"
+     *
+     * @param[in]  filename  file name of the ensemble
+     * @param[in]  k         member index
+     *
+     * @return     file name of the member
+     */
+    static std::string member_filename(const std::string& filename, unsigned int k);
+
+    /**
+     * @brief      Gets the layer sizes.
+     *
+     * @return     The sizes.
+     */
+    inline const std::vector<uint32_t>& get_sizes() const {
+        return this->sizes;
+    }
+
+    /**
+     * @brief      Gets the number of members.
+     *
+     * @return     The number of members.
+     */
+    inline unsigned int get_nr_members() const {
+        return this->nr_members;
+    }
+
+private:
+    /**
+     * @brief      Append the biases and weights of a network to the stacks
+     *
+     * @param[in]  nn    network
+     */
+    void add_member(const NeuralNetwork& nn);
+
+    /**
+     * @brief      Allocate the derivatives of the stacked parameters
+     */
+    void construct_derivative_vectors();
+
+    /**
+     * @brief      Perform feed forward of all members on a batch
+     *
+     * @param[in]  a     pointer to n input vectors (row-major)
+     * @param[in]  n     number of input vectors
+     * @param      acts  receives the stacked activations per layer
+     */
+    void forward(const double* a, size_t n, std::vector<std::vector<double> >& acts) const;
+
+    /**
+     * @brief      update all members based on mini batch
+     *
+     * @param[in]  trainingset  pointer to training set
+     * @param[in]  batches      pointer to mini batches
+     * @param[in]  start        starting index
+     * @param[in]  batch_size   batch size
+     * @param[in]  eta          learning rate
+     */
+    void update_mini_batch(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size, double eta);
+};
+
+#endif // _ENSEMBLE_H
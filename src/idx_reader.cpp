@@ -0,0 +1,92 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "idx_reader.h"
+
+/**
+ * @brief      Open an IDX file and parse its header
+ *
+ * @param[in]  filename  path to .idx or .idx.gz file
+ */
+IDXReader::IDXReader(const std::string& filename) :
+file(filename, std::ios::in | std::ios::binary) {
+    if(!this->file.is_open()) {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+
+    // detect gzip compression by its magic bytes
+    const int b0 = this->file.get();
+    const int b1 = this->file.get();
+    this->file.clear();
+    this->file.seekg(0, std::ios_base::beg);
+    if(b0 == 0x1f && b1 == 0x8b) {
+        this->stream.push(boost::iostreams::gzip_decompressor(), chunk_size);
+    }
+    this->stream.push(this->file, chunk_size);
+
+    // magic number: two zero bytes, data type and number of dimensions
+    uint8_t magic[4];
+    this->read((char*)magic, 4);
+    if(magic[0] != 0 || magic[1] != 0 || magic[3] == 0) {
+        throw std::runtime_error("Invalid IDX header in " + filename);
+    }
+    this->data_type = magic[2];
+
+    this->dimensions.resize(magic[3]);
+    for(unsigned int i=0; i<this->dimensions.size(); i++) {
+        uint32_t val = 0;
+        this->read((char*)&val, 4);
+        this->dimensions[i] = __bswap_32(val);
+    }
+}
+
+/**
+ * @brief      Gets the number of values per item.
+ *
+ * @return     The item size.
+ */
+size_t IDXReader::get_item_size() const {
+    size_t size = 1;
+    for(unsigned int i=1; i<this->dimensions.size(); i++) {
+        size *= this->dimensions[i];
+    }
+    return size;
+}
+
+/**
+ * @brief      Read the next bytes of the payload
+ *
+ * @param      dest  destination buffer
+ * @param[in]  n     number of bytes to read
+ */
+void IDXReader::read(char* dest, size_t n) {
+    this->stream.read(dest, n);
+    if((size_t)this->stream.gcount() != n) {
+        throw std::runtime_error("Unexpected end of IDX file");
+    }
+}
@@ -0,0 +1,113 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _IDX_READER_H
+#define _IDX_READER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <byteswap.h>
+
+/**
+ * @brief      Streaming reader for (gzip-compressed) IDX files
+ *
+ * The header is parsed upon construction such that the caller can allocate
+ * the destination storage exactly before reading the payload. The payload
+ * is decompressed in fixed-size chunks while it is being read, such that the
+ * compressed or decompressed file is never held in memory as a whole.
+ */
+class IDXReader {
+private:
+    std::ifstream file;                             //!< underlying file
+    boost::iostreams::filtering_istream stream;     //!< (decompressing) stream
+
+    uint8_t data_type;                              //!< IDX data type code
+    std::vector<uint32_t> dimensions;               //!< size of each dimension
+
+    static const size_t chunk_size = 1 << 16;       //!< decompression chunk size
+
+public:
+    /**
+     * @brief      Open an IDX file and parse its header
+     *
+     * @param[in]  filename  path to .idx or .idx.gz file
+     */
+    IDXReader(const std::string& filename);
+
+    IDXReader(const IDXReader&) = delete;
+
+    IDXReader& operator=(const IDXReader&) = delete;
+
+    /**
+     * @brief      Gets the IDX data type code (0x08 for unsigned bytes).
+     *
+     * @return     The data type.
+     */
+    inline uint8_t get_data_type() const {
+        return this->data_type;
+    }
+
+    /**
+     * @brief      Gets the size of each dimension.
+     *
+     * @return     The dimensions.
+     */
+    inline const std::vector<uint32_t>& get_dimensions() const {
+        return this->dimensions;
+    }
+
+    /**
+     * @brief      Gets the number of items (the size of the first dimension).
+     *
+     * @return     The number of items.
+     */
+    inline size_t get_nr_items() const {
+        return this->dimensions.empty() ? 0 : this->dimensions[0];
+    }
+
+    /**
+     * @brief      Gets the number of values per item.
+     *
+     * @return     The item size.
+     */
+    size_t get_item_size() const;
+
+    /**
+     * @brief      Read the next bytes of the payload
+     *
+     * @param      dest  destination buffer
+     * @param[in]  n     number of bytes to read
+     */
+    void read(char* dest, size_t n);
+};
+
+#endif // _IDX_READER_H
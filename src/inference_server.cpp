@@ -0,0 +1,388 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "inference_server.h"
+
+/**
+ * @brief      Constructs the server and starts the batcher
+ *
+ * @param      _model           handle to network
+ * @param[in]  _max_batch_size  requests per batch
+ * @param[in]  _max_latency     batching deadline
+ */
+InferenceServer::InferenceServer(ModelHandle& _model, size_t _max_batch_size, std::chrono::microseconds _max_latency) :
+model(_model),
+max_batch_size(std::max((size_t)1, _max_batch_size)),
+max_latency(_max_latency),
+stop(false),
+preprocess(false),
+start_time(std::chrono::steady_clock::now()),
+nr_requests(0),
+nr_batches(0),
+latency_pos(0) {
+    if(this->model.get()->get_nr_inputs() != image_size) {
+        throw std::runtime_error("Network does not accept 28x28 images");
+    }
+
+    this->batcher = std::thread(&InferenceServer::run_batches, this);
+}
+
+InferenceServer::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+        this->cv.notify_all();
+    }
+    this->batcher.join();
+}
+
+/**
+ * @brief      Serve requests on standard input and output until end of input
+ */
+void InferenceServer::serve_stdio() {
+    this->serve_connection(STDIN_FILENO, STDOUT_FILENO);
+}
+
+/**
+ * @brief      Serve requests on a Unix domain socket (does not return)
+ *
+ * @param[in]  path  path of the socket
+ */
+void InferenceServer::serve_socket(const std::string& path) {
+    // a client closing its connection early must not terminate the server
+    signal(SIGPIPE, SIG_IGN);
+
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sfd < 0) {
+        throw std::runtime_error("Cannot create socket");
+    }
+
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        close(sfd);
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    unlink(path.c_str());
+    if(bind(sfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sfd, 64) != 0) {
+        close(sfd);
+        throw std::runtime_error("Cannot listen on socket " + path);
+    }
+
+    while(true) {
+        int cfd = accept(sfd, NULL, NULL);
+        if(cfd < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            close(sfd);
+            throw std::runtime_error("Cannot accept connections on socket " + path);
+        }
+
+        std::thread([this, cfd]() {
+            try {
+                this->serve_connection(cfd, cfd);
+            } catch(const std::exception& e) {
+                std::cerr << "Connection error: " << e.what() << std::endl;
+            }
+            close(cfd);
+        }).detach();
+    }
+}
+
+/**
+ * @brief      Gets the throughput and latency statistics.
+ *
+ * @return     The statistics.
+ */
+std::string InferenceServer::get_statistics() {
+    std::lock_guard<std::mutex> lock(this->stats_mtx);
+
+    std::vector<double> sorted(this->latencies);
+    std::sort(sorted.begin(), sorted.end());
+    const double p50 = sorted.empty() ? 0.0 : sorted[(sorted.size() - 1) * 50 / 100];
+    const double p99 = sorted.empty() ? 0.0 : sorted[(sorted.size() - 1) * 99 / 100];
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start_time).count();
+    const double throughput = elapsed > 0.0 ? this->nr_requests / elapsed : 0.0;
+    const double mean_batch = this->nr_batches > 0 ? (double)this->nr_requests / this->nr_batches : 0.0;
+
+    return (boost::format("requests %i batches %i mean_batch %.1f throughput %.1f/s p50 %.1fus p99 %.1fus")
+            % this->nr_requests % this->nr_batches % mean_batch % throughput % p50 % p99).str();
+}
+
+/**
+ * @brief      Serve the requests of a single connection
+ *
+ * @param[in]  in_fd   input descriptor
+ * @param[in]  out_fd  output descriptor
+ */
+void InferenceServer::serve_connection(int in_fd, int out_fd) {
+    Connection conn{in_fd, out_fd, ""};
+
+    // responses are written by a separate thread, such that the reader can
+    // keep queuing requests of this connection for the same batch
+    std::mutex qmtx;
+    std::condition_variable qcv;
+    std::deque<std::future<std::string>> responses;
+    bool done = false;
+
+    std::thread writer([&]() {
+        while(true) {
+            std::future<std::string> f;
+            {
+                std::unique_lock<std::mutex> lock(qmtx);
+                qcv.wait(lock, [&]() {
+                    return !responses.empty() || done;
+                });
+                if(responses.empty()) {
+                    return;
+                }
+                f = std::move(responses.front());
+                responses.pop_front();
+            }
+            write_all(out_fd, f.get() + "\n");
+        }
+    });
+
+    auto respond = [&](std::future<std::string>&& f) {
+        std::lock_guard<std::mutex> lock(qmtx);
+        responses.push_back(std::move(f));
+        qcv.notify_all();
+    };
+
+    auto immediate = [&](const std::string& line) {
+        std::promise<std::string> p;
+        p.set_value(line);
+        respond(p.get_future());
+    };
+
+    std::string line;
+    while(conn.read_line(&line)) {
+        const auto arrival = std::chrono::steady_clock::now();
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+
+        if(line.empty()) {
+            continue;
+        } else if(line == "quit") {
+            break;
+        } else if(line == "stats") {
+            immediate(this->get_statistics());
+        } else if(line == "raw" || line.compare(0, 4, "png ") == 0) {
+            auto request = std::make_shared<Request>();
+            request->arrival = arrival;
+            request->input.resize(image_size);
+
+            if(line == "raw") {
+                std::vector<uint8_t> raw(image_size);
+                if(!conn.read_bytes((char*)raw.data(), image_size)) {
+                    immediate("error incomplete raw image");
+                    break;
+                }
+                for(unsigned int i=0; i<image_size; i++) {
+                    request->input[i] = (double)raw[i] / 255.0;
+                }
+            } else {
+                try {
+                    BatchClassifier::load_input_vector(line.substr(4), &request->input[0], this->preprocess);
+                } catch(const std::exception& e) {
+                    immediate(std::string("error ") + e.what());
+                    continue;
+                }
+            }
+
+            respond(request->response.get_future());
+            this->submit(request);
+        } else {
+            immediate("error unknown command");
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(qmtx);
+        done = true;
+        qcv.notify_all();
+    }
+    writer.join();
+}
+
+/**
+ * @brief      Queue a request for evaluation
+ *
+ * @param[in]  request  the request
+ */
+void InferenceServer::submit(const std::shared_ptr<Request>& request) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->pending.push_back(request);
+    this->cv.notify_all();
+}
+
+/**
+ * @brief      Evaluate queued requests in batches (batcher thread)
+ */
+void InferenceServer::run_batches() {
+    const unsigned int nr_out = this->model.get()->get_sizes().back();
+    std::vector<double> inputs(this->max_batch_size * image_size);
+    std::vector<double> outputs(this->max_batch_size * nr_out);
+    InferenceWorkspace ws;
+
+    if(Trace::is_active()) {
+        Trace::get().set_thread_name("batcher");
+    }
+
+    while(true) {
+        std::vector<std::shared_ptr<Request>> batch;
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cv.wait(lock, [this]() {
+                return !this->pending.empty() || this->stop;
+            });
+            if(this->pending.empty()) {
+                return;
+            }
+
+            // wait for a full batch until the oldest request reaches its deadline
+            const auto deadline = this->pending.front()->arrival + this->max_latency;
+            this->cv.wait_until(lock, deadline, [this]() {
+                return this->pending.size() >= this->max_batch_size || this->stop;
+            });
+
+            const size_t n = std::min(this->max_batch_size, this->pending.size());
+            batch.assign(this->pending.begin(), this->pending.begin() + n);
+            this->pending.erase(this->pending.begin(), this->pending.begin() + n);
+        }
+
+        NN_TRACE_SPAN("serve", "evaluate batch");
+
+        for(size_t i=0; i<batch.size(); i++) {
+            std::copy(batch[i]->input.begin(), batch[i]->input.end(), &inputs[i * image_size]);
+        }
+
+        // the snapshot keeps the network alive even if it is replaced meanwhile
+        const auto nn = this->model.get();
+        nn->feed_forward_batch(&inputs[0], batch.size(), &outputs[0], ws);
+
+        // account for the batch before answering, such that the statistics
+        // include every answered request
+        const auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(this->stats_mtx);
+            this->nr_batches++;
+            this->nr_requests += batch.size();
+            for(const auto& request : batch) {
+                const double us = std::chrono::duration<double, std::micro>(now - request->arrival).count();
+                if(this->latencies.size() < latency_window) {
+                    this->latencies.push_back(us);
+                } else {
+                    this->latencies[this->latency_pos] = us;
+                    this->latency_pos = (this->latency_pos + 1) % latency_window;
+                }
+            }
+        }
+
+        for(size_t i=0; i<batch.size(); i++) {
+            const double* scores = &outputs[i * nr_out];
+            std::ostringstream line;
+            line << std::distance(scores, std::max_element(scores, scores + nr_out));
+            for(unsigned int j=0; j<nr_out; j++) {
+                line << " " << scores[j];
+            }
+            batch[i]->response.set_value(line.str());
+        }
+    }
+}
+
+/**
+ * @brief      Write a string to a file descriptor
+ *
+ * @param[in]  fd    file descriptor
+ * @param[in]  str   the string
+ *
+ * @return     whether all bytes were written
+ */
+bool InferenceServer::write_all(int fd, const std::string& str) {
+    size_t pos = 0;
+    while(pos < str.size()) {
+        const ssize_t n = write(fd, str.data() + pos, str.size() - pos);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        pos += n;
+    }
+    return true;
+}
+
+bool InferenceServer::Connection::fill() {
+    char chunk[4096];
+    while(true) {
+        const ssize_t n = read(this->in_fd, chunk, sizeof(chunk));
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        this->buffer.append(chunk, n);
+        return true;
+    }
+}
+
+bool InferenceServer::Connection::read_line(std::string* line) {
+    size_t pos;
+    while((pos = this->buffer.find('\n')) == std::string::npos) {
+        if(!this->fill()) {
+            // return a final line without newline
+            if(this->buffer.empty()) {
+                return false;
+            }
+            *line = this->buffer;
+            this->buffer.clear();
+            return true;
+        }
+    }
+    *line = this->buffer.substr(0, pos);
+    this->buffer.erase(0, pos + 1);
+    return true;
+}
+
+bool InferenceServer::Connection::read_bytes(char* dest, size_t n) {
+    while(this->buffer.size() < n) {
+        if(!this->fill()) {
+            return false;
+        }
+    }
+    std::memcpy(dest, this->buffer.data(), n);
+    this->buffer.erase(0, n);
+    return true;
+}
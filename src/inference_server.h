@@ -0,0 +1,194 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _INFERENCE_SERVER_H
+#define _INFERENCE_SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/format.hpp>
+
+#include "model_handle.h"
+#include "batch_classifier.h"
+
+/**
+ * @brief      Long-running classification server with micro-batching
+ *
+ * Requests are read from a line-based protocol, either on the standard
+ * input or on the connections of a Unix domain socket:
+ *
+ *   png <path>     classify a png file
+ *   raw            followed by the raw bytes of a 28 x 28 grayscale image
+ *   stats          report throughput and latency percentiles
+ *   quit           close the connection
+ *
+ * Every request is answered by a single line, in the order the requests
+ * were issued on the connection: "<class> <score0> ... <score9>" or
+ * "error <message>". Requests of all connections are grouped into batches
+ * that are evaluated as matrix-matrix products. A batch is evaluated as
+ * soon as it is full or its oldest request has waited for the maximum
+ * latency. Each batch is evaluated by the network that is current when
+ * the batch starts, such that the network can be replaced at any time.
+ */
+class InferenceServer {
+private:
+    /**
+     * @brief      Classification request
+     */
+    struct Request {
+        std::vector<double> input;                              //!< input vector
+        std::chrono::steady_clock::time_point arrival;          //!< time of arrival
+        std::promise<std::string> response;                     //!< response line
+    };
+
+    /**
+     * @brief      Buffered reader on a file descriptor
+     */
+    struct Connection {
+        int in_fd;                                              //!< input descriptor
+        int out_fd;                                             //!< output descriptor
+        std::string buffer;                                     //!< read buffer
+
+        bool read_line(std::string* line);
+        bool read_bytes(char* dest, size_t n);
+        bool fill();
+    };
+
+    ModelHandle& model;                                         //!< handle to network
+    size_t max_batch_size;                                      //!< requests per batch
+    std::chrono::microseconds max_latency;                      //!< batching deadline
+
+    std::thread batcher;                                        //!< evaluates batches
+    std::mutex mtx;                                             //!< guards the fields below
+    std::condition_variable cv;                                 //!< signals new requests
+    std::deque<std::shared_ptr<Request>> pending;               //!< queued requests
+    bool stop;                                                  //!< stop the batcher
+    bool preprocess;                                            //!< normalize all png images
+
+    std::mutex stats_mtx;                                       //!< guards the statistics
+    std::chrono::steady_clock::time_point start_time;           //!< start of the server
+    size_t nr_requests;                                         //!< evaluated requests
+    size_t nr_batches;                                          //!< evaluated batches
+    std::vector<double> latencies;                              //!< recent latencies in us
+    size_t latency_pos;                                         //!< ring buffer position
+
+    static const size_t latency_window = 10000;                 //!< latencies kept for percentiles
+    static const unsigned int image_size = 28 * 28;             //!< bytes of a raw image
+
+public:
+    /**
+     * @brief      Constructs the server and starts the batcher
+     *
+     * @param      _model           handle to network
+     * @param[in]  _max_batch_size  requests per batch
+     * @param[in]  _max_latency     batching deadline
+     */
+    InferenceServer(ModelHandle& _model, size_t _max_batch_size, std::chrono::microseconds _max_latency);
+
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    /**
+     * @brief      Serve requests on standard input and output until end of input
+     */
+    void serve_stdio();
+
+    /**
+     * @brief      Serve requests on a Unix domain socket (does not return)
+     *
+     * @param[in]  path  path of the socket
+     */
+    void serve_socket(const std::string& path);
+
+    /**
+     * @brief      Set whether all png images are normalized like the MNIST digits
+     *
+     * @param[in]  _preprocess  whether to normalize all png images
+     */
+    inline void set_preprocess(bool _preprocess) {
+        this->preprocess = _preprocess;
+    }
+
+    /**
+     * @brief      Gets the throughput and latency statistics.
+     *
+     * @return     The statistics.
+     */
+    std::string get_statistics();
+
+private:
+    /**
+     * @brief      Serve the requests of a single connection
+     *
+     * @param[in]  in_fd   input descriptor
+     * @param[in]  out_fd  output descriptor
+     */
+    void serve_connection(int in_fd, int out_fd);
+
+    /**
+     * @brief      Queue a request for evaluation
+     *
+     * @param[in]  request  the request
+     */
+    void submit(const std::shared_ptr<Request>& request);
+
+    /**
+     * @brief      Evaluate queued requests in batches (batcher thread)
+     */
+    void run_batches();
+
+    /**
+     * @brief      Write a string to a file descriptor
+     *
+     * @param[in]  fd    file descriptor
+     * @param[in]  str   the string
+     *
+     * @return     whether all bytes were written
+     */
+    static bool write_all(int fd, const std::string& str);
+};
+
+#endif // _INFERENCE_SERVER_H
@@ -0,0 +1,406 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "memory_placement.h"
+
+const size_t MemoryPlacement::huge_page_size;
+
+MemoryPlacement::MemoryPlacement() :
+first_touch(false),
+huge_pages(HugePages::NONE) {}
+
+/**
+ * @brief      Get the process-wide placement
+ *
+ * @return     the placement
+ */
+MemoryPlacement& MemoryPlacement::get() {
+    static MemoryPlacement placement;
+    return placement;
+}
+
+/**
+ * @brief      Parse a huge page mode
+ *
+ * @param[in]  mode  none, transparent or explicit
+ *
+ * @return     the huge pages
+ */
+MemoryPlacement::HugePages MemoryPlacement::parse_huge_pages(const std::string& mode) {
+    if(mode == "none") {
+        return HugePages::NONE;
+    } else if(mode == "transparent") {
+        return HugePages::TRANSPARENT;
+    } else if(mode == "explicit") {
+        return HugePages::EXPLICIT;
+    }
+    throw std::runtime_error("Unknown huge page mode: " + mode);
+}
+
+/**
+ * @brief      Allocate a zero-initialized array placed by the settings
+ *
+ * @param[in]  bytes  size of the array
+ *
+ * @return     the array, unmapped when released
+ */
+std::shared_ptr<void> MemoryPlacement::allocate(size_t bytes) const {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t length = std::max(bytes, (size_t)1);
+    void* ptr = MAP_FAILED;
+
+    // reserved huge pages may have run out, fall back to transparent ones
+    if(this->huge_pages == HugePages::EXPLICIT) {
+        const size_t huge_length = (length + huge_page_size - 1) / huge_page_size * huge_page_size;
+        ptr = mmap(nullptr, huge_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED) {
+            length = huge_length;
+        }
+    }
+
+    if(ptr == MAP_FAILED) {
+        length = (length + page - 1) / page * page;
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED) {
+            throw std::runtime_error((boost::format("Cannot allocate %i bytes") % bytes).str());
+        }
+        if(this->huge_pages != HugePages::NONE && length >= huge_page_size) {
+            madvise(ptr, length, MADV_HUGEPAGE);
+        }
+    }
+
+    // the pages are placed on the node of the thread writing them first
+    if(this->first_touch) {
+        char* p = static_cast<char*>(ptr);
+        const size_t nr_pages = length / page;
+        const unsigned int nt = TaskPool::get().get_nr_threads();
+        TaskPool::get().run(nt, [&](unsigned int t) {
+            for(size_t i=nr_pages*t/nt; i<nr_pages*(t+1)/nt; i++) {
+                p[i * page] = 0;
+            }
+        });
+    }
+
+    return std::shared_ptr<void>(ptr, [length](void* p) {
+        munmap(p, length);
+    });
+}
+
+/**
+ * @brief      Migrate the pages of an existing array to the layout of
+ *             a parallel first touch
+ *
+ * @param[in]  ptr    start of the array
+ * @param[in]  bytes  size of the array
+ */
+void MemoryPlacement::distribute(const void* ptr, size_t bytes) const {
+    if(!this->first_touch || bytes == 0 || get_nr_nodes() < 2) {
+        return;
+    }
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t)ptr / page * page;
+    const size_t nr_pages = ((uintptr_t)ptr + bytes - begin + page - 1) / page;
+
+    // every thread moves its block of pages to its own node
+    const unsigned int nt = TaskPool::get().get_nr_threads();
+    TaskPool::get().run(nt, [&](unsigned int t) {
+        const size_t lo = nr_pages * t / nt;
+        const size_t hi = nr_pages * (t + 1) / nt;
+        unsigned int cpu = 0, node = 0;
+        if(hi > lo && syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+            std::vector<void*> pages(hi - lo);
+            std::vector<int> nodes(hi - lo, node);
+            std::vector<int> status(hi - lo);
+            for(size_t i=lo; i<hi; i++) {
+                pages[i - lo] = (void*)(begin + i * page);
+            }
+            syscall(SYS_move_pages, 0, pages.size(), &pages[0], &nodes[0], &status[0], MPOL_MF_MOVE);
+        }
+    });
+}
+
+/**
+ * @brief      Pin the threads of the task pool to cores
+ *
+ * @param[in]  spec   compact, scatter or a list of cpus
+ * @param[in]  first  position in the ordering of the first thread
+ */
+void MemoryPlacement::pin_threads(const std::string& spec, unsigned int first) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        throw std::runtime_error("Cannot get the cpus of the process");
+    }
+
+    std::vector<int> order;
+    if(spec == "compact" || spec == "scatter") {
+        // allowed cpus grouped per node
+        std::vector<std::vector<int> > nodes;
+        std::vector<bool> seen(CPU_SETSIZE, false);
+        for(unsigned int n=0; n<get_nr_nodes(); n++) {
+            std::vector<int> node;
+            for(int cpu : get_node_cpus(n)) {
+                if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed) && !seen[cpu]) {
+                    node.push_back(cpu);
+                    seen[cpu] = true;
+                }
+            }
+            if(!node.empty()) {
+                nodes.push_back(node);
+            }
+        }
+        if(nodes.empty()) {
+            nodes.emplace_back();
+            for(int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+                if(CPU_ISSET(cpu, &allowed)) {
+                    nodes.back().push_back(cpu);
+                }
+            }
+        }
+
+        if(spec == "compact") {
+            for(const auto& node : nodes) {
+                order.insert(order.end(), node.begin(), node.end());
+            }
+        } else {
+            size_t longest = 0;
+            for(const auto& node : nodes) {
+                longest = std::max(longest, node.size());
+            }
+            for(size_t i=0; i<longest; i++) {
+                for(const auto& node : nodes) {
+                    if(i < node.size()) {
+                        order.push_back(node[i]);
+                    }
+                }
+            }
+        }
+    } else {
+        order = parse_list(spec);
+        for(int cpu : order) {
+            if(cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+                throw std::runtime_error((boost::format("Cpu %i is not available") % cpu).str());
+            }
+        }
+    }
+    if(order.empty()) {
+        throw std::runtime_error("No cpus to pin the threads to: " + spec);
+    }
+
+    std::vector<int> pinned(TaskPool::get().get_nr_threads());
+    for(unsigned int t=0; t<pinned.size(); t++) {
+        pinned[t] = order[(first + t) % order.size()];
+    }
+
+    // the calling thread is not pinned, such that threads started by it later on are not confined to its cpu
+    std::atomic<bool> failed(false);
+    TaskPool::get().run(pinned.size(), [&](unsigned int t) {
+        if(t == 0) {
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pinned[t], &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0) {
+            failed = true;
+        }
+    });
+    if(failed) {
+        throw std::runtime_error("Cannot pin the threads to their cpus");
+    }
+
+    this->cpus.assign(pinned.begin() + 1, pinned.end());
+}
+
+/**
+ * @brief      Get the number of NUMA nodes
+ *
+ * @return     number of nodes (1 when the topology is unknown)
+ */
+unsigned int MemoryPlacement::get_nr_nodes() {
+    std::ifstream in("/sys/devices/system/node/online");
+    std::string list;
+    if(!std::getline(in, list)) {
+        return 1;
+    }
+    const auto nodes = parse_list(list);
+    return nodes.empty() ? 1 : *std::max_element(nodes.begin(), nodes.end()) + 1;
+}
+
+/**
+ * @brief      Count the resident pages of an array per node
+ *
+ * @param[in]  ptr    start of the array
+ * @param[in]  bytes  size of the array
+ *
+ * @return     number of pages on every node
+ */
+std::vector<size_t> MemoryPlacement::get_node_pages(const void* ptr, size_t bytes) {
+    std::vector<size_t> counts(get_nr_nodes(), 0);
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t)ptr / page * page;
+    const size_t nr_pages = bytes == 0 ? 0 : ((uintptr_t)ptr + bytes - begin + page - 1) / page;
+
+    // without target nodes, move_pages reports the node of every page
+    static const size_t chunk = 4096;
+    std::vector<void*> pages(chunk);
+    std::vector<int> status(chunk);
+    for(size_t i=0; i<nr_pages; i+=chunk) {
+        const size_t n = std::min(chunk, nr_pages - i);
+        for(size_t j=0; j<n; j++) {
+            pages[j] = (void*)(begin + (i + j) * page);
+        }
+        if(syscall(SYS_move_pages, 0, n, &pages[0], nullptr, &status[0], 0) != 0) {
+            break;
+        }
+        for(size_t j=0; j<n; j++) {
+            if(status[j] >= 0 && (size_t)status[j] < counts.size()) {
+                counts[status[j]]++;
+            }
+        }
+    }
+
+    return counts;
+}
+
+/**
+ * @brief      Get the part of an array backed by huge pages
+ *
+ * @param[in]  ptr    start of the array
+ * @param[in]  bytes  size of the array
+ *
+ * @return     estimated bytes of the array in huge pages
+ */
+size_t MemoryPlacement::get_huge_page_bytes(const void* ptr, size_t bytes) {
+    std::ifstream in("/proc/self/smaps");
+    const uintptr_t begin = (uintptr_t)ptr;
+    const uintptr_t end = begin + bytes;
+
+    // adjacent mappings may have been merged, hence the huge pages of a
+    // mapping are attributed to the array by the size of their overlap
+    double total = 0.0;
+    double share = 0.0;
+    std::string line;
+    while(std::getline(in, line)) {
+        unsigned long lo = 0, hi = 0;
+        if(sscanf(line.c_str(), "%lx-%lx", &lo, &hi) == 2) {
+            const uintptr_t overlap = std::min<uintptr_t>(hi, end) > std::max<uintptr_t>(lo, begin) ?
+                                      std::min<uintptr_t>(hi, end) - std::max<uintptr_t>(lo, begin) : 0;
+            share = hi > lo ? (double)overlap / (double)(hi - lo) : 0.0;
+            continue;
+        }
+        if(share == 0.0) {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string key;
+        size_t kb = 0;
+        if(fields >> key >> kb) {
+            if(key == "AnonHugePages:" || key == "Private_Hugetlb:" || key == "Shared_Hugetlb:") {
+                total += share * (kb << 10);
+            }
+        }
+    }
+
+    return std::min((size_t)total, bytes);
+}
+
+/**
+ * @brief      Describe the placement of an array
+ *
+ * @param[in]  ptr    start of the array
+ * @param[in]  bytes  size of the array
+ *
+ * @return     share of the pages per node and the huge page usage
+ */
+std::string MemoryPlacement::describe(const void* ptr, size_t bytes) {
+    const auto counts = get_node_pages(ptr, bytes);
+    const size_t total = std::accumulate(counts.begin(), counts.end(), (size_t)0);
+
+    std::string result = "pages per node:";
+    if(total == 0) {
+        result += " unknown";
+    }
+    for(unsigned int n=0; n<counts.size() && total > 0; n++) {
+        result += (boost::format(" %i: %.1f%%") % n % (100.0 * counts[n] / total)).str();
+    }
+    result += (boost::format(", huge pages: %i of %i MiB") % (get_huge_page_bytes(ptr, bytes) >> 20) % (bytes >> 20)).str();
+
+    return result;
+}
+
+/**
+ * @brief      Parse a list of cpus or nodes as used by sysfs
+ *
+ * @param[in]  list  the list, e.g. 0-3,8
+ *
+ * @return     the numbers
+ */
+std::vector<int> MemoryPlacement::parse_list(const std::string& list) {
+    std::vector<int> result;
+    std::istringstream in(list);
+    std::string item;
+    while(std::getline(in, item, ',')) {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if(item.empty()) {
+            continue;
+        }
+
+        int lo = 0, hi = 0, n = 0;
+        if(sscanf(item.c_str(), "%d-%d%n", &lo, &hi, &n) == 2 && n == (int)item.size() && lo >= 0 && lo <= hi) {
+            for(int i=lo; i<=hi; i++) {
+                result.push_back(i);
+            }
+        } else if(sscanf(item.c_str(), "%d%n", &lo, &n) == 1 && n == (int)item.size() && lo >= 0) {
+            result.push_back(lo);
+        } else {
+            throw std::runtime_error("Invalid list: " + list);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief      Get the cpus of a node
+ *
+ * @param[in]  node  the node
+ *
+ * @return     cpus of the node
+ */
+std::vector<int> MemoryPlacement::get_node_cpus(int node) {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if(!std::getline(in, list)) {
+        return std::vector<int>();
+    }
+    return parse_list(list);
+}
@@ -0,0 +1,225 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _MEMORY_PLACEMENT_H
+#define _MEMORY_PLACEMENT_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <cctype>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <boost/format.hpp>
+
+#include "task_pool.h"
+
+/**
+ * @brief      Placement of large arrays and threads on NUMA systems
+ *
+ * Large arrays are mapped without touching their pages. With first touch
+ * enabled, the threads of the task pool write the pages of an array in
+ * contiguous blocks (the blocks of the parallel loops working on them), such
+ * that the kernel places every block on the node of the thread that will use
+ * it. Arrays that already exist (e.g. std::vector) are migrated to the same
+ * layout instead. Optionally, arrays are backed by transparent or explicit
+ * (hugetlbfs) huge pages, and the threads of the task pool are pinned to
+ * cores.
+ */
+class MemoryPlacement {
+public:
+    enum class HugePages {
+        NONE,
+        TRANSPARENT,        //!< ask for transparent huge pages (madvise)
+        EXPLICIT            //!< reserved huge pages (MAP_HUGETLB), transparent when none are left
+    };
+
+private:
+    bool first_touch;                   //!< whether new arrays are touched by the task pool
+    HugePages huge_pages;               //!< huge pages for new arrays
+    std::vector<int> cpus;              //!< cpu of every pinned worker
+
+    static const size_t huge_page_size = 2ul << 20;
+
+public:
+    /**
+     * @brief      Get the process-wide placement
+     *
+     * @return     the placement
+     */
+    static MemoryPlacement& get();
+
+    /**
+     * @brief      Touch new arrays with the threads of the task pool
+     *
+     * Only arrays allocated by the thread owning the pool are touched in
+     * parallel; arrays allocated by other threads (e.g. the windows of a
+     * streaming dataset) are placed by the allocating thread.
+     *
+     * @param[in]  _first_touch  whether to touch new arrays in parallel
+     */
+    inline void set_first_touch(bool _first_touch) {
+        this->first_touch = _first_touch;
+    }
+
+    /**
+     * @brief      Set the huge pages backing new arrays
+     *
+     * @param[in]  _huge_pages  the huge pages
+     */
+    inline void set_huge_pages(HugePages _huge_pages) {
+        this->huge_pages = _huge_pages;
+    }
+
+    /**
+     * @brief      Parse a huge page mode
+     *
+     * @param[in]  mode  none, transparent or explicit
+     *
+     * @return     the huge pages
+     */
+    static HugePages parse_huge_pages(const std::string& mode);
+
+    /**
+     * @brief      Allocate a zero-initialized array placed by the settings
+     *
+     * @param[in]  bytes  size of the array
+     *
+     * @return     the array, unmapped when released
+     */
+    std::shared_ptr<void> allocate(size_t bytes) const;
+
+    /**
+     * @brief      Migrate the pages of an existing array to the layout of
+     *             a parallel first touch
+     *
+     * Does nothing unless first touch is enabled on a system with several
+     * nodes; pages that cannot be moved (e.g. shared with other processes)
+     * stay where they are.
+     *
+     * @param[in]  ptr    start of the array
+     * @param[in]  bytes  size of the array
+     */
+    void distribute(const void* ptr, size_t bytes) const;
+
+    /**
+     * @brief      Pin the worker threads of the task pool to cores
+     *
+     * Worker t is pinned to cpu (first + t) of the ordering, such that
+     * several processes on the same host can use disjoint cores. The
+     * calling thread (thread 0 of the pool) keeps the cpus of the process,
+     * as every thread it starts later on (e.g. of a sweep, the augmentation,
+     * OpenMP or OpenBLAS) inherits its affinity. Has to be called by the
+     * thread owning the pool.
+     *
+     * @param[in]  spec   compact (fill a node first), scatter (alternate
+     *                    between nodes) or a list of cpus, e.g. 0-3,8
+     * @param[in]  first  position in the ordering of the first thread
+     */
+    void pin_threads(const std::string& spec, unsigned int first);
+
+    /**
+     * @brief      Get the cpus the worker threads were pinned to
+     *
+     * @return     cpu of the threads 1 to n-1 of the pool (empty when not pinned)
+     */
+    inline const std::vector<int>& get_pinned_cpus() const {
+        return this->cpus;
+    }
+
+    /**
+     * @brief      Get the number of NUMA nodes
+     *
+     * @return     number of nodes (1 when the topology is unknown)
+     */
+    static unsigned int get_nr_nodes();
+
+    /**
+     * @brief      Count the resident pages of an array per node
+     *
+     * @param[in]  ptr    start of the array
+     * @param[in]  bytes  size of the array
+     *
+     * @return     number of pages on every node
+     */
+    static std::vector<size_t> get_node_pages(const void* ptr, size_t bytes);
+
+    /**
+     * @brief      Get the part of an array backed by huge pages
+     *
+     * @param[in]  ptr    start of the array
+     * @param[in]  bytes  size of the array
+     *
+     * @return     estimated bytes of the array in huge pages
+     */
+    static size_t get_huge_page_bytes(const void* ptr, size_t bytes);
+
+    /**
+     * @brief      Describe the placement of an array
+     *
+     * @param[in]  ptr    start of the array
+     * @param[in]  bytes  size of the array
+     *
+     * @return     share of the pages per node and the huge page usage
+     */
+    static std::string describe(const void* ptr, size_t bytes);
+
+private:
+    MemoryPlacement();
+
+    /**
+     * @brief      Parse a list of cpus or nodes as used by sysfs
+     *
+     * @param[in]  list  the list, e.g. 0-3,8
+     *
+     * @return     the numbers
+     */
+    static std::vector<int> parse_list(const std::string& list);
+
+    /**
+     * @brief      Get the cpus of a node
+     *
+     * @param[in]  node  the node
+     *
+     * @return     cpus of the node
+     */
+    static std::vector<int> get_node_cpus(int node);
+};
+
+#endif // _MEMORY_PLACEMENT_H
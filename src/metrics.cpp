@@ -0,0 +1,357 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "metrics.h"
+
+#ifdef ENABLE_METRICS
+
+const char* Metrics::phase_names[Metrics::NR_PHASES] = {"forward", "backward", "accumulate", "update", "evaluate"};
+
+Metrics::Counter::Counter() {
+    this->reset();
+}
+
+void Metrics::Counter::reset() {
+    this->ns = 0;
+    this->calls = 0;
+    this->flops = 0;
+    this->bytes = 0;
+}
+
+Metrics::Metrics() :
+nr_layers(0),
+samples(0),
+epoch_start(std::chrono::steady_clock::now()),
+format(Format::JSON) {}
+
+/**
+ * @brief      Get the process-wide metrics
+ *
+ * @return     the metrics
+ */
+Metrics& Metrics::get() {
+    static Metrics metrics;
+    return metrics;
+}
+
+/**
+ * @brief      Set where the metrics are exported after every epoch
+ *
+ * @param[in]  _filename  export file (empty to disable)
+ * @param[in]  _format    export format
+ */
+void Metrics::set_output(const std::string& _filename, Format _format) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->filename = _filename;
+    this->format = _format;
+}
+
+/**
+ * @brief      Collect hardware performance counters per phase and thread
+ *
+ * Only the phases as a whole are counted, not the individual layers.
+ * When the counters cannot be opened, only wall-clock times are reported.
+ *
+ * @param[in]  fp_event  raw event code counting fp operations (0 for none)
+ */
+void Metrics::enable_perf(uint64_t fp_event) {
+    this->perf.reset(new PerfCounters(fp_event));
+    this->perf_owner = std::this_thread::get_id();
+}
+
+/**
+ * @brief      Reset all counters at the start of an epoch
+ *
+ * @param[in]  _nr_layers  number of weight layers of the network
+ */
+void Metrics::start_epoch(unsigned int _nr_layers) {
+    // (re)open the hardware counters for the threads of the task pool
+    if(this->counts_perf()) {
+        if(this->perf->open()) {
+            const size_t n = this->perf->get_nr_threads() * PerfCounters::NR_EVENTS;
+            for(unsigned int i=0; i<NR_PHASES; i++) {
+                this->perf_start[i].assign(n, 0);
+                this->perf_totals[i].assign(n, 0);
+            }
+            this->perf_end.assign(n, 0);
+        } else {
+            std::cerr << "Warning: hardware counters not available (" << this->perf->get_error()
+                      << "), falling back to wall-clock timing" << std::endl;
+            this->perf.reset();
+        }
+    }
+
+    if(_nr_layers != this->nr_layers) {
+        this->layers.reset(new Counter[_nr_layers * NR_PHASES]);
+        this->nr_layers = _nr_layers;
+    }
+
+    for(unsigned int i=0; i<NR_PHASES; i++) {
+        this->phases[i].reset();
+    }
+    for(unsigned int i=0; i<this->nr_layers * NR_PHASES; i++) {
+        this->layers[i].reset();
+    }
+    this->samples = 0;
+    this->epoch_start = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief      Export the counters of the epoch
+ *
+ * @param[in]  epoch  epoch index
+ */
+void Metrics::end_epoch(unsigned int epoch) {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - this->epoch_start;
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if(this->filename.empty()) {
+        return;
+    }
+
+    if(this->format == Format::JSON) {
+        std::ofstream out(this->filename, std::ios::app);
+        out << this->to_json(epoch, elapsed.count()) << std::endl;
+        if(!out) {
+            throw std::runtime_error("Could not write metrics to " + this->filename);
+        }
+    } else {
+        const std::string tmpfilename = this->filename + ".tmp";
+        std::ofstream out(tmpfilename);
+        out << this->to_prometheus(epoch, elapsed.count());
+        out.close();
+        if(out.fail() || std::rename(tmpfilename.c_str(), this->filename.c_str()) != 0) {
+            std::remove(tmpfilename.c_str());
+            throw std::runtime_error("Could not write metrics to " + this->filename);
+        }
+    }
+}
+
+/**
+ * @brief      Add a timed scope
+ *
+ * Work done in a layer counts towards both the layer and its phase, the time
+ * of a layer only towards the layer as the phase is timed separately.
+ *
+ * @param[in]  phase  phase
+ * @param[in]  layer  layer (-1 for the whole phase)
+ * @param[in]  ns     elapsed time
+ * @param[in]  flops  floating point operations
+ * @param[in]  bytes  bytes moved
+ */
+void Metrics::add(Phase phase, int layer, uint64_t ns, uint64_t flops, uint64_t bytes) {
+    Counter& p = this->phases[phase];
+    p.flops.fetch_add(flops, std::memory_order_relaxed);
+    p.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    if(layer < 0) {
+        p.ns.fetch_add(ns, std::memory_order_relaxed);
+        p.calls.fetch_add(1, std::memory_order_relaxed);
+
+        if(this->counts_perf()) {
+            this->perf->read(&this->perf_end[0]);
+            for(unsigned int i=0; i<this->perf_end.size(); i++) {
+                // scaled counts of multiplexed counters are not strictly monotonic
+                if(this->perf_end[i] > this->perf_start[phase][i]) {
+                    this->perf_totals[phase][i] += this->perf_end[i] - this->perf_start[phase][i];
+                }
+            }
+        }
+    } else if((unsigned int)layer < this->nr_layers) {
+        Counter& l = this->layers[layer * NR_PHASES + phase];
+        l.ns.fetch_add(ns, std::memory_order_relaxed);
+        l.calls.fetch_add(1, std::memory_order_relaxed);
+        l.flops.fetch_add(flops, std::memory_order_relaxed);
+        l.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief      Format the counters of the epoch as a JSON line
+ *
+ * @param[in]  epoch    epoch index
+ * @param[in]  elapsed  duration of the epoch in seconds
+ *
+ * @return     JSON line
+ */
+std::string Metrics::to_json(unsigned int epoch, double elapsed) const {
+    auto counter = [](const Counter& c) {
+        const double ns = std::max((double)c.ns, 1.0);
+        return (boost::format("{\"seconds\": %.6f, \"calls\": %i, \"gflops\": %.3f, \"gbytes_per_second\": %.3f}")
+                % (c.ns * 1e-9) % c.calls.load() % (c.flops / ns) % (c.bytes / ns)).str();
+    };
+
+    std::string json = (boost::format("{\"epoch\": %i, \"seconds\": %.6f, \"samples\": %i, \"samples_per_second\": %.1f, \"phases\": {")
+                         % (epoch + 1) % elapsed % this->samples.load() % (this->samples / elapsed)).str();
+    for(unsigned int i=0; i<NR_PHASES; i++) {
+        std::string phase = counter(this->phases[i]);
+        if(this->counts_perf()) {
+            phase.insert(phase.size() - 1, ", \"counters\": " + this->perf_to_json((Phase)i));
+        }
+        json += (i == 0 ? "\"" : ", \"") + std::string(phase_names[i]) + "\": " + phase;
+    }
+    json += "}, \"layers\": [";
+    for(unsigned int l=0; l<this->nr_layers; l++) {
+        json += (l == 0 ? "{" : ", {") + (boost::format("\"layer\": %i") % (l + 1)).str();
+        for(unsigned int i=0; i<NR_PHASES; i++) {
+            if(this->layers[l * NR_PHASES + i].calls > 0) {
+                json += ", \"" + std::string(phase_names[i]) + "\": " + counter(this->layers[l * NR_PHASES + i]);
+            }
+        }
+        json += "}";
+    }
+    json += "]}";
+
+    return json;
+}
+
+/**
+ * @brief      Format the counters of the epoch in the Prometheus text format
+ *
+ * @param[in]  epoch    epoch index
+ * @param[in]  elapsed  duration of the epoch in seconds
+ *
+ * @return     Prometheus text
+ */
+std::string Metrics::to_prometheus(unsigned int epoch, double elapsed) const {
+    std::string text;
+    auto metric = [&text](const std::string& name, const std::string& help) {
+        text += "# HELP nn_" + name + " " + help + "\n# TYPE nn_" + name + " gauge\n";
+    };
+    auto value = [&text](const std::string& name, const std::string& labels, double v) {
+        text += (boost::format("nn_%s%s %.9g\n") % name % (labels.empty() ? "" : "{" + labels + "}") % v).str();
+    };
+    auto labels = [](unsigned int phase, int layer) {
+        return (layer < 0 ? std::string() : (boost::format("layer=\"%i\",") % layer).str()) + "phase=\"" + phase_names[phase] + "\"";
+    };
+
+    metric("epoch", "Last completed epoch");
+    value("epoch", "", epoch + 1);
+    metric("samples_per_second", "Trained samples per second in the last epoch");
+    value("samples_per_second", "", this->samples / elapsed);
+
+    metric("phase_seconds", "Time spent per phase in the last epoch");
+    for(unsigned int i=0; i<NR_PHASES; i++) {
+        value("phase_seconds", labels(i, -1), this->phases[i].ns * 1e-9);
+    }
+    metric("phase_gflops", "GFLOP/s per phase in the last epoch");
+    for(unsigned int i=0; i<NR_PHASES; i++) {
+        value("phase_gflops", labels(i, -1), this->phases[i].flops / std::max((double)this->phases[i].ns, 1.0));
+    }
+    metric("phase_gbytes_per_second", "GB/s moved per phase in the last epoch");
+    for(unsigned int i=0; i<NR_PHASES; i++) {
+        value("phase_gbytes_per_second", labels(i, -1), this->phases[i].bytes / std::max((double)this->phases[i].ns, 1.0));
+    }
+
+    metric("layer_seconds", "Time spent per layer and phase in the last epoch");
+    for(unsigned int l=0; l<this->nr_layers; l++) {
+        for(unsigned int i=0; i<NR_PHASES; i++) {
+            if(this->layers[l * NR_PHASES + i].calls > 0) {
+                value("layer_seconds", labels(i, l + 1), this->layers[l * NR_PHASES + i].ns * 1e-9);
+            }
+        }
+    }
+    metric("layer_gflops", "GFLOP/s per layer and phase in the last epoch");
+    for(unsigned int l=0; l<this->nr_layers; l++) {
+        for(unsigned int i=0; i<NR_PHASES; i++) {
+            const Counter& c = this->layers[l * NR_PHASES + i];
+            if(c.calls > 0) {
+                value("layer_gflops", labels(i, l + 1), c.flops / std::max((double)c.ns, 1.0));
+            }
+        }
+    }
+
+    if(this->counts_perf()) {
+        metric("phase_events", "Hardware events per phase and thread in the last epoch");
+        for(unsigned int i=0; i<NR_PHASES; i++) {
+            for(unsigned int t=0; t<this->perf->get_nr_threads(); t++) {
+                for(unsigned int e=0; e<PerfCounters::NR_EVENTS; e++) {
+                    if(this->perf->is_available((PerfCounters::Event)e)) {
+                        value("phase_events", (boost::format("event=\"%s\",%s,thread=\"%i\"") % PerfCounters::event_names[e] % labels(i, -1) % t).str(),
+                              this->perf_totals[i][t * PerfCounters::NR_EVENTS + e]);
+                    }
+                }
+            }
+        }
+        metric("phase_ipc", "Instructions per cycle per phase in the last epoch");
+        for(unsigned int i=0; i<NR_PHASES; i++) {
+            uint64_t cycles = 0, instructions = 0;
+            for(unsigned int t=0; t<this->perf->get_nr_threads(); t++) {
+                cycles += this->perf_totals[i][t * PerfCounters::NR_EVENTS + PerfCounters::CYCLES];
+                instructions += this->perf_totals[i][t * PerfCounters::NR_EVENTS + PerfCounters::INSTRUCTIONS];
+            }
+            value("phase_ipc", labels(i, -1), instructions / std::max((double)cycles, 1.0));
+        }
+    }
+
+    return text;
+}
+
+/**
+ * @brief      Format the hardware counters of a phase as a JSON object
+ *
+ * The totals over all threads are followed by the counts of every thread.
+ *
+ * @param[in]  phase  phase
+ *
+ * @return     JSON object
+ */
+std::string Metrics::perf_to_json(Phase phase) const {
+    const unsigned int nr_threads = this->perf->get_nr_threads();
+    const std::vector<uint64_t>& totals = this->perf_totals[phase];
+
+    auto events = [this](const uint64_t* v) {
+        std::string json;
+        for(unsigned int e=0; e<PerfCounters::NR_EVENTS; e++) {
+            if(this->perf->is_available((PerfCounters::Event)e)) {
+                json += (json.empty() ? "\"" : ", \"") + std::string(PerfCounters::event_names[e]) + "\": " + std::to_string(v[e]);
+            }
+        }
+        if(this->perf->is_available(PerfCounters::INSTRUCTIONS)) {
+            json += (boost::format(", \"ipc\": %.3f") % (v[PerfCounters::INSTRUCTIONS] / std::max((double)v[PerfCounters::CYCLES], 1.0))).str();
+        }
+        return json;
+    };
+
+    uint64_t sum[PerfCounters::NR_EVENTS] = {0};
+    for(unsigned int t=0; t<nr_threads; t++) {
+        for(unsigned int e=0; e<PerfCounters::NR_EVENTS; e++) {
+            sum[e] += totals[t * PerfCounters::NR_EVENTS + e];
+        }
+    }
+
+    std::string json = "{" + events(sum) + ", \"threads\": [";
+    for(unsigned int t=0; t<nr_threads; t++) {
+        json += (t == 0 ? "{" : ", {") + events(&totals[t * PerfCounters::NR_EVENTS]) + "}";
+    }
+    json += "]}";
+
+    return json;
+}
+
+#endif // ENABLE_METRICS
@@ -0,0 +1,276 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/*
+ * Scoped timers and counters for the phases of the training loop. The
+ * instrumentation is only compiled when ENABLE_METRICS is defined (cmake
+ * -DENABLE_METRICS=ON); otherwise all macros below expand to nothing.
+ */
+
+#ifdef ENABLE_METRICS
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <iostream>
+#include <boost/format.hpp>
+
+#include "perf_counters.h"
+
+#define NN_METRICS_CONCAT_(a, b) a##b
+#define NN_METRICS_CONCAT(a, b) NN_METRICS_CONCAT_(a, b)
+
+// time the enclosing scope as (a layer of) a phase and add the work done in it
+#define NN_METRICS_SCOPE(phase, layer, flops, bytes) \
+    Metrics::Scope NN_METRICS_CONCAT(_metrics_scope_, __LINE__)(Metrics::phase, layer, flops, bytes)
+#define NN_METRICS_SAMPLES(n) Metrics::get().add_samples(n)
+#define NN_METRICS_EPOCH_START(nr_layers) Metrics::get().start_epoch(nr_layers)
+#define NN_METRICS_EPOCH_END(epoch) Metrics::get().end_epoch(epoch)
+
+class Metrics {
+public:
+    enum Phase {
+        FORWARD,
+        BACKWARD,
+        ACCUMULATE,
+        UPDATE,
+        EVALUATE,
+        NR_PHASES
+    };
+
+    enum class Format {
+        JSON,
+        PROMETHEUS
+    };
+
+    /**
+     * @brief      Times a scope and adds the result on destruction
+     */
+    class Scope {
+    private:
+        Phase phase;                                        //!< phase being timed
+        int layer;                                          //!< layer being timed (-1 for the whole phase)
+        uint64_t flops;                                     //!< floating point operations in the scope
+        uint64_t bytes;                                     //!< bytes moved in the scope
+        std::chrono::steady_clock::time_point start;        //!< start of the scope
+
+    public:
+        inline Scope(Phase _phase, int _layer, uint64_t _flops, uint64_t _bytes) :
+        phase(_phase),
+        layer(_layer),
+        flops(_flops),
+        bytes(_bytes),
+        start(std::chrono::steady_clock::now()) {
+            if(_layer < 0) {
+                Metrics::get().begin(_phase);
+            }
+        }
+
+        inline ~Scope() {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count();
+            Metrics::get().add(this->phase, this->layer, ns, this->flops, this->bytes);
+        }
+
+        Scope(const Scope&) = delete;
+
+        Scope& operator=(const Scope&) = delete;
+    };
+
+private:
+    /**
+     * @brief      Accumulated counters of a phase or a layer
+     */
+    struct Counter {
+        std::atomic<uint64_t> ns;           //!< elapsed time
+        std::atomic<uint64_t> calls;        //!< number of timed scopes
+        std::atomic<uint64_t> flops;        //!< floating point operations
+        std::atomic<uint64_t> bytes;        //!< bytes moved
+
+        Counter();
+
+        void reset();
+    };
+
+    Counter phases[NR_PHASES];                              //!< counters per phase
+    std::unique_ptr<Counter[]> layers;                      //!< counters per layer and phase
+    unsigned int nr_layers;                                 //!< number of weight layers
+    std::atomic<uint64_t> samples;                          //!< trained samples
+    std::chrono::steady_clock::time_point epoch_start;      //!< start of the current epoch
+
+    std::unique_ptr<PerfCounters> perf;                     //!< hardware counters (null for wall-clock only)
+    std::thread::id perf_owner;                             //!< only thread whose phases are counted
+    std::vector<uint64_t> perf_start[NR_PHASES];            //!< counts at the start of a phase
+    std::vector<uint64_t> perf_end;                         //!< counts at the end of a phase
+    std::vector<uint64_t> perf_totals[NR_PHASES];           //!< counts per phase, thread and event
+
+    std::mutex mtx;                                         //!< guards the output settings
+    std::string filename;                                   //!< export file (empty to disable)
+    Format format;                                          //!< export format
+
+    static const char* phase_names[NR_PHASES];              //!< names of the phases
+
+public:
+    /**
+     * @brief      Get the process-wide metrics
+     *
+     * @return     the metrics
+     */
+    static Metrics& get();
+
+    /**
+     * @brief      Set where the metrics are exported after every epoch
+     *
+     * JSON lines are appended to the file; a Prometheus text file is
+     * replaced atomically such that a collector never reads a partial file.
+     *
+     * @param[in]  _filename  export file (empty to disable)
+     * @param[in]  _format    export format
+     */
+    void set_output(const std::string& _filename, Format _format);
+
+    /**
+     * @brief      Collect hardware performance counters per phase and thread
+     *
+     * Only the phases as a whole are counted, not the individual layers,
+     * and only those of the calling thread (the owner of the task pool):
+     * networks trained concurrently by other threads, e.g. of a sweep,
+     * would otherwise mix their counts. When the counters cannot be opened,
+     * only wall-clock times are reported.
+     *
+     * @param[in]  fp_event  raw event code counting fp operations (0 for none)
+     */
+    void enable_perf(uint64_t fp_event);
+
+    /**
+     * @brief      Reset all counters at the start of an epoch
+     *
+     * @param[in]  _nr_layers  number of weight layers of the network
+     */
+    void start_epoch(unsigned int _nr_layers);
+
+    /**
+     * @brief      Export the counters of the epoch
+     *
+     * @param[in]  epoch  epoch index
+     */
+    void end_epoch(unsigned int epoch);
+
+    /**
+     * @brief      Add a timed scope
+     *
+     * @param[in]  phase  phase
+     * @param[in]  layer  layer (-1 for the whole phase)
+     * @param[in]  ns     elapsed time
+     * @param[in]  flops  floating point operations
+     * @param[in]  bytes  bytes moved
+     */
+    void add(Phase phase, int layer, uint64_t ns, uint64_t flops, uint64_t bytes);
+
+    /**
+     * @brief      Read the hardware counters at the start of a phase
+     *
+     * @param[in]  phase  phase
+     */
+    inline void begin(Phase phase) {
+        if(this->counts_perf()) {
+            this->perf->read(&this->perf_start[phase][0]);
+        }
+    }
+
+    /**
+     * @brief      Add trained samples
+     *
+     * @param[in]  n     number of samples
+     */
+    inline void add_samples(uint64_t n) {
+        this->samples.fetch_add(n, std::memory_order_relaxed);
+    }
+
+private:
+    Metrics();
+
+    /**
+     * @brief      Whether the hardware counters are attributed to the phases
+     *             of the calling thread
+     *
+     * @return     true for the thread that enabled the counters
+     */
+    inline bool counts_perf() const {
+        return this->perf && std::this_thread::get_id() == this->perf_owner;
+    }
+
+    /**
+     * @brief      Format the counters of the epoch as a JSON line
+     *
+     * @param[in]  epoch    epoch index
+     * @param[in]  elapsed  duration of the epoch in seconds
+     *
+     * @return     JSON line
+     */
+    std::string to_json(unsigned int epoch, double elapsed) const;
+
+    /**
+     * @brief      Format the counters of the epoch in the Prometheus text format
+     *
+     * @param[in]  epoch    epoch index
+     * @param[in]  elapsed  duration of the epoch in seconds
+     *
+     * @return     Prometheus text
+     */
+    std::string to_prometheus(unsigned int epoch, double elapsed) const;
+
+    /**
+     * @brief      Format the hardware counters of a phase as a JSON object
+     *
+     * @param[in]  phase  phase
+     *
+     * @return     JSON object
+     */
+    std::string perf_to_json(Phase phase) const;
+};
+
+#else // ENABLE_METRICS
+
+#define NN_METRICS_SCOPE(phase, layer, flops, bytes)
+#define NN_METRICS_SAMPLES(n)
+#define NN_METRICS_EPOCH_START(nr_layers)
+#define NN_METRICS_EPOCH_END(epoch)
+
+#endif // ENABLE_METRICS
+
+#endif // _METRICS_H
@@ -28,72 +28,60 @@
 
 #include "mnist_loader.h"
 
-MNISTLoader::MNISTLoader() {
+const unsigned int MNISTLoader::nr_classes;
+const size_t MNISTLoader::chunk_images;
+
+MNISTLoader::MNISTLoader() :
+trainingset_size(0),
+testset_size(0),
+nr_threads(omp_get_num_procs()) {
 
 }
 
-void MNISTLoader::load_trainingset(const std::string& datafile, const std::string& labelfile) {
-    this->load_file_from_gz(datafile, &this->trainingset);
-    this->load_file_from_gz(labelfile, &this->traininglabels);
-
-    uint32_t val = 0;
-    std::memcpy(&val, &this->traininglabels[0], 4);
-    uint32_t checksum = __bswap_32(val);
-    if(checksum != 2049) {
-        throw std::runtime_error("Invalid MNIST training labels loaded");
+void MNISTLoader::load(const std::string& training_datafile, const std::string& training_labelfile,
+                       const std::string& test_datafile, const std::string& test_labelfile) {
+    if(this->nr_threads < 2) {
+        this->load_trainingset(training_datafile, training_labelfile);
+        this->load_testset(test_datafile, test_labelfile);
+        return;
     }
 
-    std::memcpy(&val, &this->trainingset[0], 4);
-    checksum = __bswap_32(val);
-    if(checksum != 2051) {
-        throw std::runtime_error("Invalid MNIST training images loaded");
-    }
+    IDXReader training_labels(training_labelfile);
+    IDXReader training_images(training_datafile);
+    IDXReader test_labels(test_labelfile);
+    IDXReader test_images(test_datafile);
 
-    std::memcpy(&val, &this->traininglabels[4], 4);
-    val = __bswap_32(val);
-    this->trainingset_size = val;
-}
+    // decompression of a single stream is serial, hence decode both sets side by side,
+    // splitting the threads by the numbers of images given in the headers
+    const size_t training_items = training_images.get_nr_items();
+    const size_t test_items = test_images.get_nr_items();
+    const size_t total_items = std::max((size_t)1, training_items + test_items);
+    const unsigned int test_threads = std::min(this->nr_threads - 1,
+        std::max(1u, (unsigned int)std::lround((double)this->nr_threads * (double)test_items / (double)total_items)));
 
-void MNISTLoader::load_testset(const std::string& datafile, const std::string& labelfile) {
-    this->load_file_from_gz(datafile, &this->testset);
-    this->load_file_from_gz(labelfile, &this->testlabels);
-
-    uint32_t val = 0;
-    std::memcpy(&val, &this->testlabels[0], 4);
-    uint32_t checksum = __bswap_32(val);
-    if(checksum != 2049) {
-        throw std::runtime_error("Invalid MNIST test labels loaded");
-    }
+    auto future_testset = std::async(std::launch::async, [&]() {
+        return this->load_dataset(test_images, test_labels, "test", test_threads);
+    });
 
-    std::memcpy(&val, &this->testset[0], 4);
-    checksum = __bswap_32(val);
-    if(checksum != 2051) {
-        throw std::runtime_error("Invalid MNIST test images loaded");
-    }
+    this->trainingset = this->load_dataset(training_images, training_labels, "training", this->nr_threads - test_threads);
+    this->trainingset_size = this->trainingset->size();
 
-    std::memcpy(&val, &this->testlabels[4], 4);
-    val = __bswap_32(val);
-    this->testset_size = val;
+    this->testset = future_testset.get();
+    this->testset_size = this->testset->size();
 }
 
-void MNISTLoader::load_file_from_gz(const std::string& filename, std::vector<char>* rep) {
-    // load file
-    std::vector<char> raw;
-    std::ifstream file(filename);
-    if (!file.eof() && !file.fail()) {
-        file.seekg(0, std::ios_base::end);
-        std::streampos filesize = file.tellg();
-        raw.resize(filesize);
-
-        file.seekg(0, std::ios_base::beg);
-        file.read(&raw[0], filesize);
-    }
+void MNISTLoader::load_trainingset(const std::string& datafile, const std::string& labelfile) {
+    IDXReader labels(labelfile);
+    IDXReader images(datafile);
+    this->trainingset = this->load_dataset(images, labels, "training", this->nr_threads);
+    this->trainingset_size = this->trainingset->size();
+}
 
-    // decompress in memory
-    boost::iostreams::filtering_ostream os;
-    os.push(boost::iostreams::gzip_decompressor());
-    os.push(boost::iostreams::back_inserter(*rep));
-    boost::iostreams::write(os, &raw[0], raw.size());
+void MNISTLoader::load_testset(const std::string& datafile, const std::string& labelfile) {
+    IDXReader labels(labelfile);
+    IDXReader images(datafile);
+    this->testset = this->load_dataset(images, labels, "test", this->nr_threads);
+    this->testset_size = this->testset->size();
 }
 
 void MNISTLoader::write_img_to_png(unsigned int imgid, const std::string& filename) {
@@ -101,46 +89,79 @@ void MNISTLoader::write_img_to_png(unsigned int imgid, const std::string& filena
 
     std::vector<uint8_t> data(imgsz * imgsz, 0);
 
+    const double* img = this->trainingset->get_input_vector(imgid);
     for(unsigned int i=0; i<(imgsz * imgsz); i++) {
-        data[i] = 255 - (uint8_t)this->trainingset[imgid * 784 + 16 + i];
+        data[i] = 255 - (uint8_t)std::lround(img[i] * 255.0);
     }
 
     PNG::write_image_buffer_to_png(filename, data, imgsz, imgsz, PNG_COLOR_TYPE_GRAY);
 }
 
 std::shared_ptr<Dataset> MNISTLoader::get_trainingset() const {
-    auto dataset = std::make_shared<Dataset>(this->trainingset_size, 784, 10);
+    return this->trainingset;
+}
 
-    for(unsigned int i=0; i<this->trainingset_size; i++) {
-        std::vector<double> in(784);
-        std::vector<double> out(10, 0.0);
+std::shared_ptr<Dataset> MNISTLoader::get_testset() const {
+    return this->testset;
+}
 
-        for(unsigned int j=0; j<784; j++) {
-            in[j] = (double)(uint8_t)this->trainingset[i * 784 + 16 + j] / 255.0;
-        }
-        out[this->traininglabels[i + 8]] = 1.0;
+std::shared_ptr<Dataset> MNISTLoader::load_dataset(IDXReader& images, IDXReader& labels, const std::string& name,
+                                                   unsigned int threads) const {
+    NN_TRACE_SPAN("data", "load dataset");
 
-        dataset->set_input_vector(i, in);
-        dataset->set_output_vector(i, out);
+    if(labels.get_data_type() != 0x08 || labels.get_dimensions().size() != 1) {
+        throw std::runtime_error("Invalid MNIST " + name + " labels loaded");
     }
 
-    return dataset;
-}
+    if(images.get_data_type() != 0x08 || images.get_dimensions().size() != 3) {
+        throw std::runtime_error("Invalid MNIST " + name + " images loaded");
+    }
 
-std::shared_ptr<Dataset> MNISTLoader::get_testset() const {
-    auto dataset = std::make_shared<Dataset>(this->testset_size, 784, 10);
+    if(images.get_nr_items() != labels.get_nr_items()) {
+        throw std::runtime_error("Number of MNIST " + name + " images and labels do not match");
+    }
 
-    for(unsigned int i=0; i<this->testset_size; i++) {
-        std::vector<double> in(784);
-        std::vector<double> out(10, 0.0);
+    // the headers are known, so the dataset can be allocated exactly
+    const size_t nr_items = images.get_nr_items();
+    const size_t imgsz = images.get_item_size();
+    auto dataset = std::make_shared<Dataset>(nr_items, imgsz, nr_classes);
+
+    // decode labels
+    std::vector<uint8_t> buffer(nr_items);
+    labels.read((char*)buffer.data(), nr_items);
+    for(size_t i=0; i<nr_items; i++) {
+        if(buffer[i] >= nr_classes) {
+            throw std::runtime_error("Invalid label in MNIST " + name + " labels");
+        }
+        double* out = dataset->get_output_vector(i);
+        std::fill(out, out + nr_classes, 0.0);
+        out[buffer[i]] = 1.0;
+    }
 
-        for(unsigned int j=0; j<784; j++) {
-            in[j] = (double)(uint8_t)this->testset[i * 784 + 16 + j] / 255.0f;
+    // decode images chunk-wise straight into the dataset
+    buffer.resize(chunk_images * imgsz);
+    for(size_t i=0; i<nr_items; i+=chunk_images) {
+        const size_t n = std::min(chunk_images, nr_items - i);
+        {
+            NN_TRACE_SPAN("data", "read chunk");
+            images.read((char*)buffer.data(), n * imgsz);
         }
-        out[this->testlabels[i + 8]] = 1.0;
 
-        dataset->set_input_vector(i, in);
-        dataset->set_output_vector(i, out);
+        // convert the chunk in parallel, each thread handling a range of samples
+        double* in = dataset->get_input_vector(i);
+        const uint8_t* raw = buffer.data();
+        #pragma omp parallel num_threads(threads)
+        {
+            NN_TRACE_SPAN("data", "convert chunk");
+
+            #pragma omp for schedule(static)
+            for(size_t k=0; k<n; k++) {
+                #pragma omp simd
+                for(size_t j=k * imgsz; j<(k+1) * imgsz; j++) {
+                    in[j] = (double)raw[j] / 255.0;
+                }
+            }
+        }
     }
 
     return dataset;
@@ -32,12 +32,16 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#include <byteswap.h>
+#include <memory>
+#include <cmath>
+#include <future>
+#include <algorithm>
+#include <omp.h>
 
+#include "idx_reader.h"
 #include "pngfuncs.h"
 #include "dataset.h"
+#include "trace.h"
 
 /**
  * @brief      Loads MNIST database
@@ -45,12 +49,15 @@
 class MNISTLoader {
 private:
     size_t trainingset_size;
-    std::vector<char> trainingset;
-    std::vector<char> traininglabels;
+    std::shared_ptr<Dataset> trainingset;
 
     size_t testset_size;
-    std::vector<char> testset;
-    std::vector<char> testlabels;
+    std::shared_ptr<Dataset> testset;
+
+    unsigned int nr_threads;                        //!< threads used for conversion
+
+    static const unsigned int nr_classes = 10;      //!< number of digits
+    static const size_t chunk_images = 4096;        //!< images decoded per chunk
 
 public:
     MNISTLoader();
@@ -63,6 +70,26 @@ public:
         return this->testset_size;
     }
 
+    /**
+     * @brief      Sets the number of threads used to convert the images.
+     *
+     * @param[in]  _nr_threads  The number of threads
+     */
+    inline void set_nr_threads(unsigned int _nr_threads) {
+        this->nr_threads = std::max(1u, _nr_threads);
+    }
+
+    /**
+     * @brief      Load training and test set concurrently
+     *
+     * @param[in]  training_datafile   training images file
+     * @param[in]  training_labelfile  training labels file
+     * @param[in]  test_datafile       test images file
+     * @param[in]  test_labelfile      test labels file
+     */
+    void load(const std::string& training_datafile, const std::string& training_labelfile,
+              const std::string& test_datafile, const std::string& test_labelfile);
+
     void load_trainingset(const std::string& datafile, const std::string& labelfile);
 
     void load_testset(const std::string& datafile, const std::string& labelfile);
@@ -74,7 +101,18 @@ public:
     std::shared_ptr<Dataset> get_testset() const;
 
 private:
-    void load_file_from_gz(const std::string& filename, std::vector<char>* rep);
+    /**
+     * @brief      Decode a pair of opened IDX files straight into a new dataset
+     *
+     * @param      images     images file
+     * @param      labels     labels file
+     * @param[in]  name       name of the set used in error messages
+     * @param[in]  threads    number of threads converting the images
+     *
+     * @return     the dataset
+     */
+    std::shared_ptr<Dataset> load_dataset(IDXReader& images, IDXReader& labels, const std::string& name,
+                                          unsigned int threads) const;
 };
 
 #endif // _MNISTLOADER_H
@@ -0,0 +1,166 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "model_handle.h"
+
+/**
+ * @brief      Load a network and construct a handle to it
+ *
+ * @param[in]  _filename  network file
+ */
+ModelHandle::ModelHandle(const std::string& _filename) :
+filename(_filename),
+generation(0),
+mtime(0),
+filesize(0),
+stop(false) {
+    this->stat_file(&this->mtime, &this->filesize);
+    this->model = std::make_shared<const NeuralNetwork>(this->filename);
+    this->generation++;
+}
+
+ModelHandle::~ModelHandle() {
+    {
+        std::lock_guard<std::mutex> lock(this->watch_mtx);
+        this->stop = true;
+        this->watch_cv.notify_all();
+    }
+
+    if(this->watcher.joinable()) {
+        this->watcher.join();
+    }
+}
+
+/**
+ * @brief      Load the network file and publish it
+ *
+ * The current network is kept when the file cannot be loaded or does
+ * not match the input and output size of the current network.
+ *
+ * @return     whether a new network was published
+ */
+bool ModelHandle::reload() {
+    std::lock_guard<std::mutex> lock(this->reload_mtx);
+
+    int64_t _mtime = 0, _filesize = 0;
+    this->stat_file(&_mtime, &_filesize);
+
+    std::shared_ptr<const NeuralNetwork> fresh;
+    try {
+        fresh = std::make_shared<const NeuralNetwork>(this->filename);
+    } catch(const std::exception& e) {
+        std::cerr << "Keeping current network: " << e.what() << std::endl;
+        return false;
+    }
+
+    const auto current = this->get();
+    if(fresh->get_nr_inputs() != current->get_nr_inputs() ||
+       fresh->get_sizes().back() != current->get_sizes().back()) {
+        std::cerr << "Keeping current network: " << this->filename << " has different input or output size" << std::endl;
+        return false;
+    }
+
+    // readers holding the old network keep it alive until they finish
+    std::atomic_store(&this->model, fresh);
+    this->mtime = _mtime;
+    this->filesize = _filesize;
+    this->generation++;
+
+    return true;
+}
+
+/**
+ * @brief      Start reloading the network whenever its file changes
+ *
+ * @param[in]  interval  polling interval
+ */
+void ModelHandle::watch(std::chrono::milliseconds interval) {
+    if(this->watcher.joinable()) {
+        return;
+    }
+
+    this->watcher = std::thread([this, interval]() {
+        int64_t last_mtime = 0, last_size = 0;
+        this->stat_file(&last_mtime, &last_size);
+
+        std::unique_lock<std::mutex> lock(this->watch_mtx);
+        while(!this->watch_cv.wait_for(lock, interval, [this]() { return this->stop; })) {
+            int64_t _mtime = 0, _filesize = 0;
+            if(!this->stat_file(&_mtime, &_filesize)) {
+                continue;
+            }
+
+            // only reload once the file has been stable for a full interval
+            bool changed;
+            {
+                std::lock_guard<std::mutex> rlock(this->reload_mtx);
+                changed = _mtime != this->mtime || _filesize != this->filesize;
+            }
+            const bool stable = _mtime == last_mtime && _filesize == last_size;
+            last_mtime = _mtime;
+            last_size = _filesize;
+
+            if(changed && stable) {
+                lock.unlock();
+                if(this->reload()) {
+                    std::cerr << "Reloaded network from " << this->filename << " (generation " << this->get_generation() << ")" << std::endl;
+                } else {
+                    // do not retry until the file changes again
+                    std::lock_guard<std::mutex> rlock(this->reload_mtx);
+                    this->mtime = _mtime;
+                    this->filesize = _filesize;
+                }
+                lock.lock();
+            }
+        }
+    });
+}
+
+/**
+ * @brief      Get modification time and size of the network file
+ *
+ * @param      _mtime     modification time (ns)
+ * @param      _filesize  file size
+ *
+ * @return     whether the file exists
+ */
+bool ModelHandle::stat_file(int64_t* _mtime, int64_t* _filesize) const {
+    struct stat st;
+    if(stat(this->filename.c_str(), &st) != 0) {
+        return false;
+    }
+
+#ifdef _APPLE
+    *_mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    *_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    *_filesize = st.st_size;
+
+    return true;
+}
@@ -0,0 +1,129 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _MODEL_HANDLE_H
+#define _MODEL_HANDLE_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "neural_network.h"
+
+/**
+ * @brief      Shared handle to a network that can be replaced while in use
+ *
+ * Readers obtain a reference-counted snapshot of the current network and
+ * keep using it for the duration of their call, while a reload publishes a
+ * freshly loaded network for all subsequent readers. A replaced network is
+ * released as soon as the last reader drops its snapshot. Optionally, a
+ * watcher thread reloads the network whenever its file changes on disk.
+ */
+class ModelHandle {
+private:
+    std::string filename;                               //!< network file
+    std::shared_ptr<const NeuralNetwork> model;         //!< current network
+    std::atomic<uint64_t> generation;                   //!< number of loads
+
+    std::mutex reload_mtx;                              //!< serializes reloads
+    int64_t mtime;                                      //!< mtime of loaded file (ns)
+    int64_t filesize;                                   //!< size of loaded file
+
+    std::thread watcher;                                //!< watches the file
+    std::mutex watch_mtx;                               //!< guards stop
+    std::condition_variable watch_cv;                   //!< wakes the watcher
+    bool stop;                                          //!< stop the watcher
+
+public:
+    /**
+     * @brief      Load a network and construct a handle to it
+     *
+     * @param[in]  _filename  network file
+     */
+    ModelHandle(const std::string& _filename);
+
+    ~ModelHandle();
+
+    ModelHandle(const ModelHandle&) = delete;
+
+    ModelHandle& operator=(const ModelHandle&) = delete;
+
+    /**
+     * @brief      Get a snapshot of the current network
+     *
+     * @return     the network, kept alive for as long as the snapshot exists
+     */
+    inline std::shared_ptr<const NeuralNetwork> get() const {
+        return std::atomic_load(&this->model);
+    }
+
+    /**
+     * @brief      Gets the number of times a network was loaded.
+     *
+     * @return     The generation.
+     */
+    inline uint64_t get_generation() const {
+        return this->generation.load();
+    }
+
+    /**
+     * @brief      Load the network file and publish it
+     *
+     * The current network is kept when the file cannot be loaded or does
+     * not match the input and output size of the current network.
+     *
+     * @return     whether a new network was published
+     */
+    bool reload();
+
+    /**
+     * @brief      Start reloading the network whenever its file changes
+     *
+     * @param[in]  interval  polling interval
+     */
+    void watch(std::chrono::milliseconds interval);
+
+private:
+    /**
+     * @brief      Get modification time and size of the network file
+     *
+     * @param      _mtime     modification time (ns)
+     * @param      _filesize  file size
+     *
+     * @return     whether the file exists
+     */
+    bool stat_file(int64_t* _mtime, int64_t* _filesize) const;
+};
+
+#endif // _MODEL_HANDLE_H
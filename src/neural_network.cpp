@@ -34,9 +34,66 @@
  * @param[in]  _sizes  vector holding layer sizes
  */
 NeuralNetwork::NeuralNetwork(const std::vector<uint32_t>& _sizes) :
-sizes(_sizes) {
+sizes(_sizes),
+deterministic(false),
+comm(nullptr),
+average_interval(0),
+nr_local_batches(0) {
     this->num_layers = this->sizes.size();
-    this->construct_bias_and_weight_vectors();
+    this->construct_bias_and_weight_vectors(std::chrono::system_clock::now().time_since_epoch().count());
+    this->construct_activation_vectors();
+}
+
+/**
+ * @brief      Constructs a neural network with reproducible initial
+ *             parameters and shuffling
+ *
+ * @param[in]  _sizes  vector holding layer sizes
+ * @param[in]  seed    random seed
+ */
+NeuralNetwork::NeuralNetwork(const std::vector<uint32_t>& _sizes, uint64_t seed) :
+sizes(_sizes),
+rng(seed),
+deterministic(false),
+comm(nullptr),
+average_interval(0),
+nr_local_batches(0) {
+    this->num_layers = this->sizes.size();
+    this->construct_bias_and_weight_vectors(seed);
+    this->construct_activation_vectors();
+}
+
+/**
+ * @brief      Constructs a neural network whose fully connected layers
+ *             are preceded by convolutional layers
+ *
+ * @param[in]  _conv_layers  convolutional layers (parameters are initialized)
+ * @param[in]  _sizes        sizes of the fully connected layers, the first
+ *                           being the output size of the last convolutional layer
+ * @param[in]  seed          random seed
+ */
+NeuralNetwork::NeuralNetwork(const std::vector<ConvLayer>& _conv_layers, const std::vector<uint32_t>& _sizes, uint64_t seed) :
+sizes(_sizes),
+conv_layers(_conv_layers),
+rng(seed),
+deterministic(false),
+comm(nullptr),
+average_interval(0),
+nr_local_batches(0) {
+    this->num_layers = this->sizes.size();
+    if(this->num_layers < 2 || (!this->conv_layers.empty() && this->conv_layers.back().get_nr_outputs() != this->sizes.front())) {
+        throw std::runtime_error("Layer sizes do not match the convolutional layers");
+    }
+    for(unsigned int i=1; i<this->conv_layers.size(); i++) {
+        if(this->conv_layers[i].get_nr_inputs() != this->conv_layers[i-1].get_nr_outputs()) {
+            throw std::runtime_error("Convolutional layers do not match");
+        }
+    }
+
+    this->construct_bias_and_weight_vectors(seed);
+    for(unsigned int i=0; i<this->conv_layers.size(); i++) {
+        this->conv_layers[i].initialize(seed + i + 1);
+    }
     this->construct_activation_vectors();
 }
 
@@ -45,7 +102,11 @@ sizes(_sizes) {
  *
  * @param[in]  filename  .net file
  */
-NeuralNetwork::NeuralNetwork(const std::string& filename) {
+NeuralNetwork::NeuralNetwork(const std::string& filename) :
+deterministic(false),
+comm(nullptr),
+average_interval(0),
+nr_local_batches(0) {
     this->load_network(filename);
     this->construct_activation_vectors();
 }
@@ -53,93 +114,263 @@ NeuralNetwork::NeuralNetwork(const std::string& filename) {
 /**
  * @brief      Perform feed forward
  *
- * @param[in]  a     input vector
+ * @param[in]  a     pointer to input vector
  */
-void NeuralNetwork::feed_forward(const std::vector<double>& a) {
+void NeuralNetwork::feed_forward(const double* a) {
+    NN_METRICS_SCOPE(FORWARD, -1, 0, 0);
+    NN_TRACE_SPAN("train", "forward");
+
+    // the convolutional layers turn the input into the input of the first dense layer
+    for(unsigned int i=0; i<this->conv_layers.size(); i++) {
+        NN_TRACE_SPAN_LAYER("train", "conv forward", i);
+        a = this->conv_layers[i].forward(a);
+    }
+
     // copy input vector to activations
-    cblas_dcopy(a.size(),
-                &a[0],
+
+    cblas_dcopy(this->sizes.front(),
+                a,
                 1,
                 &this->activations.front()[0],
                 1
                 );
 
-    for(unsigned int i=1; i<this->activations.size(); i++) {
-        // copy bias vector
-        cblas_dcopy(this->biases[i-1].size(),
-                    &this->biases[i-1][0],
-                    1,
-                    &this->z[i-1][0],
-                    1
-                    );
+    // only the checkpoints are kept; the last segment stays in the segment buffers
+    if(!this->checkpoints.empty()) {
+        for(unsigned int s=0; s+1<this->checkpoints.size(); s++) {
+            this->forward_segment(this->checkpoints[s], this->checkpoints[s+1]);
+        }
+        return;
+    }
 
-        cblas_dgemv(CblasRowMajor,
+    for(unsigned int i=1; i<this->num_layers; i++) {
+        this->forward_layer(i, &this->activations[i-1][0], &this->z[i-1][0], &this->activations[i][0]);
+    }
+}
+
+/**
+ * @brief      Perform feed forward of a single fully connected layer
+ *
+ * @param[in]  i     layer index
+ * @param[in]  in    activations of the previous layer
+ * @param      zi    receives the signals of the layer
+ * @param      ai    receives the activations of the layer
+ */
+void NeuralNetwork::forward_layer(unsigned int i, const double* in, double* zi, double* ai) const {
+    // matrix-vector product plus sigmoid; the weights dominate the traffic
+    NN_METRICS_SCOPE(FORWARD, i-1, 2ul * this->sizes[i-1] * this->sizes[i] + 2 * this->sizes[i],
+                     sizeof(double) * ((size_t)this->sizes[i-1] * this->sizes[i] + this->sizes[i-1] + 3 * this->sizes[i]));
+    NN_TRACE_SPAN_LAYER("train", "forward layer", i);
+
+    // copy bias vector
+    cblas_dcopy(this->sizes[i],
+                &this->biases[i-1][0],
+                1,
+                zi,
+                1
+                );
+
+    cblas_dgemv(CblasRowMajor,
+                CblasNoTrans,
+                this->sizes[i],                   // number of rows of matrix
+                this->sizes[i-1],                 // number of columns of matrix
+                1.0,                              // alpha value
+                &this->weights[i-1][0],           // element 0 of matrix,
+                this->sizes[i-1],                 // leading dimension
+                in,                               // element 0 of x vector
+                1,                                // increment
+                1.0,                              // beta
+                zi,                               // element 0 of y-vector
+                1                                 // increment
+                );
+
+    TaskPool::get().parallel_for(this->sizes[i], cost_activation, [&](size_t begin, size_t end) {
+        for(size_t j=begin; j<end; j++) {
+            ai[j] = this->sigmoid(zi[j]);
+        }
+    });
+}
+
+/**
+ * @brief      Perform feed forward of the layers between two checkpoints
+ *
+ * @param[in]  from  checkpoint whose activations are the input
+ * @param[in]  to    next checkpoint, whose activations are stored
+ */
+void NeuralNetwork::forward_segment(unsigned int from, unsigned int to) {
+    const double* in = &this->activations[from][0];
+    for(unsigned int l=from+1; l<=to; l++) {
+        const unsigned int slot = l - from - 1;
+        this->forward_layer(l, in, &this->segment_z[slot][0], &this->segment_a[slot][0]);
+        in = &this->segment_a[slot][0];
+    }
+    std::copy(in, in + this->sizes[to], this->activations[to].begin());
+}
+
+/**
+ * @brief      Perform feed forward without modifying the network
+ *
+ * @param[in]  a     pointer to input vector
+ * @param      ws    workspace owned by the caller
+ *
+ * @return     output vector (valid until the next use of the workspace)
+ */
+const std::vector<double>& NeuralNetwork::feed_forward(const double* a, InferenceWorkspace& ws) const {
+    ws.output.resize(this->sizes.back());
+    this->feed_forward_batch(a, 1, &ws.output[0], ws);
+    return ws.output;
+}
+
+/**
+ * @brief      Perform feed forward without modifying the network using
+ *             a workspace local to the calling thread
+ *
+ * @param[in]  a     pointer to input vector
+ *
+ * @return     output vector
+ */
+std::vector<double> NeuralNetwork::predict(const double* a) const {
+    static thread_local InferenceWorkspace ws;
+    return this->feed_forward(a, ws);
+}
+
+/**
+ * @brief      Perform feed forward on a batch of input vectors without
+ *             modifying the network
+ *
+ * @param[in]  a     pointer to n input vectors (row-major)
+ * @param[in]  n     number of input vectors
+ * @param      out   pointer to n output vectors (row-major)
+ * @param      ws    workspace owned by the caller
+ */
+void NeuralNetwork::feed_forward_batch(const double* a, size_t n, double* out, InferenceWorkspace& ws) const {
+    if(n == 0) {
+        return;
+    }
+
+    if(ws.activations.size() < this->num_layers - 1) {
+        ws.activations.resize(this->num_layers - 1);
+    }
+
+    const double* prev = a;
+    if(ws.features.size() < this->conv_layers.size()) {
+        ws.features.resize(this->conv_layers.size());
+    }
+    for(unsigned int i=0; i<this->conv_layers.size(); i++) {
+        if(ws.features[i].size() < n * this->conv_layers[i].get_nr_outputs()) {
+            ws.features[i].resize(n * this->conv_layers[i].get_nr_outputs());
+        }
+        this->conv_layers[i].forward_batch(prev, n, &ws.features[i][0], ws.scratch);
+        prev = &ws.features[i][0];
+    }
+
+    for(unsigned int i=1; i<this->num_layers; i++) {
+        // the last layer is written straight into the output
+        double* cur = out;
+        if(i != this->num_layers - 1) {
+            if(ws.activations[i-1].size() < n * this->sizes[i]) {
+                ws.activations[i-1].resize(n * this->sizes[i]);
+            }
+            cur = &ws.activations[i-1][0];
+        }
+
+        // broadcast bias vector over the rows
+        for(size_t k=0; k<n; k++) {
+            cblas_dcopy(this->sizes[i], &this->biases[i-1][0], 1, cur + k * this->sizes[i], 1);
+        }
+
+        // Z(n x m) = A(n x l) * W^T(l x m) + Z
+        cblas_dgemm(CblasRowMajor,
                     CblasNoTrans,
-                    this->activations[i].size(),      // number of rows of matrix
-                    this->activations[i-1].size(),    // number of columns of matrix
-                    1.0,                              // alpha value
-                    &this->weights[i-1][0],           // element 0 of matrix,
-                    this->activations[i-1].size(),    // leading dimension
-                    &this->activations[i-1][0],       // element 0 of x vector
-                    1,                                // increment
+                    CblasTrans,
+                    n,                                // number of rows of A
+                    this->sizes[i],                   // number of columns of W^T
+                    this->sizes[i-1],                 // matching dimension
+                    1.0,                              // alpha
+                    prev,                             // matrix A
+                    this->sizes[i-1],                 // leading dimension A
+                    &this->weights[i-1][0],           // matrix W
+                    this->sizes[i-1],                 // leading dimension W
                     1.0,                              // beta
-                    &this->z[i-1][0],                 // element 0 of y-vector
-                    1                                 // increment
+                    cur,                              // matrix Z
+                    this->sizes[i]                    // leading dimension Z
                     );
 
-        #pragma omp parallel for
-        for(unsigned int j=0; j<this->activations[i].size(); j++) {
-            this->activations[i][j] = this->sigmoid(this->z[i-1][j]);
+        for(size_t j=0; j<n * this->sizes[i]; j++) {
+            cur[j] = this->sigmoid(cur[j]);
         }
+
+        prev = cur;
     }
 }
 
 /**
  * @brief      Perform back propagation
  *
- * @param[in]  x     input vector
- * @param[in]  y     expected output
+ * @param[in]  x     pointer to input vector
+ * @param[in]  y     pointer to expected output
  */
-void NeuralNetwork::back_propagation(const std::vector<double>& x, const std::vector<double>& y) {
+void NeuralNetwork::back_propagation(const double* x, const double* y) {
+    if(!this->checkpoints.empty()) {
+        this->back_propagation_checkpointed(x, y);
+        return;
+    }
+
     // perform feed forward operation (store results in activations)
     this->feed_forward(x);
 
+    NN_METRICS_SCOPE(BACKWARD, -1, 0, 0);
+    NN_TRACE_SPAN("train", "backward");
+
     // perform backward propagation
     const unsigned int sz = *std::max_element(this->sizes.begin(), this->sizes.end());
     std::vector<double> delta(sz);
     std::vector<double> tdelta(sz);
 
-    // calculate cost derivative
-    #pragma omp parallel for
-    for(unsigned int i=0; i<y.size(); i++) {
-        delta[i] = (this->activations.back()[i] - y[i]) * this->sigmoid_prime(this->z.back()[i]);
-        nabla_b.back()[i] = delta[i];
-    }
+    {
+        // calculate cost derivative
+        NN_METRICS_SCOPE(BACKWARD, this->num_layers-2, 2ul * this->sizes.end()[-2] * this->sizes.back() + 3 * this->sizes.back(),
+                         sizeof(double) * ((size_t)this->sizes.end()[-2] * this->sizes.back() + this->sizes.end()[-2] + 4 * this->sizes.back()));
+        NN_TRACE_SPAN_LAYER("train", "backward layer", this->num_layers-1);
 
-    // nabla_w(n x m) = (n x 1) * (1 x m)
-    cblas_dgemm(CblasRowMajor,
-                CblasNoTrans,
-                CblasNoTrans,
-                y.size(),                           // number of rows
-                this->sizes.end()[-2],              // number of columns
-                1,                                  // matching dimension of the two matrices
-                1.0,                                // alpha
-                &delta[0],                          // matrix A
-                1,                                  // leading dimension a
-                &this->activations.end()[-2][0],    // matrix B
-                this->sizes.end()[-2],              // leading dimension b
-                0.0,                                // beta
-                &nabla_w.back()[0],                 // matrix C
-                this->sizes.end()[-2]               // leading dimension c
-                );
+        TaskPool::get().parallel_for(this->sizes.back(), cost_activation, [&](size_t begin, size_t end) {
+            for(size_t i=begin; i<end; i++) {
+                delta[i] = (this->activations.back()[i] - y[i]) * this->sigmoid_prime(this->z.back()[i]);
+                nabla_b.back()[i] = delta[i];
+            }
+        });
+
+        // nabla_w(n x m) = (n x 1) * (1 x m)
+        cblas_dgemm(CblasRowMajor,
+                    CblasNoTrans,
+                    CblasNoTrans,
+                    this->sizes.back(),                 // number of rows
+                    this->sizes.end()[-2],              // number of columns
+                    1,                                  // matching dimension of the two matrices
+                    1.0,                                // alpha
+                    &delta[0],                          // matrix A
+                    1,                                  // leading dimension a
+                    &this->activations.end()[-2][0],    // matrix B
+                    this->sizes.end()[-2],              // leading dimension b
+                    0.0,                                // beta
+                    &nabla_w.back()[0],                 // matrix C
+                    this->sizes.end()[-2]               // leading dimension c
+                    );
+    }
 
     for(int i=2; i<this->num_layers; i++) {
+        // transposed matrix-vector product and outer product of the layer
+        NN_METRICS_SCOPE(BACKWARD, this->num_layers-1-i, 2ul * this->sizes.end()[-i-1] * this->sizes.end()[-i] + 2ul * this->sizes.end()[-i+1] * this->sizes.end()[-i],
+                         sizeof(double) * ((size_t)this->sizes.end()[-i+1] * this->sizes.end()[-i] + (size_t)this->sizes.end()[-i] * this->sizes.end()[-i-1]));
+        NN_TRACE_SPAN_LAYER("train", "backward layer", this->num_layers-i);
+
         std::vector<double> sp(this->z.end()[-i].size());
 
-        #pragma omp parallel for
-        for(unsigned int j=0; j<this->z.end()[-i].size(); j++) {
-            sp[j] = this->sigmoid_prime(this->z.end()[-i][j]);
-        }
+        TaskPool::get().parallel_for(this->z.end()[-i].size(), cost_activation, [&](size_t begin, size_t end) {
+            for(size_t j=begin; j<end; j++) {
+                sp[j] = this->sigmoid_prime(this->z.end()[-i][j]);
+            }
+        });
 
         cblas_dgemv(CblasRowMajor,
                     CblasTrans,
@@ -155,11 +386,12 @@ void NeuralNetwork::back_propagation(const std::vector<double>& x, const std::ve
                     1                                 // increment
                     );
 
-        #pragma omp parallel for
-        for(unsigned int j=0; j<this->z.end()[-i].size(); j++) {
-            delta[j] = tdelta[j] * sp[j];
-            nabla_b.end()[-i][j] = delta[j];
-        }
+        TaskPool::get().parallel_for(this->z.end()[-i].size(), cost_update, [&](size_t begin, size_t end) {
+            for(size_t j=begin; j<end; j++) {
+                delta[j] = tdelta[j] * sp[j];
+                nabla_b.end()[-i][j] = delta[j];
+            }
+        });
 
         cblas_dgemm(CblasRowMajor,
                     CblasNoTrans,
@@ -177,6 +409,245 @@ void NeuralNetwork::back_propagation(const std::vector<double>& x, const std::ve
                     this->sizes.end()[-i-1]             // leading dimension C
                     );
     }
+
+    this->conv_back_propagation(&delta[0]);
+}
+
+/**
+ * @brief      Perform back propagation with the activations of the layers
+ *             between the checkpoints recomputed segment by segment
+ *
+ * Uses the same operations as the regular back propagation, such that the
+ * derivatives are identical.
+ *
+ * @param[in]  x     pointer to input vector
+ * @param[in]  y     pointer to expected output
+ */
+void NeuralNetwork::back_propagation_checkpointed(const double* x, const double* y) {
+    // keeps the checkpoints and the activations of the last segment
+    this->feed_forward(x);
+
+    NN_METRICS_SCOPE(BACKWARD, -1, 0, 0);
+    NN_TRACE_SPAN("train", "backward");
+
+    const unsigned int sz = *std::max_element(this->sizes.begin(), this->sizes.end());
+    std::vector<double> delta(sz);
+    std::vector<double> tdelta(sz);
+
+    for(int s=this->checkpoints.size()-2; s>=0; s--) {
+        const unsigned int from = this->checkpoints[s];
+        const unsigned int to = this->checkpoints[s+1];
+        if(s + 2 != (int)this->checkpoints.size()) {
+            NN_TRACE_SPAN("train", "recompute segment");
+            this->forward_segment(from, to);
+        }
+
+        for(unsigned int l=to; l>from; l--) {
+            NN_TRACE_SPAN_LAYER("train", "backward layer", l);
+
+            const double* zl = &this->segment_z[l-from-1][0];
+            const double* prev = (l - 1 == from) ? &this->activations[from][0] : &this->segment_a[l-from-2][0];
+
+            if(l == this->num_layers - 1) {
+                // calculate cost derivative
+                const double* al = &this->segment_a[l-from-1][0];
+                TaskPool::get().parallel_for(this->sizes[l], cost_activation, [&](size_t begin, size_t end) {
+                    for(size_t j=begin; j<end; j++) {
+                        delta[j] = (al[j] - y[j]) * this->sigmoid_prime(zl[j]);
+                        nabla_b[l-1][j] = delta[j];
+                    }
+                });
+            } else {
+                // tdelta holds the error propagated from the next layer
+                TaskPool::get().parallel_for(this->sizes[l], cost_activation, [&](size_t begin, size_t end) {
+                    for(size_t j=begin; j<end; j++) {
+                        delta[j] = tdelta[j] * this->sigmoid_prime(zl[j]);
+                        nabla_b[l-1][j] = delta[j];
+                    }
+                });
+            }
+
+            // nabla_w(n x m) = (n x 1) * (1 x m)
+            cblas_dgemm(CblasRowMajor,
+                        CblasNoTrans,
+                        CblasNoTrans,
+                        this->sizes[l],                     // number of rows of matrix
+                        this->sizes[l-1],                   // number of columns of matrix
+                        1,                                  // matching dimension of the two matrices
+                        1.0,                                // alpha value
+                        &delta[0],                          // matrix A
+                        1,                                  // leading dimension a
+                        prev,                               // matrix B
+                        this->sizes[l-1],                   // leading dimension B
+                        0.0,                                // beta
+                        &nabla_w[l-1][0],                   // matrix C
+                        this->sizes[l-1]                    // leading dimension C
+                        );
+
+            if(l > 1) {
+                cblas_dgemv(CblasRowMajor,
+                            CblasTrans,
+                            this->sizes[l],                   // number of rows of matrix
+                            this->sizes[l-1],                 // number of columns of matrix
+                            1.0,                              // alpha value
+                            &this->weights[l-1][0],           // element 0 of matrix,
+                            this->sizes[l-1],                 // leading dimension
+                            &delta[0],                        // element 0 of x vector
+                            1,                                // increment
+                            0.0,                              // beta value
+                            &tdelta[0],                       // element 0 of y-vector
+                            1                                 // increment
+                            );
+            }
+        }
+    }
+
+    this->conv_back_propagation(&delta[0]);
+}
+
+/**
+ * @brief      Perform back propagation through the convolutional layers
+ *
+ * @param[in]  delta  error of the first hidden layer
+ */
+void NeuralNetwork::conv_back_propagation(const double* delta) {
+    if(this->conv_layers.empty()) {
+        return;
+    }
+
+    // the input of the dense layers is the output of the last convolutional layer
+    this->conv_delta.resize(this->sizes[0]);
+    cblas_dgemv(CblasRowMajor,
+                CblasTrans,
+                this->sizes[1],                   // number of rows of matrix
+                this->sizes[0],                   // number of columns of matrix
+                1.0,                              // alpha value
+                &this->weights[0][0],             // element 0 of matrix,
+                this->sizes[0],                   // leading dimension
+                delta,                            // element 0 of x vector
+                1,                                // increment
+                0.0,                              // beta value
+                &this->conv_delta[0],             // element 0 of y-vector
+                1                                 // increment
+                );
+
+    for(int i=this->conv_layers.size()-1; i>=0; i--) {
+        NN_TRACE_SPAN_LAYER("train", "conv backward", i);
+
+        // the error of the input image is not needed
+        if(i == 0) {
+            this->conv_layers[i].backward(&this->conv_delta[0], nullptr);
+            break;
+        }
+        this->conv_tdelta.resize(this->conv_layers[i].get_nr_inputs());
+        this->conv_layers[i].backward(&this->conv_delta[0], &this->conv_tdelta[0]);
+        std::swap(this->conv_delta, this->conv_tdelta);
+    }
+}
+
+/**
+ * @brief      Perform back propagation without modifying the network
+ *
+ * The derivatives are stored in the workspace, such that several samples
+ * can be processed concurrently. The BLAS calls are issued per sample.
+ *
+ * @param[in]  x     pointer to input vector
+ * @param[in]  y     pointer to expected output
+ * @param      ws    workspace receiving the derivatives
+ */
+void NeuralNetwork::back_propagation(const double* x, const double* y, TrainingWorkspace& ws) const {
+    NN_TRACE_SPAN("train", "backward sample");
+
+    const unsigned int nl = this->num_layers;
+    const unsigned int sz = *std::max_element(this->sizes.begin(), this->sizes.end());
+
+    // (re)size the workspace to the network
+    ws.activations.resize(nl);
+    ws.z.resize(nl - 1);
+    ws.nabla_b.resize(nl - 1);
+    ws.nabla_w.resize(nl - 1);
+    ws.activations[0].resize(this->sizes[0]);
+    for(unsigned int i=1; i<nl; i++) {
+        ws.activations[i].resize(this->sizes[i]);
+        ws.z[i-1].resize(this->sizes[i]);
+        ws.nabla_b[i-1].resize(this->sizes[i]);
+        ws.nabla_w[i-1].resize(this->sizes[i-1] * this->sizes[i]);
+    }
+    ws.delta.resize(sz);
+    ws.tdelta.resize(sz);
+
+    // feed forward
+    std::copy(x, x + this->sizes[0], ws.activations[0].begin());
+    for(unsigned int i=1; i<nl; i++) {
+        std::copy(this->biases[i-1].begin(), this->biases[i-1].end(), ws.z[i-1].begin());
+
+        cblas_dgemv(CblasRowMajor,
+                    CblasNoTrans,
+                    this->sizes[i],                   // number of rows of matrix
+                    this->sizes[i-1],                 // number of columns of matrix
+                    1.0,                              // alpha value
+                    &this->weights[i-1][0],           // element 0 of matrix,
+                    this->sizes[i-1],                 // leading dimension
+                    &ws.activations[i-1][0],          // element 0 of x vector
+                    1,                                // increment
+                    1.0,                              // beta
+                    &ws.z[i-1][0],                    // element 0 of y-vector
+                    1                                 // increment
+                    );
+
+        for(unsigned int j=0; j<this->sizes[i]; j++) {
+            ws.activations[i][j] = this->sigmoid(ws.z[i-1][j]);
+        }
+    }
+
+    // calculate cost derivative
+    for(unsigned int j=0; j<this->sizes.back(); j++) {
+        ws.delta[j] = (ws.activations.back()[j] - y[j]) * this->sigmoid_prime(ws.z.back()[j]);
+        ws.nabla_b.back()[j] = ws.delta[j];
+    }
+
+    // propagate the error backwards; layer l receives it from layer l+1
+    for(unsigned int l=nl-1; l>=1; l--) {
+        // nabla_w(n x m) = (n x 1) * (1 x m)
+        cblas_dgemm(CblasRowMajor,
+                    CblasNoTrans,
+                    CblasNoTrans,
+                    this->sizes[l],                     // number of rows
+                    this->sizes[l-1],                   // number of columns
+                    1,                                  // matching dimension of the two matrices
+                    1.0,                                // alpha
+                    &ws.delta[0],                       // matrix A
+                    1,                                  // leading dimension a
+                    &ws.activations[l-1][0],            // matrix B
+                    this->sizes[l-1],                   // leading dimension b
+                    0.0,                                // beta
+                    &ws.nabla_w[l-1][0],                // matrix C
+                    this->sizes[l-1]                    // leading dimension c
+                    );
+
+        if(l == 1) {
+            break;
+        }
+
+        cblas_dgemv(CblasRowMajor,
+                    CblasTrans,
+                    this->sizes[l],                   // number of rows of matrix
+                    this->sizes[l-1],                 // number of columns of matrix
+                    1.0,                              // alpha value
+                    &this->weights[l-1][0],           // element 0 of matrix,
+                    this->sizes[l-1],                 // leading dimension
+                    &ws.delta[0],                     // element 0 of x vector
+                    1,                                // increment
+                    0.0,                              // beta value
+                    &ws.tdelta[0],                    // element 0 of y-vector
+                    1                                 // increment
+                    );
+
+        for(unsigned int j=0; j<this->sizes[l-1]; j++) {
+            ws.delta[j] = ws.tdelta[j] * this->sigmoid_prime(ws.z[l-2][j]);
+            ws.nabla_b[l-2][j] = ws.delta[j];
+        }
+    }
 }
 
 /**
@@ -196,23 +667,70 @@ void NeuralNetwork::sgd(const std::shared_ptr<Dataset>& trainingset,
 
     for(unsigned int j=0; j<epochs; j++) {
         auto start = std::chrono::system_clock::now();
+        NN_METRICS_EPOCH_START(this->num_layers - 1);
 
-        std::vector<unsigned int> batches(trainingset->size());
-        for(unsigned int i=0; i<trainingset->size(); i++) {
-            batches[i] = i;
-        }
+        this->sgd_pass(trainingset, mini_batch_size, eta);
 
-        auto rng = std::default_random_engine {};
-        std::shuffle(std::begin(batches), std::end(batches), rng);
+        this->report_epoch(j, testset, start);
+    }
+}
+
+/**
+ * @brief      Perform stochastic gradient descent on a streamed dataset
+ *
+ * @param      stream           training data stream
+ * @param[in]  testset          test dataset
+ * @param[in]  epochs           number of epochs
+ * @param[in]  mini_batch_size  batch size
+ * @param[in]  eta              learning rate
+ */
+void NeuralNetwork::sgd(DatasetStream& stream,
+                        const std::shared_ptr<Dataset>& testset,
+                        unsigned int epochs,
+                        unsigned int mini_batch_size,
+                        double eta) {
 
-        for(unsigned int i=0; i<trainingset->size(); i+= mini_batch_size) {
-            this->update_mini_batch(trainingset, batches, i, mini_batch_size, eta);
+    for(unsigned int j=0; j<epochs; j++) {
+        auto start = std::chrono::system_clock::now();
+        NN_METRICS_EPOCH_START(this->num_layers - 1);
+
+        // windows are read ahead by the stream while training on the current one
+        stream.start_epoch(j);
+        while(true) {
+            std::shared_ptr<Dataset> window;
+            {
+                // time spent waiting for the stream shows up as a gap in training
+                NN_TRACE_SPAN("data", "gather window");
+                window = stream.next_window();
+            }
+            if(!window) {
+                break;
+            }
+            this->sgd_pass(window, mini_batch_size, eta);
         }
 
-        auto end = std::chrono::system_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        this->report_epoch(j, testset, start);
+    }
+}
 
-        std::cout << (boost::format("%4i | %i / %i | %f sec.") % (j+1) % this->evaluate(testset) % testset->size() % elapsed.count()).str() << std::endl;
+/**
+ * @brief      Perform a single shuffled pass over a dataset
+ *
+ * @param[in]  dataset          training dataset
+ * @param[in]  mini_batch_size  batch size
+ * @param[in]  eta              learning rate
+ */
+void NeuralNetwork::sgd_pass(const std::shared_ptr<Dataset>& trainingset, unsigned int mini_batch_size, double eta) {
+    std::vector<size_t> batches(trainingset->size());
+    for(size_t i=0; i<trainingset->size(); i++) {
+        batches[i] = i;
+    }
+
+    std::shuffle(std::begin(batches), std::end(batches), this->rng);
+
+    for(size_t i=0; i<trainingset->size(); i+= mini_batch_size) {
+        const size_t batch_size = std::min((size_t)mini_batch_size, trainingset->size() - i);
+        this->update_mini_batch(trainingset, batches, i, batch_size, eta);
     }
 }
 
@@ -222,8 +740,27 @@ void NeuralNetwork::sgd(const std::shared_ptr<Dataset>& trainingset,
  * @param[in]  filename  The filename
  */
 void NeuralNetwork::save_network(const std::string& filename) {
+    NN_TRACE_SPAN("io", "save network");
+
+    // write to a temporary file first such that readers (e.g. a server
+    // watching the file) never observe a partially written network
+    const std::string tmpfilename = filename + ".tmp";
+
     // open file
-    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    std::ofstream out(tmpfilename, std::ios::out | std::ios::binary);
+    if(!out.is_open()) {
+        throw std::runtime_error("Cannot open " + tmpfilename + " for writing");
+    }
+
+    // networks with convolutional layers need the versioned format; the others
+    // keep the original format, which starts with the number of layers
+    if(!this->conv_layers.empty()) {
+        const uint32_t header[] = {file_magic, file_version, (uint32_t)this->conv_layers.size()};
+        out.write((const char*)header, sizeof(header));
+        for(const auto& layer : this->conv_layers) {
+            layer.write(out);
+        }
+    }
 
     // store sizes
     out.write((char*)&this->num_layers, sizeof(uint32_t));
@@ -246,6 +783,200 @@ void NeuralNetwork::save_network(const std::string& filename) {
     }
 
     out.close();
+
+    if(out.fail() || std::rename(tmpfilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpfilename.c_str());
+        throw std::runtime_error("Could not write network to " + filename);
+    }
+}
+
+/**
+ * @brief      Set deterministic training
+ *
+ * @param[in]  _deterministic  whether training is deterministic
+ */
+void NeuralNetwork::set_deterministic(bool _deterministic) {
+    if(_deterministic && !this->conv_layers.empty()) {
+        throw std::runtime_error("Deterministic training does not support convolutional layers");
+    }
+    this->deterministic = _deterministic;
+}
+
+/**
+ * @brief      Limit the memory holding the activations of a sample during
+ *             back propagation
+ *
+ * @param[in]  budget  bytes available for activations and signals (0: unlimited)
+ */
+void NeuralNetwork::set_activation_budget(size_t budget) {
+    this->checkpoints.clear();
+    this->segment_a.clear();
+    this->segment_z.clear();
+
+    // keep everything when it fits
+    if(budget == 0 || this->get_activation_memory() <= budget) {
+        for(unsigned int i=0; i<this->num_layers; i++) {
+            this->activations[i].resize(this->sizes[i]);
+        }
+        for(unsigned int i=1; i<this->num_layers; i++) {
+            this->z[i-1].resize(this->sizes[i]);
+        }
+        return;
+    }
+
+    // every segment is recomputed once, whatever its length; longer segments
+    // need fewer checkpoints, so use the longest segments that fit
+    std::vector<unsigned int> best;
+    size_t least = std::numeric_limits<size_t>::max();
+    for(unsigned int k=this->num_layers-1; k>=1; k--) {
+        std::vector<unsigned int> cps;
+        for(unsigned int l=0; l<this->num_layers-1; l+=k) {
+            cps.push_back(l);
+        }
+        cps.push_back(this->num_layers-1);
+
+        const size_t memory = this->checkpoint_memory(cps, nullptr);
+        least = std::min(least, memory);
+        if(memory <= budget) {
+            best = cps;
+            break;
+        }
+    }
+    if(best.empty()) {
+        throw std::runtime_error((boost::format("Activation budget of %i bytes is too small, at least %i bytes are needed") % budget % least).str());
+    }
+
+    // only the checkpoints keep their activations
+    std::vector<size_t> slots;
+    this->checkpoint_memory(best, &slots);
+    for(unsigned int i=0; i<this->num_layers; i++) {
+        if(std::binary_search(best.begin(), best.end(), i)) {
+            this->activations[i].resize(this->sizes[i]);
+        } else {
+            std::vector<double>().swap(this->activations[i]);
+        }
+    }
+    for(auto& v : this->z) {
+        std::vector<double>().swap(v);
+    }
+    for(size_t n : slots) {
+        this->segment_a.emplace_back(n);
+        this->segment_z.emplace_back(n);
+    }
+    this->checkpoints = best;
+}
+
+/**
+ * @brief      Get the memory holding the activations of a sample during
+ *             back propagation
+ *
+ * @return     bytes of activations and signals
+ */
+size_t NeuralNetwork::get_activation_memory() const {
+    if(!this->checkpoints.empty()) {
+        return this->checkpoint_memory(this->checkpoints, nullptr);
+    }
+
+    size_t n = 0;
+    for(unsigned int i=0; i<this->num_layers; i++) {
+        n += (i == 0 ? 1 : 2) * this->sizes[i];
+    }
+    return n * sizeof(double);
+}
+
+/**
+ * @brief      Move the pages of the parameters and their derivatives to
+ *             the nodes of the threads updating them
+ */
+void NeuralNetwork::distribute_parameters() const {
+    const MemoryPlacement& placement = MemoryPlacement::get();
+    for(const auto* buffers : {&this->biases, &this->weights, &this->nabla_b, &this->nabla_w}) {
+        for(const auto& v : *buffers) {
+            placement.distribute(v.data(), v.size() * sizeof(double));
+        }
+    }
+}
+
+/**
+ * @brief      Share the training with other processes
+ *
+ * @param      _comm              communicator, or nullptr to train alone
+ * @param[in]  _average_interval  mini batches between weight averaging,
+ *                                0 to average the gradients instead
+ */
+void NeuralNetwork::set_communicator(Communicator* _comm, unsigned int _average_interval) {
+    this->comm = _comm;
+    this->average_interval = _average_interval;
+    this->nr_local_batches = 0;
+
+    if(this->comm == nullptr) {
+        return;
+    }
+    if(!this->conv_layers.empty()) {
+        throw std::runtime_error("Training on several processes does not support convolutional layers");
+    }
+
+    // start from the network of the first process
+    this->pack(this->biases, this->weights, this->comm_buffer);
+    this->comm->broadcast(&this->comm_buffer[0], this->comm_buffer.size(), 0);
+    this->unpack(this->comm_buffer, this->biases, this->weights);
+}
+
+/**
+ * @brief      Get the biases and weights as a single vector
+ *
+ * @param      params  receives the parameters
+ */
+void NeuralNetwork::get_parameters(std::vector<double>& params) const {
+    if(!this->conv_layers.empty()) {
+        throw std::runtime_error("Exchanging parameters does not support convolutional layers");
+    }
+    this->pack(this->biases, this->weights, params);
+}
+
+/**
+ * @brief      Get the gradient sum of a mini batch as a single vector
+ *
+ * @param[in]  trainingset  pointer to training set
+ * @param[in]  batches      pointer to mini batches
+ * @param[in]  start        starting index
+ * @param[in]  batch_size   batch size
+ * @param      gradient     receives the gradient sum
+ */
+void NeuralNetwork::get_gradient(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size,
+                                 std::vector<double>& gradient) {
+    if(!this->conv_layers.empty()) {
+        throw std::runtime_error("Exchanging parameters does not support convolutional layers");
+    }
+
+    std::vector<std::vector<double>> nabla_b_sum;
+    std::vector<std::vector<double>> nabla_w_sum;
+    this->accumulate_gradients(trainingset, batches, start, batch_size, nabla_b_sum, nabla_w_sum);
+    this->pack(nabla_b_sum, nabla_w_sum, gradient);
+}
+
+/**
+ * @brief      Shuffle sample indices with the generator of the network
+ *
+ * @param      order  sample indices
+ */
+void NeuralNetwork::shuffle(std::vector<size_t>& order) {
+    std::shuffle(std::begin(order), std::end(order), this->rng);
+}
+
+/**
+ * @brief      Set the biases and weights from a single vector
+ *
+ * @param[in]  params  parameters as returned by get_parameters
+ */
+void NeuralNetwork::set_parameters(const std::vector<double>& params) {
+    if(!this->conv_layers.empty()) {
+        throw std::runtime_error("Exchanging parameters does not support convolutional layers");
+    }
+    if(params.size() != this->get_nr_parameters()) {
+        throw std::runtime_error("Number of parameters does not match the network");
+    }
+    this->unpack(params, this->biases, this->weights);
 }
 
 /**
@@ -254,15 +985,49 @@ void NeuralNetwork::save_network(const std::string& filename) {
  * @param[in]  filename  The filename
  */
 void NeuralNetwork::load_network(const std::string& filename) {
+    static const uint32_t max_layers = 1024;
+
+    NN_TRACE_SPAN("io", "load network");
+
     // open file
     std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if(!in.is_open()) {
+        throw std::runtime_error("Cannot open network file " + filename);
+    }
 
-    // store sizes
+    // the versioned format starts with a value that is never a valid number of layers
+    this->conv_layers.clear();
     in.read((char*)&this->num_layers, sizeof(uint32_t));
+    if(in && this->num_layers == file_magic) {
+        uint32_t header[2];
+        in.read((char*)header, sizeof(header));
+        if(!in || header[0] != file_version) {
+            throw std::runtime_error("Unsupported network file version in " + filename);
+        }
+        if(header[1] > max_layers) {
+            throw std::runtime_error("Invalid network file " + filename);
+        }
+        try {
+            for(uint32_t i=0; i<header[1]; i++) {
+                this->conv_layers.push_back(ConvLayer::read(in));
+            }
+        } catch(const std::runtime_error&) {
+            throw std::runtime_error("Invalid network file " + filename);
+        }
+        in.read((char*)&this->num_layers, sizeof(uint32_t));
+    }
+
+    // store sizes
+    if(!in || this->num_layers < 2 || this->num_layers > max_layers) {
+        throw std::runtime_error("Invalid network file " + filename);
+    }
     this->sizes.resize(num_layers);
     for(unsigned int i=0; i<this->sizes.size(); i++) {
         in.read((char*)&this->sizes[i], sizeof(uint32_t));
     }
+    if(!in || std::find(this->sizes.begin(), this->sizes.end(), 0) != this->sizes.end()) {
+        throw std::runtime_error("Invalid network file " + filename);
+    }
 
     // store biases
     this->biases.resize(this->num_layers - 1);
@@ -282,6 +1047,17 @@ void NeuralNetwork::load_network(const std::string& filename) {
         }
     }
 
+    // the file needs to hold exactly the parameters of the network
+    if(!in || in.peek() != std::char_traits<char>::eof()) {
+        throw std::runtime_error("Invalid network file " + filename);
+    }
+    for(unsigned int i=0; i<this->conv_layers.size(); i++) {
+        const size_t next = (i + 1 < this->conv_layers.size()) ? this->conv_layers[i+1].get_nr_inputs() : this->sizes.front();
+        if(this->conv_layers[i].get_nr_outputs() != next) {
+            throw std::runtime_error("Invalid network file " + filename);
+        }
+    }
+
     in.close();
 }
 
@@ -292,20 +1068,32 @@ void NeuralNetwork::load_network(const std::string& filename) {
  *
  * @return     number of successful recognitions
  */
-unsigned int NeuralNetwork::evaluate(const std::shared_ptr<Dataset>& testset) {
-    unsigned int hits = 0;
+size_t NeuralNetwork::evaluate(const std::shared_ptr<Dataset>& testset) const {
+    static const size_t batch_size = 256;
 
-    for(unsigned int i=0; i<testset->size(); i++) {
-        this->feed_forward(testset->get_input_vector(i));
+    NN_TRACE_SPAN("train", "evaluate");
 
-        auto vf = this->activations.front();
-        auto vb = this->activations.back();
+    // matrix-matrix products: the weights are read once per batch
+    NN_METRICS_SCOPE(EVALUATE, -1, 2 * this->get_nr_parameters() * testset->size(),
+                     sizeof(double) * (this->get_nr_parameters() * ((testset->size() + batch_size - 1) / batch_size) +
+                                       testset->size() * (this->sizes.front() + this->sizes.back())));
 
-        auto max_el = std::max_element(this->activations.back().begin(), this->activations.back().end());
-        unsigned int idx = std::distance(this->activations.back().begin(), max_el);
+    const unsigned int nr_out = this->sizes.back();
+    std::vector<double> out(batch_size * nr_out);
+    InferenceWorkspace ws;
+    size_t hits = 0;
 
-        if(testset->get_output_vector(i)[idx] == 1) {
-            hits++;
+    for(size_t i=0; i<testset->size(); i+=batch_size) {
+        const size_t n = std::min(batch_size, testset->size() - i);
+        this->feed_forward_batch(testset->get_input_vector(i), n, &out[0], ws);
+
+        for(size_t k=0; k<n; k++) {
+            const double* v = &out[k * nr_out];
+            const unsigned int idx = std::distance(v, std::max_element(v, v + nr_out));
+
+            if(testset->get_output_vector(i + k)[idx] == 1) {
+                hits++;
+            }
         }
     }
 
@@ -315,12 +1103,14 @@ unsigned int NeuralNetwork::evaluate(const std::shared_ptr<Dataset>& testset) {
 
 /**
  * @brief      construct bias and weight vectors
+ *
+ * @param[in]  seed  random seed
  */
-void NeuralNetwork::construct_bias_and_weight_vectors() {
+void NeuralNetwork::construct_bias_and_weight_vectors(uint64_t seed) {
     // construct random number generator
     std::uniform_real_distribution<double> unif(-1.0, 1.0);
     std::default_random_engine re;
-    re.seed(std::chrono::system_clock::now().time_since_epoch().count());
+    re.seed(seed);
 
     // construct bias vectors
     for(unsigned int i=1; i<this->sizes.size(); i++) {
@@ -371,7 +1161,7 @@ void NeuralNetwork::construct_activation_vectors() {
  *
  * @return     sigmoid value
  */
-double NeuralNetwork::sigmoid(double z) {
+double NeuralNetwork::sigmoid(double z) const {
     return 1.0 / (1.0 + std::exp(-z));
 }
 
@@ -382,7 +1172,7 @@ double NeuralNetwork::sigmoid(double z) {
  *
  * @return     sigmoid derivative value
  */
-double NeuralNetwork::sigmoid_prime(double z) {
+double NeuralNetwork::sigmoid_prime(double z) const {
     return this->sigmoid(z) * (1.0 - this->sigmoid(z));
 }
 
@@ -395,22 +1185,121 @@ double NeuralNetwork::sigmoid_prime(double z) {
  * @param[in]  batch_size   batch size
  * @param[in]  eta          learning rate
  */
-void NeuralNetwork::update_mini_batch(const std::shared_ptr<Dataset>& trainingset, const std::vector<unsigned int>& batches, unsigned int start, unsigned int batch_size, double eta) {
+void NeuralNetwork::update_mini_batch(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size, double eta) {
+    if(this->deterministic) {
+        this->update_mini_batch_deterministic(trainingset, batches, start, batch_size, eta);
+        return;
+    }
+
     std::vector<std::vector<double>> nabla_b_sum;
     std::vector<std::vector<double>> nabla_w_sum;
 
+    NN_METRICS_SAMPLES(batch_size);
+    NN_TRACE_SPAN("train", "mini batch");
+
+    this->accumulate_gradients(trainingset, batches, start, batch_size, nabla_b_sum, nabla_w_sum);
+    this->apply_gradients(nabla_b_sum, nabla_w_sum, batch_size, eta);
+}
+
+/**
+ * @brief      sum the derivatives of a mini batch
+ *
+ * @param[in]  trainingset  pointer to training set
+ * @param[in]  batches      pointer to mini batches
+ * @param[in]  start        starting index
+ * @param[in]  batch_size   batch size
+ * @param      nabla_b_sum  receives the nabla b sum
+ * @param      nabla_w_sum  receives the nabla w sum
+ */
+void NeuralNetwork::accumulate_gradients(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size,
+                                         std::vector<std::vector<double> >& nabla_b_sum, std::vector<std::vector<double> >& nabla_w_sum) {
     // construct bias vectors
+    nabla_b_sum.clear();
+    nabla_w_sum.clear();
     for(unsigned int i=1; i<this->sizes.size(); i++) {
         nabla_b_sum.emplace_back(this->sizes[i], 0.0);
         nabla_w_sum.emplace_back(this->sizes[i-1] * this->sizes[i], 0.0);
     }
 
-    for(unsigned int i=start; i<(start + batch_size); i++) {
-        this->back_propagation(trainingset->get_input_vector(i), trainingset->get_output_vector(i));
+    // the convolutional layers sum their derivatives themselves
+    for(auto& layer : this->conv_layers) {
+        layer.clear_gradients();
+    }
+
+    for(size_t i=start; i<(start + batch_size); i++) {
+        this->back_propagation(trainingset->get_input_vector(batches[i]), trainingset->get_output_vector(batches[i]));
         this->copy_nablas(nabla_b_sum, nabla_w_sum);
     }
+}
 
-    this->correct_network(nabla_b_sum, nabla_w_sum, batch_size, eta);
+/**
+ * @brief      update network based on mini batch using a fixed-order
+ *             reduction of the per-sample derivatives
+ *
+ * The samples are distributed over the threads, but every sample has its own
+ * derivatives which are summed pairwise in a tree whose shape only depends on
+ * the batch size. Hence, the sums do not depend on the number of threads.
+ *
+ * @param[in]  trainingset  pointer to training set
+ * @param[in]  batches      pointer to mini batches
+ * @param[in]  start        starting index
+ * @param[in]  batch_size   batch size
+ * @param[in]  eta          learning rate
+ */
+void NeuralNetwork::update_mini_batch_deterministic(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size, double eta) {
+    NN_METRICS_SAMPLES(batch_size);
+    NN_TRACE_SPAN("train", "mini batch");
+
+    // multi-threaded BLAS kernels may split their sums depending on the thread count
+    SerialBlas serial_blas;
+
+    if(this->sample_workspaces.size() < batch_size) {
+        this->sample_workspaces.resize(batch_size);
+    }
+    std::vector<TrainingWorkspace>& ws = this->sample_workspaces;
+
+    {
+        NN_METRICS_SCOPE(BACKWARD, -1, 0, 0);
+
+        // every sample passes over all parameters about four times
+        TaskPool::get().parallel_for(batch_size, 4.0 * cost_update * this->get_nr_parameters(), [&](size_t begin, size_t end) {
+            for(size_t i=begin; i<end; i++) {
+                const size_t sample = batches[start + i];
+                this->back_propagation(trainingset->get_input_vector(sample), trainingset->get_output_vector(sample), ws[i]);
+            }
+        });
+    }
+
+    {
+        NN_METRICS_SCOPE(ACCUMULATE, -1, (batch_size - 1) * this->get_nr_parameters(), 3 * sizeof(double) * (batch_size - 1) * this->get_nr_parameters());
+        NN_TRACE_SPAN("train", "gradient reduction");
+
+        for(size_t stride=1; stride<batch_size; stride*=2) {
+            for(size_t i=0; i+stride<batch_size; i+=2*stride) {
+                TrainingWorkspace& dest = ws[i];
+                const TrainingWorkspace& src = ws[i+stride];
+
+                for(unsigned int l=0; l<dest.nabla_b.size(); l++) {
+                    #pragma omp simd
+                    for(size_t j=0; j<dest.nabla_b[l].size(); j++) {
+                        dest.nabla_b[l][j] += src.nabla_b[l][j];
+                    }
+
+                    // elements are summed independently, so any partitioning yields the same result
+                    double* w = &dest.nabla_w[l][0];
+                    const double* v = &src.nabla_w[l][0];
+                    TaskPool::get().parallel_for(dest.nabla_w[l].size(), cost_update, [&](size_t begin, size_t end) {
+                        #pragma omp simd
+                        for(size_t j=begin; j<end; j++) {
+                            w[j] += v[j];
+                        }
+                    });
+                }
+            }
+        }
+    }
+
+    this->apply_gradients(ws[0].nabla_b, ws[0].nabla_w, batch_size, eta);
 }
 
 /**
@@ -420,18 +1309,23 @@ void NeuralNetwork::update_mini_batch(const std::shared_ptr<Dataset>& trainingse
  * @param      nabla_w_sum  The nabla w sum
  */
 void NeuralNetwork::copy_nablas(std::vector<std::vector<double> >& nabla_b_sum, std::vector<std::vector<double> >& nabla_w_sum) {
+    NN_METRICS_SCOPE(ACCUMULATE, -1, this->get_nr_parameters(), 3 * sizeof(double) * this->get_nr_parameters());
+    NN_TRACE_SPAN("train", "gradient reduction");
+
     for(unsigned int i=0; i<nabla_b_sum.size(); i++) {
-        #pragma omp parallel for
-        for(unsigned int j=0; j<nabla_b_sum[i].size(); j++) {
-            nabla_b_sum[i][j] += nabla_b[i][j];
-        }
+        TaskPool::get().parallel_for(nabla_b_sum[i].size(), cost_update, [&](size_t begin, size_t end) {
+            for(size_t j=begin; j<end; j++) {
+                nabla_b_sum[i][j] += nabla_b[i][j];
+            }
+        });
     }
 
     for(unsigned int i=0; i<nabla_w_sum.size(); i++) {
-        #pragma omp parallel for
-        for(unsigned int j=0; j<nabla_w_sum[i].size(); j++) {
-            nabla_w_sum[i][j] += nabla_w[i][j];
-        }
+        TaskPool::get().parallel_for(nabla_w_sum[i].size(), cost_update, [&](size_t begin, size_t end) {
+            for(size_t j=begin; j<end; j++) {
+                nabla_w_sum[i][j] += nabla_w[i][j];
+            }
+        });
     }
 }
 
@@ -444,19 +1338,187 @@ void NeuralNetwork::copy_nablas(std::vector<std::vector<double> >& nabla_b_sum,
  * @param[in]  eta          learning rate
  */
 void NeuralNetwork::correct_network(const std::vector<std::vector<double> >& nabla_b_sum, const std::vector<std::vector<double> >& nabla_w_sum, unsigned int batch_size, double eta) {
+    NN_METRICS_SCOPE(UPDATE, -1, 2 * this->get_nr_parameters(), 3 * sizeof(double) * this->get_nr_parameters());
+    NN_TRACE_SPAN("train", "weight update");
+
     const double factor = eta / (double)batch_size;
 
     for(unsigned int i=0; i<nabla_b_sum.size(); i++) {
-        #pragma omp parallel for
-        for(unsigned int j=0; j<nabla_b_sum[i].size(); j++) {
-            this->biases[i][j] -= factor * nabla_b_sum[i][j];
-        }
+        TaskPool::get().parallel_for(nabla_b_sum[i].size(), cost_update, [&](size_t begin, size_t end) {
+            for(size_t j=begin; j<end; j++) {
+                this->biases[i][j] -= factor * nabla_b_sum[i][j];
+            }
+        });
     }
 
     for(unsigned int i=0; i<nabla_w_sum.size(); i++) {
-        #pragma omp parallel for
-        for(unsigned int j=0; j<nabla_w_sum[i].size(); j++) {
-            this->weights[i][j] -= factor * nabla_w_sum[i][j];
+        TaskPool::get().parallel_for(nabla_w_sum[i].size(), cost_update, [&](size_t begin, size_t end) {
+            for(size_t j=begin; j<end; j++) {
+                this->weights[i][j] -= factor * nabla_w_sum[i][j];
+            }
+        });
+    }
+
+    for(auto& layer : this->conv_layers) {
+        layer.update(factor);
+    }
+}
+
+/**
+ * @brief      correct network using the nabla sums of a mini batch,
+ *             combined with the other processes if any
+ *
+ * @param      nabla_b_sum  nabla b sum
+ * @param      nabla_w_sum  nabla w sum
+ * @param[in]  batch_size   batch size
+ * @param[in]  eta          learning rate
+ */
+void NeuralNetwork::apply_gradients(std::vector<std::vector<double> >& nabla_b_sum, std::vector<std::vector<double> >& nabla_w_sum, unsigned int batch_size, double eta) {
+    if(this->comm == nullptr) {
+        this->correct_network(nabla_b_sum, nabla_w_sum, batch_size, eta);
+        return;
+    }
+
+    if(this->average_interval == 0) {
+        // the mini batch spans the samples of all processes
+        const double total = this->allreduce(nabla_b_sum, nabla_w_sum, batch_size);
+        this->correct_network(nabla_b_sum, nabla_w_sum, (unsigned int)total, eta);
+        return;
+    }
+
+    this->correct_network(nabla_b_sum, nabla_w_sum, batch_size, eta);
+    if(++this->nr_local_batches == this->average_interval) {
+        this->average_parameters();
+    }
+}
+
+/**
+ * @brief      sum bias- and weight-shaped vectors over all processes
+ *
+ * @param      b      bias-shaped vectors, replaced by the sums
+ * @param      w      weight-shaped vectors, replaced by the sums
+ * @param[in]  extra  value that is summed along
+ *
+ * @return     sum of the extra values
+ */
+double NeuralNetwork::allreduce(std::vector<std::vector<double> >& b, std::vector<std::vector<double> >& w, double extra) {
+    NN_METRICS_SCOPE(ACCUMULATE, -1, 0, 2 * sizeof(double) * this->get_nr_parameters());
+
+    std::vector<double>& buffer = this->comm_buffer;
+    this->pack(b, w, buffer);
+    buffer.push_back(extra);
+
+    this->comm->allreduce(&buffer[0], buffer.size());
+
+    this->unpack(buffer, b, w);
+    return buffer.back();
+}
+
+/**
+ * @brief      memory of the activations when keeping only checkpoints
+ *
+ * @param[in]  cps    checkpoint layers, including the first and last layer
+ * @param      slots  receives the size of every segment buffer (optional)
+ *
+ * @return     bytes of the checkpoints and the segment buffers
+ */
+size_t NeuralNetwork::checkpoint_memory(const std::vector<unsigned int>& cps, std::vector<size_t>* slots) const {
+    // segment buffers are shared by all segments and hold activations and signals
+    std::vector<size_t> sz;
+    size_t n = 0;
+    for(unsigned int s=0; s<cps.size(); s++) {
+        n += this->sizes[cps[s]];
+        if(s + 1 == cps.size()) {
+            break;
+        }
+        for(unsigned int l=cps[s]+1; l<=cps[s+1]; l++) {
+            const unsigned int slot = l - cps[s] - 1;
+            if(sz.size() <= slot) {
+                sz.resize(slot + 1, 0);
+            }
+            sz[slot] = std::max(sz[slot], (size_t)this->sizes[l]);
         }
     }
+    n += 2 * std::accumulate(sz.begin(), sz.end(), (size_t)0);
+
+    if(slots != nullptr) {
+        *slots = sz;
+    }
+    return n * sizeof(double);
+}
+
+/**
+ * @brief      copy bias- and weight-shaped vectors into a single vector
+ *
+ * @param[in]  b       bias-shaped vectors
+ * @param[in]  w       weight-shaped vectors
+ * @param      buffer  receives the vectors, layer by layer
+ */
+void NeuralNetwork::pack(const std::vector<std::vector<double> >& b, const std::vector<std::vector<double> >& w, std::vector<double>& buffer) {
+    buffer.clear();
+    for(unsigned int i=0; i<b.size(); i++) {
+        buffer.insert(buffer.end(), b[i].begin(), b[i].end());
+        buffer.insert(buffer.end(), w[i].begin(), w[i].end());
+    }
+}
+
+/**
+ * @brief      copy a single vector into bias- and weight-shaped vectors
+ *
+ * @param[in]  buffer  the vectors, layer by layer
+ * @param      b       bias-shaped vectors
+ * @param      w       weight-shaped vectors
+ */
+void NeuralNetwork::unpack(const std::vector<double>& buffer, std::vector<std::vector<double> >& b, std::vector<std::vector<double> >& w) {
+    auto it = buffer.begin();
+    for(unsigned int i=0; i<b.size(); i++) {
+        std::copy(it, it + b[i].size(), b[i].begin());
+        it += b[i].size();
+        std::copy(it, it + w[i].size(), w[i].begin());
+        it += w[i].size();
+    }
+}
+
+/**
+ * @brief      average the biases and weights over all processes
+ */
+void NeuralNetwork::average_parameters() {
+    NN_TRACE_SPAN("train", "average network");
+
+    this->nr_local_batches = 0;
+    const double factor = 1.0 / (double)this->comm->get_size();
+    this->allreduce(this->biases, this->weights, 0.0);
+
+    for(unsigned int i=0; i<this->biases.size(); i++) {
+        cblas_dscal(this->biases[i].size(), factor, &this->biases[i][0], 1);
+        cblas_dscal(this->weights[i].size(), factor, &this->weights[i][0], 1);
+    }
+}
+
+/**
+ * @brief      report performance of network after an epoch
+ *
+ * @param[in]  epoch    epoch index
+ * @param[in]  testset  test dataset
+ * @param[in]  start    starting time of the epoch
+ */
+void NeuralNetwork::report_epoch(unsigned int epoch, const std::shared_ptr<Dataset>& testset, const std::chrono::system_clock::time_point& start) {
+    // the networks of all processes have to agree before they are evaluated
+    if(this->comm != nullptr && this->average_interval > 0) {
+        this->average_parameters();
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    // only the first process reports
+    if(this->comm != nullptr && this->comm->get_rank() != 0) {
+        NN_METRICS_EPOCH_END(epoch);
+        return;
+    }
+
+    const size_t hits = this->evaluate(testset);
+    NN_METRICS_EPOCH_END(epoch);
+
+    std::cout << (boost::format("%4i | %i / %i | %f sec.") % (epoch+1) % hits % testset->size() % elapsed.count()).str() << std::endl;
 }
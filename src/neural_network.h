@@ -38,15 +38,101 @@
 #include <memory>
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <limits>
+#include <numeric>
 #include <boost/format.hpp>
 
 #include "dataset.h"
+#include "dataset_stream.h"
+#include "metrics.h"
+#include "trace.h"
+#include "communicator.h"
+#include "conv_layer.h"
+#include "memory_placement.h"
+#include "task_pool.h"
+
+class NeuralNetwork;
+
+/**
+ * @brief      Caller-owned scratch memory for inference
+ *
+ * A workspace holds the intermediate activations of a forward pass, such
+ * that a single (const) network can be shared by many threads, each using
+ * its own workspace. The workspace grows to fit the network and batch size
+ * it is used with.
+ */
+class InferenceWorkspace {
+private:
+    std::vector<std::vector<double> > activations;      //!< activations per layer
+    std::vector<std::vector<double> > features;         //!< outputs of the convolutional layers
+    std::vector<double> scratch;                        //!< unrolled patches of the convolutional layers
+    std::vector<double> output;                         //!< output of a single input
+
+    friend class NeuralNetwork;
+    friend class Ensemble;
+};
+
+/**
+ * @brief      Scratch memory for the back propagation of a single sample
+ *
+ * Used in deterministic mode, where the derivatives of all samples of a
+ * mini batch are kept apart until they are summed in a fixed order.
+ */
+class TrainingWorkspace {
+private:
+    std::vector<std::vector<double> > activations;      //!< activations per layer
+    std::vector<std::vector<double> > z;                //!< signals per layer
+    std::vector<double> delta;                          //!< error of the current layer
+    std::vector<double> tdelta;                         //!< error propagated to the previous layer
+    std::vector<std::vector<double> > nabla_b;          //!< bias derivative
+    std::vector<std::vector<double> > nabla_w;          //!< weight derivative
+
+    friend class NeuralNetwork;
+};
+
+/**
+ * @brief      Restricts BLAS to a single thread while in scope
+ *
+ * The number of BLAS threads is a process-wide setting; the previous value
+ * is restored when the guard goes out of scope.
+ */
+class SerialBlas {
+private:
+    int nr_threads;                                     //!< number of BLAS threads before the guard
+
+public:
+    SerialBlas() : nr_threads(openblas_get_num_threads()) {
+        openblas_set_num_threads(1);
+    }
+
+    ~SerialBlas() {
+        openblas_set_num_threads(this->nr_threads);
+    }
+
+    SerialBlas(const SerialBlas&) = delete;
+
+    SerialBlas& operator=(const SerialBlas&) = delete;
+};
 
 class NeuralNetwork {
 private:
+    static const uint32_t file_magic = 0x004e4e41;      //!< first value of versioned network files ("ANN")
+    static const uint32_t file_version = 2;             //!< version of network files with convolutional layers
+
+    // estimated time per element of the loops, deciding whether the task pool splits them
+    static constexpr double cost_activation = 10.0;     //!< ns per element involving an exponential
+    static constexpr double cost_update = 0.5;          //!< ns per element of an element-wise update
+
     uint32_t num_layers;                                //!< number of layers
     std::vector<uint32_t> sizes;                        //!< size of the layers
 
+    // convolutional layers in front of the fully connected layers
+    std::vector<ConvLayer> conv_layers;                 //!< convolutional layers
+    std::vector<double> conv_delta;                     //!< error of the output of a convolutional layer
+    std::vector<double> conv_tdelta;                    //!< error of the input of a convolutional layer
+
     // biases and weights
     std::vector<std::vector<double> > biases;           //!< biases
     std::vector<std::vector<double> > weights;          //!< weights
@@ -58,6 +144,23 @@ private:
     std::vector<std::vector<double> > activations;      //!< activations
     std::vector<std::vector<double> > z;                //!< signals
 
+    // activation checkpointing (only the checkpoint layers keep their activations)
+    std::vector<unsigned int> checkpoints;              //!< checkpoint layers, empty to keep all layers
+    std::vector<std::vector<double> > segment_a;        //!< activations of the layers between two checkpoints
+    std::vector<std::vector<double> > segment_z;        //!< signals of the layers between two checkpoints
+
+    std::default_random_engine rng;                     //!< generator for shuffling
+
+    bool deterministic;                                 //!< reproducible training regardless of threads
+    std::vector<TrainingWorkspace> sample_workspaces;   //!< per-sample gradients (deterministic mode)
+
+    Communicator* comm;                                 //!< processes sharing the training (not owned)
+    unsigned int average_interval;                      //!< mini batches between weight averaging (0: average gradients)
+    size_t nr_local_batches;                            //!< mini batches since the last weight averaging
+    std::vector<double> comm_buffer;                    //!< contiguous copy of the exchanged vectors
+
+    friend class Benchmark;                             //!< measures the private training steps
+
 public:
     /**
      * @brief      Constructs a neural network
@@ -66,6 +169,26 @@ public:
      */
     NeuralNetwork(const std::vector<uint32_t>& _sizes);
 
+    /**
+     * @brief      Constructs a neural network with reproducible initial
+     *             parameters and shuffling
+     *
+     * @param[in]  _sizes  vector holding layer sizes
+     * @param[in]  seed    random seed
+     */
+    NeuralNetwork(const std::vector<uint32_t>& _sizes, uint64_t seed);
+
+    /**
+     * @brief      Constructs a neural network whose fully connected layers
+     *             are preceded by convolutional layers
+     *
+     * @param[in]  _conv_layers  convolutional layers (parameters are initialized)
+     * @param[in]  _sizes        sizes of the fully connected layers, the first
+     *                           being the output size of the last convolutional layer
+     * @param[in]  seed          random seed
+     */
+    NeuralNetwork(const std::vector<ConvLayer>& _conv_layers, const std::vector<uint32_t>& _sizes, uint64_t seed);
+
     /**
      * @brief      Construct a neural network
      *
@@ -73,12 +196,69 @@ public:
      */
     NeuralNetwork(const std::string& filename);
 
+    /**
+     * @brief      Perform feed forward
+     *
+     * @param[in]  a     pointer to input vector
+     */
+    void feed_forward(const double* a);
+
     /**
      * @brief      Perform feed forward
      *
      * @param[in]  a     input vector
      */
-    void feed_forward(const std::vector<double>& a);
+    inline void feed_forward(const std::vector<double>& a) {
+        this->feed_forward(&a[0]);
+    }
+
+    /**
+     * @brief      Perform feed forward without modifying the network
+     *
+     * @param[in]  a     pointer to input vector
+     * @param      ws    workspace owned by the caller
+     *
+     * @return     output vector (valid until the next use of the workspace)
+     */
+    const std::vector<double>& feed_forward(const double* a, InferenceWorkspace& ws) const;
+
+    /**
+     * @brief      Perform feed forward without modifying the network using
+     *             a workspace local to the calling thread
+     *
+     * @param[in]  a     pointer to input vector
+     *
+     * @return     output vector
+     */
+    std::vector<double> predict(const double* a) const;
+
+    /**
+     * @brief      Perform feed forward on a batch of input vectors without
+     *             modifying the network
+     *
+     * @param[in]  a     pointer to n input vectors (row-major)
+     * @param[in]  n     number of input vectors
+     * @param      out   pointer to n output vectors (row-major)
+     * @param      ws    workspace owned by the caller
+     */
+    void feed_forward_batch(const double* a, size_t n, double* out, InferenceWorkspace& ws) const;
+
+    /**
+     * @brief      Perform back propagation
+     *
+     * @param[in]  x     pointer to input vector
+     * @param[in]  y     pointer to expected output
+     */
+    void back_propagation(const double* x, const double* y);
+
+    /**
+     * @brief      Perform back propagation without modifying the network
+     *
+     * @param[in]  x     pointer to input vector
+     * @param[in]  y     pointer to expected output
+     * @param      ws    workspace receiving the derivatives
+     */
+    void back_propagation(const double* x, const double* y, TrainingWorkspace& ws) const;
 
     /**
      * @brief      Perform back propagation
@@ -86,7 +266,9 @@ public:
      * @param[in]  x     input vector
      * @param[in]  y     expected output
      */
-    void back_propagation(const std::vector<double>& x, const std::vector<double>& y);
+    inline void back_propagation(const std::vector<double>& x, const std::vector<double>& y) {
+        this->back_propagation(&x[0], &y[0]);
+    }
 
     /**
      * @brief      Perform stochastic gradient descent
@@ -99,9 +281,33 @@ public:
      */
     void sgd(const std::shared_ptr<Dataset>& dataset, const std::shared_ptr<Dataset>& testset, unsigned int epochs, unsigned int mini_batch_size, double eta);
 
+    /**
+     * @brief      Perform stochastic gradient descent on a streamed dataset
+     *
+     * @param      stream           training data stream
+     * @param[in]  testset          test dataset
+     * @param[in]  epochs           number of epochs
+     * @param[in]  mini_batch_size  batch size
+     * @param[in]  eta              learning rate
+     */
+    void sgd(DatasetStream& stream, const std::shared_ptr<Dataset>& testset, unsigned int epochs, unsigned int mini_batch_size, double eta);
+
+    /**
+     * @brief      Perform a single shuffled pass over a dataset
+     *
+     * @param[in]  dataset          training dataset
+     * @param[in]  mini_batch_size  batch size
+     * @param[in]  eta              learning rate
+     */
+    void sgd_pass(const std::shared_ptr<Dataset>& dataset, unsigned int mini_batch_size, double eta);
+
     /**
      * @brief      save network to file
      *
+     * Networks with convolutional layers are written in a versioned format:
+     * a magic value, the version and the convolutional layers precede the
+     * fully connected layers. Other networks keep the original format.
+     *
      * @param[in]  filename  The filename
      */
     void save_network(const std::string& filename);
@@ -113,6 +319,132 @@ public:
      */
     void load_network(const std::string& filename);
 
+    /**
+     * @brief      Seed the generator used for shuffling the training data
+     *
+     * @param[in]  seed  random seed
+     */
+    inline void set_seed(uint64_t seed) {
+        this->rng.seed(seed);
+    }
+
+    /**
+     * @brief      Set deterministic training
+     *
+     * In deterministic mode, the derivatives of every sample in a mini batch
+     * are computed independently and summed in a fixed, tree-shaped order,
+     * such that training yields bit-identical networks for any number of
+     * threads. BLAS is restricted to a single thread during these updates.
+     *
+     * @param[in]  _deterministic  whether training is deterministic
+     */
+    void set_deterministic(bool _deterministic);
+
+    /**
+     * @brief      Limit the memory holding the activations of a sample during
+     *             back propagation
+     *
+     * When all activations and signals do not fit, only the activations of
+     * evenly spaced checkpoint layers are kept during the forward pass. The
+     * backward pass recomputes the layers between two checkpoints from the
+     * first one, segment by segment, using the same operations; hence the
+     * derivatives are identical. Throws if even the smallest configuration
+     * does not fit. Does not apply to deterministic training, which keeps
+     * the workspaces of all samples.
+     *
+     * @param[in]  budget  bytes available for activations and signals (0: unlimited)
+     */
+    void set_activation_budget(size_t budget);
+
+    /**
+     * @brief      Get the memory holding the activations of a sample during
+     *             back propagation
+     *
+     * @return     bytes of activations and signals
+     */
+    size_t get_activation_memory() const;
+
+    /**
+     * @brief      Gets the checkpoint layers.
+     *
+     * @return     checkpoint layers (empty when all activations are kept)
+     */
+    inline const std::vector<unsigned int>& get_checkpoints() const {
+        return this->checkpoints;
+    }
+
+    /**
+     * @brief      Move the pages of the parameters and their derivatives to
+     *             the nodes of the threads updating them
+     *
+     * See MemoryPlacement::distribute.
+     */
+    void distribute_parameters() const;
+
+    /**
+     * @brief      Share the training with other processes
+     *
+     * All processes start from the network of the first process. Either
+     * the gradients of every mini batch are summed over the processes before
+     * the network is corrected, or every process trains on its own and the
+     * networks are averaged every few mini batches and at the end of every
+     * epoch. Every process has to perform the same number of mini batches.
+     *
+     * @param      _comm              communicator, or nullptr to train alone
+     * @param[in]  _average_interval  mini batches between weight averaging,
+     *                                0 to average the gradients instead
+     */
+    void set_communicator(Communicator* _comm, unsigned int _average_interval = 0);
+
+    /**
+     * @brief      Gets the layer sizes.
+     *
+     * @return     The sizes.
+     */
+    inline const std::vector<uint32_t>& get_sizes() const {
+        return this->sizes;
+    }
+
+    /**
+     * @brief      Gets the size of the input.
+     *
+     * @return     input size of the first (convolutional) layer
+     */
+    inline size_t get_nr_inputs() const {
+        return this->conv_layers.empty() ? this->sizes.front() : this->conv_layers.front().get_nr_inputs();
+    }
+
+    /**
+     * @brief      Gets the convolutional layers.
+     *
+     * @return     The convolutional layers.
+     */
+    inline const std::vector<ConvLayer>& get_conv_layers() const {
+        return this->conv_layers;
+    }
+
+    /**
+     * @brief      Gets the convolutional layers.
+     *
+     * @return     The convolutional layers.
+     */
+    inline std::vector<ConvLayer>& get_conv_layers() {
+        return this->conv_layers;
+    }
+
+    /**
+     * @brief      Get the number of weights and biases
+     *
+     * @return     number of parameters
+     */
+    inline size_t get_nr_parameters() const {
+        size_t n = 0;
+        for(unsigned int i=1; i<this->sizes.size(); i++) {
+            n += (size_t)this->sizes[i-1] * this->sizes[i] + this->sizes[i];
+        }
+        return n;
+    }
+
     /**
      * @brief      Gets the output.
      *
@@ -140,6 +472,59 @@ public:
         this->weights = _weights;
     }
 
+    /**
+     * @brief      Get the biases and weights as a single vector, layer by
+     *             layer the biases followed by the weights
+     *
+     * @param      params  receives the parameters
+     */
+    void get_parameters(std::vector<double>& params) const;
+
+    /**
+     * @brief      Set the biases and weights from a single vector
+     *
+     * @param[in]  params  parameters as returned by get_parameters
+     */
+    void set_parameters(const std::vector<double>& params);
+
+    /**
+     * @brief      Get the gradient sum of a mini batch as a single vector,
+     *             in the layout of get_parameters
+     *
+     * @param[in]  trainingset  pointer to training set
+     * @param[in]  batches      pointer to mini batches
+     * @param[in]  start        starting index
+     * @param[in]  batch_size   batch size
+     * @param      gradient     receives the gradient sum
+     */
+    void get_gradient(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size,
+                      std::vector<double>& gradient);
+
+    /**
+     * @brief      Shuffle sample indices with the generator of the network
+     *
+     * @param      order  sample indices
+     */
+    void shuffle(std::vector<size_t>& order);
+
+    /**
+     * @brief      Gets the biases.
+     *
+     * @return     The biases.
+     */
+    inline const std::vector<std::vector<double> >& get_biases() const {
+        return this->biases;
+    }
+
+    /**
+     * @brief      Gets the weights.
+     *
+     * @return     The weights.
+     */
+    inline const std::vector<std::vector<double> >& get_weights() const {
+        return this->weights;
+    }
+
     /**
      * @brief      Gets the nabla w.
      *
@@ -174,19 +559,65 @@ public:
      *
      * @return     number of successful recognitions
      */
-    unsigned int evaluate(const std::shared_ptr<Dataset>& testset);
+    size_t evaluate(const std::shared_ptr<Dataset>& testset) const;
 
 private:
     /**
      * @brief      construct bias and weight vectors
+     *
+     * @param[in]  seed  random seed
      */
-    void construct_bias_and_weight_vectors();
+    void construct_bias_and_weight_vectors(uint64_t seed);
 
     /**
      * @brief      construct activation vectors
      */
     void construct_activation_vectors();
 
+    /**
+     * @brief      Perform feed forward of a single fully connected layer
+     *
+     * @param[in]  i     layer index
+     * @param[in]  in    activations of the previous layer
+     * @param      zi    receives the signals of the layer
+     * @param      ai    receives the activations of the layer
+     */
+    void forward_layer(unsigned int i, const double* in, double* zi, double* ai) const;
+
+    /**
+     * @brief      Perform feed forward of the layers between two checkpoints
+     *
+     * @param[in]  from  checkpoint whose activations are the input
+     * @param[in]  to    next checkpoint, whose activations are stored
+     */
+    void forward_segment(unsigned int from, unsigned int to);
+
+    /**
+     * @brief      Perform back propagation with the activations of the layers
+     *             between the checkpoints recomputed segment by segment
+     *
+     * @param[in]  x     pointer to input vector
+     * @param[in]  y     pointer to expected output
+     */
+    void back_propagation_checkpointed(const double* x, const double* y);
+
+    /**
+     * @brief      Perform back propagation through the convolutional layers
+     *
+     * @param[in]  delta  error of the first hidden layer
+     */
+    void conv_back_propagation(const double* delta);
+
+    /**
+     * @brief      memory of the activations when keeping only checkpoints
+     *
+     * @param[in]  cps    checkpoint layers, including the first and last layer
+     * @param      slots  receives the size of every segment buffer (optional)
+     *
+     * @return     bytes of the checkpoints and the segment buffers
+     */
+    size_t checkpoint_memory(const std::vector<unsigned int>& cps, std::vector<size_t>* slots) const;
+
     /**
      * @brief      sigmoid function
      *
@@ -194,7 +625,7 @@ private:
      *
      * @return     sigmoid value
      */
-    double sigmoid(double z);
+    double sigmoid(double z) const;
 
     /**
      * @brief      derivative of sigmoid function
@@ -203,7 +634,7 @@ private:
      *
      * @return     sigmoid derivative value
      */
-    double sigmoid_prime(double z);
+    double sigmoid_prime(double z) const;
 
     /**
      * @brief      update network based on mini batch
@@ -214,7 +645,59 @@ private:
      * @param[in]  batch_size   batch size
      * @param[in]  eta          learning rate
      */
-    void update_mini_batch(const std::shared_ptr<Dataset>& dataset, const std::vector<unsigned int>& batches, unsigned int start, unsigned int batch_size, double eta);
+    void update_mini_batch(const std::shared_ptr<Dataset>& dataset, const std::vector<size_t>& batches, size_t start, size_t batch_size, double eta);
+
+    /**
+     * @brief      update network based on mini batch using a fixed-order
+     *             reduction of the per-sample derivatives
+     *
+     * @param[in]  trainingset  pointer to training set
+     * @param[in]  batches      pointer to mini batches
+     * @param[in]  start        starting index
+     * @param[in]  batch_size   batch size
+     * @param[in]  eta          learning rate
+     */
+    void update_mini_batch_deterministic(const std::shared_ptr<Dataset>& dataset, const std::vector<size_t>& batches, size_t start, size_t batch_size, double eta);
+
+    /**
+     * @brief      sum the derivatives of a mini batch
+     *
+     * @param[in]  trainingset  pointer to training set
+     * @param[in]  batches      pointer to mini batches
+     * @param[in]  start        starting index
+     * @param[in]  batch_size   batch size
+     * @param      nabla_b_sum  receives the nabla b sum
+     * @param      nabla_w_sum  receives the nabla w sum
+     */
+    void accumulate_gradients(const std::shared_ptr<Dataset>& trainingset, const std::vector<size_t>& batches, size_t start, size_t batch_size,
+                              std::vector<std::vector<double> >& nabla_b_sum, std::vector<std::vector<double> >& nabla_w_sum);
+
+    /**
+     * @brief      copy bias- and weight-shaped vectors into a single vector
+     *
+     * @param[in]  b       bias-shaped vectors
+     * @param[in]  w       weight-shaped vectors
+     * @param      buffer  receives the vectors, layer by layer
+     */
+    static void pack(const std::vector<std::vector<double> >& b, const std::vector<std::vector<double> >& w, std::vector<double>& buffer);
+
+    /**
+     * @brief      copy a single vector into bias- and weight-shaped vectors
+     *
+     * @param[in]  buffer  the vectors, layer by layer
+     * @param      b       bias-shaped vectors
+     * @param      w       weight-shaped vectors
+     */
+    static void unpack(const std::vector<double>& buffer, std::vector<std::vector<double> >& b, std::vector<std::vector<double> >& w);
+
+    /**
+     * @brief      report performance of network after an epoch
+     *
+     * @param[in]  epoch    epoch index
+     * @param[in]  testset  test dataset
+     * @param[in]  start    starting time of the epoch
+     */
+    void report_epoch(unsigned int epoch, const std::shared_ptr<Dataset>& testset, const std::chrono::system_clock::time_point& start);
 
     /**
      * @brief      copy nablas
@@ -233,6 +716,33 @@ private:
      * @param[in]  eta          learning rate
      */
     void correct_network(const std::vector<std::vector<double> >& nabla_b_sum, const std::vector<std::vector<double> >& nabla_w_sum, unsigned int batch_size, double eta);
+
+    /**
+     * @brief      correct network using the nabla sums of a mini batch,
+     *             combined with the other processes if any
+     *
+     * @param      nabla_b_sum  nabla b sum
+     * @param      nabla_w_sum  nabla w sum
+     * @param[in]  batch_size   batch size
+     * @param[in]  eta          learning rate
+     */
+    void apply_gradients(std::vector<std::vector<double> >& nabla_b_sum, std::vector<std::vector<double> >& nabla_w_sum, unsigned int batch_size, double eta);
+
+    /**
+     * @brief      sum bias- and weight-shaped vectors over all processes
+     *
+     * @param      b      bias-shaped vectors, replaced by the sums
+     * @param      w      weight-shaped vectors, replaced by the sums
+     * @param[in]  extra  value that is summed along
+     *
+     * @return     sum of the extra values
+     */
+    double allreduce(std::vector<std::vector<double> >& b, std::vector<std::vector<double> >& w, double extra);
+
+    /**
+     * @brief      average the biases and weights over all processes
+     */
+    void average_parameters();
 };
 
 #endif // _NEURAL_NETWORK_H
@@ -29,13 +29,29 @@
 #include "config.h"
 #include "neural_network.h"
 #include "mnist_loader.h"
+#include "dataset_cache.h"
+#include "streaming_dataset.h"
+#include "augmenter.h"
+#include "batch_classifier.h"
+#include "inference_server.h"
 #include "pngfuncs.h"
+#include "trace.h"
+#include "shared_memory_communicator.h"
+#include "parameter_server.h"
+#include "sweep.h"
+#include "ensemble.h"
+#include "memory_placement.h"
+#include "task_pool.h"
+#include "cascade.h"
 
 #include <memory>
 #include <iostream>
 #include <omp.h>
 #include <chrono>
+#include <fstream>
 #include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
 #include <tclap/CmdLine.h>
 
 int main(int argc, char* argv[]) {
@@ -62,84 +78,614 @@ int main(int argc, char* argv[]) {
         TCLAP::SwitchArg arg_train("t","train","whether to further train network");
         cmd.add(arg_train);
 
+        // dataset cache directory
+        TCLAP::ValueArg<std::string> arg_cache("c","cache","Directory to cache the decoded datasets in (about 445 MB for MNIST; disabled by default)",false,"","directory");
+        cmd.add(arg_cache);
+
+        // out-of-core training data
+        TCLAP::ValueArg<std::string> arg_stream_images("","stream-images","Uncompressed IDX images file to stream training data from",false,"","filename");
+        cmd.add(arg_stream_images);
+        TCLAP::ValueArg<std::string> arg_stream_labels("","stream-labels","Uncompressed IDX labels file to stream training data from",false,"","filename");
+        cmd.add(arg_stream_labels);
+        TCLAP::ValueArg<unsigned int> arg_shard_size("","shard-size","Samples per shard when streaming",false,10000,"number");
+        cmd.add(arg_shard_size);
+        TCLAP::ValueArg<unsigned int> arg_window("","window","Shards per shuffle window when streaming",false,4,"number");
+        cmd.add(arg_window);
+
+        // data augmentation
+        TCLAP::SwitchArg arg_augment("a","augment","distort the training images on the fly");
+        cmd.add(arg_augment);
+        TCLAP::ValueArg<double> arg_elastic("","elastic","Magnitude of elastic distortions (0 to disable)",false,0.0,"alpha");
+        cmd.add(arg_elastic);
+        TCLAP::ValueArg<unsigned int> arg_augment_threads("","augment-threads","Number of augmentation worker threads",false,2,"number");
+        cmd.add(arg_augment_threads);
+        TCLAP::ValueArg<uint64_t> arg_augment_seed("","augment-seed","Seed of the augmentation stream",false,0,"seed");
+        cmd.add(arg_augment_seed);
+
+        // batch classification
+        TCLAP::ValueArg<std::string> arg_batch("b","batch","Directory, glob pattern or file list of images to classify",false,"","spec");
+        cmd.add(arg_batch);
+        TCLAP::ValueArg<std::string> arg_format("","format","Output format of batch classification (csv or json)",false,"csv","format");
+        cmd.add(arg_format);
+        TCLAP::ValueArg<unsigned int> arg_batch_size("","batch-size","Images per batch",false,256,"number");
+        cmd.add(arg_batch_size);
+        TCLAP::ValueArg<unsigned int> arg_threads("","threads","Number of threads",false,omp_get_num_procs(),"number");
+        cmd.add(arg_threads);
+        TCLAP::SwitchArg arg_preprocess("p","preprocess","normalize all images like the MNIST digits (only non-MNIST images otherwise)");
+        cmd.add(arg_preprocess);
+
+        // inference server
+        TCLAP::SwitchArg arg_serve("s","serve","serve classification requests on stdin or a socket");
+        cmd.add(arg_serve);
+        TCLAP::ValueArg<std::string> arg_socket("","socket","Unix domain socket to serve on (stdin when empty)",false,"","path");
+        cmd.add(arg_socket);
+        TCLAP::ValueArg<unsigned int> arg_max_latency("","max-latency","Maximum time a request waits for its batch in us",false,2000,"us");
+        cmd.add(arg_max_latency);
+        TCLAP::ValueArg<unsigned int> arg_watch("","watch","Interval in ms to check the network file for changes (0 to disable)",false,1000,"ms");
+        cmd.add(arg_watch);
+
+        // metrics (only available when compiled with ENABLE_METRICS)
+        TCLAP::ValueArg<std::string> arg_metrics("","metrics","File to export the per-phase training metrics to after every epoch",false,"","filename");
+        cmd.add(arg_metrics);
+        TCLAP::ValueArg<std::string> arg_metrics_format("","metrics-format","Metrics format: json (lines) or prometheus",false,"json","format");
+        cmd.add(arg_metrics_format);
+        TCLAP::SwitchArg arg_perf("","perf","collect hardware performance counters per phase and thread (with --metrics)");
+        cmd.add(arg_perf);
+        TCLAP::ValueArg<std::string> arg_perf_fp_event("","perf-fp-event","Raw perf event code counting fp operations, e.g. 0x10c7",false,"","code");
+        cmd.add(arg_perf_fp_event);
+
+        // timeline
+        TCLAP::ValueArg<std::string> arg_trace("","trace","File to write a Chrome trace (Perfetto) timeline of all threads to",false,"","filename");
+        cmd.add(arg_trace);
+        TCLAP::ValueArg<size_t> arg_trace_spans("","trace-spans","Maximum number of spans on the timeline; recording stops when reached",false,500000,"number");
+        cmd.add(arg_trace_spans);
+
+        // reproducibility
+        TCLAP::ValueArg<uint64_t> arg_seed("","seed","Seed of the weight initialization and shuffling",false,0,"seed");
+        cmd.add(arg_seed);
+        TCLAP::SwitchArg arg_deterministic("","deterministic","train bit-identical networks for a given seed regardless of the number of threads");
+        cmd.add(arg_deterministic);
+
+        // data-parallel training
+        TCLAP::ValueArg<unsigned int> arg_procs("","procs","Number of training processes, each training on a part of the dataset",false,1,"number");
+        cmd.add(arg_procs);
+        TCLAP::ValueArg<unsigned int> arg_average_every("","average-every","Average the networks of the processes every n mini batches instead of the gradients of every mini batch",false,0,"batches");
+        cmd.add(arg_average_every);
+
+        // asynchronous training with a parameter server
+        TCLAP::ValueArg<unsigned int> arg_ps_workers("","ps-workers","Act as parameter server for this number of workers",false,0,"number");
+        cmd.add(arg_ps_workers);
+        TCLAP::ValueArg<unsigned int> arg_ps_port("","ps-port","TCP port of the parameter server (0: any free port)",false,0,"port");
+        cmd.add(arg_ps_port);
+        TCLAP::ValueArg<std::string> arg_ps_bind("","ps-bind","IPv4 address the parameter server listens on; workers are not authenticated, so only widen it in a trusted network",false,"127.0.0.1","address");
+        cmd.add(arg_ps_bind);
+        TCLAP::SwitchArg arg_ps_local("","ps-local","start the workers of the parameter server as local processes");
+        cmd.add(arg_ps_local);
+        TCLAP::ValueArg<std::string> arg_ps_connect("","ps-connect","Train as worker of the parameter server at this address",false,"","host:port");
+        cmd.add(arg_ps_connect);
+        TCLAP::ValueArg<unsigned int> arg_staleness("","staleness","Mini batches a worker may run ahead of the slowest worker",false,2,"batches");
+        cmd.add(arg_staleness);
+
+        // hyperparameter sweep
+        TCLAP::ValueArg<std::string> arg_sweep("","sweep","Hyperparameter sweep specification or file, e.g. eta=0.5,1,3;hidden=30,100",false,"","spec");
+        cmd.add(arg_sweep);
+        TCLAP::ValueArg<unsigned int> arg_sweep_samples("","sweep-samples","Number of random configurations (0: full grid)",false,0,"number");
+        cmd.add(arg_sweep_samples);
+        TCLAP::ValueArg<unsigned int> arg_halving("","halving","Successive halving factor of the sweep (0 to disable)",false,3,"factor");
+        cmd.add(arg_halving);
+        TCLAP::ValueArg<unsigned int> arg_halving_epochs("","halving-epochs","Epochs of the first successive halving round",false,1,"epochs");
+        cmd.add(arg_halving_epochs);
+
+        // ensembles
+        TCLAP::ValueArg<unsigned int> arg_ensemble("","ensemble","Train this number of networks together as an ensemble (0: single network)",false,0,"number");
+        cmd.add(arg_ensemble);
+
+        // network topology
+        TCLAP::ValueArg<std::string> arg_conv("","conv","Convolutional layers in front of the dense layers as filters x kernel[/pooling], e.g. 8x5/2,16x3",false,"","spec");
+        cmd.add(arg_conv);
+        TCLAP::ValueArg<std::string> arg_hidden("","hidden","Sizes of the hidden dense layers, e.g. 100,100 (empty for none)",false,"30","sizes");
+        cmd.add(arg_hidden);
+
+        // cascade
+        TCLAP::ValueArg<std::string> arg_cascade("","cascade","Small network classifying the confident images in front of the input network",false,"","filename");
+        cmd.add(arg_cascade);
+        TCLAP::ValueArg<double> arg_margin("","margin","Score margin of the small network below which images fall through to the input network",false,0.5,"margin");
+        cmd.add(arg_margin);
+        TCLAP::ValueArg<double> arg_calibrate("","calibrate","Choose the margin on the test set for at most this loss in accuracy in percent",false,0.1,"percent");
+        cmd.add(arg_calibrate);
+
+        // memory
+        TCLAP::ValueArg<unsigned int> arg_activation_budget("","activation-budget","KiB of activations kept for back propagation; recompute the rest (0: unlimited)",false,0,"KiB");
+        cmd.add(arg_activation_budget);
+        TCLAP::SwitchArg arg_numa("","numa","place the datasets and parameters on the NUMA nodes of the threads using them (first touch)");
+        cmd.add(arg_numa);
+        TCLAP::ValueArg<std::string> arg_huge_pages("","huge-pages","Huge pages for the datasets (none, transparent or explicit)",false,"none","mode");
+        cmd.add(arg_huge_pages);
+        TCLAP::ValueArg<std::string> arg_pin("","pin","Pin the threads to cpus (compact, scatter or a list of cpus, e.g. 0-3,8)",false,"","spec");
+        cmd.add(arg_pin);
+
         cmd.parse(argc, argv);
 
         bool train = arg_train.getValue();
         const std::string input_filename = arg_input.getValue();
         const std::string output_filename = arg_output.getValue();
         const std::string image_filename = arg_image.getValue();
+        const std::string cache_directory = arg_cache.getValue();
+        const std::string stream_images = arg_stream_images.getValue();
+        const std::string stream_labels = arg_stream_labels.getValue();
+        const std::string batch_spec = arg_batch.getValue();
+
+        // several comma-separated networks form an ensemble
+        std::vector<std::string> input_filenames;
+        if(!input_filename.empty()) {
+            boost::split(input_filenames, input_filename, boost::is_any_of(","));
+        }
+
+        // hidden dense layers of new networks
+        std::vector<uint32_t> hidden;
+        {
+            std::vector<std::string> items;
+            if(!arg_hidden.getValue().empty()) {
+                boost::split(items, arg_hidden.getValue(), boost::is_any_of(","));
+            }
+            for(const auto& item : items) {
+                const int size = std::stoi(item);
+                if(size <= 0) {
+                    throw std::runtime_error("Invalid hidden layer size: " + item);
+                }
+                hidden.push_back(size);
+            }
+        }
+
+        // a sweep specification can also be stored in a file
+        std::string sweep_spec = arg_sweep.getValue();
+        if(!sweep_spec.empty() && boost::filesystem::is_regular_file(sweep_spec)) {
+            std::ifstream in(sweep_spec);
+            sweep_spec.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        // launch the training processes before any thread is started, as a forked
+        // process only inherits the calling thread and not the OpenMP thread pool
+        std::unique_ptr<SharedMemoryCommunicator> comm;
+        std::string rank_suffix;
+        if(train && arg_procs.getValue() > 1) {
+            comm = SharedMemoryCommunicator::launch(arg_procs.getValue());
+            if(comm->get_rank() != 0) {
+                // only the first process reports; the others write their own trace and metrics files
+                std::cout.setstate(std::ios::badbit);
+                rank_suffix = "." + std::to_string(comm->get_rank());
+            }
+        }
+
+        // the parameter server listens before its local workers are forked, such that they can connect right away
+        std::unique_ptr<ParameterServer> server;
+        std::unique_ptr<ParameterClient> client;
+        std::string ps_address = arg_ps_connect.getValue();
+        if(train && arg_ps_workers.getValue() > 0) {
+            if(comm) {
+                throw std::runtime_error("A parameter server cannot be combined with multiple processes");
+            }
+            server = std::make_unique<ParameterServer>(arg_ps_bind.getValue(), arg_ps_port.getValue(), arg_ps_workers.getValue(), arg_staleness.getValue());
+            if(arg_ps_local.getValue() && server->launch_local_workers()) {
+                ps_address = "127.0.0.1:" + std::to_string(server->get_port());
+                server.reset();
+                std::cout.setstate(std::ios::badbit);
+            } else {
+                std::cout << "Parameter server listening on port " << server->get_port() << std::endl;
+            }
+        }
+        if(train && !ps_address.empty()) {
+            if(comm) {
+                throw std::runtime_error("A parameter server worker cannot be combined with multiple processes");
+            }
+            client = std::make_unique<ParameterClient>(ps_address);
+            rank_suffix = ".worker" + std::to_string(client->get_worker());
+        }
+
+        // the training threads are started once all processes have been forked
+        TaskPool::get().set_nr_threads(arg_threads.getValue());
+        if(train && TaskPool::get().get_nr_threads() > 1) {
+            std::cout << boost::format("Training on %i threads (%.1f us per parallel loop)\n") % TaskPool::get().get_nr_threads() % (TaskPool::get().get_dispatch_time() * 1e-3);
+        }
+
+        // placement of the large arrays and the threads on the NUMA nodes
+        MemoryPlacement& placement = MemoryPlacement::get();
+        placement.set_huge_pages(MemoryPlacement::parse_huge_pages(arg_huge_pages.getValue()));
+        placement.set_first_touch(arg_numa.getValue());
+        if(!arg_pin.getValue().empty()) {
+            // processes on the same host use consecutive cores
+            const unsigned int rank = comm ? comm->get_rank() : (client ? client->get_worker() : 0);
+            placement.pin_threads(arg_pin.getValue(), rank * arg_threads.getValue());
+            std::cout << "Pinned the worker threads to cpus:";
+            for(int cpu : placement.get_pinned_cpus()) {
+                std::cout << " " << cpu;
+            }
+            std::cout << std::endl;
+        }
+
+        const std::string trace_filename = arg_trace.getValue().empty() ? "" : arg_trace.getValue() + rank_suffix;
+        const std::string metrics_filename = arg_metrics.getValue().empty() ? "" : arg_metrics.getValue() + rank_suffix;
+
+        if(!trace_filename.empty()) {
+            Trace::get().set_thread_name("main");
+            Trace::get().start(arg_trace_spans.getValue());
+        }
+
+        if(!metrics_filename.empty()) {
+#ifdef ENABLE_METRICS
+            Metrics::Format format;
+            if(arg_metrics_format.getValue() == "json") {
+                format = Metrics::Format::JSON;
+            } else if(arg_metrics_format.getValue() == "prometheus") {
+                format = Metrics::Format::PROMETHEUS;
+            } else {
+                throw std::runtime_error("Unknown metrics format: " + arg_metrics_format.getValue());
+            }
+            Metrics::get().set_output(metrics_filename, format);
+            if(arg_perf.getValue()) {
+                Metrics::get().enable_perf(arg_perf_fp_event.getValue().empty() ? 0 : std::stoull(arg_perf_fp_event.getValue(), nullptr, 0));
+            }
+#else
+            std::cerr << "Warning: metrics are not available, configure with -DENABLE_METRICS=ON" << std::endl;
+#endif
+        }
+
+        // a small network deciding the confident images in front of the full network
+        std::unique_ptr<NeuralNetwork> cascade_first;
+        std::unique_ptr<NeuralNetwork> cascade_full;
+        std::unique_ptr<Cascade> cascade;
+        if(!arg_cascade.getValue().empty()) {
+            if(train || arg_serve.getValue() || input_filenames.size() != 1) {
+                throw std::runtime_error("A cascade classifies images with the single network given as input");
+            }
+            cascade_first = std::make_unique<NeuralNetwork>(arg_cascade.getValue());
+            cascade_full = std::make_unique<NeuralNetwork>(input_filename);
+            cascade = std::make_unique<Cascade>(*cascade_first, *cascade_full, arg_margin.getValue());
+
+            if(arg_calibrate.isSet()) {
+                MNISTLoader ml;
+                ml.load_testset("../data/t10k-images-idx3-ubyte.gz", "../data/t10k-labels-idx1-ubyte.gz");
+                const auto testset = ml.get_testset();
+                const auto c = cascade->calibrate(testset, arg_calibrate.getValue() / 100.0);
+
+                std::cout << boost::format("Calibrated on %i images for an accuracy loss of at most %.2f%%\n") % testset->size() % arg_calibrate.getValue();
+                std::cout << boost::format("  small network: %6.2f%% at %7.2f us per image\n") % (100.0 * c.accuracy_first) % c.first_us;
+                std::cout << boost::format("  full network:  %6.2f%% at %7.2f us per image\n") % (100.0 * c.accuracy_full) % c.full_us;
+                std::cout << boost::format("  cascade:       %6.2f%% at %7.2f us per image (%.1f%% fall through)\n") % (100.0 * c.accuracy) % c.get_cascade_us() % (100.0 * c.escalated);
+                std::cout << boost::format("Use --margin %.6g to apply this threshold\n") % c.threshold;
+            }
+        }
 
         if(train) {
             auto start = std::chrono::system_clock::now();
 
-            if(output_filename.empty()) {
+            if(output_filename.empty() && !client && sweep_spec.empty()) {
                 throw std::runtime_error("You need to specify an output file");
             }
 
-            MNISTLoader ml;
-            ml.load_testset("../data/t10k-images-idx3-ubyte.gz", "../data/t10k-labels-idx1-ubyte.gz");
-            ml.load_trainingset("../data/train-images-idx3-ubyte.gz", "../data/train-labels-idx1-ubyte.gz");
+            const std::vector<std::string> training_files = {"../data/train-images-idx3-ubyte.gz", "../data/train-labels-idx1-ubyte.gz"};
+            const std::vector<std::string> test_files = {"../data/t10k-images-idx3-ubyte.gz", "../data/t10k-labels-idx1-ubyte.gz"};
 
-            auto trainingset = ml.get_trainingset();
-            auto testset = ml.get_testset();
+            std::shared_ptr<Dataset> trainingset;
+            std::shared_ptr<Dataset> testset;
+            std::unique_ptr<DatasetStream> stream;
 
-            std::unique_ptr<NeuralNetwork> nn;
+            if(!stream_images.empty()) {
+                if(comm || server || client) {
+                    throw std::runtime_error("Streaming is not supported with multiple processes");
+                }
 
-            if(input_filename.empty()) {
-                nn = std::make_unique<NeuralNetwork>(std::vector<uint32_t>({784,30,10}));
+                // stream the training data from disk and only keep the test set resident
+                auto streaming = std::make_unique<StreamingDataset>(stream_images, stream_labels, 10,
+                                                                    arg_shard_size.getValue(), arg_window.getValue(), 1,
+                                                                    arg_seed.isSet() ? arg_seed.getValue() : std::random_device{}());
+                std::cout << boost::format("Streaming %i samples using at most %i MiB\n") % streaming->size() % (streaming->get_max_resident_bytes() >> 20);
+                stream = std::move(streaming);
+
+                MNISTLoader ml;
+                ml.load_testset(test_files[0], test_files[1]);
+                testset = ml.get_testset();
+
+                // the network is evaluated on the MNIST test set
+                if(stream->get_nr_input_nodes() != testset->get_nr_input_nodes()) {
+                    throw std::runtime_error((boost::format("Streamed images have %i pixels, but the test set has %i") %
+                                              stream->get_nr_input_nodes() % testset->get_nr_input_nodes()).str());
+                }
             } else {
-                std::cout << "Loading network from: " << input_filename << std::endl;
-                nn = std::make_unique<NeuralNetwork>(input_filename);
+                // try to map previously decoded datasets
+                if(!cache_directory.empty()) {
+                    DatasetCache cache(cache_directory);
+                    trainingset = cache.load("mnist-train", training_files);
+                    testset = cache.load("mnist-test", test_files);
+                    if(trainingset && testset) {
+                        std::cout << "Using cached datasets from: " << cache_directory << std::endl;
+                    }
+                }
+
+                if(!trainingset || !testset) {
+                    MNISTLoader ml;
+                    ml.load(training_files[0], training_files[1], test_files[0], test_files[1]);
+
+                    trainingset = ml.get_trainingset();
+                    testset = ml.get_testset();
+
+                    if(!cache_directory.empty()) {
+                        try {
+                            DatasetCache cache(cache_directory);
+                            cache.store("mnist-train", training_files, *trainingset);
+                            cache.store("mnist-test", test_files, *testset);
+                        } catch(const std::exception& e) {
+                            std::cerr << "Warning: " << e.what() << std::endl;
+                        }
+                    }
+                }
+            }
+
+            // every process trains on its own part of the dataset
+            if(comm) {
+                trainingset = Dataset::shard(trainingset, comm->get_rank(), comm->get_size());
+                std::cout << boost::format("Training on %i processes with %i samples each\n") % comm->get_size() % trainingset->size();
+            }
+            if(client) {
+                trainingset = Dataset::shard(trainingset, client->get_worker(), client->get_nr_workers());
+            }
+
+            // mapped cache files were not placed when they were allocated
+            if(trainingset && (arg_numa.getValue() || arg_huge_pages.getValue() != "none")) {
+                const size_t bytes = trainingset->size() * trainingset->get_nr_input_nodes() * sizeof(double);
+                placement.distribute(trainingset->get_input_vector(0), bytes);
+                std::cout << "Training set on " << MemoryPlacement::get_nr_nodes() << " node(s), "
+                          << MemoryPlacement::describe(trainingset->get_input_vector(0), bytes) << std::endl;
+            }
+
+            if(!sweep_spec.empty() && (stream || comm || server || client || arg_augment.getValue())) {
+                throw std::runtime_error("A sweep requires a resident training set in a single process");
+            }
+            if(arg_ensemble.getValue() > 0 && (stream || comm || server || client || arg_augment.getValue() || !sweep_spec.empty())) {
+                throw std::runtime_error("An ensemble requires a resident training set in a single process");
+            }
+            if(!arg_conv.getValue().empty() && (!sweep_spec.empty() || arg_ensemble.getValue() > 0 || !input_filename.empty())) {
+                throw std::runtime_error("Convolutional layers can only be specified for a new network");
             }
 
-            nn->sgd(trainingset, testset, 10, 10, 3.0);
+            // distort the training images ahead of their use
+            if(arg_augment.getValue()) {
+                if(stream || server || client) {
+                    throw std::runtime_error("Augmentation requires a resident training set");
+                }
+
+                AugmentationParameters params;
+                params.elastic_alpha = arg_elastic.getValue();
+                stream = std::make_unique<Augmenter>(trainingset, 28, 28, params, 1000,
+                                                     arg_augment_threads.getValue(), arg_augment_seed.getValue());
+            }
+
+            if(!sweep_spec.empty()) {
+                // train all configurations concurrently on the data loaded above
+                const auto configs = arg_sweep_samples.getValue() > 0 ?
+                    Sweep::random(sweep_spec, arg_sweep_samples.getValue(), arg_seed.getValue()) :
+                    Sweep::grid(sweep_spec);
+                std::cout << boost::format("Sweeping %i configurations on %i threads\n") % configs.size() % arg_threads.getValue();
+
+                Sweep sweep(trainingset, testset, arg_threads.getValue(), arg_halving.getValue(), arg_halving_epochs.getValue(), arg_seed.getValue());
+                const auto results = sweep.run(configs);
+                Sweep::write_table(std::cout, results);
+
+                if(!output_filename.empty()) {
+                    std::ofstream out(output_filename);
+                    if(!out.is_open()) {
+                        throw std::runtime_error("Cannot open " + output_filename + " for writing");
+                    }
+                    std::cout << "Writing to " << output_filename << std::endl;
+                    Sweep::write_csv(out, results);
+                }
+            } else if(arg_ensemble.getValue() > 0) {
+                // all members are trained on the same mini batches
+                std::unique_ptr<Ensemble> ensemble;
+                if(input_filenames.empty()) {
+                    std::vector<uint32_t> sizes = {trainingset->get_nr_input_nodes()};
+                    sizes.insert(sizes.end(), hidden.begin(), hidden.end());
+                    sizes.push_back(10);
+                    ensemble = std::make_unique<Ensemble>(sizes, arg_ensemble.getValue(), arg_seed.isSet() ? arg_seed.getValue() : std::random_device{}());
+                } else {
+                    std::cout << "Loading ensemble from: " << input_filename << std::endl;
+                    ensemble = std::make_unique<Ensemble>(input_filenames);
+                    if(ensemble->get_nr_members() != arg_ensemble.getValue()) {
+                        throw std::runtime_error("The number of input networks does not match the size of the ensemble");
+                    }
+                }
+
+                ensemble->sgd(trainingset, testset, 10, 10, 3.0);
+
+                for(unsigned int k=0; k<ensemble->get_nr_members(); k++) {
+                    const std::string filename = Ensemble::member_filename(output_filename, k);
+                    std::cout << "Writing to " << filename << std::endl;
+                    ensemble->get_member(k)->save_network(filename);
+                }
+            } else {
+                std::unique_ptr<NeuralNetwork> nn;
 
-            std::cout << "Writing to " << output_filename << std::endl;
-            nn->save_network(output_filename);
+                if(input_filename.empty()) {
+                    const uint32_t nr_inputs = stream ? stream->get_nr_input_nodes() : trainingset->get_nr_input_nodes();
+                    std::vector<uint32_t> sizes = {nr_inputs};
+                    sizes.insert(sizes.end(), hidden.begin(), hidden.end());
+                    sizes.push_back(10);
+                    if(!arg_conv.getValue().empty()) {
+                        // the inputs are square single-channel images
+                        const uint32_t side = std::lround(std::sqrt((double)nr_inputs));
+                        if(side * side != nr_inputs) {
+                            throw std::runtime_error("Convolutional layers require square input images");
+                        }
+                        const auto conv = ConvLayer::parse(arg_conv.getValue(), 1, side, side);
+                        sizes.front() = conv.back().get_nr_outputs();
+                        nn = std::make_unique<NeuralNetwork>(conv, sizes, arg_seed.isSet() ? arg_seed.getValue() : std::random_device{}());
+                    } else if(arg_seed.isSet()) {
+                        nn = std::make_unique<NeuralNetwork>(sizes, arg_seed.getValue());
+                    } else {
+                        nn = std::make_unique<NeuralNetwork>(sizes);
+                    }
+                } else {
+                    std::cout << "Loading network from: " << input_filename << std::endl;
+                    nn = std::make_unique<NeuralNetwork>(input_filename);
+                    if(arg_seed.isSet()) {
+                        nn->set_seed(arg_seed.getValue());
+                    }
+                }
+                nn->set_deterministic(arg_deterministic.getValue());
+                nn->set_communicator(comm.get(), arg_average_every.getValue());
+                nn->distribute_parameters();
+                if(arg_activation_budget.getValue() > 0) {
+                    const size_t full = nn->get_activation_memory();
+                    nn->set_activation_budget((size_t)arg_activation_budget.getValue() << 10);
+                    std::cout << boost::format("Keeping %i of %i bytes of activations at layers:") % nn->get_activation_memory() % full;
+                    for(unsigned int l : nn->get_checkpoints()) {
+                        std::cout << " " << l;
+                    }
+                    std::cout << (nn->get_checkpoints().empty() ? " all" : "") << std::endl;
+                }
+
+                if(client) {
+                    client->train(*nn, trainingset, 10, 10);
+                } else if(server) {
+                    // the server applies the gradients of the workers and reports once per epoch
+                    std::cout << boost::format("Serving %i workers with a staleness of %i mini batches\n") % arg_ps_workers.getValue() % arg_staleness.getValue();
+                    auto serve_start = std::chrono::steady_clock::now();
+                    const size_t epoch = (trainingset->size() / arg_ps_workers.getValue()) * arg_ps_workers.getValue();
+                    std::vector<double> params;
+                    nn->get_parameters(params);
+                    server->serve(params, 3.0, epoch, [&](size_t samples, const std::vector<double>& snapshot) {
+                        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - serve_start).count();
+                        nn->set_parameters(snapshot);
+                        const size_t hits = nn->evaluate(testset);
+                        std::cout << boost::format("%4i | %i / %i | %.0f samples/s\n") % (samples / epoch) % hits % testset->size() % (samples / seconds);
+                    });
+                    nn->set_parameters(params);
+                } else if(stream) {
+                    nn->sgd(*stream, testset, 10, 10, 3.0);
+                } else {
+                    nn->sgd(trainingset, testset, 10, 10, 3.0);
+                }
+
+                if(comm) {
+                    const unsigned int failed = comm->finalize();
+                    if(failed > 0) {
+                        throw std::runtime_error(std::to_string(failed) + " training process(es) failed");
+                    }
+                }
+
+                if((!comm || comm->get_rank() == 0) && !client) {
+                    std::cout << "Writing to " << output_filename << std::endl;
+                    nn->save_network(output_filename);
+                }
+
+            }
 
             auto end = std::chrono::system_clock::now();
             auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
             std::cout << boost::format("Total elapsed time: %f ms\n") % elapsed.count();
             std::cout << "--------------------------------------------------------------" << std::endl;
-        } else {
+        } else if(arg_serve.getValue()) {
             /*
-             * Read sample image and predict number
+             * Serve classification requests until terminated
              */
             if(input_filename.empty()) {
                 throw std::runtime_error("You need to specify an input file for the network");
             }
 
-            if(image_filename.empty()) {
-                throw std::runtime_error("You need to specify an image file");
+            ModelHandle model(input_filename);
+            if(arg_watch.getValue() > 0) {
+                model.watch(std::chrono::milliseconds(arg_watch.getValue()));
+            }
+            InferenceServer server(model, arg_batch_size.getValue(), std::chrono::microseconds(arg_max_latency.getValue()));
+            server.set_preprocess(arg_preprocess.getValue());
+
+            if(arg_socket.getValue().empty()) {
+                std::cerr << "Serving requests on standard input" << std::endl;
+                server.serve_stdio();
+                std::cerr << server.get_statistics() << std::endl;
+            } else {
+                std::cerr << "Serving requests on " << arg_socket.getValue() << std::endl;
+                server.serve_socket(arg_socket.getValue());
+            }
+        } else if(!batch_spec.empty()) {
+            /*
+             * Classify many images using a single network load
+             */
+            if(input_filename.empty()) {
+                throw std::runtime_error("You need to specify an input file for the network");
             }
 
-            // load neural network from file
-            NeuralNetwork nn(input_filename);
+            BatchClassifier::OutputFormat format;
+            if(arg_format.getValue() == "csv") {
+                format = BatchClassifier::OutputFormat::CSV;
+            } else if(arg_format.getValue() == "json") {
+                format = BatchClassifier::OutputFormat::JSON;
+            } else {
+                throw std::runtime_error("Unknown output format: " + arg_format.getValue());
+            }
 
-            // grab image
-            std::cout << "Reading " << image_filename << std::endl;
-            std::vector<uint8_t> buffer;
-            png_uint_32 width, height;
-            int col, bit_depth;
-            PNG::load_image_buffer_from_png(image_filename, buffer, &width, &height, &col, &bit_depth);
+            std::unique_ptr<NeuralNetwork> nn;
+            if(!cascade) {
+                nn = std::make_unique<NeuralNetwork>(input_filename);
+            }
+            BatchClassifier bc(cascade ? *cascade_full : *nn, arg_batch_size.getValue(), arg_threads.getValue());
+            bc.set_preprocess(arg_preprocess.getValue());
+            bc.set_cascade(cascade.get());
+            const auto files = BatchClassifier::collect_files(batch_spec);
 
-            if(width != 28 || height != 28) {
-                throw std::runtime_error("Image needs to be 28x28 px!");
+            auto start = std::chrono::system_clock::now();
+            size_t nr_failed = 0;
+            if(output_filename.empty()) {
+                nr_failed = bc.classify(files, std::cout, format);
+            } else {
+                std::ofstream out(output_filename);
+                if(!out.is_open()) {
+                    throw std::runtime_error("Cannot open " + output_filename + " for writing");
+                }
+                nr_failed = bc.classify(files, out, format);
             }
+            auto end = std::chrono::system_clock::now();
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
 
-            if(col != PNG_COLOR_TYPE_GRAY) {
-                throw std::runtime_error("Image needs to be saved in grayscale with no alpha channel!");
+            std::cerr << boost::format("Classified %i images (%i failed) in %i ms\n") % files.size() % nr_failed % elapsed.count();
+            if(cascade) {
+                std::cerr << boost::format("%i images fell through to the full network\n") % cascade->get_nr_escalated();
+            }
+        } else if(!image_filename.empty() || !cascade || !arg_calibrate.isSet()) {
+            /*
+             * Read sample image and predict number
+             */
+            if(input_filename.empty()) {
+                throw std::runtime_error("You need to specify an input file for the network");
+            }
+
+            if(image_filename.empty()) {
+                throw std::runtime_error("You need to specify an image file");
             }
 
-            // conver to input structure
-            std::vector<double> in;
-            for(unsigned int i=0; i<buffer.size(); i++) {
-                in.push_back((double)buffer[i] / 255.0);
+            // load neural network(s) from file
+            std::unique_ptr<NeuralNetwork> nn;
+            std::unique_ptr<Ensemble> ensemble;
+            if(input_filenames.size() > 1) {
+                ensemble = std::make_unique<Ensemble>(input_filenames);
+            } else if(!cascade) {
+                nn = std::make_unique<NeuralNetwork>(input_filename);
             }
 
-            // perform feed forward and output result
-            nn.feed_forward(in);
-            auto v = nn.get_output();
+            // grab image and convert to input structure
+            std::cout << "Reading " << image_filename << std::endl;
+            std::vector<double> in(ensemble ? ensemble->get_sizes().front() : (cascade ? cascade_full : nn)->get_nr_inputs());
+            BatchClassifier::load_input_vector(image_filename, &in[0], arg_preprocess.getValue());
+
+            // perform feed forward and output result (averaged over the ensemble)
+            std::vector<double> v;
+            if(cascade) {
+                v.resize(cascade_full->get_sizes().back());
+                cascade->classify_batch(&in[0], 1, &v[0]);
+                std::cout << "Decided by the " << (cascade->get_nr_escalated() > 0 ? "full" : "small") << " network" << std::endl;
+            } else {
+                v = ensemble ? ensemble->predict(&in[0]) : nn->predict(&in[0]);
+            }
             std::cout << "--------------------------------------------------------------" << std::endl;
             std::cout << "This image is classified as \"";
             std::cout << std::distance(v.begin(), std::max_element(v.begin(), v.end()));
@@ -147,6 +693,14 @@ int main(int argc, char* argv[]) {
             std::cout << "--------------------------------------------------------------" << std::endl;
         }
 
+        if(!trace_filename.empty()) {
+            Trace::get().write(trace_filename);
+            std::cerr << "Timeline written to " << trace_filename << std::endl;
+            if(Trace::get().get_nr_dropped() > 0) {
+                std::cerr << boost::format("Recording stopped after %i spans, raise --trace-spans to cover more of the run\n") % arg_trace_spans.getValue();
+            }
+        }
+
     } catch (TCLAP::ArgException &e) {
         std::cerr << "error: " << e.error() <<
                      " for arg " << e.argId() << std::endl;
@@ -0,0 +1,520 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "parameter_server.h"
+
+#include <iostream>
+#include <sys/prctl.h>
+#include <boost/format.hpp>
+
+/**
+ * @brief      Write a buffer to a connection
+ *
+ * @param[in]  fd    connection
+ * @param[in]  data  buffer
+ * @param[in]  n     number of bytes
+ */
+static void write_all(int fd, const void* data, size_t n) {
+    const char* ptr = static_cast<const char*>(data);
+    while(n > 0) {
+        ssize_t written = write(fd, ptr, n);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            throw std::runtime_error("Cannot write to connection: " + std::string(strerror(errno)));
+        }
+        ptr += written;
+        n -= written;
+    }
+}
+
+/**
+ * @brief      Read a buffer from a connection
+ *
+ * @param[in]  fd    connection
+ * @param      data  buffer
+ * @param[in]  n     number of bytes
+ */
+static void read_all(int fd, void* data, size_t n) {
+    char* ptr = static_cast<char*>(data);
+    while(n > 0) {
+        ssize_t nread = read(fd, ptr, n);
+        if(nread < 0 && errno == EINTR) {
+            continue;
+        }
+        if(nread == 0) {
+            throw std::runtime_error("Connection closed");
+        }
+        if(nread < 0) {
+            throw std::runtime_error("Cannot read from connection: " + std::string(strerror(errno)));
+        }
+        ptr += nread;
+        n -= nread;
+    }
+}
+
+/**
+ * @brief      Constructs the server and starts listening
+ *
+ * @param[in]  _address     IPv4 address to listen on, e.g. 127.0.0.1
+ * @param[in]  _port        TCP port, 0 to pick a free one
+ * @param[in]  _nr_workers  number of workers to wait for
+ * @param[in]  _staleness   maximum clock difference between workers
+ */
+ParameterServer::ParameterServer(const std::string& _address, uint16_t _port, unsigned int _nr_workers, unsigned int _staleness) :
+nr_workers(_nr_workers),
+staleness(_staleness),
+params(nullptr),
+eta(0.0),
+nr_samples(0),
+nr_updates(0) {
+    if(this->nr_workers == 0) {
+        throw std::runtime_error("A parameter server needs at least one worker");
+    }
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_port);
+    if(inet_pton(AF_INET, _address.c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("Invalid IPv4 address to listen on: " + _address);
+    }
+
+    this->sfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(this->sfd < 0) {
+        throw std::runtime_error("Cannot create socket");
+    }
+
+    int one = 1;
+    setsockopt(this->sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    socklen_t len = sizeof(addr);
+    if(bind(this->sfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(this->sfd, 64) != 0 ||
+       getsockname(this->sfd, (struct sockaddr*)&addr, &len) != 0) {
+        close(this->sfd);
+        throw std::runtime_error("Cannot listen on port " + std::to_string(_port) + ": " + strerror(errno));
+    }
+    this->port = ntohs(addr.sin_port);
+}
+
+/**
+ * @brief      Destructor; waits for local worker processes
+ */
+ParameterServer::~ParameterServer() {
+    close(this->sfd);
+
+    for(pid_t pid : this->local_workers) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+/**
+ * @brief      Fork the workers on the local host
+ *
+ * @return     whether the calling process is a worker
+ */
+bool ParameterServer::launch_local_workers() {
+    // buffered output would otherwise be written by every process
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+
+    const pid_t server = getpid();
+    for(unsigned int i=0; i<this->nr_workers; i++) {
+        const pid_t pid = fork();
+        if(pid < 0) {
+            throw std::runtime_error("Cannot fork worker process: " + std::string(strerror(errno)));
+        }
+
+        if(pid == 0) {
+            // do not outlive the server
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if(getppid() != server) {
+                _exit(-1);
+            }
+            this->local_workers.clear();
+            return true;
+        }
+
+        this->local_workers.push_back(pid);
+    }
+
+    return false;
+}
+
+/**
+ * @brief      Serve the workers until all of them have finished
+ *
+ * @param      _params          parameters, updated in place
+ * @param[in]  _eta             learning rate
+ * @param[in]  report_interval  samples between two reports
+ * @param[in]  report           called with the number of samples and a
+ *                              copy of the parameters
+ */
+void ParameterServer::serve(std::vector<double>& _params, double _eta, size_t report_interval,
+                            const std::function<void(size_t, const std::vector<double>&)>& report) {
+    // a worker closing its connection early must not terminate the server
+    signal(SIGPIPE, SIG_IGN);
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->params = &_params;
+        this->eta = _eta;
+        this->workers.assign(this->nr_workers, WorkerState());
+        this->nr_samples = 0;
+        this->nr_updates = 0;
+    }
+
+    // workers are numbered in the order they connect
+    std::vector<std::thread> threads;
+    for(unsigned int w=0; w<this->nr_workers; w++) {
+        // local workers that died before connecting would otherwise be waited for forever
+        struct pollfd pfd = {this->sfd, POLLIN, 0};
+        const int ready = poll(&pfd, 1, 1000);
+        if(ready == 0 || (ready < 0 && errno == EINTR)) {
+            if(this->local_workers_lost()) {
+                std::cerr << boost::format("Lost the local workers; continuing with %i of %i workers\n") % w % this->nr_workers;
+                std::lock_guard<std::mutex> lock(this->mtx);
+                for(; w<this->nr_workers; w++) {
+                    this->workers[w].done = true;
+                }
+                break;
+            }
+            w--;
+            continue;
+        }
+
+        int cfd = accept(this->sfd, NULL, NULL);
+        if(cfd < 0) {
+            if(errno == EINTR) {
+                w--;
+                continue;
+            }
+            std::cerr << "Cannot accept worker: " << strerror(errno) << std::endl;
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->workers[w].done = true;
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        threads.emplace_back(&ParameterServer::serve_worker, this, cfd, w);
+    }
+
+    size_t next_report = report_interval;
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while(true) {
+        auto all_done = [this]() {
+            return std::all_of(this->workers.begin(), this->workers.end(), [](const WorkerState& w) { return w.done; });
+        };
+        this->cv.wait(lock, [&]() {
+            return all_done() || (report_interval > 0 && this->nr_samples >= next_report);
+        });
+
+        if(report_interval > 0 && this->nr_samples >= next_report) {
+            // report on a snapshot, such that the workers are not held up
+            const std::vector<double> snapshot(*this->params);
+            const size_t samples = this->nr_samples;
+            while(next_report <= samples) {
+                next_report += report_interval;
+            }
+            lock.unlock();
+            report(samples, snapshot);
+            lock.lock();
+            continue;
+        }
+
+        break;
+    }
+    lock.unlock();
+
+    for(auto& t : threads) {
+        t.join();
+    }
+}
+
+/**
+ * @brief      Handle the messages of a worker (connection thread)
+ *
+ * @param[in]  fd      connection
+ * @param[in]  worker  worker index
+ */
+void ParameterServer::serve_worker(int fd, unsigned int worker) {
+    Trace::get().set_thread_name((boost::format("worker %i") % worker).str());
+
+    try {
+        ParameterMessage hello = {ParameterMessage::HELLO, worker, this->nr_workers, 0, 0.0};
+        write_all(fd, &hello, sizeof(hello));
+
+        std::vector<double> buffer;
+        while(true) {
+            ParameterMessage msg;
+            read_all(fd, &msg, sizeof(msg));
+
+            if(msg.type == ParameterMessage::PULL) {
+                ParameterMessage reply = {ParameterMessage::PULL, worker, 0, 0, 0.0};
+                {
+                    NN_TRACE_SPAN("ps", "pull");
+                    std::unique_lock<std::mutex> lock(this->mtx);
+                    this->cv.wait(lock, [&]() { return this->within_staleness(msg.clock); });
+                    buffer = *this->params;
+                    reply.clock = this->nr_updates;
+                }
+                reply.length = buffer.size();
+                write_all(fd, &reply, sizeof(reply));
+                write_all(fd, buffer.data(), buffer.size() * sizeof(double));
+            } else if(msg.type == ParameterMessage::PUSH) {
+                // the parameters are not resized while serving
+                if(msg.length != this->params->size()) {
+                    throw std::runtime_error("Gradient does not match the parameters");
+                }
+                if(!(msg.batch_size > 0.0)) {
+                    throw std::runtime_error("Invalid batch size of gradient");
+                }
+                buffer.resize(msg.length);
+                read_all(fd, buffer.data(), buffer.size() * sizeof(double));
+                {
+                    NN_TRACE_SPAN("ps", "apply gradient");
+                    std::lock_guard<std::mutex> lock(this->mtx);
+                    const double factor = this->eta / msg.batch_size;
+                    double* p = this->params->data();
+                    #pragma omp simd
+                    for(size_t j=0; j<buffer.size(); j++) {
+                        p[j] -= factor * buffer[j];
+                    }
+                    this->workers[worker].clock = msg.clock;
+                    this->nr_samples += (size_t)msg.batch_size;
+                    this->nr_updates++;
+                }
+                this->cv.notify_all();
+            } else if(msg.type == ParameterMessage::DONE) {
+                break;
+            } else {
+                throw std::runtime_error("Invalid message");
+            }
+        }
+    } catch(const std::exception& e) {
+        std::cerr << boost::format("Worker %i failed: %s\n") % worker % e.what();
+    }
+
+    close(fd);
+
+    // a finished worker no longer holds back the others
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->workers[worker].done = true;
+    }
+    this->cv.notify_all();
+}
+
+/**
+ * @brief      Reap the local workers that have exited
+ *
+ * @return     whether a worker failed or all of them have exited
+ */
+bool ParameterServer::local_workers_lost() {
+    if(this->local_workers.empty()) {
+        return false;
+    }
+
+    bool failed = false;
+    for(auto it = this->local_workers.begin(); it != this->local_workers.end();) {
+        int status = 0;
+        if(waitpid(*it, &status, WNOHANG) == *it) {
+            failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            it = this->local_workers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return failed || this->local_workers.empty();
+}
+
+/**
+ * @brief      Check whether a worker may receive parameters
+ *
+ * @param[in]  clock  clock of the requesting worker
+ *
+ * @return     whether no unfinished worker lags more than the staleness
+ */
+bool ParameterServer::within_staleness(uint64_t clock) const {
+    for(const auto& w : this->workers) {
+        if(!w.done && w.clock + this->staleness < clock) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief      Connect to a parameter server
+ *
+ * @param[in]  address  host:port
+ */
+ParameterClient::ParameterClient(const std::string& address) :
+fd(-1),
+clock(0) {
+    const size_t sep = address.rfind(':');
+    if(sep == std::string::npos) {
+        throw std::runtime_error("Invalid server address (expected host:port): " + address);
+    }
+    const std::string host = address.substr(0, sep);
+    const std::string service = address.substr(sep + 1);
+
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if(getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0) {
+        throw std::runtime_error("Cannot resolve server address: " + address);
+    }
+
+    // the server may still be starting up
+    for(unsigned int attempt=0; attempt<50 && this->fd < 0; attempt++) {
+        for(struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+            int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if(s < 0) {
+                continue;
+            }
+            if(connect(s, ai->ai_addr, ai->ai_addrlen) == 0) {
+                this->fd = s;
+                break;
+            }
+            close(s);
+        }
+        if(this->fd < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    freeaddrinfo(result);
+
+    if(this->fd < 0) {
+        throw std::runtime_error("Cannot connect to parameter server at " + address);
+    }
+
+    int one = 1;
+    setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    ParameterMessage hello;
+    read_all(this->fd, &hello, sizeof(hello));
+    if(hello.type != ParameterMessage::HELLO) {
+        close(this->fd);
+        throw std::runtime_error("Invalid response of parameter server");
+    }
+    this->worker = hello.worker;
+    this->nr_workers = hello.clock;
+}
+
+/**
+ * @brief      Destructor; closes the connection
+ */
+ParameterClient::~ParameterClient() {
+    close(this->fd);
+}
+
+/**
+ * @brief      Get the parameters
+ *
+ * @param      params  receives the parameters
+ */
+void ParameterClient::pull(std::vector<double>& params) {
+    NN_TRACE_SPAN("ps", "pull");
+
+    ParameterMessage msg = {ParameterMessage::PULL, this->worker, this->clock, 0, 0.0};
+    write_all(this->fd, &msg, sizeof(msg));
+
+    read_all(this->fd, &msg, sizeof(msg));
+    if(msg.type != ParameterMessage::PULL) {
+        throw std::runtime_error("Invalid response of parameter server");
+    }
+    params.resize(msg.length);
+    read_all(this->fd, params.data(), params.size() * sizeof(double));
+}
+
+/**
+ * @brief      Send the gradient sum of a mini batch
+ *
+ * @param[in]  gradient    gradient sum
+ * @param[in]  batch_size  number of samples in the sum
+ */
+void ParameterClient::push(const std::vector<double>& gradient, size_t batch_size) {
+    NN_TRACE_SPAN("ps", "push");
+
+    this->clock++;
+    ParameterMessage msg = {ParameterMessage::PUSH, this->worker, this->clock, gradient.size(), (double)batch_size};
+    write_all(this->fd, &msg, sizeof(msg));
+    write_all(this->fd, gradient.data(), gradient.size() * sizeof(double));
+}
+
+/**
+ * @brief      Tell the server that this worker has finished
+ */
+void ParameterClient::done() {
+    ParameterMessage msg = {ParameterMessage::DONE, this->worker, this->clock, 0, 0.0};
+    write_all(this->fd, &msg, sizeof(msg));
+}
+
+/**
+ * @brief      Perform stochastic gradient descent as a worker
+ *
+ * @param      nn               network computing the gradients
+ * @param[in]  dataset          training dataset of this worker
+ * @param[in]  epochs           number of epochs
+ * @param[in]  mini_batch_size  batch size
+ */
+void ParameterClient::train(NeuralNetwork& nn, const std::shared_ptr<Dataset>& trainingset, unsigned int epochs, unsigned int mini_batch_size) {
+    std::vector<size_t> batches(trainingset->size());
+    for(size_t i=0; i<trainingset->size(); i++) {
+        batches[i] = i;
+    }
+
+    std::vector<double> params;
+    std::vector<double> gradient;
+
+    for(unsigned int j=0; j<epochs; j++) {
+        nn.shuffle(batches);
+
+        for(size_t i=0; i<trainingset->size(); i+= mini_batch_size) {
+            const size_t batch_size = std::min((size_t)mini_batch_size, trainingset->size() - i);
+
+            this->pull(params);
+            nn.set_parameters(params);
+
+            NN_METRICS_SAMPLES(batch_size);
+            NN_TRACE_SPAN("train", "mini batch");
+
+            nn.get_gradient(trainingset, batches, i, batch_size, gradient);
+            this->push(gradient, batch_size);
+        }
+    }
+
+    this->done();
+}
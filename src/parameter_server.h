@@ -0,0 +1,264 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _PARAMETER_SERVER_H
+#define _PARAMETER_SERVER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "trace.h"
+#include "neural_network.h"
+
+/**
+ * @brief      Messages between parameter server and workers
+ *
+ * Every message starts with this header, followed by `length` doubles.
+ */
+struct ParameterMessage {
+    enum Type : uint32_t {
+        HELLO = 1,                          //!< server -> worker: worker index and number of workers
+        PULL = 2,                           //!< worker -> server: request parameters; server -> worker: parameters
+        PUSH = 3,                           //!< worker -> server: gradient sum of a mini batch
+        DONE = 4                            //!< worker -> server: worker has finished
+    };
+
+    uint32_t type;                          //!< message type
+    uint32_t worker;                        //!< worker index
+    uint64_t clock;                         //!< mini batches completed by the worker
+    uint64_t length;                        //!< number of doubles following the header
+    double batch_size;                      //!< samples in the gradient sum (PUSH)
+};
+
+/**
+ * @brief      Server owning the network parameters of an asynchronous,
+ *             distributed training run
+ *
+ * Workers pull the current parameters, compute the gradient of a mini batch
+ * on their own part of the training data and push it back, upon which the
+ * server immediately corrects the parameters. Consistency is bounded by
+ * stale synchronous parallel (SSP) scheduling: a worker that has completed
+ * c mini batches only receives parameters once every other worker has
+ * completed at least c - staleness mini batches. Fast workers are therefore
+ * never blocked by slow ones unless they run too far ahead; a staleness of
+ * zero makes the training bulk-synchronous.
+ */
+class ParameterServer {
+private:
+    /**
+     * @brief      Progress of a worker
+     */
+    struct WorkerState {
+        uint64_t clock = 0;                 //!< mini batches pushed
+        bool done = false;                  //!< whether the worker has finished
+    };
+
+    int sfd;                                //!< listening socket
+    uint16_t port;                          //!< port of the listening socket
+    unsigned int nr_workers;                //!< number of workers to wait for
+    unsigned int staleness;                 //!< maximum clock difference between workers
+    std::vector<pid_t> local_workers;       //!< forked worker processes
+
+    std::mutex mtx;                         //!< guards the fields below
+    std::condition_variable cv;             //!< signals progress of the workers
+    std::vector<double>* params;            //!< parameters being trained
+    double eta;                             //!< learning rate
+    std::vector<WorkerState> workers;       //!< progress per worker
+    size_t nr_samples;                      //!< samples in all pushed gradients
+    size_t nr_updates;                      //!< pushed gradients
+    std::string error;                      //!< first error of a connection
+
+public:
+    /**
+     * @brief      Constructs the server and starts listening
+     *
+     * The server does not authenticate its workers; only bind it to an
+     * address other than the loopback one in a trusted network.
+     *
+     * @param[in]  _address     IPv4 address to listen on, e.g. 127.0.0.1
+     * @param[in]  _port        TCP port, 0 to pick a free one
+     * @param[in]  _nr_workers  number of workers to wait for
+     * @param[in]  _staleness   maximum clock difference between workers
+     */
+    ParameterServer(const std::string& _address, uint16_t _port, unsigned int _nr_workers, unsigned int _staleness);
+
+    /**
+     * @brief      Destructor; waits for local worker processes
+     */
+    ~ParameterServer();
+
+    ParameterServer(const ParameterServer&) = delete;
+
+    ParameterServer& operator=(const ParameterServer&) = delete;
+
+    /**
+     * @brief      Fork the workers on the local host
+     *
+     * Every child returns true and should connect to the server as a worker,
+     * after destroying its copy of the server; the server returns false.
+     * Has to be called before any thread is started.
+     *
+     * @return     whether the calling process is a worker
+     */
+    bool launch_local_workers();
+
+    /**
+     * @brief      Gets the port the server listens on.
+     *
+     * @return     The port.
+     */
+    inline uint16_t get_port() const {
+        return this->port;
+    }
+
+    /**
+     * @brief      Serve the workers until all of them have finished
+     *
+     * @param      _params          parameters, updated in place
+     * @param[in]  _eta             learning rate
+     * @param[in]  report_interval  samples between two reports
+     * @param[in]  report           called with the number of samples and a
+     *                              copy of the parameters
+     */
+    void serve(std::vector<double>& _params, double _eta, size_t report_interval,
+               const std::function<void(size_t, const std::vector<double>&)>& report);
+
+private:
+    /**
+     * @brief      Handle the messages of a worker (connection thread)
+     *
+     * @param[in]  fd      connection
+     * @param[in]  worker  worker index
+     */
+    void serve_worker(int fd, unsigned int worker);
+
+    /**
+     * @brief      Reap the local workers that have exited
+     *
+     * @return     whether a worker failed or all of them have exited
+     */
+    bool local_workers_lost();
+
+    /**
+     * @brief      Check whether a worker may receive parameters
+     *
+     * @param[in]  clock  clock of the requesting worker
+     *
+     * @return     whether no unfinished worker lags more than the staleness
+     */
+    bool within_staleness(uint64_t clock) const;
+};
+
+/**
+ * @brief      Connection of a worker to the parameter server
+ */
+class ParameterClient {
+private:
+    int fd;                                 //!< connection
+    unsigned int worker;                    //!< index of this worker
+    unsigned int nr_workers;                //!< number of workers
+    uint64_t clock;                         //!< mini batches pushed
+
+public:
+    /**
+     * @brief      Connect to a parameter server
+     *
+     * @param[in]  address  host:port
+     */
+    ParameterClient(const std::string& address);
+
+    /**
+     * @brief      Destructor; closes the connection
+     */
+    ~ParameterClient();
+
+    ParameterClient(const ParameterClient&) = delete;
+
+    ParameterClient& operator=(const ParameterClient&) = delete;
+
+    inline unsigned int get_worker() const {
+        return this->worker;
+    }
+
+    inline unsigned int get_nr_workers() const {
+        return this->nr_workers;
+    }
+
+    /**
+     * @brief      Get the parameters, waiting while this worker is more than
+     *             the staleness ahead of the slowest worker
+     *
+     * @param      params  receives the parameters
+     */
+    void pull(std::vector<double>& params);
+
+    /**
+     * @brief      Send the gradient sum of a mini batch
+     *
+     * @param[in]  gradient    gradient sum
+     * @param[in]  batch_size  number of samples in the sum
+     */
+    void push(const std::vector<double>& gradient, size_t batch_size);
+
+    /**
+     * @brief      Tell the server that this worker has finished
+     */
+    void done();
+
+    /**
+     * @brief      Perform stochastic gradient descent as a worker, the
+     *             server owning the parameters and applying the learning rate
+     *
+     * @param      nn               network computing the gradients
+     * @param[in]  dataset          training dataset of this worker
+     * @param[in]  epochs           number of epochs
+     * @param[in]  mini_batch_size  batch size
+     */
+    void train(NeuralNetwork& nn, const std::shared_ptr<Dataset>& dataset, unsigned int epochs, unsigned int mini_batch_size);
+};
+
+#endif // _PARAMETER_SERVER_H
@@ -0,0 +1,176 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "perf_counters.h"
+
+const char* PerfCounters::event_names[PerfCounters::NR_EVENTS] = {"cycles", "instructions", "cache_misses", "branch_misses", "fp_events", "node_misses"};
+
+/**
+ * @brief      Constructs the counters (no counters are opened yet)
+ *
+ * @param[in]  _fp_event  raw event code counting fp operations (0 for none)
+ */
+PerfCounters::PerfCounters(uint64_t _fp_event) :
+fp_event(_fp_event) {
+    std::fill(this->available, this->available + NR_EVENTS, false);
+}
+
+PerfCounters::~PerfCounters() {
+    this->close();
+}
+
+/**
+ * @brief      Open the counters in every thread of the task pool
+ *
+ * @return     whether any counter is available
+ */
+bool PerfCounters::open() {
+    this->close();
+    this->groups.resize(TaskPool::get().get_nr_threads());
+
+    // counters only count the thread that opened them
+    TaskPool::get().run(this->groups.size(), [this](unsigned int t) {
+        this->open_group(this->groups[t]);
+    });
+
+    for(unsigned int i=0; i<NR_EVENTS; i++) {
+        this->available[i] = !this->groups.empty();
+        for(const Group& g : this->groups) {
+            this->available[i] = this->available[i] && g.fds[i] >= 0;
+        }
+    }
+
+    if(!this->available[CYCLES]) {
+        if(this->error.empty()) {
+            this->error = "cycle counter not available";
+        }
+        this->close();
+        std::fill(this->available, this->available + NR_EVENTS, false);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief      Read the counters of all threads
+ *
+ * Counts are scaled when the kernel had to multiplex the counters.
+ *
+ * @param      values  counts per thread and event (nr_threads x NR_EVENTS)
+ */
+void PerfCounters::read(uint64_t* values) const {
+    // layout of PERF_FORMAT_GROUP with the enabled and running times
+    uint64_t buffer[3 + NR_EVENTS];
+
+    for(unsigned int t=0; t<this->groups.size(); t++) {
+        const Group& g = this->groups[t];
+        uint64_t* v = values + t * NR_EVENTS;
+        std::fill(v, v + NR_EVENTS, 0);
+
+        if(g.leader < 0 || ::read(g.leader, buffer, sizeof(buffer)) <= 0) {
+            continue;
+        }
+
+        const uint64_t nr = buffer[0];
+        const double scale = buffer[2] > 0 ? (double)buffer[1] / (double)buffer[2] : 1.0;
+
+        // the values follow in the order in which the events were added to the group
+        unsigned int k = 0;
+        for(unsigned int i=0; i<NR_EVENTS && k<nr; i++) {
+            if(g.fds[i] >= 0) {
+                v[i] = (uint64_t)(buffer[3 + k] * scale);
+                k++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief      Open the counter group of the calling thread
+ *
+ * @param      group  the group
+ */
+void PerfCounters::open_group(Group& group) {
+    static const uint32_t types[NR_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_RAW,
+                                              PERF_TYPE_HW_CACHE};
+    // node misses are reads served by the memory of another node
+    const uint64_t configs[NR_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+                                         PERF_COUNT_HW_BRANCH_MISSES, this->fp_event,
+                                         PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+
+    group.leader = -1;
+    group.nr_open = 0;
+    std::fill(group.fds, group.fds + NR_EVENTS, -1);
+
+    for(unsigned int i=0; i<NR_EVENTS; i++) {
+        if(i == FP_EVENTS && this->fp_event == 0) {
+            continue;
+        }
+
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // measure the calling thread on any cpu
+        const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, group.leader, 0);
+        if(fd < 0) {
+            if(group.leader < 0) {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                this->error = std::string("perf_event_open failed: ") + std::strerror(errno);
+                return;
+            }
+            continue;
+        }
+
+        if(group.leader < 0) {
+            group.leader = fd;
+        }
+        group.fds[i] = fd;
+        group.nr_open++;
+    }
+}
+
+/**
+ * @brief      Close all counter groups
+ */
+void PerfCounters::close() {
+    for(Group& g : this->groups) {
+        for(unsigned int i=0; i<NR_EVENTS; i++) {
+            if(g.fds[i] >= 0) {
+                ::close(g.fds[i]);
+            }
+        }
+    }
+    this->groups.clear();
+}
@@ -0,0 +1,158 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <mutex>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "task_pool.h"
+
+/**
+ * @brief      Hardware performance counters of the threads of the task pool
+ *
+ * Every thread of the task pool opens a group of counters for itself,
+ * which can then be read from any thread. Counters that the kernel or the
+ * processor does not provide (e.g. in containers or virtual machines) are
+ * reported as unavailable; when none can be opened, callers fall back to
+ * wall-clock timing.
+ */
+class PerfCounters {
+public:
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        FP_EVENTS,
+        NODE_MISSES,
+        NR_EVENTS
+    };
+
+    static const char* event_names[NR_EVENTS];      //!< names of the events
+
+private:
+    /**
+     * @brief      Counter group of a single thread
+     */
+    struct Group {
+        int leader;                             //!< file descriptor of the group leader
+        int fds[NR_EVENTS];                     //!< file descriptors (-1 when unavailable)
+        unsigned int nr_open;                   //!< number of opened counters
+    };
+
+    std::vector<Group> groups;                  //!< counter groups per thread
+    uint64_t fp_event;                          //!< raw event code counting fp operations (0 for none)
+    bool available[NR_EVENTS];                  //!< whether an event is counted
+    std::mutex mtx;                             //!< guards opening the groups
+    std::string error;                          //!< reason when no counters are available
+
+public:
+    /**
+     * @brief      Constructs the counters (no counters are opened yet)
+     *
+     * @param[in]  _fp_event  raw event code counting fp operations (0 for none)
+     */
+    PerfCounters(uint64_t _fp_event);
+
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /**
+     * @brief      Open the counters in every thread of the task pool
+     *
+     * @return     whether any counter is available
+     */
+    bool open();
+
+    /**
+     * @brief      Get the number of threads being counted
+     *
+     * @return     number of threads
+     */
+    inline unsigned int get_nr_threads() const {
+        return this->groups.size();
+    }
+
+    /**
+     * @brief      Get whether an event is counted
+     *
+     * @param[in]  event  the event
+     *
+     * @return     whether the event is counted
+     */
+    inline bool is_available(Event event) const {
+        return this->available[event];
+    }
+
+    /**
+     * @brief      Get why no counters are available
+     *
+     * @return     description of the failure
+     */
+    inline const std::string& get_error() const {
+        return this->error;
+    }
+
+    /**
+     * @brief      Read the counters of all threads
+     *
+     * Counts are scaled when the kernel had to multiplex the counters.
+     *
+     * @param      values  counts per thread and event (nr_threads x NR_EVENTS)
+     */
+    void read(uint64_t* values) const;
+
+private:
+    /**
+     * @brief      Open the counter group of the calling thread
+     *
+     * @param      group  the group
+     */
+    void open_group(Group& group);
+
+    /**
+     * @brief      Close all counter groups
+     */
+    void close();
+};
+
+#endif // _PERF_COUNTERS_H
@@ -159,88 +159,244 @@ void PNG::write_image_buffer_to_png(const std::string& filename, const std::vect
  *
  */
 void PNG::load_image_buffer_from_png(const std::string& filename, std::vector<uint8_t>& buffer, png_uint_32* width, png_uint_32* height, int* col, int* bit_depth) {
-    png_structp png_ptr;
-    png_infop info_ptr;
+    static thread_local Decoder decoder;
+    static thread_local std::vector<uint8_t> pixels;
 
-    char header[8];    // 8 is the maximum size that can be checked
+    const ImageInfo info = decoder.decode_file(filename, pixels);
+    *width = info.width;
+    *height = info.height;
+    *col = info.col;
+    *bit_depth = info.bit_depth;
 
-    /* open file and test for it being a png */
-    std::ifstream ifile(filename.c_str(), std::ios::binary);
+    // transfer the first width bytes of every row to the buffer
+    buffer.resize((*width) * (*height), 0);
+    for(unsigned int i=0; i<(*height); i++) {
+        for(unsigned int j=0; j<(*width); j++) {
+            buffer[i * (*width) + j] = pixels[i * info.rowbytes + j];
+        }
+    }
+}
 
-    if (!ifile.is_open() ) {
-        std::cerr << "[read_png_file] File " << filename.c_str() << " could not be opened for reading" << std::endl;
-        exit(-1);
+void PNG::read_file_callback( png_structp png_ptr, png_bytep out, png_size_t count ) {
+    png_voidp io_ptr = png_get_io_ptr( png_ptr );
+
+    if( io_ptr == 0 ) {
+        return;
     }
 
-    ifile.read(&header[0], 8 * sizeof(char));
-    if (!png_check_sig((png_bytep)header, 8)) {
-        std::cerr << "[read_png_file] File " << filename.c_str() << " is not recognized as a PNG file" << std::endl;
-        exit(-1);
+    std::ifstream &ifs = *(std::ifstream*)io_ptr;
+
+    ifs.read( (char*)out, count );
+}
+
+void PNG::write_file_callback(png_structp png_ptr, png_bytep data, png_size_t count) {
+    std::ofstream *outfile = (std::ofstream*)png_get_io_ptr(png_ptr);
+    outfile->write((char*)data, count);
+}
+
+PNG::Decoder::Decoder() {}
+
+/**
+ * @brief      Read the header of an image in memory
+ *
+ * @param[in]  data  png bytes
+ * @param[in]  size  number of bytes
+ *
+ * @return     properties of the decoded image
+ */
+PNG::ImageInfo PNG::Decoder::read_info(const uint8_t* data, size_t size) {
+    ImageInfo info;
+    if(!this->run(data, size, nullptr, 0, nullptr, &info)) {
+        throw std::runtime_error("[png_decoder] " + this->error_message);
     }
+    return info;
+}
 
-    /* initialize stuff */
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+/**
+ * @brief      Decode an image in memory
+ *
+ * @param[in]  data      png bytes
+ * @param[in]  size      number of bytes
+ * @param      dest      destination buffer
+ * @param[in]  capacity  size of destination buffer
+ *
+ * @return     properties of the decoded image
+ */
+PNG::ImageInfo PNG::Decoder::decode(const uint8_t* data, size_t size, uint8_t* dest, size_t capacity) {
+    ImageInfo info;
+    if(!this->run(data, size, dest, capacity, nullptr, &info)) {
+        throw std::runtime_error("[png_decoder] " + this->error_message);
+    }
+    return info;
+}
 
-    if (!png_ptr) {
-        std::cerr << "[read_png_file] png_create_read_struct failed for file " << filename.c_str() << std::endl;
-        exit(-1);
+/**
+ * @brief      Decode an image in memory, growing the destination when needed
+ *
+ * @param[in]  data  png bytes
+ * @param[in]  size  number of bytes
+ * @param      dest  destination buffer
+ *
+ * @return     properties of the decoded image
+ */
+PNG::ImageInfo PNG::Decoder::decode(const uint8_t* data, size_t size, std::vector<uint8_t>& dest) {
+    ImageInfo info;
+    if(!this->run(data, size, nullptr, 0, &dest, &info)) {
+        throw std::runtime_error("[png_decoder] " + this->error_message);
     }
+    return info;
+}
 
-    info_ptr = png_create_info_struct(png_ptr);
+/**
+ * @brief      Decode a png file, growing the destination when needed
+ *
+ * @param[in]  filename  The filename
+ * @param      dest      destination buffer
+ *
+ * @return     properties of the decoded image
+ */
+PNG::ImageInfo PNG::Decoder::decode_file(const std::string& filename, std::vector<uint8_t>& dest) {
+    std::ifstream ifile(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!ifile.is_open() ) {
+        throw std::runtime_error("[png_decoder] File " + filename + " could not be opened for reading");
+    }
 
-    if (!info_ptr) {
-        std::cerr << "[read_png_file] png_create_info_struct failed for file " << filename.c_str() << std::endl;
-        exit(-1);
+    const std::streamsize filesize = ifile.tellg();
+    ifile.seekg(0, std::ios::beg);
+    if(this->file_buffer.size() < (size_t)filesize) {
+        this->file_buffer.resize(filesize);
+    }
+    if(filesize <= 0 || !ifile.read((char*)this->file_buffer.data(), filesize)) {
+        throw std::runtime_error("[png_decoder] File " + filename + " could not be read");
     }
 
-    png_set_read_fn(png_ptr, (void*)&ifile, read_file_callback);
+    try {
+        return this->decode(this->file_buffer.data(), filesize, dest);
+    } catch(const std::exception& e) {
+        throw std::runtime_error(std::string(e.what()) + " in " + filename);
+    }
+}
 
-    png_set_sig_bytes(png_ptr, 8);
+/**
+ * @brief      Run the header and (optionally) the pixel stage of libpng
+ *
+ * Note that no objects with non-trivial destructors may live in this
+ * function, as libpng reports errors by jumping back to setjmp.
+ *
+ * @param[in]  data      png bytes
+ * @param[in]  size      number of bytes
+ * @param      dest      destination buffer or nullptr to only read the header
+ * @param[in]  capacity  size of destination buffer
+ * @param      grow      destination grown to the image size after reading
+ *                       the header (replaces dest), or nullptr
+ * @param      info      properties of the decoded image
+ *
+ * @return     whether decoding succeeded (error_message is set otherwise)
+ */
+bool PNG::Decoder::run(const uint8_t* data, size_t size, uint8_t* dest, size_t capacity, std::vector<uint8_t>* grow, ImageInfo* info) {
+    if(size < 8 || png_sig_cmp((png_const_bytep)data, 0, 8) != 0) {
+        this->error_message = "not recognized as a PNG file";
+        return false;
+    }
 
-    png_read_info(png_ptr, info_ptr);
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, this, error_callback, warning_callback);
+    if (!png_ptr) {
+        this->error_message = "png_create_read_struct failed";
+        return false;
+    }
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        this->error_message = "png_create_info_struct failed";
+        return false;
+    }
 
-    png_get_IHDR(png_ptr, info_ptr, (png_uint_32*)width, (png_uint_32*)height, bit_depth, col, 0, 0, 0);
+    Source source = {data, size, 0};
 
-    // allocate space for storing texture
-    png_bytepp row_pointers = new png_bytep[(*height)];
-    for (unsigned int y=0; y<(*height); y++) {
-        row_pointers[y] = new png_byte[png_get_rowbytes(png_ptr,info_ptr)];
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return false;
     }
 
-    png_read_image(png_ptr, row_pointers);
-    png_read_end(png_ptr, info_ptr);
+    png_set_read_fn(png_ptr, (void*)&source, read_memory_callback);
+    png_read_info(png_ptr, info_ptr);
 
-    // transfer data to std::vector
-    buffer.resize((*width) * (*height), 0);
-    for(unsigned int i=0; i<(*height); i++) {
-        for(unsigned int j=0; j<(*width); j++) {
-            buffer[i * (*width) + j] = row_pointers[i][j];
+    // expand palettes and sub-byte gray levels to whole bytes per sample
+    if(png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    }
+    if(png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_GRAY && png_get_bit_depth(png_ptr, info_ptr) < 8) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    }
+    if(png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+        png_set_tRNS_to_alpha(png_ptr);
+    }
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    info->width = png_get_image_width(png_ptr, info_ptr);
+    info->height = png_get_image_height(png_ptr, info_ptr);
+    info->col = png_get_color_type(png_ptr, info_ptr);
+    info->bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    info->channels = png_get_channels(png_ptr, info_ptr);
+    info->rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+
+    // size the destination from the header, such that the image is parsed only once;
+    // the arguments are left untouched, as they live across setjmp
+    uint8_t* target = dest;
+    size_t target_capacity = capacity;
+    if(grow != nullptr) {
+        if(grow->size() < info->size()) {
+            try {
+                grow->resize(info->size());
+            } catch(const std::bad_alloc&) {
+                png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+                this->error_message = "cannot allocate destination buffer";
+                return false;
+            }
         }
+        target = grow->data();
+        target_capacity = grow->size();
     }
 
-    ifile.close();
+    if(target != nullptr) {
+        if(target_capacity < info->size()) {
+            png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+            this->error_message = "destination buffer too small";
+            return false;
+        }
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        if(this->row_pointers.size() < info->height) {
+            this->row_pointers.resize(info->height);
+        }
+        for(png_uint_32 y=0; y<info->height; y++) {
+            this->row_pointers[y] = target + y * info->rowbytes;
+        }
 
-    for(unsigned int i=0; i<*height; i++) {
-        delete[] row_pointers[i];
+        png_read_image(png_ptr, this->row_pointers.data());
+        png_read_end(png_ptr, NULL);
     }
-    delete[] row_pointers;
-}
 
-void PNG::read_file_callback( png_structp png_ptr, png_bytep out, png_size_t count ) {
-    png_voidp io_ptr = png_get_io_ptr( png_ptr );
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    return true;
+}
 
-    if( io_ptr == 0 ) {
-        return;
+void PNG::Decoder::read_memory_callback(png_structp png_ptr, png_bytep out, png_size_t count) {
+    Source* source = (Source*)png_get_io_ptr(png_ptr);
+    if(source->pos + count > source->size) {
+        png_error(png_ptr, "unexpected end of data");
     }
+    std::memcpy(out, source->data + source->pos, count);
+    source->pos += count;
+}
 
-    std::ifstream &ifs = *(std::ifstream*)io_ptr;
-
-    ifs.read( (char*)out, count );
+void PNG::Decoder::error_callback(png_structp png_ptr, png_const_charp msg) {
+    Decoder* decoder = (Decoder*)png_get_error_ptr(png_ptr);
+    decoder->error_message = msg;
+    png_longjmp(png_ptr, 1);
 }
 
-void PNG::write_file_callback(png_structp png_ptr, png_bytep data, png_size_t count) {
-    std::ofstream *outfile = (std::ofstream*)png_get_io_ptr(png_ptr);
-    outfile->write((char*)data, count);
+void PNG::Decoder::warning_callback(png_structp, png_const_charp) {
+    // warnings do not affect the decoded image
 }
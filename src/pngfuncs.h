@@ -32,6 +32,10 @@
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <stdexcept>
+#include <string>
+#include <csetjmp>
+#include <cstring>
 #include <png.h>
 
 /*
@@ -80,6 +84,117 @@ namespace PNG {
 
     void read_file_callback(png_structp png_ptr, png_bytep out, png_size_t count);
 
+    /**
+     * @brief      Properties of a decoded image
+     */
+    struct ImageInfo {
+        png_uint_32 width;          //!< width in pixels
+        png_uint_32 height;         //!< height in pixels
+        int col;                    //!< color type (palettes are expanded to RGB)
+        int bit_depth;              //!< bits per sample (8 or 16)
+        unsigned int channels;      //!< samples per pixel
+        size_t rowbytes;            //!< bytes per row
+
+        inline size_t size() const {
+            return this->rowbytes * this->height;
+        }
+    };
+
+    /**
+     * @brief      Reusable png decoder
+     *
+     * The decoder decodes png images from memory or file into a contiguous,
+     * caller-provided buffer without any per-row allocations. Palettes are
+     * expanded to RGB and sub-byte gray levels to 8 bits, such that every
+     * sample occupies one (or for 16-bit images two) bytes. The file buffer
+     * and row pointers are kept between calls; libpng itself requires fresh
+     * read structures for every image, which are cheap in comparison.
+     * Errors are reported as std::runtime_error.
+     */
+    class Decoder {
+    private:
+        std::vector<uint8_t> file_buffer;       //!< contents of the last file read
+        std::vector<png_bytep> row_pointers;    //!< row pointers into the destination
+        std::string error_message;              //!< last libpng error
+
+        /**
+         * @brief      Memory source of the image being decoded
+         */
+        struct Source {
+            const uint8_t* data;
+            size_t size;
+            size_t pos;
+        };
+
+    public:
+        Decoder();
+
+        /**
+         * @brief      Read the header of an image in memory
+         *
+         * @param[in]  data  png bytes
+         * @param[in]  size  number of bytes
+         *
+         * @return     properties of the decoded image
+         */
+        ImageInfo read_info(const uint8_t* data, size_t size);
+
+        /**
+         * @brief      Decode an image in memory
+         *
+         * @param[in]  data      png bytes
+         * @param[in]  size      number of bytes
+         * @param      dest      destination buffer
+         * @param[in]  capacity  size of destination buffer
+         *
+         * @return     properties of the decoded image
+         */
+        ImageInfo decode(const uint8_t* data, size_t size, uint8_t* dest, size_t capacity);
+
+        /**
+         * @brief      Decode an image in memory, growing the destination when needed
+         *
+         * @param[in]  data  png bytes
+         * @param[in]  size  number of bytes
+         * @param      dest  destination buffer
+         *
+         * @return     properties of the decoded image
+         */
+        ImageInfo decode(const uint8_t* data, size_t size, std::vector<uint8_t>& dest);
+
+        /**
+         * @brief      Decode a png file, growing the destination when needed
+         *
+         * @param[in]  filename  The filename
+         * @param      dest      destination buffer
+         *
+         * @return     properties of the decoded image
+         */
+        ImageInfo decode_file(const std::string& filename, std::vector<uint8_t>& dest);
+
+    private:
+        /**
+         * @brief      Run the header and (optionally) the pixel stage of libpng
+         *
+         * @param[in]  data      png bytes
+         * @param[in]  size      number of bytes
+         * @param      dest      destination buffer or nullptr to only read the header
+         * @param[in]  capacity  size of destination buffer
+         * @param      grow      destination grown to the image size after reading
+         *                       the header (replaces dest), or nullptr
+         * @param      info      properties of the decoded image
+         *
+         * @return     whether decoding succeeded (error_message is set otherwise)
+         */
+        bool run(const uint8_t* data, size_t size, uint8_t* dest, size_t capacity, std::vector<uint8_t>* grow, ImageInfo* info);
+
+        static void read_memory_callback(png_structp png_ptr, png_bytep out, png_size_t count);
+
+        static void error_callback(png_structp png_ptr, png_const_charp msg);
+
+        static void warning_callback(png_structp png_ptr, png_const_charp msg);
+    };
+
     void write_file_callback(png_structp png_ptr, png_bytep data, png_size_t count);
 }
 
@@ -0,0 +1,310 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "preprocess.h"
+
+constexpr float Preprocessor::threshold;
+const unsigned int Preprocessor::box_size;
+
+/**
+ * @brief      Convert interleaved samples to gray values between 0 and 1
+ *
+ * @param[in]  pixels  decoded image
+ * @param[in]  n       number of pixels
+ * @param      gray    gray values
+ *
+ * @tparam     C       samples per pixel (1: gray, 2: gray + alpha, 3: RGB, 4: RGBA)
+ * @tparam     B       bytes per sample (big endian)
+ */
+template<unsigned int C, unsigned int B>
+static void gray_kernel(const uint8_t* pixels, size_t n, float* gray) {
+    const float scale = 1.0f / (B == 1 ? 255.0f : 65535.0f);
+
+    #pragma omp simd
+    for(size_t i=0; i<n; i++) {
+        float s[C];
+        for(unsigned int k=0; k<C; k++) {
+            const uint8_t* p = pixels + (i * C + k) * B;
+            s[k] = (B == 1 ? (float)p[0] : (float)((p[0] << 8) | p[B-1])) * scale;
+        }
+
+        // luma of the color channels composited on a white background
+        const float v = C < 3 ? s[0] : 0.299f * s[0] + 0.587f * s[1] + 0.114f * s[2 % C];
+        const float a = (C == 2 || C == 4) ? s[C-1] : 1.0f;
+        gray[i] = v * a + (1.0f - a);
+    }
+}
+
+Preprocessor::Preprocessor() {}
+
+/**
+ * @brief      Convert a decoded image to an input vector
+ *
+ * @param[in]  pixels  decoded image
+ * @param[in]  info    properties of the decoded image
+ * @param      out     input vector (28 x 28 values)
+ */
+void Preprocessor::process(const uint8_t* pixels, const PNG::ImageInfo& info, double* out) {
+    const unsigned int width = info.width;
+    const unsigned int height = info.height;
+
+    this->to_gray(pixels, info);
+    this->normalize(width, height);
+
+    // bounding box of the digit
+    unsigned int xmin = width, xmax = 0, ymin = height, ymax = 0;
+    for(unsigned int y=0; y<height; y++) {
+        const float* row = &this->gray[y * width];
+        for(unsigned int x=0; x<width; x++) {
+            if(row[x] > threshold) {
+                xmin = std::min(xmin, x);
+                xmax = std::max(xmax, x);
+                ymin = std::min(ymin, y);
+                ymax = std::max(ymax, y);
+            }
+        }
+    }
+    if(xmin > xmax) {
+        throw std::runtime_error("Image does not contain a digit");
+    }
+
+    const unsigned int bw = xmax - xmin + 1;
+    const unsigned int bh = ymax - ymin + 1;
+    this->crop.resize(bw * bh);
+    for(unsigned int y=0; y<bh; y++) {
+        std::copy(&this->gray[(ymin + y) * width + xmin], &this->gray[(ymin + y) * width + xmin] + bw, &this->crop[y * bw]);
+    }
+
+    // fit the longest side of the digit to the box, preserving the aspect ratio
+    const float scale = (float)box_size / (float)std::max(bw, bh);
+    const unsigned int nw = std::max(1u, std::min(box_size, (unsigned int)std::lround(bw * scale)));
+    const unsigned int nh = std::max(1u, std::min(box_size, (unsigned int)std::lround(bh * scale)));
+    this->box.resize(nw * nh);
+    this->resize(&this->crop[0], bw, bh, &this->box[0], nw, nh);
+
+    // center of mass of the resized digit
+    double mass = 0.0, mx = 0.0, my = 0.0;
+    for(unsigned int y=0; y<nh; y++) {
+        for(unsigned int x=0; x<nw; x++) {
+            const double v = this->box[y * nw + x];
+            mass += v;
+            mx += v * x;
+            my += v * y;
+        }
+    }
+
+    // shift the center of mass to the center of the image, keeping the digit inside
+    const double center = (image_size - 1) / 2.0;
+    const int ox = std::max(0, std::min((int)(image_size - nw), (int)std::lround(center - mx / mass)));
+    const int oy = std::max(0, std::min((int)(image_size - nh), (int)std::lround(center - my / mass)));
+
+    std::fill(out, out + image_size * image_size, 0.0);
+    for(unsigned int y=0; y<nh; y++) {
+        double* dest = out + (oy + y) * image_size + ox;
+        const float* src = &this->box[y * nw];
+        #pragma omp simd
+        for(unsigned int x=0; x<nw; x++) {
+            dest[x] = std::min(1.0f, std::max(0.0f, src[x]));
+        }
+    }
+}
+
+/**
+ * @brief      Convert pixels to gray values between 0 and 1
+ *
+ * Images with an alpha channel are composited on a white background.
+ *
+ * @param[in]  pixels  decoded image
+ * @param[in]  info    properties of the decoded image
+ */
+void Preprocessor::to_gray(const uint8_t* pixels, const PNG::ImageInfo& info) {
+    const size_t n = (size_t)info.width * info.height;
+    this->gray.resize(n);
+
+    if(info.bit_depth != 8 && info.bit_depth != 16) {
+        throw std::runtime_error("Unsupported bit depth");
+    }
+    const bool wide = info.bit_depth == 16;
+
+    // rows are contiguous as the decoded images are not padded
+    switch(info.channels) {
+        case 1:
+            wide ? gray_kernel<1,2>(pixels, n, &this->gray[0]) : gray_kernel<1,1>(pixels, n, &this->gray[0]);
+        break;
+        case 2:
+            wide ? gray_kernel<2,2>(pixels, n, &this->gray[0]) : gray_kernel<2,1>(pixels, n, &this->gray[0]);
+        break;
+        case 3:
+            wide ? gray_kernel<3,2>(pixels, n, &this->gray[0]) : gray_kernel<3,1>(pixels, n, &this->gray[0]);
+        break;
+        case 4:
+            wide ? gray_kernel<4,2>(pixels, n, &this->gray[0]) : gray_kernel<4,1>(pixels, n, &this->gray[0]);
+        break;
+        default:
+            throw std::runtime_error("Unsupported number of channels");
+    }
+}
+
+/**
+ * @brief      Invert light backgrounds and stretch the contrast
+ *
+ * The background level is estimated from the pixels on the border of the
+ * image; MNIST digits are light on a dark background.
+ *
+ * @param[in]  width   image width
+ * @param[in]  height  image height
+ */
+void Preprocessor::normalize(unsigned int width, unsigned int height) {
+    float* g = &this->gray[0];
+    const size_t n = (size_t)width * height;
+
+    double border = 0.0;
+    for(unsigned int x=0; x<width; x++) {
+        border += g[x] + g[(height - 1) * width + x];
+    }
+    for(unsigned int y=0; y<height; y++) {
+        border += g[y * width] + g[y * width + width - 1];
+    }
+    float background = border / (2.0 * (width + height));
+
+    if(background > 0.5f) {
+        #pragma omp simd
+        for(size_t i=0; i<n; i++) {
+            g[i] = 1.0f - g[i];
+        }
+        background = 1.0f - background;
+    }
+
+    float maximum = 0.0f;
+    #pragma omp simd reduction(max:maximum)
+    for(size_t i=0; i<n; i++) {
+        maximum = std::max(maximum, g[i]);
+    }
+    if(maximum - background < threshold) {
+        throw std::runtime_error("Image does not contain a digit");
+    }
+
+    const float scale = 1.0f / (maximum - background);
+    #pragma omp simd
+    for(size_t i=0; i<n; i++) {
+        g[i] = std::max(0.0f, (g[i] - background) * scale);
+    }
+}
+
+/**
+ * @brief      Resize an image with a triangle filter
+ *
+ * The image is resampled along its columns, transposed, resampled along
+ * its (former) rows and transposed back, such that all filtering runs over
+ * contiguous memory.
+ *
+ * @param[in]  in          input image
+ * @param[in]  width       input width
+ * @param[in]  height      input height
+ * @param      out         output image
+ * @param[in]  new_width   output width
+ * @param[in]  new_height  output height
+ */
+void Preprocessor::resize(const float* in, unsigned int width, unsigned int height, float* out, unsigned int new_width, unsigned int new_height) {
+    this->tmp.resize(width * new_height);
+    this->tmp2.resize(width * new_height);
+    this->resample_rows(in, width, height, &this->tmp[0], new_height);
+    transpose(&this->tmp[0], width, new_height, &this->tmp2[0]);
+
+    this->tmp.resize(new_height * new_width);
+    this->resample_rows(&this->tmp2[0], new_height, width, &this->tmp[0], new_width);
+    transpose(&this->tmp[0], new_height, new_width, out);
+}
+
+/**
+ * @brief      Resample the rows of an image
+ *
+ * @param[in]  in          input image
+ * @param[in]  width       image width
+ * @param[in]  height      input height
+ * @param      out         output image
+ * @param[in]  new_height  output height
+ */
+void Preprocessor::resample_rows(const float* in, unsigned int width, unsigned int height, float* out, unsigned int new_height) {
+    const float scale = (float)new_height / (float)height;
+    const float radius = std::max(1.0f, 1.0f / scale);
+
+    this->taps.resize(new_height);
+    for(unsigned int i=0; i<new_height; i++) {
+        Taps& t = this->taps[i];
+        t.index.clear();
+        t.weight.clear();
+
+        const float center = (i + 0.5f) / scale - 0.5f;
+        const int first = (int)std::floor(center - radius) + 1;
+        const int last = (int)std::ceil(center + radius) - 1;
+        float sum = 0.0f;
+        for(int j=first; j<=last; j++) {
+            const float w = 1.0f - std::abs(j - center) / radius;
+            if(w <= 0.0f) {
+                continue;
+            }
+            t.index.push_back(std::max(0, std::min((int)height - 1, j)));
+            t.weight.push_back(w);
+            sum += w;
+        }
+        for(float& w : t.weight) {
+            w /= sum;
+        }
+    }
+
+    for(unsigned int i=0; i<new_height; i++) {
+        float* dest = out + i * width;
+        std::fill(dest, dest + width, 0.0f);
+        const Taps& t = this->taps[i];
+        for(unsigned int k=0; k<t.index.size(); k++) {
+            const float* src = in + t.index[k] * width;
+            const float w = t.weight[k];
+            #pragma omp simd
+            for(unsigned int x=0; x<width; x++) {
+                dest[x] += w * src[x];
+            }
+        }
+    }
+}
+
+/**
+ * @brief      Transpose an image
+ *
+ * @param[in]  in      input image
+ * @param[in]  width   input width
+ * @param[in]  height  input height
+ * @param      out     output image
+ */
+void Preprocessor::transpose(const float* in, unsigned int width, unsigned int height, float* out) {
+    for(unsigned int y=0; y<height; y++) {
+        for(unsigned int x=0; x<width; x++) {
+            out[x * height + y] = in[y * width + x];
+        }
+    }
+}
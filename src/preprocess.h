@@ -0,0 +1,138 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _PREPROCESS_H
+#define _PREPROCESS_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "pngfuncs.h"
+
+/**
+ * @brief      Converts arbitrary images to MNIST-style input vectors
+ *
+ * The image is converted to gray, inverted when it has a light background
+ * and contrast-stretched. The digit is then cropped to its bounding box,
+ * resized with antialiasing such that it fits in a 20x20 box and placed in a
+ * 28x28 image such that its center of mass lies at the center, following the
+ * normalization of the MNIST database. All buffers are kept between calls.
+ */
+class Preprocessor {
+private:
+    std::vector<float> gray;            //!< gray values of the full image
+    std::vector<float> crop;            //!< bounding box of the digit
+    std::vector<float> tmp;             //!< intermediate result of resampling
+    std::vector<float> tmp2;            //!< intermediate result of resampling
+    std::vector<float> box;             //!< resized digit
+
+    /**
+     * @brief      Contributions of input pixels to an output pixel
+     */
+    struct Taps {
+        std::vector<unsigned int> index;    //!< input pixel
+        std::vector<float> weight;          //!< weight of the input pixel
+    };
+    std::vector<Taps> taps;             //!< filter taps of resampling
+
+    static constexpr float threshold = 0.05f;       //!< minimum intensity of digit pixels
+
+public:
+    static const unsigned int image_size = 28;      //!< width and height of the output
+    static const unsigned int box_size = 20;        //!< size of the box holding the digit
+
+    Preprocessor();
+
+    /**
+     * @brief      Convert a decoded image to an input vector
+     *
+     * @param[in]  pixels  decoded image
+     * @param[in]  info    properties of the decoded image
+     * @param      out     input vector (28 x 28 values)
+     */
+    void process(const uint8_t* pixels, const PNG::ImageInfo& info, double* out);
+
+private:
+    /**
+     * @brief      Convert pixels to gray values between 0 and 1
+     *
+     * Images with an alpha channel are composited on a white background.
+     *
+     * @param[in]  pixels  decoded image
+     * @param[in]  info    properties of the decoded image
+     */
+    void to_gray(const uint8_t* pixels, const PNG::ImageInfo& info);
+
+    /**
+     * @brief      Invert light backgrounds and stretch the contrast
+     *
+     * @param[in]  width   image width
+     * @param[in]  height  image height
+     */
+    void normalize(unsigned int width, unsigned int height);
+
+    /**
+     * @brief      Resize an image with a triangle filter
+     *
+     * The filter is widened when shrinking, which averages all input pixels
+     * covered by an output pixel.
+     *
+     * @param[in]  in          input image
+     * @param[in]  width       input width
+     * @param[in]  height      input height
+     * @param      out         output image
+     * @param[in]  new_width   output width
+     * @param[in]  new_height  output height
+     */
+    void resize(const float* in, unsigned int width, unsigned int height, float* out, unsigned int new_width, unsigned int new_height);
+
+    /**
+     * @brief      Resample the rows of an image
+     *
+     * @param[in]  in          input image
+     * @param[in]  width       image width
+     * @param[in]  height      input height
+     * @param      out         output image
+     * @param[in]  new_height  output height
+     */
+    void resample_rows(const float* in, unsigned int width, unsigned int height, float* out, unsigned int new_height);
+
+    /**
+     * @brief      Transpose an image
+     *
+     * @param[in]  in      input image
+     * @param[in]  width   input width
+     * @param[in]  height  input height
+     * @param      out     output image
+     */
+    static void transpose(const float* in, unsigned int width, unsigned int height, float* out);
+};
+
+#endif //_PREPROCESS_H
@@ -0,0 +1,330 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "shared_memory_communicator.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <ctime>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+#include "trace.h"
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "process-shared atomics have to be lock-free");
+
+/**
+ * @brief      Sleep until a futex word changes or a timeout expires
+ *
+ * @param      word     futex word in shared memory
+ * @param[in]  value    expected value
+ * @param[in]  timeout  timeout in ns
+ */
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t value, long timeout) {
+    struct timespec ts = {0, timeout};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, value, &ts, nullptr, 0);
+}
+
+/**
+ * @brief      Wake all processes sleeping on a futex word
+ *
+ * @param      word  futex word in shared memory
+ */
+static void futex_wake(std::atomic<uint32_t>* word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief      Fork the training processes
+ *
+ * @param[in]  nr_procs  number of processes
+ * @param[in]  capacity  elements per shared buffer
+ *
+ * @return     communicator of the calling process
+ */
+std::unique_ptr<SharedMemoryCommunicator> SharedMemoryCommunicator::launch(unsigned int nr_procs, size_t capacity) {
+    if(nr_procs == 0 || capacity == 0) {
+        throw std::runtime_error("Invalid number of processes or buffer capacity");
+    }
+
+    void* state = mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(state == MAP_FAILED) {
+        throw std::runtime_error("Cannot map shared memory: " + std::string(strerror(errno)));
+    }
+
+    // pages of the buffers are only allocated once they are touched
+    void* buffers = mmap(nullptr, nr_procs * capacity * sizeof(double), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(buffers == MAP_FAILED) {
+        munmap(state, sizeof(State));
+        throw std::runtime_error("Cannot map shared memory: " + std::string(strerror(errno)));
+    }
+
+    std::unique_ptr<SharedMemoryCommunicator> comm(new SharedMemoryCommunicator(static_cast<State*>(state), static_cast<double*>(buffers), capacity, nr_procs));
+
+    // buffered output would otherwise be written by every process
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+
+    for(unsigned int r=1; r<nr_procs; r++) {
+        const pid_t pid = fork();
+        if(pid < 0) {
+            throw std::runtime_error("Cannot fork training process: " + std::string(strerror(errno)));
+        }
+
+        if(pid == 0) {
+            // do not outlive the first process
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if(getppid() != comm->state->launcher) {
+                _exit(-1);
+            }
+
+            comm->rank = r;
+            comm->children.clear();
+            return comm;
+        }
+
+        comm->children.push_back(pid);
+    }
+
+    return comm;
+}
+
+/**
+ * @brief      Constructs the communicator of the first process
+ *
+ * @param      _state     shared control block
+ * @param      _buffers   shared buffers
+ * @param[in]  _capacity  elements per buffer
+ * @param[in]  _nr_procs  number of processes
+ */
+SharedMemoryCommunicator::SharedMemoryCommunicator(State* _state, double* _buffers, size_t _capacity, unsigned int _nr_procs) :
+state(_state),
+buffers(_buffers),
+capacity(_capacity),
+rank(0),
+nr_procs(_nr_procs),
+nr_failed(0),
+finalized(false) {
+    this->state->arrived.store(0);
+    this->state->generation.store(0);
+    this->state->aborted.store(0);
+    this->state->launcher = getpid();
+}
+
+/**
+ * @brief      Destructor
+ */
+SharedMemoryCommunicator::~SharedMemoryCommunicator() {
+    if(!this->finalized) {
+        this->abort();
+        this->wait_children();
+    }
+
+    munmap(this->buffers, this->nr_procs * this->capacity * sizeof(double));
+    munmap(this->state, sizeof(State));
+}
+
+/**
+ * @brief      Wait until all processes have reached this point
+ */
+void SharedMemoryCommunicator::barrier() {
+    const uint32_t generation = this->state->generation.load(std::memory_order_acquire);
+
+    if(this->state->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == this->nr_procs) {
+        this->state->arrived.store(0, std::memory_order_relaxed);
+        this->state->generation.fetch_add(1, std::memory_order_release);
+        futex_wake(&this->state->generation);
+    } else {
+        // spin briefly, as the processes usually arrive close together, then sleep
+        unsigned int spins = 0;
+        while(this->state->generation.load(std::memory_order_acquire) == generation && !this->state->aborted.load()) {
+            if(++spins < 1000) {
+                sched_yield();
+                continue;
+            }
+            futex_wait(&this->state->generation, generation, 100000000);
+            this->check_processes();
+        }
+    }
+
+    if(this->state->aborted.load()) {
+        throw std::runtime_error("Training process has failed, aborting");
+    }
+}
+
+/**
+ * @brief      Sum a vector over all processes using a ring all-reduce
+ *
+ * @param      data  vector, replaced by the sum
+ * @param[in]  n     number of elements
+ */
+void SharedMemoryCommunicator::allreduce(double* data, size_t n) {
+    if(this->nr_procs == 1) {
+        return;
+    }
+
+    NN_TRACE_SPAN("comm", "allreduce");
+
+    for(size_t offset=0; offset<n; offset+=this->capacity) {
+        this->allreduce_part(data + offset, std::min(this->capacity, n - offset));
+    }
+}
+
+/**
+ * @brief      Copy a vector from one process to all others
+ *
+ * @param      data  vector, replaced by the one of the root process
+ * @param[in]  n     number of elements
+ * @param[in]  root  rank of the sending process
+ */
+void SharedMemoryCommunicator::broadcast(double* data, size_t n, unsigned int root) {
+    if(this->nr_procs == 1) {
+        return;
+    }
+
+    NN_TRACE_SPAN("comm", "broadcast");
+
+    for(size_t offset=0; offset<n; offset+=this->capacity) {
+        const size_t len = std::min(this->capacity, n - offset);
+        if(this->rank == root) {
+            std::copy(data + offset, data + offset + len, this->get_buffer(root));
+        }
+        this->barrier();
+        if(this->rank != root) {
+            std::copy(this->get_buffer(root), this->get_buffer(root) + len, data + offset);
+        }
+        this->barrier();
+    }
+}
+
+/**
+ * @brief      End the collective operations
+ *
+ * @return     number of child processes that failed
+ */
+unsigned int SharedMemoryCommunicator::finalize() {
+    this->finalized = true;
+    this->wait_children();
+    return this->nr_failed;
+}
+
+/**
+ * @brief      Sum a vector that fits in the buffers
+ *
+ * @param      data  vector, replaced by the sum
+ * @param[in]  n     number of elements (at most the capacity)
+ */
+void SharedMemoryCommunicator::allreduce_part(double* data, size_t n) {
+    const unsigned int p = this->nr_procs;
+    double* own = this->get_buffer(this->rank);
+    const double* left = this->get_buffer((this->rank + p - 1) % p);
+    auto lo = [n, p](unsigned int chunk) {
+        return n * chunk / p;
+    };
+
+    std::copy(data, data + n, own);
+    this->barrier();
+
+    // reduce-scatter: after p-1 steps, chunk rank+1 holds the sum over all processes
+    for(unsigned int s=0; s<p-1; s++) {
+        const unsigned int c = (this->rank + 2 * p - 1 - s) % p;
+        #pragma omp simd
+        for(size_t j=lo(c); j<lo(c+1); j++) {
+            own[j] += left[j];
+        }
+        this->barrier();
+    }
+
+    // all-gather: pass the completed chunks around the ring
+    for(unsigned int s=0; s<p-1; s++) {
+        const unsigned int c = (this->rank + p - s) % p;
+        std::copy(left + lo(c), left + lo(c+1), own + lo(c));
+        this->barrier();
+    }
+
+    std::copy(own, own + n, data);
+}
+
+/**
+ * @brief      Abort when another process has exited prematurely
+ */
+void SharedMemoryCommunicator::check_processes() {
+    if(this->rank != 0) {
+        if(getppid() != this->state->launcher) {
+            this->abort();
+        }
+        return;
+    }
+
+    for(auto it = this->children.begin(); it != this->children.end();) {
+        int status = 0;
+        if(waitpid(*it, &status, WNOHANG) == *it) {
+            it = this->children.erase(it);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                this->nr_failed++;
+                this->abort();
+            }
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief      Wake all processes and let their collective operations fail
+ */
+void SharedMemoryCommunicator::abort() {
+    this->state->aborted.store(1);
+    this->state->generation.fetch_add(1, std::memory_order_release);
+    futex_wake(&this->state->generation);
+}
+
+/**
+ * @brief      Wait for the remaining child processes
+ */
+void SharedMemoryCommunicator::wait_children() {
+    for(pid_t pid : this->children) {
+        int status = 0;
+        if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            this->nr_failed++;
+        }
+    }
+    this->children.clear();
+}
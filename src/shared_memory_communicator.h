@@ -0,0 +1,179 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _SHARED_MEMORY_COMMUNICATOR_H
+#define _SHARED_MEMORY_COMMUNICATOR_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <sys/types.h>
+
+#include "communicator.h"
+
+/**
+ * @brief      Communicator between processes on the same host
+ *
+ * The processes are forked by the launcher and exchange data through a
+ * shared memory region holding one buffer per process. Vectors are summed
+ * with a ring all-reduce: in the reduce-scatter phase every process adds one
+ * chunk of its left neighbour per step, in the all-gather phase the completed
+ * chunks travel around the ring. Every process thereby reads and writes
+ * 2 (size - 1) / size of the vector, independent of the number of processes,
+ * and the order of the additions is fixed.
+ */
+class SharedMemoryCommunicator : public Communicator {
+private:
+    /**
+     * @brief      Control block in shared memory
+     */
+    struct State {
+        std::atomic<uint32_t> arrived;      //!< processes waiting at the barrier
+        std::atomic<uint32_t> generation;   //!< number of completed barriers (futex word)
+        std::atomic<uint32_t> aborted;      //!< set when any process has failed
+        pid_t launcher;                     //!< process id of the first process
+    };
+
+    State* state;                           //!< shared control block
+    double* buffers;                        //!< shared buffers of all processes
+    size_t capacity;                        //!< elements per buffer
+    unsigned int rank;                      //!< index of this process
+    unsigned int nr_procs;                  //!< number of processes
+    std::vector<pid_t> children;            //!< running child processes (first process only)
+    unsigned int nr_failed;                 //!< number of failed child processes
+    bool finalized;                         //!< whether finalize has been called
+
+public:
+    /**
+     * @brief      Fork the training processes
+     *
+     * The calling process becomes rank 0; every child returns from this
+     * function with its own rank and continues in the caller. Processes
+     * should be launched before any thread pool is started, since forked
+     * processes only inherit the calling thread.
+     *
+     * @param[in]  nr_procs  number of processes
+     * @param[in]  capacity  elements per shared buffer; longer vectors are
+     *                       exchanged in parts
+     *
+     * @return     communicator of the calling process
+     */
+    static std::unique_ptr<SharedMemoryCommunicator> launch(unsigned int nr_procs, size_t capacity = 1 << 20);
+
+    /**
+     * @brief      Destructor; aborts the collective operations of all
+     *             processes when finalize has not been called
+     */
+    ~SharedMemoryCommunicator();
+
+    inline unsigned int get_rank() const override {
+        return this->rank;
+    }
+
+    inline unsigned int get_size() const override {
+        return this->nr_procs;
+    }
+
+    /**
+     * @brief      Wait until all processes have reached this point
+     */
+    void barrier() override;
+
+    /**
+     * @brief      Sum a vector over all processes using a ring all-reduce
+     *
+     * @param      data  vector, replaced by the sum
+     * @param[in]  n     number of elements
+     */
+    void allreduce(double* data, size_t n) override;
+
+    /**
+     * @brief      Copy a vector from one process to all others
+     *
+     * @param      data  vector, replaced by the one of the root process
+     * @param[in]  n     number of elements
+     * @param[in]  root  rank of the sending process
+     */
+    void broadcast(double* data, size_t n, unsigned int root) override;
+
+    /**
+     * @brief      End the collective operations; the first process waits
+     *             for all children to exit
+     *
+     * @return     number of child processes that failed
+     */
+    unsigned int finalize();
+
+private:
+    /**
+     * @brief      Constructs the communicator of the first process
+     *
+     * @param      _state     shared control block
+     * @param      _buffers   shared buffers
+     * @param[in]  _capacity  elements per buffer
+     * @param[in]  _nr_procs  number of processes
+     */
+    SharedMemoryCommunicator(State* _state, double* _buffers, size_t _capacity, unsigned int _nr_procs);
+
+    /**
+     * @brief      Sum a vector that fits in the buffers
+     *
+     * @param      data  vector, replaced by the sum
+     * @param[in]  n     number of elements (at most the capacity)
+     */
+    void allreduce_part(double* data, size_t n);
+
+    /**
+     * @brief      Get the shared buffer of a process
+     *
+     * @param[in]  r     rank of the process
+     *
+     * @return     pointer to the buffer
+     */
+    inline double* get_buffer(unsigned int r) const {
+        return this->buffers + r * this->capacity;
+    }
+
+    /**
+     * @brief      Abort when another process has exited prematurely
+     */
+    void check_processes();
+
+    /**
+     * @brief      Wake all processes and let their collective operations fail
+     */
+    void abort();
+
+    /**
+     * @brief      Wait for the remaining child processes
+     */
+    void wait_children();
+};
+
+#endif // _SHARED_MEMORY_COMMUNICATOR_H
@@ -0,0 +1,412 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "streaming_dataset.h"
+
+/**
+ * @brief      Constructs a streaming dataset
+ *
+ * @param[in]  images_file    uncompressed IDX file holding the images
+ * @param[in]  labels_file    uncompressed IDX file holding the labels
+ * @param[in]  nr_classes     number of classes
+ * @param[in]  _shard_size    samples per shard
+ * @param[in]  _window_shards shards per window
+ * @param[in]  _readahead     number of windows to read ahead
+ * @param[in]  _seed          seed for shuffling
+ */
+StreamingDataset::StreamingDataset(const std::string& images_file, const std::string& labels_file,
+                                   unsigned int nr_classes, size_t _shard_size, unsigned int _window_shards,
+                                   unsigned int _readahead, uint64_t _seed) :
+images_fd(-1),
+labels_fd(-1),
+nr_output_nodes(nr_classes),
+shard_size(std::max((size_t)1, _shard_size)),
+window_shards(std::max(1u, _window_shards)),
+readahead(std::max(1u, _readahead)),
+seed(_seed),
+finished(true),
+stop(false) {
+    // parse headers; the payload is accessed by offset hereafter
+    {
+        IDXReader images(images_file);
+        IDXReader labels(labels_file);
+
+        std::ifstream f(images_file, std::ios::in | std::ios::binary);
+        if(f.get() == 0x1f && f.get() == 0x8b) {
+            throw std::runtime_error("Streaming requires an uncompressed IDX file: " + images_file);
+        }
+
+        if(images.get_dimensions().size() < 2 || labels.get_dimensions().size() != 1) {
+            throw std::runtime_error("Invalid IDX dimensions for streaming dataset");
+        }
+
+        if(images.get_nr_items() != labels.get_nr_items()) {
+            throw std::runtime_error("Number of images and labels do not match");
+        }
+
+        this->images_type = images.get_data_type();
+        this->labels_type = labels.get_data_type();
+        get_type_size(this->images_type);
+        get_type_size(this->labels_type);
+
+        this->images_offset = 4 + 4 * images.get_dimensions().size();
+        this->labels_offset = 4 + 4 * labels.get_dimensions().size();
+        this->nr_items = images.get_nr_items();
+        this->nr_input_nodes = images.get_item_size();
+    }
+
+    this->images_fd = open(images_file.c_str(), O_RDONLY);
+    this->labels_fd = open(labels_file.c_str(), O_RDONLY);
+    if(this->images_fd < 0 || this->labels_fd < 0) {
+        if(this->images_fd >= 0) close(this->images_fd);
+        if(this->labels_fd >= 0) close(this->labels_fd);
+        throw std::runtime_error("Cannot open IDX files for streaming");
+    }
+}
+
+StreamingDataset::~StreamingDataset() {
+    this->stop_producer();
+    close(this->images_fd);
+    close(this->labels_fd);
+}
+
+/**
+ * @brief      Start producing the windows of an epoch
+ *
+ * @param[in]  epoch  epoch index
+ */
+void StreamingDataset::start_epoch(unsigned int epoch) {
+    this->stop_producer();
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->queue.clear();
+    this->finished = false;
+    this->stop = false;
+    this->error = nullptr;
+    this->producer = std::thread(&StreamingDataset::produce, this, epoch);
+}
+
+/**
+ * @brief      Get the next window of the current epoch
+ *
+ * @return     window or nullptr when the epoch is exhausted
+ */
+std::shared_ptr<Dataset> StreamingDataset::next_window() {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->cv.wait(lock, [this]() {
+        return !this->queue.empty() || this->finished;
+    });
+
+    if(this->error) {
+        std::rethrow_exception(this->error);
+    }
+
+    if(this->queue.empty()) {
+        return nullptr;
+    }
+
+    auto window = this->queue.front();
+    this->queue.pop_front();
+    this->cv.notify_all();
+
+    return window;
+}
+
+/**
+ * @brief      Gets the upper bound of memory held by resident windows.
+ *
+ * These are the windows read ahead (including the one being read) and the
+ * window being trained on.
+ *
+ * @return     The number of bytes.
+ */
+size_t StreamingDataset::get_max_resident_bytes() const {
+    const size_t window_size = std::min(this->nr_items, this->shard_size * this->window_shards);
+    return (this->readahead + 1) * window_size * (this->nr_input_nodes + this->nr_output_nodes) * sizeof(double);
+}
+
+/**
+ * @brief      Stop the producer thread and discard its windows
+ */
+void StreamingDataset::stop_producer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+        this->cv.notify_all();
+    }
+
+    if(this->producer.joinable()) {
+        this->producer.join();
+    }
+}
+
+/**
+ * @brief      Read all windows of an epoch (producer thread)
+ *
+ * @param[in]  epoch  epoch index
+ */
+void StreamingDataset::produce(unsigned int epoch) {
+    if(Trace::is_active()) {
+        Trace::get().set_thread_name("stream reader");
+    }
+
+    std::mt19937_64 rng(this->seed ^ (0x9e3779b97f4a7c15ULL * (epoch + 1)));
+
+    // shuffle shard order
+    const size_t nr_shards = (this->nr_items + this->shard_size - 1) / this->shard_size;
+    std::vector<size_t> order(nr_shards);
+    for(size_t i=0; i<nr_shards; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    try {
+        for(size_t i=0; i<nr_shards; i+=this->window_shards) {
+            // a window under construction takes up a slot of the read-ahead, bounding the resident windows
+            {
+                std::unique_lock<std::mutex> lock(this->mtx);
+                this->cv.wait(lock, [this]() {
+                    return this->queue.size() < this->readahead || this->stop;
+                });
+                if(this->stop) {
+                    return;
+                }
+            }
+
+            std::vector<size_t> shards(order.begin() + i, order.begin() + std::min(nr_shards, i + this->window_shards));
+            auto window = this->read_window(shards, rng);
+
+            std::lock_guard<std::mutex> lock(this->mtx);
+            if(this->stop) {
+                return;
+            }
+            this->queue.push_back(window);
+            this->cv.notify_all();
+        }
+    } catch(...) {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->finished = true;
+    this->cv.notify_all();
+}
+
+/**
+ * @brief      Read a set of shards into a shuffled window
+ *
+ * @param[in]  shards  shard indices
+ * @param      rng     random number generator
+ *
+ * @return     the window
+ */
+std::shared_ptr<Dataset> StreamingDataset::read_window(const std::vector<size_t>& shards, std::mt19937_64& rng) const {
+    NN_TRACE_SPAN("data", "read window");
+
+    size_t window_size = 0;
+    for(size_t shard : shards) {
+        window_size += std::min(this->shard_size, this->nr_items - shard * this->shard_size);
+    }
+
+    // position of each sample within the window
+    std::vector<size_t> perm(window_size);
+    for(size_t i=0; i<window_size; i++) {
+        perm[i] = i;
+    }
+    std::shuffle(perm.begin(), perm.end(), rng);
+
+    auto window = std::make_shared<Dataset>(window_size, this->nr_input_nodes, this->nr_output_nodes);
+
+    const size_t img_bytes = this->nr_input_nodes * get_type_size(this->images_type);
+    const size_t lbl_bytes = get_type_size(this->labels_type);
+    std::vector<char> images(this->shard_size * img_bytes);
+    std::vector<char> labels(this->shard_size * lbl_bytes);
+    double offset, scale;
+    get_pixel_scaling(this->images_type, offset, scale);
+
+    size_t pos = 0;
+    for(size_t shard : shards) {
+        const size_t first = shard * this->shard_size;
+        const size_t n = std::min(this->shard_size, this->nr_items - first);
+
+        read_at(this->images_fd, images.data(), n * img_bytes, this->images_offset + first * img_bytes);
+        read_at(this->labels_fd, labels.data(), n * lbl_bytes, this->labels_offset + first * lbl_bytes);
+
+        for(size_t k=0; k<n; k++) {
+            const size_t row = perm[pos + k];
+
+            double* in = window->get_input_vector(row);
+            const char* src = images.data() + k * img_bytes;
+            if(this->images_type == 0x08) {
+                for(unsigned int j=0; j<this->nr_input_nodes; j++) {
+                    in[j] = (double)(uint8_t)src[j] / 255.0;
+                }
+            } else {
+                const size_t sz = get_type_size(this->images_type);
+                for(unsigned int j=0; j<this->nr_input_nodes; j++) {
+                    in[j] = (decode_value(src + j * sz, this->images_type) - offset) * scale;
+                }
+            }
+
+            const double label = decode_value(labels.data() + k * lbl_bytes, this->labels_type);
+            if(label < 0 || label >= this->nr_output_nodes) {
+                throw std::runtime_error("Invalid label in streaming dataset");
+            }
+            double* out = window->get_output_vector(row);
+            std::fill(out, out + this->nr_output_nodes, 0.0);
+            out[(size_t)label] = 1.0;
+        }
+
+        pos += n;
+    }
+
+    return window;
+}
+
+/**
+ * @brief      Read bytes at a 64-bit file offset
+ *
+ * @param[in]  fd      file descriptor
+ * @param      dest    destination buffer
+ * @param[in]  n       number of bytes
+ * @param[in]  offset  file offset
+ */
+void StreamingDataset::read_at(int fd, char* dest, size_t n, size_t offset) {
+    while(n > 0) {
+        const ssize_t r = pread(fd, dest, n, (off_t)offset);
+        if(r <= 0) {
+            throw std::runtime_error("Unexpected end of IDX file while streaming");
+        }
+        dest += r;
+        offset += r;
+        n -= r;
+    }
+}
+
+/**
+ * @brief      Gets the number of bytes of an IDX data type.
+ *
+ * @param[in]  type  IDX data type
+ *
+ * @return     The number of bytes.
+ */
+size_t StreamingDataset::get_type_size(uint8_t type) {
+    switch(type) {
+        case 0x08: // unsigned byte
+        case 0x09: // signed byte
+            return 1;
+        case 0x0B: // short
+            return 2;
+        case 0x0C: // int
+        case 0x0D: // float
+            return 4;
+        case 0x0E: // double
+            return 8;
+        default:
+            throw std::runtime_error("Unknown IDX data type");
+    }
+}
+
+/**
+ * @brief      Get the mapping of IDX pixel values onto [0,1]
+ *
+ * @param[in]  type    IDX data type
+ * @param      offset  receives the lowest value of the type
+ * @param      scale   receives the inverse of the range of the type
+ */
+void StreamingDataset::get_pixel_scaling(uint8_t type, double& offset, double& scale) {
+    switch(type) {
+        case 0x08:
+            offset = 0.0;
+            scale = 1.0 / 255.0;
+            return;
+        case 0x09:
+            offset = -128.0;
+            scale = 1.0 / 255.0;
+            return;
+        case 0x0B:
+            offset = -32768.0;
+            scale = 1.0 / 65535.0;
+            return;
+        case 0x0C:
+            offset = -2147483648.0;
+            scale = 1.0 / 4294967295.0;
+            return;
+        default:
+            // floating point images are expected to be scaled already
+            offset = 0.0;
+            scale = 1.0;
+            return;
+    }
+}
+
+/**
+ * @brief      Decode a big-endian IDX value
+ *
+ * @param[in]  p     pointer to value
+ * @param[in]  type  IDX data type
+ *
+ * @return     the value
+ */
+double StreamingDataset::decode_value(const char* p, uint8_t type) {
+    switch(type) {
+        case 0x08:
+            return (double)(uint8_t)p[0];
+        case 0x09:
+            return (double)(int8_t)p[0];
+        case 0x0B: {
+            uint16_t v;
+            std::memcpy(&v, p, 2);
+            return (double)(int16_t)__bswap_16(v);
+        }
+        case 0x0C: {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            return (double)(int32_t)__bswap_32(v);
+        }
+        case 0x0D: {
+            uint32_t v;
+            float f;
+            std::memcpy(&v, p, 4);
+            v = __bswap_32(v);
+            std::memcpy(&f, &v, 4);
+            return (double)f;
+        }
+        case 0x0E: {
+            uint64_t v;
+            double d;
+            std::memcpy(&v, p, 8);
+            v = __bswap_64(v);
+            std::memcpy(&d, &v, 8);
+            return d;
+        }
+        default:
+            throw std::runtime_error("Unknown IDX data type");
+    }
+}
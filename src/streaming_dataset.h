@@ -0,0 +1,210 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _STREAMING_DATASET_H
+#define _STREAMING_DATASET_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <byteswap.h>
+
+#include "dataset_stream.h"
+#include "idx_reader.h"
+#include "trace.h"
+
+/**
+ * @brief      Out-of-core dataset streamed from a pair of IDX files
+ *
+ * The samples are divided into shards of consecutive samples. Every epoch
+ * the order of the shards is shuffled and a number of shards is combined
+ * into a window, whose samples are shuffled as well. Windows are read from
+ * disk by a background thread ahead of their use, such that at most
+ * (1 + readahead) windows reside in memory.
+ *
+ * The files need to be uncompressed to allow random access. Images can be
+ * of any IDX data type; integers are scaled from the range of their type to
+ * [0,1], floating point values are taken as they are. Labels are expanded
+ * to one-hot output vectors.
+ */
+class StreamingDataset : public DatasetStream {
+private:
+    int images_fd;                          //!< file descriptor of images file
+    int labels_fd;                          //!< file descriptor of labels file
+    uint8_t images_type;                    //!< IDX data type of images
+    uint8_t labels_type;                    //!< IDX data type of labels
+    size_t images_offset;                   //!< start of image payload
+    size_t labels_offset;                   //!< start of label payload
+
+    size_t nr_items;                        //!< number of samples
+    unsigned int nr_input_nodes;            //!< values per image
+    unsigned int nr_output_nodes;           //!< number of classes
+
+    size_t shard_size;                      //!< samples per shard
+    unsigned int window_shards;             //!< shards per window
+    unsigned int readahead;                 //!< windows read ahead
+    uint64_t seed;                          //!< seed for shuffling
+
+    std::thread producer;                   //!< thread reading windows
+    std::mutex mtx;                         //!< guards the fields below
+    std::condition_variable cv;             //!< signals queue changes
+    std::deque<std::shared_ptr<Dataset>> queue; //!< windows read ahead
+    bool finished;                          //!< producer has finished epoch
+    bool stop;                              //!< request producer to stop
+    std::exception_ptr error;               //!< error raised by producer
+
+public:
+    /**
+     * @brief      Constructs a streaming dataset
+     *
+     * @param[in]  images_file    uncompressed IDX file holding the images
+     * @param[in]  labels_file    uncompressed IDX file holding the labels
+     * @param[in]  nr_classes     number of classes
+     * @param[in]  _shard_size    samples per shard
+     * @param[in]  _window_shards shards per window
+     * @param[in]  _readahead     number of windows to read ahead
+     * @param[in]  _seed          seed for shuffling
+     */
+    StreamingDataset(const std::string& images_file, const std::string& labels_file,
+                     unsigned int nr_classes, size_t _shard_size, unsigned int _window_shards,
+                     unsigned int _readahead, uint64_t _seed);
+
+    ~StreamingDataset();
+
+    StreamingDataset(const StreamingDataset&) = delete;
+
+    StreamingDataset& operator=(const StreamingDataset&) = delete;
+
+    /**
+     * @brief      Start producing the windows of an epoch
+     *
+     * @param[in]  epoch  epoch index
+     */
+    void start_epoch(unsigned int epoch) override;
+
+    /**
+     * @brief      Get the next window of the current epoch
+     *
+     * @return     window or nullptr when the epoch is exhausted
+     */
+    std::shared_ptr<Dataset> next_window() override;
+
+    inline size_t size() const override {
+        return this->nr_items;
+    }
+
+    inline unsigned int get_nr_input_nodes() const override {
+        return this->nr_input_nodes;
+    }
+
+    inline unsigned int get_nr_output_nodes() const override {
+        return this->nr_output_nodes;
+    }
+
+    /**
+     * @brief      Gets the upper bound of memory held by resident windows.
+     *
+     * These are the windows read ahead (including the one being read) and
+     * the window being trained on.
+     *
+     * @return     The number of bytes.
+     */
+    size_t get_max_resident_bytes() const;
+
+private:
+    /**
+     * @brief      Stop the producer thread and discard its windows
+     */
+    void stop_producer();
+
+    /**
+     * @brief      Read all windows of an epoch (producer thread)
+     *
+     * @param[in]  epoch  epoch index
+     */
+    void produce(unsigned int epoch);
+
+    /**
+     * @brief      Read a set of shards into a shuffled window
+     *
+     * @param[in]  shards  shard indices
+     * @param      rng     random number generator
+     *
+     * @return     the window
+     */
+    std::shared_ptr<Dataset> read_window(const std::vector<size_t>& shards, std::mt19937_64& rng) const;
+
+    /**
+     * @brief      Read bytes at a 64-bit file offset
+     *
+     * @param[in]  fd      file descriptor
+     * @param      dest    destination buffer
+     * @param[in]  n       number of bytes
+     * @param[in]  offset  file offset
+     */
+    static void read_at(int fd, char* dest, size_t n, size_t offset);
+
+    /**
+     * @brief      Gets the number of bytes of an IDX data type.
+     *
+     * @param[in]  type  IDX data type
+     *
+     * @return     The number of bytes.
+     */
+    static size_t get_type_size(uint8_t type);
+
+    /**
+     * @brief      Decode a big-endian IDX value
+     *
+     * @param[in]  p     pointer to value
+     * @param[in]  type  IDX data type
+     *
+     * @return     the value
+     */
+    static double decode_value(const char* p, uint8_t type);
+
+    /**
+     * @brief      Get the mapping of IDX pixel values onto [0,1]
+     *
+     * @param[in]  type    IDX data type
+     * @param      offset  receives the lowest value of the type
+     * @param      scale   receives the inverse of the range of the type
+     */
+    static void get_pixel_scaling(uint8_t type, double& offset, double& scale);
+};
+
+#endif // _STREAMING_DATASET_H
@@ -0,0 +1,349 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "sweep.h"
+
+#include <omp.h>
+#include <mutex>
+#include <cmath>
+
+/**
+ * @brief      Constructs the sweep
+ *
+ * @param[in]  _trainingset  training data
+ * @param[in]  _testset      test data
+ * @param[in]  _nr_threads   networks trained concurrently
+ * @param[in]  _reduction    successive halving factor (< 2 to disable)
+ * @param[in]  _min_epochs   epochs of the first halving round
+ * @param[in]  _seed         seed of the first network
+ */
+Sweep::Sweep(const std::shared_ptr<Dataset>& _trainingset, const std::shared_ptr<Dataset>& _testset,
+             unsigned int _nr_threads, unsigned int _reduction, unsigned int _min_epochs, uint64_t _seed) :
+trainingset(_trainingset),
+testset(_testset),
+nr_threads(std::max(1u, _nr_threads)),
+reduction(_reduction),
+min_epochs(std::max(1u, _min_epochs)),
+seed(_seed) {}
+
+/**
+ * @brief      All combinations of the listed hyperparameter values
+ *
+ * @param[in]  spec  specification
+ *
+ * @return     configurations
+ */
+std::vector<SweepConfig> Sweep::grid(const std::string& spec) {
+    std::vector<SweepConfig> configs(1);
+
+    for(const auto& term : parse(spec)) {
+        std::vector<SweepConfig> expanded;
+        for(const auto& config : configs) {
+            for(const auto& value : term.second) {
+                if(value.find(':') != std::string::npos) {
+                    throw std::runtime_error("Ranges require a random search: " + term.first + "=" + value);
+                }
+                expanded.push_back(config);
+                set(expanded.back(), term.first, std::stod(value));
+            }
+        }
+        configs = expanded;
+    }
+
+    return configs;
+}
+
+/**
+ * @brief      Random samples of the hyperparameter values and ranges
+ *
+ * @param[in]  spec  specification
+ * @param[in]  n     number of configurations
+ * @param[in]  seed  random seed
+ *
+ * @return     configurations
+ */
+std::vector<SweepConfig> Sweep::random(const std::string& spec, unsigned int n, uint64_t seed) {
+    const auto terms = parse(spec);
+    std::mt19937_64 gen(seed);
+    std::vector<SweepConfig> configs(n);
+
+    for(auto& config : configs) {
+        for(const auto& term : terms) {
+            std::uniform_int_distribution<size_t> pick(0, term.second.size() - 1);
+            const std::string& value = term.second[pick(gen)];
+
+            const size_t sep = value.find(':');
+            if(sep == std::string::npos) {
+                set(config, term.first, std::stod(value));
+                continue;
+            }
+
+            const double lo = std::stod(value.substr(0, sep));
+            const double hi = std::stod(value.substr(sep + 1));
+            if(!(lo <= hi)) {
+                throw std::runtime_error("Invalid range: " + term.first + "=" + value);
+            }
+            if(term.first == "eta") {
+                if(lo <= 0.0) {
+                    throw std::runtime_error("Learning rate range has to be positive: " + value);
+                }
+                std::uniform_real_distribution<double> dist(std::log(lo), std::log(hi));
+                set(config, term.first, std::exp(dist(gen)));
+            } else {
+                std::uniform_int_distribution<long> dist(std::lround(lo), std::lround(hi));
+                set(config, term.first, (double)dist(gen));
+            }
+        }
+    }
+
+    return configs;
+}
+
+/**
+ * @brief      Train and evaluate all configurations
+ *
+ * @param[in]  configs  configurations
+ *
+ * @return     results, best first
+ */
+std::vector<SweepResult> Sweep::run(const std::vector<SweepConfig>& configs) {
+    // the networks are trained in parallel instead of the matrix operations
+    SerialBlas serial_blas;
+
+    std::vector<Member> members(configs.size());
+    std::vector<Member*> racing;
+    unsigned int max_epochs = 0;
+    for(unsigned int i=0; i<configs.size(); i++) {
+        const std::vector<uint32_t> sizes = {this->trainingset->get_nr_input_nodes(), configs[i].hidden, this->trainingset->get_nr_output_nodes()};
+        members[i].nn = std::make_unique<NeuralNetwork>(sizes, this->seed + i);
+        members[i].result.config = configs[i];
+        racing.push_back(&members[i]);
+        max_epochs = std::max(max_epochs, configs[i].epochs);
+    }
+
+    const bool halving = this->reduction >= 2;
+    unsigned int epochs = halving ? this->min_epochs : max_epochs;
+
+    while(!racing.empty()) {
+        std::cout << boost::format("Training %i configuration(s) up to %i epoch(s)\n") % racing.size() % epochs;
+        this->train(racing, epochs);
+
+        // configurations that trained all their epochs leave the race
+        std::vector<Member*> remaining;
+        for(Member* m : racing) {
+            if(m->result.epochs_trained < m->result.config.epochs) {
+                remaining.push_back(m);
+            } else {
+                m->nn.reset();
+            }
+        }
+
+        if(halving && !remaining.empty()) {
+            std::stable_sort(remaining.begin(), remaining.end(), [](const Member* a, const Member* b) {
+                return a->result.hits > b->result.hits;
+            });
+            const size_t keep = std::max((size_t)1, remaining.size() / this->reduction);
+            for(size_t i=keep; i<remaining.size(); i++) {
+                remaining[i]->result.pruned = true;
+                remaining[i]->nn.reset();
+            }
+            remaining.resize(keep);
+            epochs *= this->reduction;
+        }
+
+        racing = remaining;
+    }
+
+    std::vector<SweepResult> results;
+    for(const auto& m : members) {
+        results.push_back(m.result);
+    }
+    std::stable_sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) {
+        return a.hits > b.hits;
+    });
+
+    return results;
+}
+
+/**
+ * @brief      Write results as an aligned table
+ *
+ * @param      out      output stream
+ * @param[in]  results  results, best first
+ */
+void Sweep::write_table(std::ostream& out, const std::vector<SweepResult>& results) {
+    out << boost::format("%4s %10s %6s %7s %7s %9s %9s  %s\n") % "rank" % "eta" % "batch" % "hidden" % "epochs" % "accuracy" % "time" % "status";
+    for(unsigned int i=0; i<results.size(); i++) {
+        const auto& r = results[i];
+        out << boost::format("%4i %10.4g %6i %7i %3i/%-3i %8.2f%% %8.1fs  %s\n")
+               % (i+1) % r.config.eta % r.config.mini_batch_size % r.config.hidden % r.epochs_trained % r.config.epochs
+               % (r.accuracy * 100.0) % r.seconds % (r.pruned ? "pruned" : "complete");
+    }
+}
+
+/**
+ * @brief      Write results as CSV
+ *
+ * @param      out      output stream
+ * @param[in]  results  results, best first
+ */
+void Sweep::write_csv(std::ostream& out, const std::vector<SweepResult>& results) {
+    out << "rank,eta,mini_batch_size,hidden,epochs,epochs_trained,hits,accuracy,seconds,status\n";
+    for(unsigned int i=0; i<results.size(); i++) {
+        const auto& r = results[i];
+        out << boost::format("%i,%g,%i,%i,%i,%i,%i,%.6f,%.3f,%s\n")
+               % (i+1) % r.config.eta % r.config.mini_batch_size % r.config.hidden % r.config.epochs % r.epochs_trained
+               % r.hits % r.accuracy % r.seconds % (r.pruned ? "pruned" : "complete");
+    }
+}
+
+/**
+ * @brief      Split a specification into its values per hyperparameter
+ *
+ * @param[in]  spec  specification
+ *
+ * @return     values per hyperparameter name
+ */
+std::map<std::string, std::vector<std::string>> Sweep::parse(const std::string& spec) {
+    std::map<std::string, std::vector<std::string>> terms;
+
+    std::string normalized(spec);
+    std::replace(normalized.begin(), normalized.end(), '\n', ';');
+    std::stringstream ss(normalized);
+    std::string term;
+    while(std::getline(ss, term, ';')) {
+        term.erase(std::remove_if(term.begin(), term.end(), ::isspace), term.end());
+        if(term.empty() || term[0] == '#') {
+            continue;
+        }
+
+        const size_t eq = term.find('=');
+        if(eq == std::string::npos) {
+            throw std::runtime_error("Invalid sweep term (expected name=values): " + term);
+        }
+        const std::string name = term.substr(0, eq);
+        if(name != "eta" && name != "batch" && name != "epochs" && name != "hidden") {
+            throw std::runtime_error("Unknown hyperparameter: " + name);
+        }
+
+        std::stringstream values(term.substr(eq + 1));
+        std::string value;
+        while(std::getline(values, value, ',')) {
+            if(!value.empty()) {
+                terms[name].push_back(value);
+            }
+        }
+        if(terms[name].empty()) {
+            throw std::runtime_error("No values given for " + name);
+        }
+    }
+
+    return terms;
+}
+
+/**
+ * @brief      Set a hyperparameter of a configuration
+ *
+ * @param      config  configuration
+ * @param[in]  name    hyperparameter name
+ * @param[in]  value   value
+ */
+void Sweep::set(SweepConfig& config, const std::string& name, double value) {
+    if(name == "eta") {
+        if(value <= 0.0) {
+            throw std::runtime_error("Learning rate has to be positive");
+        }
+        config.eta = value;
+        return;
+    }
+
+    if(value < 1.0) {
+        throw std::runtime_error(name + " has to be at least 1");
+    }
+    if(name == "batch") {
+        config.mini_batch_size = (unsigned int)value;
+    } else if(name == "epochs") {
+        config.epochs = (unsigned int)value;
+    } else {
+        config.hidden = (unsigned int)value;
+    }
+}
+
+/**
+ * @brief      Train networks concurrently up to a number of epochs
+ *
+ * @param      members  networks to train
+ * @param[in]  epochs   epochs every network has trained afterwards
+ *                      (at most its configured number)
+ */
+void Sweep::train(const std::vector<Member*>& members, unsigned int epochs) {
+    std::atomic<size_t> next(0);
+    std::mutex mtx;
+    std::exception_ptr error;
+
+    auto work = [&]() {
+        // every thread trains whole networks; nested parallelism would only add overhead
+        omp_set_num_threads(1);
+        Trace::get().set_thread_name("sweep");
+
+        for(size_t i=next++; i<members.size(); i=next++) {
+            Member* m = members[i];
+            try {
+                NN_TRACE_SPAN("sweep", "train configuration");
+
+                auto start = std::chrono::steady_clock::now();
+                const unsigned int target = std::min(epochs, m->result.config.epochs);
+                while(m->result.epochs_trained < target) {
+                    m->nn->sgd_pass(this->trainingset, m->result.config.mini_batch_size, m->result.config.eta);
+                    m->result.epochs_trained++;
+                }
+
+                m->result.hits = m->nn->evaluate(this->testset);
+                m->result.accuracy = (double)m->result.hits / (double)this->testset->size();
+                m->result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(mtx);
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<std::min((size_t)this->nr_threads, members.size()); t++) {
+        threads.emplace_back(work);
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
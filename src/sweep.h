@@ -0,0 +1,193 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _SWEEP_H
+#define _SWEEP_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <random>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+#include "neural_network.h"
+#include "dataset.h"
+
+/**
+ * @brief      Hyperparameters of a single training run
+ */
+struct SweepConfig {
+    double eta = 3.0;                       //!< learning rate
+    unsigned int mini_batch_size = 10;      //!< batch size
+    unsigned int epochs = 10;               //!< number of epochs
+    unsigned int hidden = 30;               //!< size of the hidden layer
+};
+
+/**
+ * @brief      Outcome of a single training run
+ */
+struct SweepResult {
+    SweepConfig config;                     //!< hyperparameters
+    unsigned int epochs_trained = 0;        //!< epochs actually trained
+    size_t hits = 0;                        //!< correctly classified test samples
+    double accuracy = 0.0;                  //!< fraction of correctly classified test samples
+    bool pruned = false;                    //!< stopped early by successive halving
+    double seconds = 0.0;                   //!< training time
+};
+
+/**
+ * @brief      Hyperparameter search over networks trained concurrently on
+ *             one shared, in-memory dataset
+ *
+ * A specification holds one term per hyperparameter, separated by semicolons
+ * or newlines, e.g. "eta=0.5,1,3;batch=10,20;hidden=30,100;epochs=10". A term
+ * either lists values or, for random search, gives a range "lo:hi" (sampled
+ * log-uniformly for eta and uniformly otherwise). Missing hyperparameters
+ * keep their default.
+ *
+ * With successive halving, all configurations are first trained for a few
+ * epochs; only the best 1/reduction of them are trained for reduction times
+ * as many epochs, and so on, until the remaining configurations have trained
+ * all their epochs.
+ */
+class Sweep {
+private:
+    std::shared_ptr<Dataset> trainingset;   //!< training data shared by all networks
+    std::shared_ptr<Dataset> testset;       //!< test data shared by all networks
+    unsigned int nr_threads;                //!< networks trained concurrently
+    unsigned int reduction;                 //!< successive halving factor (< 2 to disable)
+    unsigned int min_epochs;                //!< epochs of the first halving round
+    uint64_t seed;                          //!< seed of the first network
+
+    /**
+     * @brief      Network being trained with its result
+     */
+    struct Member {
+        std::unique_ptr<NeuralNetwork> nn;  //!< the network
+        SweepResult result;                 //!< result so far
+    };
+
+public:
+    /**
+     * @brief      Constructs the sweep
+     *
+     * @param[in]  _trainingset  training data
+     * @param[in]  _testset      test data
+     * @param[in]  _nr_threads   networks trained concurrently
+     * @param[in]  _reduction    successive halving factor (< 2 to disable)
+     * @param[in]  _min_epochs   epochs of the first halving round
+     * @param[in]  _seed         seed of the first network
+     */
+    Sweep(const std::shared_ptr<Dataset>& _trainingset, const std::shared_ptr<Dataset>& _testset,
+          unsigned int _nr_threads, unsigned int _reduction, unsigned int _min_epochs, uint64_t _seed);
+
+    /**
+     * @brief      All combinations of the listed hyperparameter values
+     *
+     * @param[in]  spec  specification
+     *
+     * @return     configurations
+     */
+    static std::vector<SweepConfig> grid(const std::string& spec);
+
+    /**
+     * @brief      Random samples of the hyperparameter values and ranges
+     *
+     * @param[in]  spec  specification
+     * @param[in]  n     number of configurations
+     * @param[in]  seed  random seed
+     *
+     * @return     configurations
+     */
+    static std::vector<SweepConfig> random(const std::string& spec, unsigned int n, uint64_t seed);
+
+    /**
+     * @brief      Train and evaluate all configurations
+     *
+     * @param[in]  configs  configurations
+     *
+     * @return     results, best first
+     */
+    std::vector<SweepResult> run(const std::vector<SweepConfig>& configs);
+
+    /**
+     * @brief      Write results as an aligned table
+     *
+     * @param      out      output stream
+     * @param[in]  results  results, best first
+     */
+    static void write_table(std::ostream& out, const std::vector<SweepResult>& results);
+
+    /**
+     * @brief      Write results as CSV
+     *
+     * @param      out      output stream
+     * @param[in]  results  results, best first
+     */
+    static void write_csv(std::ostream& out, const std::vector<SweepResult>& results);
+
+private:
+    /**
+     * @brief      Split a specification into its values per hyperparameter
+     *
+     * @param[in]  spec  specification
+     *
+     * @return     values per hyperparameter name
+     */
+    static std::map<std::string, std::vector<std::string>> parse(const std::string& spec);
+
+    /**
+     * @brief      Set a hyperparameter of a configuration
+     *
+     * @param      config  configuration
+     * @param[in]  name    hyperparameter name
+     * @param[in]  value   value
+     */
+    static void set(SweepConfig& config, const std::string& name, double value);
+
+    /**
+     * @brief      Train networks concurrently up to a number of epochs
+     *
+     * @param      members  networks to train
+     * @param[in]  epochs   epochs every network has trained afterwards
+     *                      (at most its configured number)
+     */
+    void train(const std::vector<Member*>& members, unsigned int epochs);
+};
+
+#endif // _SWEEP_H
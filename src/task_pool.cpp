@@ -0,0 +1,206 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "task_pool.h"
+
+TaskPool::TaskPool() :
+nr_threads(1),
+owner(std::this_thread::get_id()),
+pid(getpid()),
+busy(false),
+job(nullptr),
+context(nullptr),
+nr_tasks(0),
+generation(0),
+pending(0),
+stop(false),
+dispatch_ns(0.0),
+min_chunk_ns(std::numeric_limits<double>::infinity()) {}
+
+TaskPool::~TaskPool() {
+    this->shutdown();
+}
+
+/**
+ * @brief      Get the process-wide pool
+ *
+ * @return     the pool
+ */
+TaskPool& TaskPool::get() {
+    static TaskPool pool;
+    return pool;
+}
+
+/**
+ * @brief      Start the pool; the calling thread dispatches its jobs
+ *
+ * @param[in]  _nr_threads  number of threads including the caller
+ */
+void TaskPool::set_nr_threads(unsigned int _nr_threads) {
+    _nr_threads = std::max(1u, _nr_threads);
+    if(_nr_threads == this->nr_threads && this->owner == std::this_thread::get_id() && this->pid == getpid()) {
+        return;
+    }
+
+    this->shutdown();
+    this->nr_threads = _nr_threads;
+    this->owner = std::this_thread::get_id();
+    this->pid = getpid();
+    this->stop = false;
+    const uint64_t seen = this->generation.load(std::memory_order_acquire);
+    for(unsigned int t=1; t<this->nr_threads; t++) {
+        this->workers.emplace_back(&TaskPool::work, this, t, seen);
+    }
+    this->calibrate();
+}
+
+/**
+ * @brief      Whether the calling thread can dispatch a job
+ *
+ * @return     true when the pool has workers for this thread
+ */
+bool TaskPool::dispatchable() const {
+    // busy is only written by the owner, hence only read it on the owner
+    return std::this_thread::get_id() == this->owner && getpid() == this->pid && this->nr_threads > 1 && !this->busy;
+}
+
+/**
+ * @brief      Run a job on the first threads of the pool
+ *
+ * @param[in]  _job       runs a single task
+ * @param      _context   argument of the job
+ * @param[in]  _nr_tasks  number of tasks (at most the number of threads)
+ */
+void TaskPool::dispatch(void (*_job)(void*, unsigned int), void* _context, unsigned int _nr_tasks) {
+    this->busy = true;
+    this->job = _job;
+    this->context = _context;
+    this->nr_tasks = _nr_tasks;
+    this->pending.store(this->nr_threads - 1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->generation.fetch_add(1, std::memory_order_release);
+    }
+    this->cv.notify_all();
+
+    // the caller is thread 0
+    _job(_context, 0);
+
+    // all workers have to acknowledge the job before it can be replaced
+    while(this->pending.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+    this->busy = false;
+}
+
+/**
+ * @brief      Loop of a worker thread
+ *
+ * @param[in]  t     index of the thread
+ * @param[in]  seen  last job before the thread was started
+ */
+void TaskPool::work(unsigned int t, uint64_t seen) {
+    for(;;) {
+        // poll for a while to pick up jobs in quick succession, then sleep
+        uint64_t current = seen;
+        for(unsigned int i=0; i<spin_limit && current == seen; i++) {
+            std::this_thread::yield();
+            current = this->generation.load(std::memory_order_acquire);
+        }
+        if(current == seen) {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cv.wait(lock, [&]() {
+                return this->generation.load(std::memory_order_acquire) != seen;
+            });
+            current = this->generation.load(std::memory_order_acquire);
+        }
+        seen = current;
+
+        if(this->stop) {
+            return;
+        }
+        if(t < this->nr_tasks) {
+            this->job(this->context, t);
+        }
+        this->pending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief      Stop and join the workers
+ */
+void TaskPool::shutdown() {
+    if(this->workers.empty()) {
+        return;
+    }
+
+    // threads of the parent do not exist in a forked process, yet destroying
+    // their joinable handles would terminate it; leak the handles instead
+    if(getpid() != this->pid) {
+        new std::vector<std::thread>(std::move(this->workers));
+        this->workers.clear();
+        this->nr_threads = 1;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+        this->generation.fetch_add(1, std::memory_order_release);
+    }
+    this->cv.notify_all();
+    for(auto& worker : this->workers) {
+        worker.join();
+    }
+    this->workers.clear();
+    this->nr_threads = 1;
+}
+
+/**
+ * @brief      Measure the cost of dispatching a job
+ */
+void TaskPool::calibrate() {
+    if(this->nr_threads == 1) {
+        this->dispatch_ns = 0.0;
+        this->min_chunk_ns = std::numeric_limits<double>::infinity();
+        return;
+    }
+
+    // the fastest of a series of empty jobs, once the workers are awake
+    static const unsigned int nr_jobs = 64;
+    double best = std::numeric_limits<double>::infinity();
+    for(unsigned int i=0; i<nr_jobs; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        this->dispatch([](void*, unsigned int) {}, nullptr, this->nr_threads);
+        best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    this->dispatch_ns = best;
+
+    // splitting pays off once every task does a few times the work of waking it
+    this->min_chunk_ns = std::max(4.0 * this->dispatch_ns, 1000.0);
+}
@@ -0,0 +1,217 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _TASK_POOL_H
+#define _TASK_POOL_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <unistd.h>
+
+/**
+ * @brief      Persistent pool of threads running the parallel loops of the
+ *             training
+ *
+ * Task t of a job always runs on thread t of the pool (the calling thread
+ * being thread 0), such that a thread keeps working on the same block of an
+ * array and the pages placed by a first touch stay local. Loops are only
+ * split when their estimated work is worth the cost of waking the threads,
+ * which is measured when the pool is started; small loops (e.g. over the
+ * neurons of a hidden layer) run inline.
+ *
+ * Only the thread that started the pool dispatches jobs to it. Other
+ * threads (e.g. of a sweep), jobs started from within a job and forked
+ * processes run their tasks inline, one after the other. Tasks must not
+ * throw.
+ */
+class TaskPool {
+private:
+    std::vector<std::thread> workers;       //!< threads 1 to nr_threads-1
+    unsigned int nr_threads;                //!< number of threads including the caller
+    std::thread::id owner;                  //!< thread dispatching the jobs
+    pid_t pid;                              //!< process that started the workers
+    bool busy;                              //!< whether a job is running (owner only)
+
+    // current job
+    void (*job)(void*, unsigned int);       //!< runs a single task
+    void* context;                          //!< argument of the job
+    unsigned int nr_tasks;                  //!< number of tasks of the job
+
+    std::atomic<uint64_t> generation;       //!< incremented for every job
+    std::atomic<unsigned int> pending;      //!< workers that did not finish the job
+    std::mutex mtx;                         //!< guards sleeping workers
+    std::condition_variable cv;             //!< wakes sleeping workers
+    bool stop;                              //!< whether the workers have to exit
+
+    double dispatch_ns;                     //!< measured cost of a job without work
+    double min_chunk_ns;                    //!< least work per task of a split loop
+
+    static const unsigned int spin_limit = 2000;   //!< polls of a worker before it sleeps
+
+public:
+    /**
+     * @brief      Get the process-wide pool
+     *
+     * @return     the pool
+     */
+    static TaskPool& get();
+
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    /**
+     * @brief      Start the pool; the calling thread dispatches its jobs
+     *
+     * @param[in]  _nr_threads  number of threads including the caller
+     */
+    void set_nr_threads(unsigned int _nr_threads);
+
+    /**
+     * @brief      Get the number of threads
+     *
+     * @return     number of threads including the caller
+     */
+    inline unsigned int get_nr_threads() const {
+        return this->nr_threads;
+    }
+
+    /**
+     * @brief      Get the measured cost of dispatching a job
+     *
+     * @return     time in ns to run a job without work on all threads
+     */
+    inline double get_dispatch_time() const {
+        return this->dispatch_ns;
+    }
+
+    /**
+     * @brief      Run tasks on the threads of the pool
+     *
+     * @param[in]  tasks  number of tasks (task t runs on thread t % nr_threads)
+     * @param[in]  f      function called with the index of every task
+     */
+    template<typename F>
+    void run(unsigned int tasks, const F& f) {
+        if(tasks == 0) {
+            return;
+        }
+        if(tasks == 1 || !this->dispatchable()) {
+            for(unsigned int t=0; t<tasks; t++) {
+                f(t);
+            }
+            return;
+        }
+
+        // tasks beyond the number of threads are run by the same threads
+        const unsigned int n = std::min(tasks, this->nr_threads);
+        struct Context {
+            const F& f;
+            unsigned int tasks;
+            unsigned int n;
+        } ctx = {f, tasks, n};
+        this->dispatch([](void* c, unsigned int t) {
+            const Context& ctx = *static_cast<Context*>(c);
+            for(unsigned int i=t; i<ctx.tasks; i+=ctx.n) {
+                ctx.f(i);
+            }
+        }, &ctx, n);
+    }
+
+    /**
+     * @brief      Run a loop, split over the threads when it is worth it
+     *
+     * The range is split into contiguous blocks, one per task, such that
+     * any element-wise loop gives the same result regardless of the split.
+     *
+     * @param[in]  n     number of iterations
+     * @param[in]  cost  estimated time per iteration in ns
+     * @param[in]  f     function called with the range [begin, end) of a task
+     */
+    template<typename F>
+    void parallel_for(size_t n, double cost, const F& f) {
+        const double work = (double)n * cost;
+        const unsigned int tasks = (unsigned int)std::min<double>(std::min<double>(this->nr_threads, n), work / this->min_chunk_ns);
+        if(tasks <= 1 || !this->dispatchable()) {
+            f((size_t)0, n);
+            return;
+        }
+
+        this->run(tasks, [&](unsigned int t) {
+            f(n * t / tasks, n * (t + 1) / tasks);
+        });
+    }
+
+private:
+    TaskPool();
+
+    /**
+     * @brief      Whether the calling thread can dispatch a job
+     *
+     * @return     true when the pool has workers for this thread
+     */
+    bool dispatchable() const;
+
+    /**
+     * @brief      Run a job on the first threads of the pool
+     *
+     * @param[in]  _job       runs a single task
+     * @param      _context   argument of the job
+     * @param[in]  _nr_tasks  number of tasks (at most the number of threads)
+     */
+    void dispatch(void (*_job)(void*, unsigned int), void* _context, unsigned int _nr_tasks);
+
+    /**
+     * @brief      Loop of a worker thread
+     *
+     * @param[in]  t     index of the thread
+     * @param[in]  seen  last job before the thread was started
+     */
+    void work(unsigned int t, uint64_t seen);
+
+    /**
+     * @brief      Stop and join the workers
+     */
+    void shutdown();
+
+    /**
+     * @brief      Measure the cost of dispatching a job
+     */
+    void calibrate();
+};
+
+#endif // _TASK_POOL_H
@@ -28,10 +28,86 @@
 
 #include "neuralnetworktest.h"
 #include "neural_network.h"
+#include "shared_memory_communicator.h"
+#include "parameter_server.h"
+#include "ensemble.h"
+#include "cascade.h"
+#include "streaming_dataset.h"
+#include "augmenter.h"
+#include "sweep.h"
+#include "model_handle.h"
+#include "preprocess.h"
+
+#include <omp.h>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <set>
+#include <map>
+#include <tuple>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
 
 // Registers the fixture into the 'registry'
 CPPUNIT_TEST_SUITE_REGISTRATION(NeuralNetworkTest);
 
+/**
+ * @brief      build a dataset of uniformly random inputs with cyclic labels
+ *
+ * @param[in]  nr_samples  number of samples
+ * @param[in]  nr_inputs   size of the input vectors
+ * @param[in]  nr_outputs  number of classes
+ * @param[in]  seed        seed of the inputs
+ * @param[in]  signal      added to the input matching the label of a sample,
+ *                         making the classes learnable
+ *
+ * @return     the dataset
+ */
+static std::shared_ptr<Dataset> make_random_dataset(unsigned int nr_samples, unsigned int nr_inputs,
+                                                    unsigned int nr_outputs, unsigned int seed, double signal = 0.0) {
+    auto dataset = std::make_shared<Dataset>(nr_samples, nr_inputs, nr_outputs);
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    for(unsigned int i=0; i<nr_samples; i++) {
+        std::vector<double> x(nr_inputs);
+        for(auto& v : x) {
+            v = dist(gen);
+        }
+        std::vector<double> y(nr_outputs, 0.0);
+        y[i % nr_outputs] = 1.0;
+        x[i % nr_outputs] += signal;
+        dataset->set_input_vector(i, x);
+        dataset->set_output_vector(i, y);
+    }
+    return dataset;
+}
+
+/**
+ * @brief      write an IDX file
+ *
+ * @param[in]  filename  The filename
+ * @param[in]  type      IDX data type
+ * @param[in]  dims      dimensions
+ * @param[in]  payload   big-endian values
+ */
+static void write_idx(const std::string& filename, uint8_t type, const std::vector<uint32_t>& dims, const std::vector<uint8_t>& payload) {
+    std::ofstream out(filename, std::ios::binary);
+    const uint8_t magic[] = {0, 0, type, (uint8_t)dims.size()};
+    out.write((const char*)magic, 4);
+    for(uint32_t d : dims) {
+        const uint8_t be[] = {(uint8_t)(d >> 24), (uint8_t)(d >> 16), (uint8_t)(d >> 8), (uint8_t)d};
+        out.write((const char*)be, 4);
+    }
+    out.write((const char*)payload.data(), payload.size());
+}
+
 /**
  * @brief      test setup */
 void NeuralNetworkTest::setUp(){}
@@ -132,3 +208,795 @@ void NeuralNetworkTest::testBackPropagation() {
     CPPUNIT_ASSERT_DOUBLES_EQUAL(-0.01253539, nabla_w.back()[1], tol);
     CPPUNIT_ASSERT_DOUBLES_EQUAL(-0.00918682, nabla_w.back()[2], tol);
 }
+
+/**
+ * @brief      test const (workspace-based) inference against feed forward
+ */
+void NeuralNetworkTest::testConstFeedForward() {
+    static const double tol = 1e-12;
+
+    NeuralNetwork nn(std::vector<uint32_t>({4, 5, 3}));
+
+    std::vector<double> in = {0.1, 0.2, 0.3, 0.4,
+                              0.9, 0.8, 0.7, 0.6};
+
+    nn.feed_forward(&in[0]);
+    const std::vector<double> ref0 = nn.get_output();
+    nn.feed_forward(&in[4]);
+    const std::vector<double> ref1 = nn.get_output();
+
+    // single input using a caller-owned workspace
+    InferenceWorkspace ws;
+    const auto& v = nn.feed_forward(&in[0], ws);
+    for(unsigned int i=0; i<3; i++) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref0[i], v[i], tol);
+    }
+
+    // single input using a thread-local workspace
+    const auto w = nn.predict(&in[4]);
+    for(unsigned int i=0; i<3; i++) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref1[i], w[i], tol);
+    }
+
+    // batch of inputs
+    std::vector<double> out(6);
+    nn.feed_forward_batch(&in[0], 2, &out[0], ws);
+    for(unsigned int i=0; i<3; i++) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref0[i], out[i], tol);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref1[i], out[3 + i], tol);
+    }
+
+    // an empty batch on a fresh workspace is a no-op
+    InferenceWorkspace empty;
+    nn.feed_forward_batch(&in[0], 0, &out[0], empty);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(ref0[0], out[0], tol);
+}
+
+/**
+ * @brief      test that deterministic training does not depend on the number of threads
+ */
+void NeuralNetworkTest::testDeterministicTraining() {
+    static const unsigned int nr_samples = 64;
+
+    auto dataset = make_random_dataset(nr_samples, 8, 4, 5);
+
+    const int nr_threads = omp_get_max_threads();
+    const int nr_blas_threads = openblas_get_num_threads();
+    std::vector<std::vector<std::vector<double> > > weights;
+    std::vector<std::vector<std::vector<double> > > biases;
+
+    for(int t : {1, 4}) {
+        omp_set_num_threads(t);
+        TaskPool::get().set_nr_threads(t);
+        NeuralNetwork nn(std::vector<uint32_t>({8, 6, 4}), 42);
+        nn.set_deterministic(true);
+        for(unsigned int e=0; e<3; e++) {
+            nn.sgd_pass(dataset, 16, 3.0);
+        }
+        weights.push_back(nn.get_weights());
+        biases.push_back(nn.get_biases());
+    }
+    omp_set_num_threads(nr_threads);
+    TaskPool::get().set_nr_threads(1);
+
+    // the process-wide BLAS setting is left as it was
+    CPPUNIT_ASSERT_EQUAL(nr_blas_threads, openblas_get_num_threads());
+
+    // models have to be bit-identical
+    CPPUNIT_ASSERT(weights[0] == weights[1]);
+    CPPUNIT_ASSERT(biases[0] == biases[1]);
+
+    // and training has to have changed the network
+    NeuralNetwork ref(std::vector<uint32_t>({8, 6, 4}), 42);
+    CPPUNIT_ASSERT(ref.get_weights() != weights[0]);
+}
+
+/**
+ * @brief      test the ring all-reduce between processes
+ */
+void NeuralNetworkTest::testAllReduce() {
+    static const unsigned int nr_procs = 3;
+    static const size_t n = 20;
+
+    // a small capacity forces the vector to be exchanged in parts of uneven chunks
+    auto comm = SharedMemoryCommunicator::launch(nr_procs, 7);
+    const unsigned int rank = comm->get_rank();
+
+    std::vector<double> data(n);
+    for(size_t i=0; i<n; i++) {
+        data[i] = (double)(rank + 1) * (double)i;
+    }
+    comm->allreduce(&data[0], n);
+
+    bool correct = true;
+    for(size_t i=0; i<n; i++) {
+        correct &= (data[i] == 6.0 * (double)i);
+    }
+
+    std::vector<double> root(n, (double)rank);
+    comm->broadcast(&root[0], n, 1);
+    correct &= std::all_of(root.begin(), root.end(), [](double v) { return v == 1.0; });
+
+    // child processes only report through their exit code
+    if(rank != 0) {
+        comm->finalize();
+        _exit(correct ? 0 : 1);
+    }
+
+    CPPUNIT_ASSERT(correct);
+    CPPUNIT_ASSERT_EQUAL(0u, comm->finalize());
+}
+
+/**
+ * @brief      test asynchronous training with local worker processes and the
+ *             bound on the staleness of the workers
+ */
+void NeuralNetworkTest::testParameterServer() {
+    const std::vector<uint32_t> sizes = {6, 5, 3};
+    auto dataset = make_random_dataset(32, 6, 3, 17, 1.0);
+
+    // every local worker trains on its own shard
+    auto server = std::make_unique<ParameterServer>("127.0.0.1", 0, 2, 1);
+    const std::string address = "127.0.0.1:" + std::to_string(server->get_port());
+    if(server->launch_local_workers()) {
+        server.reset();
+        try {
+            NeuralNetwork nn(sizes, 3);
+            ParameterClient client(address);
+            client.train(nn, Dataset::shard(dataset, client.get_worker(), client.get_nr_workers()), 2, 4);
+        } catch(...) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    NeuralNetwork nn(sizes, 3);
+    std::vector<double> params;
+    nn.get_parameters(params);
+    const std::vector<double> initial = params;
+    size_t reported = 0;
+    server->serve(params, 3.0, 16, [&](size_t samples, const std::vector<double>&) {
+        reported = samples;
+    });
+    server.reset();
+    CPPUNIT_ASSERT(params != initial);
+    CPPUNIT_ASSERT(reported >= 16);
+
+    // a worker more than the staleness ahead of the slowest one waits for it
+    ParameterServer bounded("127.0.0.1", 0, 2, 1);
+    std::vector<double> shared(4, 0.0);
+    std::thread serving([&]() {
+        bounded.serve(shared, 1.0, 0, [](size_t, const std::vector<double>&) {});
+    });
+    ParameterClient fast("127.0.0.1:" + std::to_string(bounded.get_port()));
+    ParameterClient slow("127.0.0.1:" + std::to_string(bounded.get_port()));
+    const std::vector<double> gradient(4, 1.0);
+    std::vector<double> received;
+    fast.push(gradient, 1);
+    fast.pull(received);
+    fast.push(gradient, 1);
+    auto pulled = std::async(std::launch::async, [&]() {
+        fast.pull(received);
+    });
+    CPPUNIT_ASSERT(pulled.wait_for(std::chrono::milliseconds(200)) == std::future_status::timeout);
+    slow.push(gradient, 1);
+    CPPUNIT_ASSERT(pulled.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    pulled.get();
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-3.0, received[0], 1e-12);
+
+    fast.done();
+    slow.done();
+    serving.join();
+}
+
+/**
+ * @brief      test that an ensemble trains its members like separate networks
+ */
+void NeuralNetworkTest::testEnsembleTraining() {
+    static const unsigned int nr_samples = 32;
+    static const unsigned int nr_members = 3;
+    const std::vector<uint32_t> sizes = {8, 6, 5, 4};
+
+    auto dataset = make_random_dataset(nr_samples, 8, 4, 7);
+
+    // a single mini batch per pass, such that the shuffled order does not matter
+    Ensemble ensemble(sizes, nr_members, 42);
+    std::vector<std::unique_ptr<NeuralNetwork> > networks;
+    for(unsigned int k=0; k<nr_members; k++) {
+        networks.push_back(std::make_unique<NeuralNetwork>(sizes, 42 + k));
+    }
+    for(unsigned int e=0; e<3; e++) {
+        ensemble.sgd_pass(dataset, nr_samples, 3.0);
+        for(auto& nn : networks) {
+            nn->sgd_pass(dataset, nr_samples, 3.0);
+        }
+    }
+
+    // sums are taken in a different order, hence not bit-identical
+    std::vector<double> average(4, 0.0);
+    for(unsigned int k=0; k<nr_members; k++) {
+        const auto member = ensemble.get_member(k);
+        for(unsigned int l=0; l<sizes.size()-1; l++) {
+            for(unsigned int j=0; j<networks[k]->get_weights()[l].size(); j++) {
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(networks[k]->get_weights()[l][j], member->get_weights()[l][j], 1e-10);
+            }
+            for(unsigned int j=0; j<networks[k]->get_biases()[l].size(); j++) {
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(networks[k]->get_biases()[l][j], member->get_biases()[l][j], 1e-10);
+            }
+        }
+
+        const auto out = networks[k]->predict(dataset->get_input_vector(0));
+        for(unsigned int j=0; j<4; j++) {
+            average[j] += out[j] / nr_members;
+        }
+    }
+
+    // inference averages the outputs of the members
+    const auto out = ensemble.predict(dataset->get_input_vector(0));
+    for(unsigned int j=0; j<4; j++) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(average[j], out[j], 1e-12);
+    }
+}
+
+/**
+ * @brief      test the convolutional layers against numerical derivatives,
+ *             batched inference and the network file
+ */
+void NeuralNetworkTest::testConvolution() {
+    static const double h = 1e-6;
+    static const double tol = 1e-7;
+
+    // 7x7 -> 2 x 5x5 -> 2 x 4x4 pooled to 2 x 2x2; the derivatives of the first
+    // layer pass through the second one
+    NeuralNetwork nn(ConvLayer::parse("2x3,2x2/2", 1, 7, 7), std::vector<uint32_t>({8, 5, 3}), 3);
+    CPPUNIT_ASSERT_EQUAL((size_t)49, nn.get_nr_inputs());
+
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<double> x(3 * 49);
+    for(auto& v : x) {
+        v = dist(gen);
+    }
+    const std::vector<double> y = {0.0, 1.0, 0.0};
+
+    auto cost = [&]() {
+        nn.feed_forward(&x[0]);
+        double c = 0.0;
+        for(unsigned int j=0; j<3; j++) {
+            c += 0.5 * (nn.get_output()[j] - y[j]) * (nn.get_output()[j] - y[j]);
+        }
+        return c;
+    };
+
+    ConvLayer& layer = nn.get_conv_layers().front();
+    layer.clear_gradients();
+    nn.back_propagation(&x[0], &y[0]);
+    const std::vector<double> nabla_k = layer.get_nabla_k();
+
+    // central differences of the cost with respect to every filter weight
+    std::vector<double> kernels = layer.get_kernels();
+    for(unsigned int i=0; i<kernels.size(); i++) {
+        const double k = kernels[i];
+        kernels[i] = k + h;
+        layer.set_kernels(kernels);
+        const double cp = cost();
+        kernels[i] = k - h;
+        layer.set_kernels(kernels);
+        const double cm = cost();
+        kernels[i] = k;
+        layer.set_kernels(kernels);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL((cp - cm) / (2.0 * h), nabla_k[i], tol);
+    }
+
+    // batched inference matches the single-sample forward pass
+    InferenceWorkspace ws;
+    std::vector<double> out(3 * 3);
+    nn.feed_forward_batch(&x[0], 3, &out[0], ws);
+    for(unsigned int s=0; s<3; s++) {
+        nn.feed_forward(&x[s * 49]);
+        for(unsigned int j=0; j<3; j++) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(nn.get_output()[j], out[s * 3 + j], 1e-12);
+        }
+    }
+
+    // the layers are stored in the network file
+    const std::string filename = "conv_test.ann";
+    nn.save_network(filename);
+    NeuralNetwork loaded(filename);
+    std::remove(filename.c_str());
+    CPPUNIT_ASSERT_EQUAL((size_t)2, loaded.get_conv_layers().size());
+    CPPUNIT_ASSERT(loaded.get_conv_layers().front().get_kernels() == layer.get_kernels());
+    const auto v = loaded.predict(&x[0]);
+    nn.feed_forward(&x[0]);
+    for(unsigned int j=0; j<3; j++) {
+        CPPUNIT_ASSERT_EQUAL(nn.get_output()[j], v[j]);
+    }
+}
+
+/**
+ * @brief      test that recomputing activations from checkpoints yields
+ *             identical gradients
+ */
+void NeuralNetworkTest::testActivationCheckpointing() {
+    static const unsigned int nr_samples = 32;
+    const std::vector<uint32_t> sizes = {6, 16, 16, 16, 16, 16, 16, 16, 3};
+
+    NeuralNetwork full(sizes, 9);
+    NeuralNetwork checkpointed(sizes, 9);
+
+    // only keep part of the activations
+    const size_t budget = full.get_activation_memory() * 2 / 3;
+    checkpointed.set_activation_budget(budget);
+    CPPUNIT_ASSERT(checkpointed.get_checkpoints().size() > 2);
+    CPPUNIT_ASSERT(checkpointed.get_activation_memory() <= budget);
+    CPPUNIT_ASSERT(full.get_checkpoints().empty());
+
+    auto dataset = make_random_dataset(nr_samples, 6, 3, 13);
+
+    // derivatives of a single sample have to be bit-identical
+    full.back_propagation(dataset->get_input_vector(0), dataset->get_output_vector(0));
+    checkpointed.back_propagation(dataset->get_input_vector(0), dataset->get_output_vector(0));
+    CPPUNIT_ASSERT(full.get_nabla_w() == checkpointed.get_nabla_w());
+    CPPUNIT_ASSERT(full.get_nabla_b() == checkpointed.get_nabla_b());
+    CPPUNIT_ASSERT(full.get_output() == checkpointed.get_output());
+
+    // and so do the trained models
+    for(unsigned int e=0; e<2; e++) {
+        full.sgd_pass(dataset, 8, 3.0);
+        checkpointed.sgd_pass(dataset, 8, 3.0);
+    }
+    CPPUNIT_ASSERT(full.get_weights() == checkpointed.get_weights());
+    CPPUNIT_ASSERT(full.get_biases() == checkpointed.get_biases());
+
+    // a budget below the input and output layers cannot be met
+    CPPUNIT_ASSERT_THROW(checkpointed.set_activation_budget(8), std::runtime_error);
+}
+
+/**
+ * @brief      test the arrays placed by the threads touching them first
+ */
+void NeuralNetworkTest::testMemoryPlacement() {
+    MemoryPlacement& placement = MemoryPlacement::get();
+    CPPUNIT_ASSERT_THROW(MemoryPlacement::parse_huge_pages("large"), std::runtime_error);
+
+    // pages are touched by two threads and are resident afterwards
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t bytes = 64 * page;
+    TaskPool::get().set_nr_threads(2);
+    placement.set_first_touch(true);
+    placement.set_huge_pages(MemoryPlacement::parse_huge_pages("transparent"));
+    auto array = placement.allocate(bytes);
+    placement.set_first_touch(false);
+    placement.set_huge_pages(MemoryPlacement::HugePages::NONE);
+
+    const double* values = static_cast<const double*>(array.get());
+    CPPUNIT_ASSERT(std::all_of(values, values + bytes / sizeof(double), [](double v) { return v == 0.0; }));
+
+    // node queries are not available everywhere (e.g. in containers)
+    const auto counts = MemoryPlacement::get_node_pages(array.get(), bytes);
+    const size_t resident = std::accumulate(counts.begin(), counts.end(), (size_t)0);
+    CPPUNIT_ASSERT(resident == 0 || resident == 64);
+    TaskPool::get().set_nr_threads(1);
+
+    // datasets own their zero-initialized storage
+    Dataset dataset(10, 7, 3);
+    CPPUNIT_ASSERT_EQUAL(0.0, dataset.get_output_vector(9)[2]);
+    CPPUNIT_ASSERT(dataset.get_output_vector(0) == dataset.get_input_vector(0) + 70);
+}
+
+/**
+ * @brief      test the splitting of loops over the task pool
+ */
+void NeuralNetworkTest::testTaskPool() {
+    TaskPool& pool = TaskPool::get();
+    pool.set_nr_threads(3);
+    CPPUNIT_ASSERT_EQUAL(3u, pool.get_nr_threads());
+    const std::thread::id caller = std::this_thread::get_id();
+
+    // task t runs on thread t % 3, the caller being thread 0
+    std::vector<std::thread::id> ids(5);
+    pool.run(5, [&](unsigned int t) {
+        ids[t] = std::this_thread::get_id();
+    });
+    CPPUNIT_ASSERT(ids[0] == caller && ids[3] == caller);
+    CPPUNIT_ASSERT(ids[1] == ids[4] && ids[1] != caller && ids[2] != caller && ids[1] != ids[2]);
+
+    // an expensive loop is split into blocks covering every iteration once
+    std::vector<int> counts(1000, 0);
+    std::vector<std::thread::id> blocks;
+    std::mutex mtx;
+    pool.parallel_for(counts.size(), 1e6, [&](size_t begin, size_t end) {
+        for(size_t i=begin; i<end; i++) {
+            counts[i]++;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        blocks.push_back(std::this_thread::get_id());
+    });
+    CPPUNIT_ASSERT(std::all_of(counts.begin(), counts.end(), [](int c) { return c == 1; }));
+    CPPUNIT_ASSERT_EQUAL((size_t)3, blocks.size());
+
+    // a cheap loop, a nested loop and a loop of another thread run inline
+    blocks.clear();
+    pool.parallel_for(10, 1.0, [&](size_t begin, size_t end) {
+        CPPUNIT_ASSERT(begin == 0 && end == 10);
+        blocks.push_back(std::this_thread::get_id());
+    });
+    CPPUNIT_ASSERT(blocks.size() == 1 && blocks[0] == caller);
+
+    std::atomic<unsigned int> nested(0);
+    pool.run(3, [&](unsigned int) {
+        pool.parallel_for(100, 1e6, [&](size_t begin, size_t end) {
+            nested += end - begin;
+        });
+    });
+    CPPUNIT_ASSERT_EQUAL(300u, nested.load());
+
+    bool whole = false;
+    std::thread other([&]() {
+        pool.parallel_for(100, 1e6, [&](size_t begin, size_t end) {
+            whole = begin == 0 && end == 100;
+        });
+    });
+    other.join();
+    CPPUNIT_ASSERT(whole);
+
+    // a forked child runs inline and can restart or stop the pool
+    const pid_t pid = fork();
+    if(pid == 0) {
+        size_t count = 0;
+        pool.parallel_for(100, 1e6, [&](size_t begin, size_t end) {
+            count += end - begin;
+        });
+        pool.set_nr_threads(2);
+        pool.parallel_for(100, 1e6, [&](size_t begin, size_t end) {
+            count += end - begin;
+        });
+        pool.set_nr_threads(1);
+        _exit(count == 200 ? 0 : 1);
+    }
+    int status = 0;
+    CPPUNIT_ASSERT(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CPPUNIT_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    pool.set_nr_threads(1);
+}
+
+/**
+ * @brief      test that the cascade escalates uncertain images to the full
+ *             network and that calibration keeps its accuracy
+ */
+void NeuralNetworkTest::testCascade() {
+    static const unsigned int nr_samples = 64;
+    NeuralNetwork first({6, 3}, 5);
+    NeuralNetwork full({6, 12, 3}, 7);
+    CPPUNIT_ASSERT_THROW(Cascade(first, NeuralNetwork({6, 12, 4}, 7), 0.5), std::runtime_error);
+
+    // the margin is the distance between the two highest scores
+    const double scores[] = {0.1, 0.7, 0.4, 0.65};
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.05, Cascade::margin(scores, 4), 1e-12);
+
+    auto dataset = make_random_dataset(nr_samples, 6, 3, 3, 1.0);
+    full.sgd_pass(dataset, 8, 3.0);
+
+    // without a threshold the small network decides every image
+    std::vector<double> out(nr_samples * 3);
+    Cascade cascade(first, full, 0.0);
+    cascade.classify_batch(dataset->get_input_vector(0), nr_samples, &out[0]);
+    CPPUNIT_ASSERT_EQUAL((size_t)nr_samples, cascade.get_nr_classified());
+    CPPUNIT_ASSERT_EQUAL((size_t)0, cascade.get_nr_escalated());
+    const auto v = first.predict(dataset->get_input_vector(0));
+    for(unsigned int j=0; j<3; j++) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(v[j], out[j], 1e-12);
+    }
+
+    // with an infinite threshold every image falls through to the full network
+    cascade.set_threshold(std::numeric_limits<double>::infinity());
+    cascade.classify_batch(dataset->get_input_vector(0), nr_samples, &out[0]);
+    CPPUNIT_ASSERT_EQUAL((size_t)nr_samples, cascade.get_nr_escalated());
+    for(unsigned int i=0; i<nr_samples; i++) {
+        const auto v = full.predict(dataset->get_input_vector(i));
+        for(unsigned int j=0; j<3; j++) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(v[j], out[i * 3 + j], 1e-12);
+        }
+    }
+
+    // calibrating without a loss keeps the accuracy of the full network
+    const auto c = cascade.calibrate(dataset, 0.0);
+    CPPUNIT_ASSERT(c.accuracy >= c.accuracy_full);
+    CPPUNIT_ASSERT(c.escalated >= 0.0 && c.escalated <= 1.0);
+    CPPUNIT_ASSERT_EQUAL(c.threshold, cascade.get_threshold());
+}
+
+/**
+ * @brief      test that a streamed epoch holds every sample once, in windows
+ *             within the memory bound, and that invalid files are rejected
+ */
+void NeuralNetworkTest::testStreamingDataset() {
+    static const unsigned int nr_samples = 50;
+    const std::string prefix = "/tmp/nn_stream_" + std::to_string(getpid());
+
+    // the first pixel identifies the sample, as a signed short
+    std::vector<uint8_t> images;
+    std::vector<uint8_t> labels;
+    for(unsigned int i=0; i<nr_samples; i++) {
+        const int16_t pixels[] = {(int16_t)(i * 1000 - 32768), 32767, -32768};
+        for(int16_t p : pixels) {
+            images.push_back((uint8_t)((uint16_t)p >> 8));
+            images.push_back((uint8_t)p);
+        }
+        labels.push_back(i % 3);
+    }
+    write_idx(prefix + "-images.idx", 0x0B, {nr_samples, 3}, images);
+    write_idx(prefix + "-labels.idx", 0x08, {nr_samples}, labels);
+
+    StreamingDataset stream(prefix + "-images.idx", prefix + "-labels.idx", 3, 4, 3, 1, 5);
+    CPPUNIT_ASSERT_EQUAL((size_t)nr_samples, stream.size());
+    CPPUNIT_ASSERT_EQUAL(3u, stream.get_nr_input_nodes());
+    CPPUNIT_ASSERT_EQUAL((size_t)(2 * 12 * (3 + 3) * sizeof(double)), stream.get_max_resident_bytes());
+
+    std::vector<std::vector<unsigned int> > orders;
+    for(unsigned int epoch=0; epoch<2; epoch++) {
+        std::vector<unsigned int> order;
+        stream.start_epoch(epoch);
+        while(auto window = stream.next_window()) {
+            CPPUNIT_ASSERT(window->size() <= 12);
+            for(size_t k=0; k<window->size(); k++) {
+                const double* in = window->get_input_vector(k);
+                const unsigned int id = (unsigned int)std::lround(in[0] * 65535.0 / 1000.0);
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, in[1], 1e-12);
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, in[2], 1e-12);
+                CPPUNIT_ASSERT_EQUAL(1.0, window->get_output_vector(k)[id % 3]);
+                order.push_back(id);
+            }
+        }
+
+        // every sample exactly once
+        std::vector<unsigned int> sorted = order;
+        std::sort(sorted.begin(), sorted.end());
+        CPPUNIT_ASSERT_EQUAL((size_t)nr_samples, sorted.size());
+        for(unsigned int i=0; i<nr_samples; i++) {
+            CPPUNIT_ASSERT_EQUAL(i, sorted[i]);
+        }
+        orders.push_back(order);
+    }
+    CPPUNIT_ASSERT(orders[0] != orders[1]);
+
+    // labels beyond the number of classes
+    labels[7] = 3;
+    write_idx(prefix + "-labels.idx", 0x08, {nr_samples}, labels);
+    StreamingDataset invalid(prefix + "-images.idx", prefix + "-labels.idx", 3, 4, 3, 1, 5);
+    invalid.start_epoch(0);
+    CPPUNIT_ASSERT_THROW(while(invalid.next_window()) {}, std::runtime_error);
+
+    unlink((prefix + "-images.idx").c_str());
+    unlink((prefix + "-labels.idx").c_str());
+}
+
+/**
+ * @brief      test that the augmented stream depends on the seed, but not on
+ *             the number of workers
+ */
+void NeuralNetworkTest::testAugmenter() {
+    auto source = make_random_dataset(37, 8 * 8, 3, 11);
+
+    AugmentationParameters params;
+    params.elastic_alpha = 2.0;
+    params.elastic_sigma = 1.5;
+
+    // collect all windows of the first two epochs
+    auto generate = [&](unsigned int nr_workers, uint64_t seed) {
+        Augmenter augmenter(source, 8, 8, params, 5, nr_workers, seed);
+        std::vector<double> values;
+        for(unsigned int epoch=0; epoch<2; epoch++) {
+            augmenter.start_epoch(epoch);
+            while(auto window = augmenter.next_window()) {
+                CPPUNIT_ASSERT(window->size() <= 5);
+                for(size_t k=0; k<window->size(); k++) {
+                    values.insert(values.end(), window->get_input_vector(k), window->get_input_vector(k) + 8 * 8);
+                    values.insert(values.end(), window->get_output_vector(k), window->get_output_vector(k) + 3);
+                }
+            }
+        }
+        return values;
+    };
+
+    const std::vector<double> serial = generate(1, 42);
+    const std::vector<double> parallel = generate(3, 42);
+    CPPUNIT_ASSERT_EQUAL((size_t)(2 * 37 * (8 * 8 + 3)), serial.size());
+    CPPUNIT_ASSERT_EQUAL(serial.size(), parallel.size());
+    CPPUNIT_ASSERT(std::memcmp(serial.data(), parallel.data(), serial.size() * sizeof(double)) == 0);
+
+    const std::vector<double> other = generate(3, 43);
+    CPPUNIT_ASSERT_EQUAL(serial.size(), other.size());
+    CPPUNIT_ASSERT(serial != other);
+}
+
+/**
+ * @brief      test grid expansion, random sampling and successive halving
+ */
+void NeuralNetworkTest::testSweep() {
+    // every combination of the listed values
+    const auto grid = Sweep::grid("eta=0.5,1,3;batch=10,20\nhidden=30,100;epochs=10");
+    CPPUNIT_ASSERT_EQUAL((size_t)12, grid.size());
+    std::set<std::tuple<double, unsigned int, unsigned int> > combinations;
+    for(const auto& c : grid) {
+        CPPUNIT_ASSERT_EQUAL(10u, c.epochs);
+        combinations.emplace(c.eta, c.mini_batch_size, c.hidden);
+    }
+    CPPUNIT_ASSERT_EQUAL((size_t)12, combinations.size());
+    CPPUNIT_ASSERT_THROW(Sweep::grid("eta=0.1:1"), std::runtime_error);
+
+    // samples stay within their ranges and lists
+    const auto samples = Sweep::random("eta=0.01:1;hidden=10:20;batch=5,7", 200, 3);
+    CPPUNIT_ASSERT_EQUAL((size_t)200, samples.size());
+    std::set<unsigned int> hidden;
+    for(const auto& c : samples) {
+        CPPUNIT_ASSERT(c.eta >= 0.01 && c.eta <= 1.0);
+        CPPUNIT_ASSERT(c.hidden >= 10 && c.hidden <= 20);
+        CPPUNIT_ASSERT(c.mini_batch_size == 5 || c.mini_batch_size == 7);
+        hidden.insert(c.hidden);
+    }
+    CPPUNIT_ASSERT_EQUAL((size_t)11, hidden.size());
+    CPPUNIT_ASSERT_EQUAL(samples[17].eta, Sweep::random("eta=0.01:1;hidden=10:20;batch=5,7", 200, 3)[17].eta);
+
+    // halving 8 configurations: 8 train 1 epoch, 4 train 2 and 2 train all 4
+    auto trainingset = make_random_dataset(60, 8, 3, 21, 1.0);
+    auto testset = make_random_dataset(30, 8, 3, 22, 1.0);
+    const auto configs = Sweep::grid("eta=0.5,1,2,4;hidden=4,6;epochs=4;batch=10");
+    const int nr_blas_threads = openblas_get_num_threads();
+
+    std::stringstream log;
+    std::streambuf* cout_buffer = std::cout.rdbuf(log.rdbuf());
+    Sweep sweep(trainingset, testset, 2, 2, 1, 7);
+    const auto results = sweep.run(configs);
+    std::cout.rdbuf(cout_buffer);
+
+    CPPUNIT_ASSERT_EQUAL(nr_blas_threads, openblas_get_num_threads());
+    CPPUNIT_ASSERT_EQUAL(configs.size(), results.size());
+    std::map<unsigned int, unsigned int> pruned_after;
+    unsigned int complete = 0;
+    for(size_t i=0; i<results.size(); i++) {
+        if(results[i].pruned) {
+            pruned_after[results[i].epochs_trained]++;
+        } else {
+            CPPUNIT_ASSERT_EQUAL(4u, results[i].epochs_trained);
+            complete++;
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL((double)results[i].hits / 30.0, results[i].accuracy, 1e-12);
+        if(i > 0) {
+            CPPUNIT_ASSERT(results[i-1].hits >= results[i].hits);
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(2u, complete);
+    CPPUNIT_ASSERT_EQUAL(4u, pruned_after[1]);
+    CPPUNIT_ASSERT_EQUAL(2u, pruned_after[2]);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, pruned_after.size());
+}
+
+/**
+ * @brief      test that reloading a model leaves readers of the old one intact
+ */
+void NeuralNetworkTest::testModelHandle() {
+    const std::string filename = "/tmp/nn_model_" + std::to_string(getpid()) + ".ann";
+
+    NeuralNetwork first(std::vector<uint32_t>({8, 6, 4}), 1);
+    first.save_network(filename);
+    ModelHandle handle(filename);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)1, handle.get_generation());
+
+    // a reader in the middle of a call holds on to its snapshot
+    const auto snapshot = handle.get();
+    CPPUNIT_ASSERT(snapshot->get_weights() == first.get_weights());
+
+    NeuralNetwork second(std::vector<uint32_t>({8, 10, 4}), 2);
+    second.save_network(filename);
+    CPPUNIT_ASSERT(handle.reload());
+    CPPUNIT_ASSERT_EQUAL((uint64_t)2, handle.get_generation());
+    CPPUNIT_ASSERT(snapshot->get_weights() == first.get_weights());
+    CPPUNIT_ASSERT(snapshot->get_biases() == first.get_biases());
+    CPPUNIT_ASSERT(handle.get()->get_weights() == second.get_weights());
+    CPPUNIT_ASSERT(handle.get()->get_biases() == second.get_biases());
+
+    // networks with a different input or output size are rejected
+    std::stringstream log;
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(log.rdbuf());
+    NeuralNetwork(std::vector<uint32_t>({9, 6, 4}), 3).save_network(filename);
+    const bool input_reloaded = handle.reload();
+    NeuralNetwork(std::vector<uint32_t>({8, 6, 5}), 4).save_network(filename);
+    const bool output_reloaded = handle.reload();
+    std::cerr.rdbuf(cerr_buffer);
+
+    CPPUNIT_ASSERT(!input_reloaded);
+    CPPUNIT_ASSERT(!output_reloaded);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)2, handle.get_generation());
+    CPPUNIT_ASSERT(handle.get()->get_weights() == second.get_weights());
+
+    unlink(filename.c_str());
+}
+
+/**
+ * @brief      check that a preprocessed digit fits the 20x20 box and has its
+ *             center of mass at the center of the image
+ *
+ * @param[in]  out   input vector (28 x 28 values)
+ */
+static void check_mnist_layout(const double* out) {
+    const unsigned int size = Preprocessor::image_size;
+    unsigned int xmin = size, xmax = 0, ymin = size, ymax = 0;
+    double mass = 0.0, mx = 0.0, my = 0.0;
+    for(unsigned int y=0; y<size; y++) {
+        for(unsigned int x=0; x<size; x++) {
+            const double v = out[y * size + x];
+            CPPUNIT_ASSERT(v >= 0.0 && v <= 1.0);
+            if(v > 0.0) {
+                xmin = std::min(xmin, x);
+                xmax = std::max(xmax, x);
+                ymin = std::min(ymin, y);
+                ymax = std::max(ymax, y);
+            }
+            mass += v;
+            mx += v * x;
+            my += v * y;
+        }
+    }
+
+    CPPUNIT_ASSERT(mass > 0.0);
+    CPPUNIT_ASSERT(xmax - xmin + 1 <= Preprocessor::box_size);
+    CPPUNIT_ASSERT(ymax - ymin + 1 <= Preprocessor::box_size);
+    CPPUNIT_ASSERT(std::max(xmax - xmin, ymax - ymin) + 1 >= Preprocessor::box_size - 1);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(13.5, mx / mass, 0.75);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(13.5, my / mass, 0.75);
+}
+
+/**
+ * @brief      test the normalization of images that are not MNIST digits
+ */
+void NeuralNetworkTest::testPreprocessor() {
+    Preprocessor preprocessor;
+    std::vector<double> out(Preprocessor::image_size * Preprocessor::image_size);
+
+    // dark, off-center and lopsided digit on a light RGB background
+    PNG::ImageInfo rgb;
+    rgb.width = 90;
+    rgb.height = 70;
+    rgb.col = PNG_COLOR_TYPE_RGB;
+    rgb.bit_depth = 8;
+    rgb.channels = 3;
+    rgb.rowbytes = rgb.width * 3;
+    std::vector<uint8_t> pixels(rgb.size(), 230);
+    for(unsigned int y=10; y<60; y++) {
+        for(unsigned int x=55; x<80; x++) {
+            if(x < 62 || y > 52) {
+                std::fill(&pixels[(y * rgb.width + x) * 3], &pixels[(y * rgb.width + x) * 3] + 3, 20);
+            }
+        }
+    }
+    preprocessor.process(pixels.data(), rgb, out.data());
+    check_mnist_layout(out.data());
+
+    // light ring on a dark 16-bit gray background
+    PNG::ImageInfo wide;
+    wide.width = 64;
+    wide.height = 100;
+    wide.col = PNG_COLOR_TYPE_GRAY;
+    wide.bit_depth = 16;
+    wide.channels = 1;
+    wide.rowbytes = wide.width * 2;
+    std::vector<uint8_t> samples(wide.size(), 0);
+    for(unsigned int y=0; y<wide.height; y++) {
+        for(unsigned int x=0; x<wide.width; x++) {
+            const double r = std::hypot(((double)x - 20.0) / 15.0, ((double)y - 60.0) / 30.0);
+            if(r > 0.6 && r < 1.0) {
+                samples[(y * wide.width + x) * 2] = 0xF0;
+                samples[(y * wide.width + x) * 2 + 1] = 0x00;
+            }
+        }
+    }
+    preprocessor.process(samples.data(), wide, out.data());
+    check_mnist_layout(out.data());
+
+    // an image without a digit is rejected
+    std::fill(pixels.begin(), pixels.end(), 230);
+    CPPUNIT_ASSERT_THROW(preprocessor.process(pixels.data(), rgb, out.data()), std::runtime_error);
+}
@@ -36,6 +36,21 @@ class NeuralNetworkTest : public CppUnit::TestFixture
   CPPUNIT_TEST_SUITE( NeuralNetworkTest );
   CPPUNIT_TEST( testFeedForward );
   CPPUNIT_TEST( testBackPropagation );
+  CPPUNIT_TEST( testConstFeedForward );
+  CPPUNIT_TEST( testDeterministicTraining );
+  CPPUNIT_TEST( testAllReduce );
+  CPPUNIT_TEST( testParameterServer );
+  CPPUNIT_TEST( testEnsembleTraining );
+  CPPUNIT_TEST( testConvolution );
+  CPPUNIT_TEST( testActivationCheckpointing );
+  CPPUNIT_TEST( testMemoryPlacement );
+  CPPUNIT_TEST( testTaskPool );
+  CPPUNIT_TEST( testCascade );
+  CPPUNIT_TEST( testStreamingDataset );
+  CPPUNIT_TEST( testAugmenter );
+  CPPUNIT_TEST( testSweep );
+  CPPUNIT_TEST( testModelHandle );
+  CPPUNIT_TEST( testPreprocessor );
   CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -44,6 +59,21 @@ public:
 
   void testFeedForward();
   void testBackPropagation();
+  void testConstFeedForward();
+  void testDeterministicTraining();
+  void testAllReduce();
+  void testParameterServer();
+  void testEnsembleTraining();
+  void testConvolution();
+  void testActivationCheckpointing();
+  void testMemoryPlacement();
+  void testTaskPool();
+  void testCascade();
+  void testStreamingDataset();
+  void testAugmenter();
+  void testSweep();
+  void testModelHandle();
+  void testPreprocessor();
 };
 
 #endif  // _NEURALNETWORKTEST_H
@@ -0,0 +1,165 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#include "trace.h"
+
+std::atomic<bool> Trace::active(false);
+
+Trace::Trace() :
+max_spans(0),
+nr_spans(0) {}
+
+/**
+ * @brief      Get the process-wide trace
+ *
+ * @return     the trace
+ */
+Trace& Trace::get() {
+    static Trace trace;
+    return trace;
+}
+
+/**
+ * @brief      Start recording spans
+ *
+ * @param[in]  _max_spans  maximum number of spans
+ */
+void Trace::start(size_t _max_spans) {
+    this->max_spans = _max_spans;
+    this->nr_spans = 0;
+    active = this->max_spans > 0;
+}
+
+/**
+ * @brief      Stop recording and write the timeline
+ *
+ * Spans that complete while the timeline is written are omitted.
+ *
+ * @param[in]  filename  The filename
+ */
+void Trace::write(const std::string& filename) {
+    active = false;
+
+    std::ofstream out(filename);
+    if(!out.is_open()) {
+        throw std::runtime_error("Cannot open " + filename + " for writing");
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+
+    // threads may still complete spans; take a copy of what has been recorded so far
+    std::vector<std::vector<Event>> events(this->buffers.size());
+    for(size_t i=0; i<this->buffers.size(); i++) {
+        std::lock_guard<std::mutex> buffer_lock(this->buffers[i]->mtx);
+        events[i] = this->buffers[i]->events;
+    }
+
+    // the timeline starts at the earliest span
+    int64_t origin = INT64_MAX;
+    for(const auto& buffer : events) {
+        for(const auto& e : buffer) {
+            origin = std::min(origin, e.start);
+        }
+    }
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"neuralnetworkdemo\"}}";
+    for(size_t i=0; i<this->buffers.size(); i++) {
+        const auto& buffer = this->buffers[i];
+        out << boost::format(",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": \"%s\"}}")
+               % buffer->tid % buffer->name;
+        out << boost::format(",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"sort_index\": %i}}")
+               % buffer->tid % buffer->tid;
+
+        for(const auto& e : events[i]) {
+            out << boost::format(",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, \"ts\": %.3f, \"dur\": %.3f")
+                   % e.name % e.cat % buffer->tid % ((e.start - origin) * 1e-3) % ((e.end - e.start) * 1e-3);
+            if(e.layer >= 0) {
+                out << ", \"args\": {\"layer\": " << e.layer << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    if(!out) {
+        throw std::runtime_error("Could not write trace to " + filename);
+    }
+}
+
+/**
+ * @brief      Name the calling thread on the timeline
+ *
+ * @param[in]  name  thread name
+ */
+void Trace::set_thread_name(const std::string& name) {
+    ThreadBuffer& buffer = this->get_buffer();
+    std::lock_guard<std::mutex> lock(this->mtx);
+    buffer.name = name;
+}
+
+/**
+ * @brief      Add a completed span of the calling thread
+ *
+ * @param[in]  cat    category
+ * @param[in]  name   name
+ * @param[in]  layer  layer (-1 for none)
+ * @param[in]  start  start in ns
+ * @param[in]  end    end in ns
+ */
+void Trace::record(const char* cat, const char* name, int layer, int64_t start, int64_t end) {
+    // once full, new spans are no longer timed at all; spans that were open are dropped
+    if(this->nr_spans.fetch_add(1, std::memory_order_relaxed) >= this->max_spans) {
+        active = false;
+        return;
+    }
+
+    // the lock of the own buffer is only contended while the timeline is written
+    ThreadBuffer& buffer = this->get_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mtx);
+    buffer.events.push_back({cat, name, layer, start, end});
+}
+
+/**
+ * @brief      Get the buffer of the calling thread
+ *
+ * @return     the buffer
+ */
+Trace::ThreadBuffer& Trace::get_buffer() {
+    static thread_local std::shared_ptr<ThreadBuffer> buffer;
+
+    if(!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(this->mtx);
+        buffer->tid = this->buffers.size() + 1;
+        buffer->name = buffer->tid == 1 ? "main" : "thread " + std::to_string(buffer->tid);
+        this->buffers.push_back(buffer);
+    }
+
+    return *buffer;
+}
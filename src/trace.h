@@ -0,0 +1,206 @@
+/************************************************************************************
+ *   This file is part of neuralnetworkdemo.                                        *
+ *   https://github.com/ifilot/neuralnetworkdemo                                    *
+ *                                                                                  *
+ *   MIT License                                                                    *
+ *                                                                                  *
+ *   Copyright (c) 2018 Ivo Filot <ivo@ivofilot.nl>                                 *
+ *                                                                                  *
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ *   of this software and associated documentation files (the "Software"), to deal  *
+ *   in the Software without restriction, including without limitation the rights   *
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ *   copies of the Software, and to permit persons to whom the Software is          *
+ *   furnished to do so, subject to the following conditions:                       *
+ *                                                                                  *
+ *   The above copyright notice and this permission notice shall be included in all *
+ *   copies or substantial portions of the Software.                                *
+ *                                                                                  *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ *   SOFTWARE.                                                                      *
+ *                                                                                  *
+ ************************************************************************************/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+#define NN_TRACE_CONCAT_(a, b) a##b
+#define NN_TRACE_CONCAT(a, b) NN_TRACE_CONCAT_(a, b)
+
+// record the enclosing scope as a span on the timeline of the calling thread;
+// names and categories need to be string literals
+#define NN_TRACE_SPAN(cat, name) \
+    Trace::Span NN_TRACE_CONCAT(_trace_span_, __LINE__)(cat, name, -1)
+#define NN_TRACE_SPAN_LAYER(cat, name, layer) \
+    Trace::Span NN_TRACE_CONCAT(_trace_span_, __LINE__)(cat, name, layer)
+
+/**
+ * @brief      Records a timeline of spans per thread
+ *
+ * The timeline is written in the Chrome trace event format, which can be
+ * opened in chrome://tracing or https://ui.perfetto.dev. Recording is off
+ * until start() is called, such that a disabled span costs a single load.
+ * Every thread records into its own buffer; buffers outlive their threads.
+ */
+class Trace {
+public:
+    /**
+     * @brief      Records a scope when tracing is active
+     */
+    class Span {
+    private:
+        const char* cat;        //!< category
+        const char* name;       //!< name
+        int layer;              //!< layer (-1 for none)
+        int64_t start;          //!< start in ns (-1 when not recording)
+
+    public:
+        inline Span(const char* _cat, const char* _name, int _layer) :
+        cat(_cat),
+        name(_name),
+        layer(_layer),
+        start(Trace::is_active() ? Trace::now() : -1) {}
+
+        inline ~Span() {
+            if(this->start >= 0) {
+                Trace::get().record(this->cat, this->name, this->layer, this->start, Trace::now());
+            }
+        }
+
+        Span(const Span&) = delete;
+
+        Span& operator=(const Span&) = delete;
+    };
+
+private:
+    /**
+     * @brief      Completed span
+     */
+    struct Event {
+        const char* cat;        //!< category
+        const char* name;       //!< name
+        int layer;              //!< layer (-1 for none)
+        int64_t start;          //!< start in ns
+        int64_t end;            //!< end in ns
+    };
+
+    /**
+     * @brief      Spans of a single thread
+     */
+    struct ThreadBuffer {
+        unsigned int tid;               //!< thread id on the timeline
+        std::string name;               //!< thread name
+        std::mutex mtx;                 //!< guards the spans against a concurrent write
+        std::vector<Event> events;      //!< completed spans
+    };
+
+    static std::atomic<bool> active;                        //!< whether spans are recorded
+
+    size_t max_spans;                                       //!< spans recorded before recording stops
+    std::atomic<size_t> nr_spans;                           //!< spans completed while recording
+
+    std::mutex mtx;                                         //!< guards the list of buffers
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;     //!< buffers of all threads
+
+public:
+    /**
+     * @brief      Get the process-wide trace
+     *
+     * @return     the trace
+     */
+    static Trace& get();
+
+    /**
+     * @brief      Get whether spans are recorded
+     *
+     * @return     whether spans are recorded
+     */
+    static inline bool is_active() {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief      Get the current time
+     *
+     * @return     time in ns
+     */
+    static inline int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief      Start recording spans
+     *
+     * Recording stops once max_spans spans are buffered, such that a long run
+     * keeps the detailed timeline of its start in bounded memory.
+     *
+     * @param[in]  _max_spans  maximum number of spans
+     */
+    void start(size_t _max_spans);
+
+    /**
+     * @brief      Get the number of spans that were not recorded
+     *
+     * @return     spans completed after the maximum was reached
+     */
+    inline size_t get_nr_dropped() const {
+        const size_t n = this->nr_spans.load(std::memory_order_relaxed);
+        return n > this->max_spans ? n - this->max_spans : 0;
+    }
+
+    /**
+     * @brief      Stop recording and write the timeline
+     *
+     * Spans that complete while the timeline is written are omitted.
+     *
+     * @param[in]  filename  The filename
+     */
+    void write(const std::string& filename);
+
+    /**
+     * @brief      Name the calling thread on the timeline
+     *
+     * @param[in]  name  thread name
+     */
+    void set_thread_name(const std::string& name);
+
+    /**
+     * @brief      Add a completed span of the calling thread
+     *
+     * @param[in]  cat    category
+     * @param[in]  name   name
+     * @param[in]  layer  layer (-1 for none)
+     * @param[in]  start  start in ns
+     * @param[in]  end    end in ns
+     */
+    void record(const char* cat, const char* name, int layer, int64_t start, int64_t end);
+
+private:
+    Trace();
+
+    /**
+     * @brief      Get the buffer of the calling thread
+     *
+     * @return     the buffer
+     */
+    ThreadBuffer& get_buffer();
+};
+
+#endif // _TRACE_H